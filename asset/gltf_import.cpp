@@ -0,0 +1,714 @@
+#include "mesh_import_internal.h"
+#include <atomic>
+#include <brtoy/mesh_import.h>
+#include <brtoy/thread_pool.h>
+#include <charconv>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <string_view>
+
+namespace brtoy {
+
+namespace {
+
+// Deeper nesting is rejected rather than risking the stack
+constexpr u32 JsonDepthMax = 64;
+
+struct JsonValue {
+    enum class Type : u8 {
+        Null,
+        Bool,
+        Number,
+        String,
+        Array,
+        Object,
+    };
+
+    Type type;
+    bool boolean;
+    double number;
+    // Without the quotes, escapes not decoded
+    std::string_view string;
+    // Of an object member
+    std::string_view key;
+    u32 first_child;
+    u32 child_count;
+};
+
+// Flat tree of the values in a JSON text, the root first. The children of an array or object are
+// stored contiguously in m_children, so that they are indexed in constant time.
+struct Json {
+    std::vector<JsonValue> m_values;
+    std::vector<u32> m_children;
+
+    const JsonValue &root() const { return m_values[0]; }
+    const JsonValue *member(const JsonValue &object, std::string_view key) const;
+    const JsonValue *element(const JsonValue *array, size_t index) const;
+    size_t size(const JsonValue *array) const;
+    const JsonValue *child(const JsonValue &value, size_t index) const {
+        return &m_values[m_children[value.first_child + index]];
+    }
+};
+
+const JsonValue *Json::member(const JsonValue &object, std::string_view key) const {
+    if (object.type != JsonValue::Type::Object)
+        return nullptr;
+    for (u32 i = 0; i < object.child_count; ++i) {
+        const JsonValue *value = child(object, i);
+        if (value->key == key)
+            return value;
+    }
+    return nullptr;
+}
+
+const JsonValue *Json::element(const JsonValue *array, size_t index) const {
+    if (!array || array->type != JsonValue::Type::Array || index >= array->child_count)
+        return nullptr;
+    return child(*array, index);
+}
+
+size_t Json::size(const JsonValue *array) const {
+    return array && array->type == JsonValue::Type::Array ? array->child_count : 0;
+}
+
+struct JsonParser {
+    const char *m_p;
+    const char *m_end;
+    Json &m_json;
+
+    void skipSpace() {
+        while (m_p < m_end && (*m_p == ' ' || *m_p == '\t' || *m_p == '\n' || *m_p == '\r'))
+            ++m_p;
+    }
+
+    bool consume(char c) {
+        skipSpace();
+        if (m_p == m_end || *m_p != c)
+            return false;
+        ++m_p;
+        return true;
+    }
+
+    bool consumeWord(std::string_view word) {
+        if ((size_t)(m_end - m_p) < word.size() || std::string_view(m_p, word.size()) != word)
+            return false;
+        m_p += word.size();
+        return true;
+    }
+
+    bool parseString(std::string_view &out) {
+        if (!consume('"'))
+            return false;
+        const char *begin = m_p;
+        while (m_p < m_end && *m_p != '"')
+            m_p += *m_p == '\\' ? 2 : 1;
+        if (m_p >= m_end)
+            return false;
+        out = std::string_view(begin, m_p - begin);
+        ++m_p;
+        return true;
+    }
+
+    // Children are collected in a list per container and appended to m_children when it closes,
+    // after the children's own children
+    bool parseValue(u32 depth, u32 &out_index) {
+        if (depth > JsonDepthMax)
+            return false;
+        skipSpace();
+        if (m_p == m_end)
+            return false;
+        out_index = (u32)m_json.m_values.size();
+        m_json.m_values.push_back({});
+        JsonValue value = {};
+        std::vector<u32> children;
+        if (*m_p == '{' || *m_p == '[') {
+            bool is_object = *m_p == '{';
+            char close = is_object ? '}' : ']';
+            value.type = is_object ? JsonValue::Type::Object : JsonValue::Type::Array;
+            ++m_p;
+            if (!consume(close)) {
+                do {
+                    std::string_view key;
+                    if (is_object && !(parseString(key) && consume(':')))
+                        return false;
+                    u32 child;
+                    if (!parseValue(depth + 1, child))
+                        return false;
+                    m_json.m_values[child].key = key;
+                    children.push_back(child);
+                } while (consume(','));
+                if (!consume(close))
+                    return false;
+            }
+            value.first_child = (u32)m_json.m_children.size();
+            value.child_count = (u32)children.size();
+            m_json.m_children.insert(m_json.m_children.end(), children.begin(), children.end());
+        } else if (*m_p == '"') {
+            value.type = JsonValue::Type::String;
+            if (!parseString(value.string))
+                return false;
+        } else if (consumeWord("true")) {
+            value.type = JsonValue::Type::Bool;
+            value.boolean = true;
+        } else if (consumeWord("false")) {
+            value.type = JsonValue::Type::Bool;
+            value.boolean = false;
+        } else if (consumeWord("null")) {
+            value.type = JsonValue::Type::Null;
+        } else {
+            value.type = JsonValue::Type::Number;
+            auto [ptr, ec] = std::from_chars(m_p, m_end, value.number);
+            if (ec != std::errc())
+                return false;
+            m_p = ptr;
+        }
+        m_json.m_values[out_index] = value;
+        return true;
+    }
+};
+
+std::optional<Json> parseJson(std::string_view text) {
+    Json json;
+    JsonParser parser = {text.data(), text.data() + text.size(), json};
+    u32 root;
+    if (!parser.parseValue(0, root))
+        return std::nullopt;
+    parser.skipSpace();
+    if (parser.m_p != parser.m_end)
+        return std::nullopt;
+    return json;
+}
+
+// Decodes the escapes of a JSON string, then the percent escapes of a URI. Only ASCII \u escapes
+// are supported.
+std::optional<std::string> decodeUri(std::string_view raw) {
+    std::string result;
+    for (size_t i = 0; i < raw.size(); ++i) {
+        char c = raw[i];
+        if (c == '\\') {
+            if (++i == raw.size())
+                return std::nullopt;
+            c = raw[i];
+            if (c == 'u') {
+                u32 code;
+                auto [ptr, ec] =
+                    std::from_chars(raw.data() + i + 1, raw.data() + std::min(i + 5, raw.size()),
+                                    code, 16);
+                if (ec != std::errc() || ptr != raw.data() + i + 5 || code >= 0x80)
+                    return std::nullopt;
+                c = (char)code;
+                i += 4;
+            } else if (c != '"' && c != '\\' && c != '/') {
+                return std::nullopt;
+            }
+        } else if (c == '%' && i + 2 < raw.size()) {
+            u32 code;
+            auto [ptr, ec] = std::from_chars(raw.data() + i + 1, raw.data() + i + 3, code, 16);
+            if (ec != std::errc() || ptr != raw.data() + i + 3)
+                return std::nullopt;
+            c = (char)code;
+            i += 2;
+        }
+        result.push_back(c);
+    }
+    return result;
+}
+
+std::optional<std::vector<std::byte>> decodeBase64(std::string_view text) {
+    std::vector<std::byte> result;
+    result.reserve(text.size() / 4 * 3);
+    u32 bits = 0;
+    u32 bit_count = 0;
+    for (char c : text) {
+        u32 value;
+        if (c >= 'A' && c <= 'Z')
+            value = c - 'A';
+        else if (c >= 'a' && c <= 'z')
+            value = c - 'a' + 26;
+        else if (c >= '0' && c <= '9')
+            value = c - '0' + 52;
+        else if (c == '+')
+            value = 62;
+        else if (c == '/')
+            value = 63;
+        else if (c == '=')
+            break;
+        else
+            return std::nullopt;
+        bits = bits << 6 | value;
+        bit_count += 6;
+        if (bit_count >= 8) {
+            bit_count -= 8;
+            result.push_back(std::byte(bits >> bit_count));
+        }
+    }
+    return result;
+}
+
+constexpr u32 GlbMagic = 0x46546c67;     // "glTF"
+constexpr u32 GlbChunkJson = 0x4e4f534a; // "JSON"
+constexpr u32 GlbChunkBin = 0x004e4942;  // "BIN\0"
+constexpr u32 GlbHeaderSize = 12;
+constexpr u32 GlbChunkHeaderSize = 8;
+
+constexpr u32 ComponentUnsignedByte = 5121;
+constexpr u32 ComponentUnsignedShort = 5123;
+constexpr u32 ComponentUnsignedInt = 5125;
+constexpr u32 ComponentFloat = 5126;
+constexpr u32 ModeTriangles = 4;
+
+u32 readU32(const std::byte *p) {
+    u32 value;
+    std::memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+// The JSON text and binary chunk of a .glb, or the whole file as JSON otherwise
+struct GltfContainer {
+    std::string_view json;
+    std::span<const std::byte> bin;
+};
+
+std::optional<GltfContainer> splitContainer(std::span<const std::byte> file) {
+    if (file.size() < GlbHeaderSize || readU32(file.data()) != GlbMagic)
+        return GltfContainer{std::string_view((const char *)file.data(), file.size()), {}};
+    if (readU32(file.data() + 4) != 2 || readU32(file.data() + 8) > file.size())
+        return std::nullopt;
+    file = file.first(readU32(file.data() + 8));
+    GltfContainer container;
+    bool has_json = false;
+    for (size_t offset = GlbHeaderSize; offset + GlbChunkHeaderSize <= file.size();) {
+        u32 length = readU32(file.data() + offset);
+        u32 type = readU32(file.data() + offset + 4);
+        offset += GlbChunkHeaderSize;
+        if (length > file.size() - offset)
+            return std::nullopt;
+        std::span<const std::byte> chunk = file.subspan(offset, length);
+        if (type == GlbChunkJson && !has_json) {
+            container.json = std::string_view((const char *)chunk.data(), chunk.size());
+            has_json = true;
+        } else if (type == GlbChunkBin && container.bin.empty()) {
+            container.bin = chunk;
+        }
+        offset += length;
+    }
+    if (!has_json)
+        return std::nullopt;
+    return container;
+}
+
+std::optional<u32> indexValue(const JsonValue &value) {
+    if (value.type != JsonValue::Type::Number || value.number < 0.0 ||
+        value.number > std::numeric_limits<u32>::max() || value.number != std::floor(value.number))
+        return std::nullopt;
+    return (u32)value.number;
+}
+
+std::optional<u32> indexMember(const Json &json, const JsonValue &object, std::string_view key) {
+    const JsonValue *value = json.member(object, key);
+    if (!value)
+        return std::nullopt;
+    return indexValue(*value);
+}
+
+// Sizes and offsets are limited to 32 bits, so that the bounds checks can't overflow
+std::optional<u64> sizeMember(const Json &json, const JsonValue &object, std::string_view key,
+                              u64 fallback) {
+    if (!json.member(object, key))
+        return fallback;
+    return indexMember(json, object, key);
+}
+
+// Strided elements of an accessor, bounds-checked against its buffer
+struct AccessorView {
+    const std::byte *data;
+    size_t count;
+    size_t stride;
+    u32 component_type;
+};
+
+struct Transform {
+    // Column-major, like glTF's matrices
+    M44f matrix;
+    // Inverse transpose of the upper 3x3 times the determinant, for the normals
+    V3f normal_axes[3];
+    bool flips_winding;
+};
+
+// A primitive to import and the node transform to import it with
+struct GltfDraw {
+    AccessorView positions;
+    std::optional<AccessorView> normals;
+    std::optional<AccessorView> indices;
+    Transform transform;
+    size_t first_vertex;
+    size_t first_index;
+};
+
+struct GltfReader {
+    explicit GltfReader(const Json &json);
+
+    const Json &m_json;
+    std::vector<std::span<const std::byte>> m_buffers;
+    std::vector<GltfDraw> m_draws;
+    // Indexed like the nodes, see addNode
+    std::vector<bool> m_node_added;
+    size_t m_vertex_count = 0;
+    size_t m_index_count = 0;
+
+    const JsonValue *array(std::string_view key) const { return m_json.member(m_json.root(), key); }
+
+    std::optional<AccessorView> accessor(u32 index, std::string_view type,
+                                         std::span<const u32> component_types) const;
+    bool addPrimitive(const JsonValue &primitive, const Transform &transform);
+    // Adds the node and its descendants. A node may only be added once, which rules out cycles
+    // and nodes with several parents, so the walk is linear in the node count. It keeps its own
+    // stack, as the depth of the hierarchy is up to the file.
+    bool addNode(u32 node, const M44f &parent);
+};
+
+GltfReader::GltfReader(const Json &json)
+    : m_json(json), m_node_added(json.size(array("nodes"))) {}
+
+std::optional<AccessorView> GltfReader::accessor(u32 index, std::string_view type,
+                                                 std::span<const u32> component_types) const {
+    const JsonValue *accessor = m_json.element(array("accessors"), index);
+    if (!accessor || m_json.member(*accessor, "sparse"))
+        return std::nullopt;
+    const JsonValue *type_value = m_json.member(*accessor, "type");
+    std::optional<u32> component_type = indexMember(m_json, *accessor, "componentType");
+    std::optional<u32> count = indexMember(m_json, *accessor, "count");
+    std::optional<u32> view_index = indexMember(m_json, *accessor, "bufferView");
+    if (!type_value || type_value->string != type || !component_type || !count || !view_index ||
+        std::find(component_types.begin(), component_types.end(), *component_type) ==
+            component_types.end())
+        return std::nullopt;
+    const JsonValue *view = m_json.element(array("bufferViews"), *view_index);
+    std::optional<u32> buffer = view ? indexMember(m_json, *view, "buffer") : std::nullopt;
+    if (!buffer || *buffer >= m_buffers.size())
+        return std::nullopt;
+
+    u64 component_size = *component_type == ComponentUnsignedByte    ? 1
+                         : *component_type == ComponentUnsignedShort ? 2
+                                                                     : 4;
+    u64 element_size = component_size * (type == "VEC3" ? 3 : 1);
+    std::optional<u64> view_offset = sizeMember(m_json, *view, "byteOffset", 0);
+    std::optional<u64> view_length = sizeMember(m_json, *view, "byteLength", 0);
+    std::optional<u64> offset = sizeMember(m_json, *accessor, "byteOffset", 0);
+    std::optional<u64> stride = sizeMember(m_json, *view, "byteStride", element_size);
+    std::span<const std::byte> data = m_buffers[*buffer];
+    if (!view_offset || !view_length || !offset || !stride || *stride < element_size ||
+        *view_offset > data.size() || *view_length > data.size() - *view_offset ||
+        (*count > 0 && *offset + *stride * (*count - 1) + element_size > *view_length))
+        return std::nullopt;
+    return AccessorView{data.data() + *view_offset + *offset, *count, *stride,
+                        *component_type};
+}
+
+V3f transformPoint(const M44f &m, const V3f &p) {
+    return {m.i.x * p.x + m.j.x * p.y + m.k.x * p.z + m.l.x,
+            m.i.y * p.x + m.j.y * p.y + m.k.y * p.z + m.l.y,
+            m.i.z * p.x + m.j.z * p.y + m.k.z * p.z + m.l.z};
+}
+
+Transform makeTransform(const M44f &m) {
+    V3f a = {m.i.x, m.i.y, m.i.z};
+    V3f b = {m.j.x, m.j.y, m.j.z};
+    V3f c = {m.k.x, m.k.y, m.k.z};
+    // The cofactor matrix, whose columns are these cross products
+    Transform transform = {m, {cross(b, c), cross(c, a), cross(a, b)}, false};
+    transform.flips_winding = dot(a, cross(b, c)) < 0.0f;
+    return transform;
+}
+
+M44f nodeMatrix(const Json &json, const JsonValue &node) {
+    M44f m;
+    setIdentity(m);
+    if (const JsonValue *matrix = json.member(node, "matrix")) {
+        // Column major, like M44f
+        V4f *columns[] = {&m.i, &m.j, &m.k, &m.l};
+        for (size_t i = 0; i < 16 && i < json.size(matrix); ++i)
+            columns[i / 4]->e[i % 4] = (float)json.element(matrix, i)->number;
+        return m;
+    }
+    auto vector = [&](std::string_view key, std::span<float> out) {
+        const JsonValue *value = json.member(node, key);
+        for (size_t i = 0; i < out.size() && i < json.size(value); ++i)
+            out[i] = (float)json.element(value, i)->number;
+    };
+    float t[3] = {0.0f, 0.0f, 0.0f};
+    float r[4] = {0.0f, 0.0f, 0.0f, 1.0f};
+    float s[3] = {1.0f, 1.0f, 1.0f};
+    vector("translation", t);
+    vector("rotation", r);
+    vector("scale", s);
+    float x = r[0], y = r[1], z = r[2], w = r[3];
+    m.i = V4f((1 - 2 * (y * y + z * z)) * s[0], 2 * (x * y + z * w) * s[0],
+              2 * (x * z - y * w) * s[0], 0.0f);
+    m.j = V4f(2 * (x * y - z * w) * s[1], (1 - 2 * (x * x + z * z)) * s[1],
+              2 * (y * z + x * w) * s[1], 0.0f);
+    m.k = V4f(2 * (x * z + y * w) * s[2], 2 * (y * z - x * w) * s[2],
+              (1 - 2 * (x * x + y * y)) * s[2], 0.0f);
+    m.l = V4f(t[0], t[1], t[2], 1.0f);
+    return m;
+}
+
+bool GltfReader::addPrimitive(const JsonValue &primitive, const Transform &transform) {
+    std::optional<u32> mode = indexMember(m_json, primitive, "mode");
+    // Points, lines, strips and fans are left out
+    if (mode && *mode != ModeTriangles)
+        return true;
+    const JsonValue *attributes = m_json.member(primitive, "attributes");
+    std::optional<u32> position = attributes ? indexMember(m_json, *attributes, "POSITION")
+                                             : std::nullopt;
+    if (!position)
+        return false;
+    constexpr u32 FloatTypes[] = {ComponentFloat};
+    constexpr u32 IndexTypes[] = {ComponentUnsignedByte, ComponentUnsignedShort,
+                                  ComponentUnsignedInt};
+    GltfDraw draw = {};
+    std::optional<AccessorView> positions = accessor(*position, "VEC3", FloatTypes);
+    if (!positions)
+        return false;
+    draw.positions = *positions;
+    if (std::optional<u32> normal = indexMember(m_json, *attributes, "NORMAL")) {
+        draw.normals = accessor(*normal, "VEC3", FloatTypes);
+        if (!draw.normals || draw.normals->count != positions->count)
+            return false;
+    }
+    if (std::optional<u32> indices = indexMember(m_json, primitive, "indices")) {
+        draw.indices = accessor(*indices, "SCALAR", IndexTypes);
+        if (!draw.indices)
+            return false;
+    }
+    size_t index_count = draw.indices ? draw.indices->count : positions->count;
+    draw.transform = transform;
+    draw.first_vertex = m_vertex_count;
+    draw.first_index = m_index_count;
+    m_vertex_count += positions->count;
+    m_index_count += index_count / 3 * 3;
+    m_draws.push_back(draw);
+    return true;
+}
+
+bool GltfReader::addNode(u32 root_index, const M44f &root_parent) {
+    struct PendingNode {
+        u32 index;
+        M44f parent;
+    };
+    std::vector<PendingNode> stack = {{root_index, root_parent}};
+    while (!stack.empty()) {
+        PendingNode pending = stack.back();
+        stack.pop_back();
+        const JsonValue *node = m_json.element(array("nodes"), pending.index);
+        if (!node || m_node_added[pending.index])
+            return false;
+        m_node_added[pending.index] = true;
+
+        M44f matrix = pending.parent * nodeMatrix(m_json, *node);
+        if (std::optional<u32> mesh_index = indexMember(m_json, *node, "mesh")) {
+            const JsonValue *mesh = m_json.element(array("meshes"), *mesh_index);
+            const JsonValue *primitives = mesh ? m_json.member(*mesh, "primitives") : nullptr;
+            if (!primitives)
+                return false;
+            Transform transform = makeTransform(matrix);
+            for (size_t i = 0; i < m_json.size(primitives); ++i) {
+                if (!addPrimitive(*m_json.element(primitives, i), transform))
+                    return false;
+            }
+        }
+        // Pushed in reverse, so that the children are added in order
+        const JsonValue *children = m_json.member(*node, "children");
+        for (size_t i = m_json.size(children); i-- > 0;) {
+            std::optional<u32> child = indexValue(*m_json.element(children, i));
+            if (!child)
+                return false;
+            stack.push_back({*child, matrix});
+        }
+    }
+    return true;
+}
+
+u32 readIndex(const AccessorView &view, size_t i) {
+    const std::byte *p = view.data + i * view.stride;
+    switch (view.component_type) {
+    case ComponentUnsignedByte:
+        return (u32)*p;
+    case ComponentUnsignedShort: {
+        u16 value;
+        std::memcpy(&value, p, sizeof(value));
+        return value;
+    }
+    default:
+        return readU32(p);
+    }
+}
+
+V3f readV3f(const AccessorView &view, size_t i) {
+    V3f value;
+    std::memcpy(value.e, view.data + i * view.stride, sizeof(value.e));
+    return value;
+}
+
+bool importDraw(const GltfDraw &draw, MeshSource &mesh) {
+    const Transform &transform = draw.transform;
+    size_t vertex_count = draw.positions.count;
+    V3f *positions = mesh.positions.data() + draw.first_vertex;
+    V3f *normals = mesh.normals.data() + draw.first_vertex;
+    u32 *indices = mesh.indices.data() + draw.first_index;
+    for (size_t i = 0; i < vertex_count; ++i)
+        positions[i] = transformPoint(transform.matrix, readV3f(draw.positions, i));
+
+    size_t index_count = draw.indices ? draw.indices->count / 3 * 3 : vertex_count / 3 * 3;
+    for (size_t i = 0; i < index_count; ++i) {
+        u32 index = draw.indices ? readIndex(*draw.indices, i) : (u32)i;
+        if (index >= vertex_count)
+            return false;
+        indices[i] = index;
+    }
+    // Mirroring transforms turn the triangles inside out unless their winding is flipped too
+    if (transform.flips_winding) {
+        for (size_t i = 0; i < index_count; i += 3)
+            std::swap(indices[i + 1], indices[i + 2]);
+    }
+
+    if (draw.normals) {
+        for (size_t i = 0; i < vertex_count; ++i) {
+            V3f n = readV3f(*draw.normals, i);
+            normals[i] = transform.normal_axes[0] * n.x + transform.normal_axes[1] * n.y +
+                         transform.normal_axes[2] * n.z;
+            if (length(normals[i]) > 0.0f)
+                normals[i] = normalize(normals[i]);
+        }
+    } else {
+        computeSmoothNormals(
+            std::span(positions, vertex_count), index_count, [&](size_t i) { return indices[i]; },
+            std::span(normals, vertex_count));
+    }
+    // Offset last, the smooth normals are computed with the primitive's own indices
+    for (size_t i = 0; i < index_count; ++i)
+        indices[i] += (u32)draw.first_vertex;
+    return true;
+}
+
+std::optional<Json> parseGltfJson(std::span<const std::byte> file, GltfContainer &out_container) {
+    std::optional<GltfContainer> container = splitContainer(file);
+    if (!container)
+        return std::nullopt;
+    out_container = *container;
+    std::optional<Json> json = parseJson(container->json);
+    if (!json || json->root().type != JsonValue::Type::Object ||
+        json->size(json->member(json->root(), "extensionsRequired")) > 0)
+        return std::nullopt;
+    return json;
+}
+
+} // namespace
+
+std::optional<std::vector<std::string>> gltfExternalBufferUris(std::span<const std::byte> file) {
+    GltfContainer container;
+    std::optional<Json> json = parseGltfJson(file, container);
+    if (!json)
+        return std::nullopt;
+    std::vector<std::string> uris;
+    const JsonValue *buffers = json->member(json->root(), "buffers");
+    for (size_t i = 0; i < json->size(buffers); ++i) {
+        const JsonValue *uri = json->member(*json->element(buffers, i), "uri");
+        if (!uri || uri->string.starts_with("data:"))
+            continue;
+        std::optional<std::string> decoded = decodeUri(uri->string);
+        if (!decoded)
+            return std::nullopt;
+        uris.push_back(std::move(*decoded));
+    }
+    return uris;
+}
+
+std::optional<MeshSource> importGltf(std::span<const std::byte> file,
+                                     std::span<const std::span<const std::byte>> external_buffers,
+                                     ThreadPool *thread_pool) {
+    GltfContainer container;
+    std::optional<Json> json = parseGltfJson(file, container);
+    if (!json)
+        return std::nullopt;
+    GltfReader reader(*json);
+
+    // Decoded data URIs, which the buffer spans point into
+    std::vector<std::vector<std::byte>> decoded_buffers;
+    const JsonValue *buffers = reader.array("buffers");
+    decoded_buffers.reserve(json->size(buffers));
+    size_t external_index = 0;
+    for (size_t i = 0; i < json->size(buffers); ++i) {
+        const JsonValue &buffer = *json->element(buffers, i);
+        const JsonValue *uri = json->member(buffer, "uri");
+        std::span<const std::byte> data;
+        if (!uri) {
+            data = container.bin;
+        } else if (uri->string.starts_with("data:")) {
+            size_t comma = uri->string.find(";base64,");
+            if (comma == std::string_view::npos)
+                return std::nullopt;
+            std::optional<std::vector<std::byte>> decoded =
+                decodeBase64(uri->string.substr(comma + 8));
+            if (!decoded)
+                return std::nullopt;
+            data = decoded_buffers.emplace_back(std::move(*decoded));
+        } else {
+            if (external_index >= external_buffers.size())
+                return std::nullopt;
+            data = external_buffers[external_index++];
+        }
+        std::optional<u64> length = sizeMember(*json, buffer, "byteLength", 0);
+        if (!length || *length > data.size())
+            return std::nullopt;
+        reader.m_buffers.push_back(data.first(*length));
+    }
+
+    M44f identity;
+    setIdentity(identity);
+    const JsonValue *scenes = reader.array("scenes");
+    if (json->size(scenes) > 0) {
+        u32 scene_index = indexMember(*json, json->root(), "scene").value_or(0);
+        const JsonValue *scene = json->element(scenes, scene_index);
+        const JsonValue *nodes = scene ? json->member(*scene, "nodes") : nullptr;
+        if (!scene)
+            return std::nullopt;
+        for (size_t i = 0; i < json->size(nodes); ++i) {
+            std::optional<u32> node = indexValue(*json->element(nodes, i));
+            if (!node || !reader.addNode(*node, identity))
+                return std::nullopt;
+        }
+    } else {
+        // Without a scene there are no nodes to place the meshes, so each is imported as it is
+        const JsonValue *meshes = reader.array("meshes");
+        Transform transform = makeTransform(identity);
+        for (size_t m = 0; m < json->size(meshes); ++m) {
+            const JsonValue *primitives = json->member(*json->element(meshes, m), "primitives");
+            for (size_t i = 0; i < json->size(primitives); ++i) {
+                if (!reader.addPrimitive(*json->element(primitives, i), transform))
+                    return std::nullopt;
+            }
+        }
+    }
+    if (reader.m_vertex_count > std::numeric_limits<u32>::max() ||
+        reader.m_index_count > std::numeric_limits<u32>::max())
+        return std::nullopt;
+
+    MeshSource mesh;
+    mesh.positions.resize(reader.m_vertex_count);
+    mesh.normals.resize(reader.m_vertex_count);
+    mesh.indices.resize(reader.m_index_count);
+    std::atomic<bool> valid = true;
+    parallelFor(thread_pool, reader.m_draws.size(), [&](size_t first, size_t last) {
+        for (size_t i = first; i < last && valid; ++i) {
+            if (!importDraw(reader.m_draws[i], mesh))
+                valid = false;
+        }
+    });
+    if (!valid)
+        return std::nullopt;
+    return mesh;
+}
+
+} // namespace brtoy
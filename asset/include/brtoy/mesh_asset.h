@@ -0,0 +1,108 @@
+#pragma once
+#include <array>
+#include <brtoy/mesh_optimizer.h>
+#include <brtoy/vec.h>
+#include <cstddef>
+#include <span>
+#include <vector>
+
+namespace brtoy {
+
+struct ThreadPool;
+
+// Decoded by loadPosition and loadNormal in the gpu_driven_rendering example's world.hlsl
+enum class PositionFormat : u32 {
+    Float3,
+    // PackedPosition
+    Unorm16,
+};
+
+enum class NormalFormat : u32 {
+    Float3,
+    Oct16,
+    Oct8,
+};
+
+struct VertexFormat {
+    PositionFormat position;
+    NormalFormat normal;
+};
+
+u32 vertexSize(PositionFormat format);
+u32 vertexSize(NormalFormat format);
+
+inline constexpr u32 MeshLodCountMax = 8;
+// Meshes with at most this many vertices store 16-bit indices
+inline constexpr u32 ShortIndexVertexCountMax = 1 << 16;
+
+struct MeshLodSource {
+    std::vector<u32> indices;
+    // Distance in mesh units by which the level deviates from the full mesh
+    float error;
+};
+
+// Float vertex streams of a mesh before it's optimized and encoded
+struct MeshSource {
+    std::vector<V3f> positions;
+    std::vector<V3f> normals;
+    std::vector<u32> indices;
+    // Simplified from indices by optimizeMesh, coarsest last
+    std::vector<MeshLodSource> lods;
+};
+
+struct MeshOptimizeStats {
+    u32 source_vertex_count;
+    VertexCacheStats before;
+    VertexCacheStats after;
+};
+
+// Welds duplicate vertices, builds the levels of detail, orders the triangles for the vertex
+// cache and front to back, then the vertices by first use. Welding runs on the thread pool if
+// there is one, so jobs of the same pool must pass none.
+MeshOptimizeStats optimizeMesh(MeshSource &mesh, ThreadPool *thread_pool = nullptr);
+
+// Streams start at multiples of this within an encoded mesh
+inline constexpr u64 MeshStreamAlignment = 16;
+
+// Formats, bounds and levels of detail of an encoded mesh. Its streams are stored back to back in
+// one block: positions, normals, then the indices of every level in order. This is the layout
+// they have in a cooked mesh file and in staging memory, so that either is a single copy from the
+// other. The struct is stored in cooked mesh files as it is, so it has no padding.
+struct MeshLayout {
+    VertexFormat format;
+    u32 vertex_count;
+    // 2 or 4 bytes, picked from the vertex count
+    u32 index_size;
+    // The full mesh first, then increasingly coarse ones
+    u32 lod_count;
+    std::array<u32, MeshLodCountMax> lod_first_indices;
+    std::array<u32, MeshLodCountMax> lod_index_counts;
+    std::array<float, MeshLodCountMax> lod_errors;
+    // Unorm16 positions decode to pos_offset + pos_scale * the stored values
+    V3f pos_offset;
+    V3f pos_scale;
+    // Bounding sphere in mesh units
+    V3f bounds_center;
+    float bounds_radius;
+
+    u64 positionsSize() const;
+    u64 attribsSize() const;
+    u64 indicesSize() const;
+    u64 attribsOffset() const;
+    u64 indicesOffset() const;
+    // Of the whole block
+    u64 size() const;
+};
+static_assert(sizeof(MeshLayout) == 156);
+
+// Sizes the streams. The bounds and errors are left for encodeMesh.
+MeshLayout layoutMesh(VertexFormat format, u32 vertex_count,
+                      std::span<const u32> lod_index_counts);
+// Layout of the mesh with its levels of detail
+MeshLayout layoutMesh(const MeshSource &mesh, VertexFormat format);
+// Fills in the bounds and errors of the layout and writes the streams in its format to dst, which
+// holds layout.size() bytes and is aligned to MeshStreamAlignment. The layout must come from
+// layoutMesh with the mesh's counts.
+void encodeMesh(const MeshSource &mesh, MeshLayout &layout, std::byte *dst);
+
+} // namespace brtoy
@@ -0,0 +1,47 @@
+#pragma once
+#include <brtoy/mesh_asset.h>
+#include <cstddef>
+#include <optional>
+#include <span>
+
+namespace brtoy {
+
+// Cooked mesh file: a MeshFileHeader at the start, then the streams of the mesh at
+// MeshFileStreamsOffset exactly as MeshLayout lays them out. Files are written in the host's byte
+// order, which is little endian on every target.
+struct MeshFileHeader {
+    static constexpr u32 Magic = 0x48534d42; // "BMSH"
+    // Bumped whenever the header, the layout or the encoding of any stream changes
+    static constexpr u32 Version = 1;
+
+    u32 magic;
+    u32 version;
+    // Hash of the cooker's input and settings, for skipping inputs that haven't changed
+    u64 source_hash;
+    MeshLayout layout;
+    u32 reserved;
+};
+static_assert(sizeof(MeshFileHeader) == 176);
+
+inline constexpr u64 MeshFileStreamsOffset = sizeof(MeshFileHeader);
+static_assert(MeshFileStreamsOffset % MeshStreamAlignment == 0);
+
+struct MeshFileView {
+    MeshFileHeader header;
+    // Of header.layout.size() bytes
+    std::span<const std::byte> streams;
+};
+
+// Checks everything in the header but whether the file holds the streams, for readers that read
+// the header on its own before the streams.
+bool validateMeshFileHeader(const MeshFileHeader &header);
+
+// Checks the header and that the streams fit in data. The indices are trusted to be in range.
+std::optional<MeshFileView> parseMeshFile(std::span<const std::byte> data);
+
+// Writes to a temporary file next to path and renames it over path, so that an interrupted write
+// never leaves a truncated file that a later parse would accept.
+bool writeMeshFile(const char *path, u64 source_hash, const MeshLayout &layout,
+                   std::span<const std::byte> streams);
+
+} // namespace brtoy
@@ -0,0 +1,38 @@
+#pragma once
+#include <brtoy/mesh_asset.h>
+#include <cstddef>
+#include <optional>
+#include <span>
+#include <string>
+#include <vector>
+
+namespace brtoy {
+
+struct ThreadPool;
+
+// The importers fill a MeshSource, for optimizeMesh and then encodeMesh or MeshData::add. They
+// count everything first and then write the streams in place, so that the only allocations are
+// one per stream. Vertices without a normal get the area-weighted average of the normals of the
+// faces around their position. The importers return nullopt on malformed input. Given a thread
+// pool, they run on it, so they must not be called from one of its jobs.
+
+// Reads the v, vn and f statements of a Wavefront OBJ file into one mesh, ignoring everything else
+// such as groups and materials. Polygons are fanned into triangles. Every triangle corner becomes
+// a vertex of its own, for optimizeMesh to weld. The file is split into line-aligned chunks that
+// are parsed in parallel.
+std::optional<MeshSource> importObj(std::span<const std::byte> text,
+                                    ThreadPool *thread_pool = nullptr);
+
+// URIs of the buffers of a .gltf file that live in files of their own, in the order importGltf
+// takes their contents. Base64 data URIs are decoded by importGltf and left out.
+std::optional<std::vector<std::string>> gltfExternalBufferUris(std::span<const std::byte> file);
+
+// Reads the triangle primitives of the meshes in the default scene of a glTF 2.0 file, .gltf or
+// .glb, into one mesh, with the node transforms applied. A .glb's first buffer is its binary
+// chunk. Primitives are converted in parallel. Sparse accessors, quantized attributes and
+// extensions that are required aren't supported.
+std::optional<MeshSource> importGltf(std::span<const std::byte> file,
+                                     std::span<const std::span<const std::byte>> external_buffers,
+                                     ThreadPool *thread_pool = nullptr);
+
+} // namespace brtoy
@@ -0,0 +1,196 @@
+#include <algorithm>
+#include <brtoy/mesh_asset.h>
+#include <brtoy/mesh_simplifier.h>
+#include <brtoy/vertex_codec.h>
+#include <cstring>
+#include <limits>
+
+namespace brtoy {
+
+namespace {
+
+// Each level of detail has half the triangles of the previous one. The chain ends early where the
+// simplifier stalls, e.g. on a mesh made of seams only.
+constexpr float LodReductionMax = 0.8f;
+
+u64 alignStream(u64 offset) {
+    return (offset + MeshStreamAlignment - 1) / MeshStreamAlignment * MeshStreamAlignment;
+}
+
+void remapMeshVertices(MeshSource &mesh, std::span<const u32> remap, u32 vertex_count) {
+    std::vector<V3f> stream(vertex_count);
+    remapVertices<V3f>(mesh.positions, remap, stream.data());
+    std::swap(mesh.positions, stream);
+    stream.resize(vertex_count);
+    remapVertices<V3f>(mesh.normals, remap, stream.data());
+    std::swap(mesh.normals, stream);
+}
+
+void buildLods(MeshSource &mesh) {
+    std::vector<u32> lod_indices(mesh.indices.size());
+    size_t index_count = mesh.indices.size();
+    while (mesh.lods.size() + 1 < MeshLodCountMax) {
+        // Simplifying the full mesh every time keeps the errors relative to it
+        float error;
+        size_t lod_index_count =
+            simplifyMesh(lod_indices, mesh.indices, mesh.positions, index_count / 6 * 3,
+                         std::numeric_limits<float>::max(), &error);
+        if (lod_index_count == 0 || lod_index_count > index_count * LodReductionMax)
+            break;
+        mesh.lods.push_back(
+            {{lod_indices.begin(), lod_indices.begin() + lod_index_count}, error});
+        index_count = lod_index_count;
+    }
+}
+
+} // namespace
+
+u32 vertexSize(PositionFormat format) {
+    return format == PositionFormat::Unorm16 ? sizeof(PackedPosition) : sizeof(V3f);
+}
+
+u32 vertexSize(NormalFormat format) {
+    switch (format) {
+    case NormalFormat::Oct16:
+        return sizeof(OctNormal16);
+    case NormalFormat::Oct8:
+        return sizeof(OctNormal8);
+    default:
+        return sizeof(V3f);
+    }
+}
+
+MeshOptimizeStats optimizeMesh(MeshSource &mesh, ThreadPool *thread_pool) {
+    MeshOptimizeStats stats = {};
+    stats.source_vertex_count = (u32)mesh.positions.size();
+    if (mesh.indices.empty())
+        return stats;
+    std::vector<u32> remap(stats.source_vertex_count);
+    std::array weld_streams = std::to_array<WeldStream>({
+        {mesh.positions.front().e, 3, 3},
+        {mesh.normals.front().e, 3, 3},
+    });
+    u32 vertex_count =
+        weldVertices(weld_streams, stats.source_vertex_count, remap, thread_pool);
+    remapIndices(mesh.indices, remap);
+    remapMeshVertices(mesh, remap, vertex_count);
+    buildLods(mesh);
+
+    stats.before = analyzeVertexCache(mesh.indices, vertex_count);
+    optimizeVertexCache(mesh.indices, vertex_count);
+    optimizeOverdraw(mesh.indices, mesh.positions);
+    for (MeshLodSource &lod : mesh.lods) {
+        optimizeVertexCache(lod.indices, vertex_count);
+        optimizeOverdraw(lod.indices, mesh.positions);
+    }
+    // The levels only use vertices of the full mesh, so its order serves them all
+    vertex_count = optimizeVertexFetch(mesh.indices, vertex_count, remap);
+    for (MeshLodSource &lod : mesh.lods)
+        remapIndices(lod.indices, remap);
+    remapMeshVertices(mesh, remap, vertex_count);
+    stats.after = analyzeVertexCache(mesh.indices, vertex_count);
+    return stats;
+}
+
+u64 MeshLayout::positionsSize() const { return (u64)vertexSize(format.position) * vertex_count; }
+
+u64 MeshLayout::attribsSize() const { return (u64)vertexSize(format.normal) * vertex_count; }
+
+u64 MeshLayout::indicesSize() const {
+    u32 last = lod_count - 1;
+    return (u64)index_size * (lod_first_indices[last] + lod_index_counts[last]);
+}
+
+u64 MeshLayout::attribsOffset() const { return alignStream(positionsSize()); }
+
+u64 MeshLayout::indicesOffset() const { return alignStream(attribsOffset() + attribsSize()); }
+
+u64 MeshLayout::size() const { return indicesOffset() + indicesSize(); }
+
+MeshLayout layoutMesh(VertexFormat format, u32 vertex_count,
+                      std::span<const u32> lod_index_counts) {
+    BRTOY_ASSERT(!lod_index_counts.empty() && lod_index_counts.size() <= MeshLodCountMax);
+    u32 index_size = vertex_count <= ShortIndexVertexCountMax ? sizeof(u16) : sizeof(u32);
+    MeshLayout layout = {
+        .format = format,
+        .vertex_count = vertex_count,
+        .index_size = index_size,
+        .lod_count = (u32)lod_index_counts.size(),
+        .lod_first_indices = {},
+        .lod_index_counts = {},
+        .lod_errors = {},
+        .pos_offset = {0.0f, 0.0f, 0.0f},
+        .pos_scale = {1.0f, 1.0f, 1.0f},
+        .bounds_center = {0.0f, 0.0f, 0.0f},
+        .bounds_radius = 0.0f,
+    };
+    u32 index_count = 0;
+    for (u32 lod = 0; lod < layout.lod_count; ++lod) {
+        layout.lod_first_indices[lod] = index_count;
+        layout.lod_index_counts[lod] = lod_index_counts[lod];
+        index_count += lod_index_counts[lod];
+    }
+    return layout;
+}
+
+MeshLayout layoutMesh(const MeshSource &mesh, VertexFormat format) {
+    std::array<u32, MeshLodCountMax> lod_index_counts;
+    lod_index_counts[0] = (u32)mesh.indices.size();
+    size_t lod_count = std::min<size_t>(mesh.lods.size() + 1, MeshLodCountMax);
+    for (size_t lod = 1; lod < lod_count; ++lod)
+        lod_index_counts[lod] = (u32)mesh.lods[lod - 1].indices.size();
+    return layoutMesh(format, (u32)mesh.positions.size(),
+                      std::span(lod_index_counts.data(), lod_count));
+}
+
+void encodeMesh(const MeshSource &mesh, MeshLayout &layout, std::byte *dst) {
+    BRTOY_ASSERT(mesh.positions.size() == layout.vertex_count &&
+                 mesh.normals.size() == layout.vertex_count);
+    const std::vector<V3f> &positions = mesh.positions;
+    Aabb bounds = computeBounds(positions.data(), positions.size());
+    layout.bounds_center = (bounds.min + bounds.max) * 0.5f;
+    layout.bounds_radius = 0.0f;
+    for (const V3f &p : positions)
+        layout.bounds_radius = std::max(layout.bounds_radius, length(p - layout.bounds_center));
+
+    if (layout.format.position == PositionFormat::Unorm16) {
+        encodePositions(positions.data(), positions.size(), bounds, (PackedPosition *)dst);
+        layout.pos_offset = bounds.min;
+        layout.pos_scale = (bounds.max - bounds.min) / 65535.0f;
+    } else {
+        std::copy(positions.begin(), positions.end(), (V3f *)dst);
+    }
+
+    const std::vector<V3f> &normals = mesh.normals;
+    std::byte *dst_normals = dst + layout.attribsOffset();
+    switch (layout.format.normal) {
+    case NormalFormat::Float3:
+        std::copy(normals.begin(), normals.end(), (V3f *)dst_normals);
+        break;
+    case NormalFormat::Oct16:
+        encodeNormals(normals.data(), normals.size(), (OctNormal16 *)dst_normals);
+        break;
+    case NormalFormat::Oct8:
+        encodeNormals(normals.data(), normals.size(), (OctNormal8 *)dst_normals);
+        break;
+    }
+
+    std::byte *dst_indices = dst + layout.indicesOffset();
+    for (u32 lod = 0; lod < layout.lod_count; ++lod) {
+        const std::vector<u32> &indices = lod == 0 ? mesh.indices : mesh.lods[lod - 1].indices;
+        BRTOY_ASSERT(indices.size() == layout.lod_index_counts[lod]);
+        u32 first = layout.lod_first_indices[lod];
+        // Narrowed to the index size
+        if (layout.index_size == sizeof(u16))
+            std::copy(indices.begin(), indices.end(), (u16 *)dst_indices + first);
+        else
+            std::copy(indices.begin(), indices.end(), (u32 *)dst_indices + first);
+        layout.lod_errors[lod] = lod == 0 ? 0.0f : mesh.lods[lod - 1].error;
+    }
+    // Zeroes the padding between streams, which cooked files would otherwise carry as garbage
+    std::memset(dst + layout.positionsSize(), 0, layout.attribsOffset() - layout.positionsSize());
+    std::memset(dst_normals + layout.attribsSize(), 0,
+                layout.indicesOffset() - layout.attribsOffset() - layout.attribsSize());
+}
+
+} // namespace brtoy
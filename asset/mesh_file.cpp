@@ -0,0 +1,68 @@
+#include <brtoy/mesh_file.h>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <string>
+
+namespace brtoy {
+
+bool validateMeshFileHeader(const MeshFileHeader &header) {
+    const MeshLayout &layout = header.layout;
+    if (header.magic != MeshFileHeader::Magic || header.version != MeshFileHeader::Version)
+        return false;
+    if (layout.format.position > PositionFormat::Unorm16 ||
+        layout.format.normal > NormalFormat::Oct8 || layout.lod_count == 0 ||
+        layout.lod_count > MeshLodCountMax)
+        return false;
+
+    u64 lod_index_total = 0;
+    for (u32 lod = 0; lod < layout.lod_count; ++lod)
+        lod_index_total += layout.lod_index_counts[lod];
+    if (lod_index_total > std::numeric_limits<u32>::max())
+        return false;
+    // Everything the layout derives from the counts has to match
+    MeshLayout expected =
+        layoutMesh(layout.format, layout.vertex_count,
+                   std::span(layout.lod_index_counts.data(), layout.lod_count));
+    return layout.index_size == expected.index_size &&
+           layout.lod_first_indices == expected.lod_first_indices;
+}
+
+std::optional<MeshFileView> parseMeshFile(std::span<const std::byte> data) {
+    if (data.size() < MeshFileStreamsOffset)
+        return std::nullopt;
+    MeshFileView view;
+    std::memcpy(&view.header, data.data(), sizeof(view.header));
+    if (!validateMeshFileHeader(view.header) ||
+        view.header.layout.size() > data.size() - MeshFileStreamsOffset)
+        return std::nullopt;
+    view.streams = data.subspan(MeshFileStreamsOffset, view.header.layout.size());
+    return view;
+}
+
+bool writeMeshFile(const char *path, u64 source_hash, const MeshLayout &layout,
+                   std::span<const std::byte> streams) {
+    BRTOY_ASSERT(streams.size() == layout.size());
+    MeshFileHeader header = {
+        .magic = MeshFileHeader::Magic,
+        .version = MeshFileHeader::Version,
+        .source_hash = source_hash,
+        .layout = layout,
+        .reserved = 0,
+    };
+
+    std::filesystem::path tmp_path = std::string(path) + ".tmp";
+    {
+        std::ofstream ofs(tmp_path, std::ios::out | std::ios::binary | std::ios::trunc);
+        ofs.write((const char *)&header, sizeof(header));
+        ofs.write((const char *)streams.data(), streams.size());
+        if (!ofs)
+            return false;
+    }
+    std::error_code ec;
+    std::filesystem::rename(tmp_path, path, ec);
+    return !ec;
+}
+
+} // namespace brtoy
@@ -0,0 +1,287 @@
+#include "mesh_import_internal.h"
+#include <atomic>
+#include <brtoy/mesh_import.h>
+#include <brtoy/thread_pool.h>
+#include <charconv>
+#include <cstring>
+#include <limits>
+#include <string_view>
+
+namespace brtoy {
+
+namespace {
+
+// Below this, a chunk isn't worth a thread of its own
+constexpr size_t ObjChunkSizeMin = 1024 * 1024;
+
+constexpr u32 NoNormal = ~0u;
+
+struct ObjCorner {
+    u32 position;
+    u32 normal;
+};
+
+enum class ObjStatement {
+    Other,
+    Position,
+    Normal,
+    Face,
+};
+
+// Line-aligned range of the file. The counts are filled by the first pass and the bases, the
+// number of each element in the chunks before, from them.
+struct ObjChunk {
+    const char *begin;
+    const char *end;
+    size_t position_count;
+    size_t normal_count;
+    size_t triangle_count;
+    size_t position_base;
+    size_t normal_base;
+    size_t triangle_base;
+};
+
+bool isSpace(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+
+const char *skipSpace(const char *p, const char *end) {
+    while (p < end && isSpace(*p))
+        ++p;
+    return p;
+}
+
+const char *lineEnd(const char *p, const char *end) {
+    const char *line_end = (const char *)std::memchr(p, '\n', end - p);
+    return line_end ? line_end : end;
+}
+
+bool startsStatement(std::string_view line, std::string_view keyword) {
+    return line.size() > keyword.size() && line.starts_with(keyword) &&
+           isSpace(line[keyword.size()]);
+}
+
+// Advances p past the keyword
+ObjStatement classify(const char *&p, const char *line_end) {
+    p = skipSpace(p, line_end);
+    std::string_view line(p, line_end - p);
+    if (startsStatement(line, "v")) {
+        p += 1;
+        return ObjStatement::Position;
+    }
+    if (startsStatement(line, "vn")) {
+        p += 2;
+        return ObjStatement::Normal;
+    }
+    if (startsStatement(line, "f")) {
+        p += 1;
+        return ObjStatement::Face;
+    }
+    return ObjStatement::Other;
+}
+
+size_t countTokens(const char *p, const char *end) {
+    size_t count = 0;
+    while (true) {
+        p = skipSpace(p, end);
+        if (p == end)
+            return count;
+        ++count;
+        while (p < end && !isSpace(*p))
+            ++p;
+    }
+}
+
+bool parseFloat(const char *&p, const char *end, float &out) {
+    p = skipSpace(p, end);
+    auto [ptr, ec] = std::from_chars(p, end, out);
+    p = ptr;
+    return ec == std::errc();
+}
+
+bool parseV3f(const char *&p, const char *end, V3f &out) {
+    return parseFloat(p, end, out.x) && parseFloat(p, end, out.y) && parseFloat(p, end, out.z);
+}
+
+// OBJ indices start at 1, negative ones count back from the last element read so far
+bool parseIndex(const char *&p, const char *end, size_t count, u32 &out) {
+    i64 value;
+    auto [ptr, ec] = std::from_chars(p, end, value);
+    p = ptr;
+    if (ec != std::errc() || value == 0)
+        return false;
+    i64 index = value > 0 ? value - 1 : (i64)count + value;
+    if (index < 0 || index >= (i64)count)
+        return false;
+    out = (u32)index;
+    return true;
+}
+
+// One of v, v/vt, v//vn or v/vt/vn. Texture coordinates aren't used, so they aren't checked.
+bool parseCorner(const char *&p, const char *end, size_t position_count, size_t normal_count,
+                 ObjCorner &out) {
+    out.normal = NoNormal;
+    if (!parseIndex(p, end, position_count, out.position))
+        return false;
+    if (p == end || *p != '/')
+        return true;
+    ++p;
+    while (p < end && *p != '/' && !isSpace(*p))
+        ++p;
+    if (p == end || *p != '/')
+        return true;
+    ++p;
+    return parseIndex(p, end, normal_count, out.normal);
+}
+
+void countChunk(ObjChunk &chunk) {
+    for (const char *p = chunk.begin; p < chunk.end;) {
+        const char *line_end = lineEnd(p, chunk.end);
+        switch (classify(p, line_end)) {
+        case ObjStatement::Position:
+            ++chunk.position_count;
+            break;
+        case ObjStatement::Normal:
+            ++chunk.normal_count;
+            break;
+        case ObjStatement::Face: {
+            // Faces with fewer than three corners fail to parse later
+            size_t corner_count = countTokens(p, line_end);
+            chunk.triangle_count += corner_count >= 3 ? corner_count - 2 : 0;
+            break;
+        }
+        case ObjStatement::Other:
+            break;
+        }
+        p = line_end + 1;
+    }
+}
+
+// Writes the chunk's elements at its bases
+bool parseChunk(const ObjChunk &chunk, V3f *positions, V3f *normals, ObjCorner *corners) {
+    size_t position_count = chunk.position_base;
+    size_t normal_count = chunk.normal_base;
+    ObjCorner *corner = corners + chunk.triangle_base * 3;
+    for (const char *p = chunk.begin; p < chunk.end;) {
+        const char *line_end = lineEnd(p, chunk.end);
+        bool valid = true;
+        switch (classify(p, line_end)) {
+        case ObjStatement::Position:
+            valid = parseV3f(p, line_end, positions[position_count++]);
+            break;
+        case ObjStatement::Normal:
+            valid = parseV3f(p, line_end, normals[normal_count++]);
+            break;
+        case ObjStatement::Face: {
+            // Fanned around the first corner, which is written again for every triangle
+            ObjCorner first, previous;
+            size_t corner_index = 0;
+            p = skipSpace(p, line_end);
+            while (valid && p < line_end) {
+                ObjCorner current;
+                valid = parseCorner(p, line_end, position_count, normal_count, current) &&
+                        (p == line_end || isSpace(*p));
+                if (valid && corner_index == 0) {
+                    first = current;
+                } else if (valid && corner_index >= 2) {
+                    *corner++ = first;
+                    *corner++ = previous;
+                    *corner++ = current;
+                }
+                previous = current;
+                ++corner_index;
+                p = skipSpace(p, line_end);
+            }
+            valid = valid && corner_index >= 3;
+            break;
+        }
+        case ObjStatement::Other:
+            break;
+        }
+        if (!valid)
+            return false;
+        p = line_end + 1;
+    }
+    return true;
+}
+
+} // namespace
+
+std::optional<MeshSource> importObj(std::span<const std::byte> text, ThreadPool *thread_pool) {
+    const char *begin = (const char *)text.data();
+    const char *end = begin + text.size();
+    size_t thread_count = thread_pool ? thread_pool->threadCount() : 1;
+    size_t chunk_count = std::clamp(text.size() / ObjChunkSizeMin, size_t(1), thread_count);
+    std::vector<ObjChunk> chunks(chunk_count, ObjChunk{});
+    const char *chunk_begin = begin;
+    for (size_t i = 0; i < chunk_count; ++i) {
+        const char *chunk_end = end;
+        if (i + 1 < chunk_count) {
+            const char *line_end = lineEnd(begin + text.size() * (i + 1) / chunk_count, end);
+            chunk_end = std::max(line_end < end ? line_end + 1 : end, chunk_begin);
+        }
+        chunks[i].begin = chunk_begin;
+        chunks[i].end = chunk_end;
+        chunk_begin = chunk_end;
+    }
+
+    parallelFor(thread_pool, chunk_count, [&](size_t first, size_t last) {
+        for (size_t i = first; i < last; ++i)
+            countChunk(chunks[i]);
+    });
+    size_t position_count = 0;
+    size_t normal_count = 0;
+    size_t triangle_count = 0;
+    for (ObjChunk &chunk : chunks) {
+        chunk.position_base = position_count;
+        chunk.normal_base = normal_count;
+        chunk.triangle_base = triangle_count;
+        position_count += chunk.position_count;
+        normal_count += chunk.normal_count;
+        triangle_count += chunk.triangle_count;
+    }
+    if (triangle_count * 3 > std::numeric_limits<u32>::max())
+        return std::nullopt;
+
+    // Faces index the elements read before them, so a chunk's faces may use the elements of the
+    // chunks before it, which other threads are writing. Indices are only checked against the
+    // counts here and read after all chunks are done.
+    std::vector<V3f> positions(position_count);
+    std::vector<V3f> normals(normal_count);
+    std::vector<ObjCorner> corners(triangle_count * 3);
+    std::atomic<bool> valid = true;
+    parallelFor(thread_pool, chunk_count, [&](size_t first, size_t last) {
+        for (size_t i = first; i < last && valid; ++i) {
+            if (!parseChunk(chunks[i], positions.data(), normals.data(), corners.data()))
+                valid = false;
+        }
+    });
+    if (!valid)
+        return std::nullopt;
+
+    std::vector<V3f> smooth_normals;
+    for (const ObjCorner &corner : corners) {
+        if (corner.normal == NoNormal) {
+            smooth_normals.resize(position_count);
+            computeSmoothNormals(
+                positions, corners.size(), [&](size_t i) { return corners[i].position; },
+                smooth_normals);
+            break;
+        }
+    }
+
+    MeshSource mesh;
+    mesh.positions.resize(corners.size());
+    mesh.normals.resize(corners.size());
+    mesh.indices.resize(corners.size());
+    parallelFor(thread_pool, corners.size(), [&](size_t first, size_t last) {
+        for (size_t i = first; i < last; ++i) {
+            const ObjCorner &corner = corners[i];
+            mesh.positions[i] = positions[corner.position];
+            mesh.normals[i] = corner.normal != NoNormal ? normals[corner.normal]
+                                                        : smooth_normals[corner.position];
+            mesh.indices[i] = (u32)i;
+        }
+    });
+    return mesh;
+}
+
+} // namespace brtoy
@@ -0,0 +1,31 @@
+#pragma once
+#include <algorithm>
+#include <brtoy/vec.h>
+#include <span>
+
+namespace brtoy {
+
+// Area-weighted average of the normals of the triangles around each position, where
+// position(corner) gives the position index of a triangle corner. Positions without triangles
+// get zero, which encodes as +Z.
+template <typename F>
+void computeSmoothNormals(std::span<const V3f> positions, size_t corner_count, F &&position,
+                          std::span<V3f> normals) {
+    std::fill(normals.begin(), normals.end(), V3f{0.0f, 0.0f, 0.0f});
+    // The cross product's length is twice the triangle's area, which weights the average
+    for (size_t i = 0; i + 2 < corner_count; i += 3) {
+        u32 p0 = position(i);
+        u32 p1 = position(i + 1);
+        u32 p2 = position(i + 2);
+        V3f n = cross(positions[p1] - positions[p0], positions[p2] - positions[p0]);
+        normals[p0] += n;
+        normals[p1] += n;
+        normals[p2] += n;
+    }
+    for (V3f &n : normals) {
+        if (length(n) > 0.0f)
+            n = normalize(n);
+    }
+}
+
+} // namespace brtoy
@@ -0,0 +1,51 @@
+#include <brtoy/arena.h>
+
+#ifdef BRTOY_COUNT_ALLOCATIONS
+#include <atomic>
+#include <stdlib.h>
+
+namespace brtoy {
+
+// Implemented per platform; memory from alignedAlloc() must be freed with alignedFree()
+void *alignedAlloc(size_t size, size_t alignment);
+void alignedFree(void *ptr);
+
+static std::atomic<u64> g_heap_allocation_count = 0;
+static std::atomic<HeapAllocationHook> g_heap_allocation_hook = nullptr;
+
+u64 heapAllocationCount() { return g_heap_allocation_count.load(std::memory_order_relaxed); }
+
+void setHeapAllocationHook(HeapAllocationHook hook) {
+    g_heap_allocation_hook.store(hook, std::memory_order_relaxed);
+}
+
+// An alignment of 0 allocates with malloc
+static void *countedAlloc(size_t size, size_t alignment) {
+    g_heap_allocation_count.fetch_add(1, std::memory_order_relaxed);
+    if (HeapAllocationHook hook = g_heap_allocation_hook.load(std::memory_order_relaxed))
+        hook(size);
+    if (size == 0)
+        size = 1;
+    void *ptr = alignment == 0 ? malloc(size) : alignedAlloc(size, alignment);
+    if (!ptr)
+        throw std::bad_alloc();
+    return ptr;
+}
+
+} // namespace brtoy
+
+// The nothrow and sized forms forward to these by default
+void *operator new(size_t size) { return brtoy::countedAlloc(size, 0); }
+void *operator new[](size_t size) { return brtoy::countedAlloc(size, 0); }
+void *operator new(size_t size, std::align_val_t alignment) {
+    return brtoy::countedAlloc(size, (size_t)alignment);
+}
+void *operator new[](size_t size, std::align_val_t alignment) {
+    return brtoy::countedAlloc(size, (size_t)alignment);
+}
+void operator delete(void *ptr) noexcept { free(ptr); }
+void operator delete[](void *ptr) noexcept { free(ptr); }
+void operator delete(void *ptr, std::align_val_t) noexcept { brtoy::alignedFree(ptr); }
+void operator delete[](void *ptr, std::align_val_t) noexcept { brtoy::alignedFree(ptr); }
+
+#endif
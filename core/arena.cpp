@@ -0,0 +1,53 @@
+#include <brtoy/arena.h>
+#include <algorithm>
+
+namespace brtoy {
+
+FrameArena::FrameArena(size_t capacity) : m_capacity(capacity) {
+    m_memory = (std::byte *)::operator new(m_capacity);
+}
+
+FrameArena::~FrameArena() {
+    reset();
+    ::operator delete(m_memory);
+}
+
+void *FrameArena::allocate(size_t size, size_t alignment) {
+    uintptr_t base = (uintptr_t)m_memory;
+    size_t offset = ((base + m_offset + alignment - 1) & ~(alignment - 1)) - base;
+    if (offset + size <= m_capacity) {
+        m_offset = offset + size;
+        return m_memory + offset;
+    }
+
+    // The block header keeps the payload aligned to alignof(std::max_align_t)
+    size_t header_size = (sizeof(OverflowBlock) + alignof(std::max_align_t) - 1) &
+                         ~(alignof(std::max_align_t) - 1);
+    size_t padding = alignment > alignof(std::max_align_t) ? alignment : 0;
+    auto block = (OverflowBlock *)::operator new(header_size + padding + size);
+    block->next = m_overflow;
+    block->size = size;
+    m_overflow = block;
+    m_overflow_size += size + padding;
+    uintptr_t payload = (uintptr_t)block + header_size;
+    return (void *)((payload + alignment - 1) & ~(uintptr_t)(alignment - 1));
+}
+
+void FrameArena::reset() {
+    m_peak = std::max(m_peak, used());
+    while (m_overflow) {
+        OverflowBlock *next = m_overflow->next;
+        ::operator delete(m_overflow);
+        m_overflow = next;
+    }
+    if (m_overflow_size > 0) {
+        // Allocations of the next frame may be aligned differently, hence the margin
+        m_capacity = m_peak + m_peak / 4;
+        ::operator delete(m_memory);
+        m_memory = (std::byte *)::operator new(m_capacity);
+        m_overflow_size = 0;
+    }
+    m_offset = 0;
+}
+
+} // namespace brtoy
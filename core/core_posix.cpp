@@ -0,0 +1,26 @@
+#include <brtoy/brtoy.h>
+#include <brtoy/profiler.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <time.h>
+
+namespace brtoy {
+
+void debugBreak() { raise(SIGTRAP); }
+
+u64 cpuTimestamp() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u64)ts.tv_sec * 1000000000ull + (u64)ts.tv_nsec;
+}
+
+u64 cpuTimestampFrequency() { return 1000000000ull; }
+
+void *alignedAlloc(size_t size, size_t alignment) {
+    // aligned_alloc() wants the size to be a multiple of the alignment
+    return aligned_alloc(alignment, (size + alignment - 1) & ~(alignment - 1));
+}
+
+void alignedFree(void *ptr) { free(ptr); }
+
+} // namespace brtoy
@@ -1,8 +1,26 @@
 #include <Windows.h>
 #include <brtoy/brtoy.h>
+#include <brtoy/profiler.h>
+#include <malloc.h>
 
 namespace brtoy {
 
 void debugBreak() { DebugBreak(); }
 
+u64 cpuTimestamp() {
+    LARGE_INTEGER counter;
+    QueryPerformanceCounter(&counter);
+    return (u64)counter.QuadPart;
+}
+
+u64 cpuTimestampFrequency() {
+    LARGE_INTEGER frequency;
+    QueryPerformanceFrequency(&frequency);
+    return (u64)frequency.QuadPart;
+}
+
+void *alignedAlloc(size_t size, size_t alignment) { return _aligned_malloc(size, alignment); }
+
+void alignedFree(void *ptr) { _aligned_free(ptr); }
+
 } // namespace brtoy
@@ -0,0 +1,89 @@
+#pragma once
+#include <brtoy/brtoy.h>
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace brtoy {
+
+// Linear allocator for memory that lives until the end of the frame. Allocation bumps an offset
+// and individual frees are no-ops; reset() releases everything at once. When an allocation
+// doesn't fit, it is served from an overflow block on the heap, and the next reset() grows the
+// arena to the high-water mark so that the following frames don't overflow again. Not thread safe.
+struct FrameArena {
+    FrameArena(size_t capacity);
+    ~FrameArena();
+    FrameArena(const FrameArena &) = delete;
+    FrameArena &operator=(const FrameArena &) = delete;
+
+    void *allocate(size_t size, size_t alignment = alignof(std::max_align_t));
+    // Everything allocated since the last reset must be dead
+    void reset();
+
+    size_t used() const { return m_offset + m_overflow_size; }
+
+    struct OverflowBlock {
+        OverflowBlock *next;
+        size_t size;
+    };
+
+    std::byte *m_memory = nullptr;
+    size_t m_capacity;
+    size_t m_offset = 0;
+    // Largest used() seen at a reset
+    size_t m_peak = 0;
+    OverflowBlock *m_overflow = nullptr;
+    size_t m_overflow_size = 0;
+};
+
+// Allocator adaptor for standard containers. Without an arena it allocates from the heap, so that
+// code can take an optional arena. Memory is returned to the arena only by FrameArena::reset(), so
+// containers should be reserved up front where the final size is known.
+template <typename T> struct ArenaAllocator {
+    using value_type = T;
+
+    ArenaAllocator(FrameArena *arena = nullptr) : m_arena(arena) {}
+    template <typename U> ArenaAllocator(const ArenaAllocator<U> &other) : m_arena(other.m_arena) {}
+
+    T *allocate(size_t count) {
+        if (m_arena)
+            return (T *)m_arena->allocate(count * sizeof(T), alignof(T));
+        return std::allocator<T>().allocate(count);
+    }
+
+    void deallocate(T *ptr, size_t count) {
+        if (!m_arena)
+            std::allocator<T>().deallocate(ptr, count);
+    }
+
+    template <typename U> bool operator==(const ArenaAllocator<U> &other) const {
+        return m_arena == other.m_arena;
+    }
+
+    FrameArena *m_arena;
+};
+
+template <typename T> using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+using ArenaString = std::basic_string<char, std::char_traits<char>, ArenaAllocator<char>>;
+
+#ifdef BRTOY_COUNT_ALLOCATIONS
+
+// Replaces the global operator new and delete to count heap allocations across all threads, so
+// that a frame loop can verify that it doesn't allocate once it has warmed up. The hook, if set,
+// is called on every allocation, e.g. to break in the debugger.
+inline constexpr bool IsCountingHeapAllocations = true;
+u64 heapAllocationCount();
+using HeapAllocationHook = void (*)(size_t size);
+void setHeapAllocationHook(HeapAllocationHook hook);
+
+#else
+
+inline constexpr bool IsCountingHeapAllocations = false;
+inline u64 heapAllocationCount() { return 0; }
+using HeapAllocationHook = void (*)(size_t size);
+inline void setHeapAllocationHook(HeapAllocationHook) {}
+
+#endif
+
+} // namespace brtoy
@@ -1,30 +1,30 @@
 #pragma once
+#include <algorithm>
 #include <array>
 #include <brtoy/brtoy.h>
+#include <cstddef>
+#include <cstring>
+#include <initializer_list>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
 
 namespace brtoy {
 
+// Fixed capacity vector. All Capacity elements are constructed up front, so T must be default
+// constructible, and elements past size() hold default values.
 template <typename T, size_t N> class StackVector {
   public:
     using value_type = T;
     using pointer_type = T *;
+    using iterator = T *;
+    using const_iterator = const T *;
     static constexpr size_t Capacity = N;
     using array_type = std::array<value_type, Capacity>;
 
-    struct iterator {
-        array_type *m_ary;
-        size_t m_cur;
-
-        std::strong_ordering operator<=>(const iterator &) const = default;
-        iterator &operator++() {
-            ++m_cur;
-            return *this;
-        }
-        const T &operator*() const { return (*m_ary)[m_cur]; }
-    };
-
     StackVector() = default;
-    StackVector(size_t count) : m_count(count) {}
+    StackVector(size_t count) : m_count(count) { BRTOY_ASSERT(count <= Capacity); }
 
     StackVector(StackVector &&other) : m_count(other.m_count), m_array(std::move(other.m_array)) {
         other.m_count = 0;
@@ -43,32 +43,244 @@ template <typename T, size_t N> class StackVector {
 
     bool empty() const { return m_count == 0; }
 
-    const value_type &operator[](size_t i) const { return m_array[i]; }
+    value_type &operator[](size_t i) {
+        BRTOY_ASSERT(i < m_count);
+        return m_array[i];
+    }
+
+    const value_type &operator[](size_t i) const {
+        BRTOY_ASSERT(i < m_count);
+        return m_array[i];
+    }
 
     void push_back(T &&elem) {
-        if (m_count < Capacity)
-            m_array[m_count++] = std::move(elem);
+        BRTOY_ASSERT(m_count < Capacity);
+        m_array[m_count++] = std::move(elem);
     }
 
     void push_back(const value_type &elem) {
-        if (m_count < Capacity)
-            m_array[m_count++] = std::move(elem);
+        BRTOY_ASSERT(m_count < Capacity);
+        m_array[m_count++] = elem;
     }
 
     void clear() {
-        m_array.fill({});
+        std::fill_n(m_array.begin(), m_count, value_type{});
         m_count = 0;
     }
 
-    iterator begin() { return iterator{&m_array, 0}; }
+    iterator begin() { return m_array.data(); }
+    const_iterator begin() const { return m_array.data(); }
 
-    iterator end() { return iterator{&m_array, Capacity}; }
+    iterator end() { return m_array.data() + m_count; }
+    const_iterator end() const { return m_array.data() + m_count; }
 
     pointer_type data() { return m_array.data(); }
+    const value_type *data() const { return m_array.data(); }
 
   private:
     size_t m_count = 0;
     array_type m_array = {};
 };
 
+// Vector with inline storage for N elements that moves to the heap once it outgrows them. Only
+// size() elements are constructed. Elements that are trivially copyable are relocated with
+// memcpy when the vector grows or is moved. Iterators are pointers and, like those of
+// std::vector, are invalidated when the vector grows.
+template <typename T, size_t N> class SmallVector {
+    static_assert(N > 0);
+
+  public:
+    using value_type = T;
+    using size_type = size_t;
+    using iterator = T *;
+    using const_iterator = const T *;
+    static constexpr size_t InlineCapacity = N;
+
+    SmallVector() = default;
+    explicit SmallVector(size_t count) { resize(count); }
+    SmallVector(size_t count, const value_type &value) { resize(count, value); }
+    SmallVector(std::initializer_list<value_type> init) {
+        reserve(init.size());
+        std::uninitialized_copy(init.begin(), init.end(), m_data);
+        m_size = init.size();
+    }
+
+    SmallVector(const SmallVector &other) {
+        reserve(other.m_size);
+        std::uninitialized_copy(other.begin(), other.end(), m_data);
+        m_size = other.m_size;
+    }
+
+    SmallVector(SmallVector &&other) noexcept { takeFrom(other); }
+
+    SmallVector &operator=(const SmallVector &other) {
+        if (this != &other) {
+            clear();
+            reserve(other.m_size);
+            std::uninitialized_copy(other.begin(), other.end(), m_data);
+            m_size = other.m_size;
+        }
+        return *this;
+    }
+
+    SmallVector &operator=(SmallVector &&other) noexcept {
+        if (this != &other) {
+            clear();
+            freeHeap();
+            takeFrom(other);
+        }
+        return *this;
+    }
+
+    ~SmallVector() {
+        clear();
+        freeHeap();
+    }
+
+    size_t size() const { return m_size; }
+    size_t capacity() const { return m_capacity; }
+    bool empty() const { return m_size == 0; }
+    bool isInline() const { return m_data == inlineData(); }
+
+    value_type *data() { return m_data; }
+    const value_type *data() const { return m_data; }
+
+    value_type &operator[](size_t i) {
+        BRTOY_ASSERT(i < m_size);
+        return m_data[i];
+    }
+
+    const value_type &operator[](size_t i) const {
+        BRTOY_ASSERT(i < m_size);
+        return m_data[i];
+    }
+
+    value_type &front() { return (*this)[0]; }
+    const value_type &front() const { return (*this)[0]; }
+    value_type &back() { return (*this)[m_size - 1]; }
+    const value_type &back() const { return (*this)[m_size - 1]; }
+
+    iterator begin() { return m_data; }
+    const_iterator begin() const { return m_data; }
+    iterator end() { return m_data + m_size; }
+    const_iterator end() const { return m_data + m_size; }
+
+    void reserve(size_t capacity) {
+        if (capacity > m_capacity)
+            grow(capacity);
+    }
+
+    void resize(size_t count) {
+        reserve(count);
+        if (count > m_size)
+            std::uninitialized_value_construct(m_data + m_size, m_data + count);
+        else
+            std::destroy(m_data + count, m_data + m_size);
+        m_size = count;
+    }
+
+    void resize(size_t count, const value_type &value) {
+        if (count > m_capacity) {
+            // value may refer to an element
+            value_type copy = value;
+            grow(count);
+            std::uninitialized_fill(m_data + m_size, m_data + count, copy);
+        } else if (count > m_size) {
+            std::uninitialized_fill(m_data + m_size, m_data + count, value);
+        } else {
+            std::destroy(m_data + count, m_data + m_size);
+        }
+        m_size = count;
+    }
+
+    template <typename... Args> value_type &emplace_back(Args &&...args) {
+        if (m_size == m_capacity) {
+            // The arguments may refer to elements, so construct before the storage moves
+            value_type elem(std::forward<Args>(args)...);
+            grow(m_capacity * 2);
+            return *new (m_data + m_size++) value_type(std::move(elem));
+        }
+        return *new (m_data + m_size++) value_type(std::forward<Args>(args)...);
+    }
+
+    void push_back(const value_type &elem) { emplace_back(elem); }
+    void push_back(value_type &&elem) { emplace_back(std::move(elem)); }
+
+    void pop_back() {
+        BRTOY_ASSERT(m_size > 0);
+        std::destroy_at(m_data + --m_size);
+    }
+
+    // Keeps the storage
+    void clear() {
+        std::destroy(m_data, m_data + m_size);
+        m_size = 0;
+    }
+
+    iterator erase(const_iterator pos) { return erase(pos, pos + 1); }
+
+    iterator erase(const_iterator first, const_iterator last) {
+        iterator dst = m_data + (first - m_data);
+        iterator src = m_data + (last - m_data);
+        if (dst != src) {
+            iterator new_end = std::move(src, end(), dst);
+            std::destroy(new_end, end());
+            m_size = new_end - m_data;
+        }
+        return dst;
+    }
+
+  private:
+    value_type *inlineData() { return reinterpret_cast<value_type *>(m_inline); }
+    const value_type *inlineData() const { return reinterpret_cast<const value_type *>(m_inline); }
+
+    // Moves the elements from src to uninitialized dst and destroys them in src
+    static void relocate(value_type *src, size_t count, value_type *dst) {
+        if constexpr (std::is_trivially_copyable_v<value_type>) {
+            if (count > 0)
+                memcpy((void *)dst, (const void *)src, count * sizeof(value_type));
+        } else {
+            std::uninitialized_move(src, src + count, dst);
+            std::destroy(src, src + count);
+        }
+    }
+
+    void grow(size_t capacity) {
+        capacity = std::max(capacity, m_size + 1);
+        auto data = (value_type *)::operator new(capacity * sizeof(value_type),
+                                                 std::align_val_t(alignof(value_type)));
+        relocate(m_data, m_size, data);
+        freeHeap();
+        m_data = data;
+        m_capacity = capacity;
+    }
+
+    void freeHeap() {
+        if (!isInline()) {
+            ::operator delete(m_data, std::align_val_t(alignof(value_type)));
+            m_data = inlineData();
+            m_capacity = N;
+        }
+    }
+
+    // Expects this to be empty and inline
+    void takeFrom(SmallVector &other) {
+        if (other.isInline()) {
+            relocate(other.m_data, other.m_size, m_data);
+        } else {
+            m_data = other.m_data;
+            m_capacity = other.m_capacity;
+            other.m_data = other.inlineData();
+            other.m_capacity = N;
+        }
+        m_size = other.m_size;
+        other.m_size = 0;
+    }
+
+    value_type *m_data = inlineData();
+    size_t m_size = 0;
+    size_t m_capacity = N;
+    alignas(value_type) std::byte m_inline[N * sizeof(value_type)];
+};
+
 } // namespace brtoy
@@ -0,0 +1,20 @@
+#pragma once
+#include <brtoy/brtoy.h>
+#include <cstddef>
+#include <span>
+
+namespace brtoy {
+
+inline constexpr u64 FnvOffsetBasis = 0xcbf29ce484222325ull;
+
+// 64-bit FNV-1a, for detecting changed contents. Passing a previous hash continues it, so that
+// several buffers hash as if they were one.
+inline u64 hashBytes(std::span<const std::byte> bytes, u64 hash = FnvOffsetBasis) {
+    for (std::byte b : bytes) {
+        hash ^= (u64)b;
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+} // namespace brtoy
@@ -0,0 +1,73 @@
+#pragma once
+#include <brtoy/vec.h>
+#include <cstddef>
+#include <span>
+
+namespace brtoy {
+
+struct ThreadPool;
+
+// The passes operate on triangle lists and are meant to run in this order: vertex cache,
+// overdraw, vertex fetch. The first two only reorder triangles, the last renumbers the vertices.
+
+// Post-transform cache behaviour of an index buffer, simulated with a FIFO cache
+struct VertexCacheStats {
+    u32 transformed_vertices;
+    // Transformed vertices per triangle, 0.5 at best and 3 at worst
+    float acmr;
+    // Transformed vertices per referenced vertex, 1 at best
+    float atvr;
+};
+
+VertexCacheStats analyzeVertexCache(std::span<const u32> indices, u32 vertex_count,
+                                    u32 cache_size = 16);
+
+// Reorders the triangles for vertex reuse with Tom Forsyth's linear-speed algorithm
+void optimizeVertexCache(std::span<u32> indices, u32 vertex_count);
+
+// Splits the triangle order from optimizeVertexCache into clusters and sorts the clusters so that
+// those facing outwards from the mesh center are drawn first and occlude the rest. A cluster ends
+// where the vertex cache would be cold anyway or where its own ACMR is within threshold of the
+// mesh's, so the ACMR grows by at most about threshold.
+void optimizeOverdraw(std::span<u32> indices, std::span<const V3f> positions,
+                      float threshold = 1.05f);
+
+// Renumbers the vertices in the order the indices first reference them, so that vertex fetches
+// walk memory linearly. remap gets the new index of every old vertex, or NotReferenced. Returns
+// the number of referenced vertices.
+inline constexpr u32 NotReferenced = ~0u;
+u32 optimizeVertexFetch(std::span<u32> indices, u32 vertex_count, std::span<u32> remap);
+
+// A float vertex stream compared by weldVertices
+struct WeldStream {
+    const float *data;
+    // In floats
+    u32 stride;
+    // Compared floats at the start of each vertex
+    u32 components;
+    // Components are snapped to a grid of this spacing before comparing, 0 compares them exactly.
+    // Values close to a grid line may snap apart, so this welds within epsilon but not all of it.
+    float epsilon = 0.0f;
+};
+
+// Finds vertices that are equal in all streams by hashing. remap gets the new index of every
+// vertex, numbered by first occurrence, with duplicates mapping to the same index as the first.
+// Returns the number of unique vertices. Large inputs are hashed and matched in parallel on the
+// thread pool if there is one.
+u32 weldVertices(std::span<const WeldStream> streams, u32 vertex_count, std::span<u32> remap,
+                 ThreadPool *thread_pool = nullptr);
+
+void remapIndices(std::span<u32> indices, std::span<const u32> remap);
+
+// Moves the vertices of a stream to where remap says. dst holds the referenced vertices only and
+// must not overlap src. Of vertices remapped to the same index, as welded ones are, the last
+// one is kept.
+template <typename T>
+void remapVertices(std::span<const T> src, std::span<const u32> remap, T *dst) {
+    for (size_t i = 0; i < src.size(); ++i) {
+        if (remap[i] != NotReferenced)
+            dst[remap[i]] = src[i];
+    }
+}
+
+} // namespace brtoy
@@ -0,0 +1,21 @@
+#pragma once
+#include <brtoy/vec.h>
+#include <cstddef>
+#include <span>
+
+namespace brtoy {
+
+// Simplifies a triangle list by edge collapses ordered by quadric error (Garland and Heckbert).
+// Every collapse moves a vertex onto a neighbour, so the result indexes the same vertices as the
+// input. Vertices on attribute seams, i.e. sharing their position with another vertex, and
+// vertices where the surface isn't manifold stay in place; border vertices only slide along the
+// border, and not where it turns sharply, so that its corners stay. Collapses stop at
+// target_index_count or before one would exceed target_error, a distance in mesh units.
+//
+// Writes the simplified indices to destination, which must hold as many as indices, and returns
+// their count. out_error gets the error of the result as a distance in mesh units.
+size_t simplifyMesh(std::span<u32> destination, std::span<const u32> indices,
+                    std::span<const V3f> positions, size_t target_index_count, float target_error,
+                    float *out_error = nullptr);
+
+} // namespace brtoy
@@ -0,0 +1,69 @@
+#pragma once
+#include <brtoy/brtoy.h>
+
+namespace brtoy {
+
+// Monotonic CPU clock, cpuTimestampFrequency() ticks per second. It is the clock of the host time
+// domain used for calibrated GPU timestamps, so GPU times can be placed on the same timeline.
+u64 cpuTimestamp();
+u64 cpuTimestampFrequency();
+
+// A track is a row of the trace. Track 0 is the thread recording the zone; other tracks carry
+// zones measured elsewhere, such as on the GPU.
+using TraceTrack = u32;
+static constexpr TraceTrack ThreadTrack = 0;
+
+#ifdef BRTOY_PROFILE
+
+// Zones are recorded while a trace is running. Every thread appends to its own buffer without
+// locking, and writeTrace() writes the zones recorded since beginTrace() as Chrome trace event
+// JSON, which also opens in Perfetto. beginTrace() sets buffers aside for the threads, which grow
+// from them while tracing and are kept until exit. Zone and track names must outlive the trace;
+// string literals are the intended use.
+void beginTrace();
+void endTrace();
+bool isTracing();
+bool writeTrace(const char *path);
+
+// Registers the calling thread with the trace, which allocates its buffer, so it is best called
+// while tracing only
+void setTraceThreadName(const char *name);
+TraceTrack createTraceTrack(const char *name);
+// begin and end are cpuTimestamp() values
+void recordTraceZone(TraceTrack track, const char *name, u64 begin, u64 end);
+
+struct CpuZone {
+    CpuZone(const char *name) : m_name(name), m_begin(isTracing() ? cpuTimestamp() : 0) {}
+    ~CpuZone() {
+        if (m_begin)
+            recordTraceZone(ThreadTrack, m_name, m_begin, cpuTimestamp());
+    }
+    CpuZone(const CpuZone &) = delete;
+    CpuZone &operator=(const CpuZone &) = delete;
+
+    const char *m_name;
+    u64 m_begin;
+};
+
+#define BRTOY_PROFILE_CONCAT_(a, b) a##b
+#define BRTOY_PROFILE_CONCAT(a, b) BRTOY_PROFILE_CONCAT_(a, b)
+#define BRTOY_PROFILE_ZONE(name)                                                                   \
+    ::brtoy::CpuZone BRTOY_PROFILE_CONCAT(brtoy_profile_zone_, __LINE__)(name)
+
+#else
+
+inline void beginTrace() {}
+inline void endTrace() {}
+inline bool isTracing() { return false; }
+inline bool writeTrace(const char *) { return false; }
+inline void setTraceThreadName(const char *) {}
+inline TraceTrack createTraceTrack(const char *) { return ThreadTrack; }
+inline void recordTraceZone(TraceTrack, const char *, u64, u64) {}
+
+#define BRTOY_PROFILE_ZONE(name)                                                                   \
+    do {                                                                                           \
+    } while (0)
+
+#endif
+
+} // namespace brtoy
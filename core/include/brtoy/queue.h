@@ -0,0 +1,261 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <brtoy/brtoy.h>
+#include <cstddef>
+#include <memory>
+
+namespace brtoy {
+
+// Fixed rather than std::hardware_destructive_interference_size, which compilers warn about in
+// headers since its value may differ between translation units
+inline constexpr size_t CacheLineSize = 64;
+
+// Bounded lock-free queue for one producer thread and one consumer thread. The capacity must be a
+// power of two. Slots are default constructed up front and reused by assignment, so T must be
+// default constructible. The producer's and the consumer's positions are on separate cache lines,
+// and each side caches the other's position so that it only reads the shared one when the cached
+// one says the queue is full or empty.
+template <typename T> struct SpscQueue {
+    SpscQueue(size_t capacity) : m_mask(capacity - 1), m_slots(std::make_unique<T[]>(capacity)) {
+        BRTOY_ASSERT(capacity > 0 && (capacity & (capacity - 1)) == 0);
+    }
+    SpscQueue(const SpscQueue &) = delete;
+    SpscQueue &operator=(const SpscQueue &) = delete;
+
+    size_t capacity() const { return m_mask + 1; }
+    // Exact when called by the producer or the consumer while the other side is idle
+    size_t sizeApprox() const {
+        size_t head = m_head.load(std::memory_order_acquire);
+        return m_tail.load(std::memory_order_acquire) - head;
+    }
+
+    // Producer only. Returns false if the queue is full.
+    template <typename U> bool push(U &&item) {
+        size_t tail = m_tail.load(std::memory_order_relaxed);
+        if (tail - m_cached_head == capacity()) {
+            m_cached_head = m_head.load(std::memory_order_acquire);
+            if (tail - m_cached_head == capacity())
+                return false;
+        }
+        m_slots[tail & m_mask] = std::forward<U>(item);
+        m_tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Producer only. Pushes up to count items, as many as fit, and returns how many were pushed.
+    // Pass a std::move_iterator to move the items.
+    template <typename InputIt> size_t pushBatch(InputIt first, size_t count) {
+        size_t tail = m_tail.load(std::memory_order_relaxed);
+        size_t free = capacity() - (tail - m_cached_head);
+        if (free < count) {
+            m_cached_head = m_head.load(std::memory_order_acquire);
+            free = capacity() - (tail - m_cached_head);
+        }
+        count = std::min(count, free);
+        for (size_t i = 0; i < count; ++i, ++first)
+            m_slots[(tail + i) & m_mask] = *first;
+        m_tail.store(tail + count, std::memory_order_release);
+        return count;
+    }
+
+    // Consumer only. Returns false if the queue is empty.
+    bool pop(T &out_item) {
+        size_t head = m_head.load(std::memory_order_relaxed);
+        if (head == m_cached_tail) {
+            m_cached_tail = m_tail.load(std::memory_order_acquire);
+            if (head == m_cached_tail)
+                return false;
+        }
+        out_item = std::move(m_slots[head & m_mask]);
+        m_head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer only. Pops up to count items and returns how many were popped.
+    template <typename OutputIt> size_t popBatch(OutputIt out, size_t count) {
+        size_t head = m_head.load(std::memory_order_relaxed);
+        size_t available = m_cached_tail - head;
+        if (available < count) {
+            m_cached_tail = m_tail.load(std::memory_order_acquire);
+            available = m_cached_tail - head;
+        }
+        count = std::min(count, available);
+        for (size_t i = 0; i < count; ++i, ++out)
+            *out = std::move(m_slots[(head + i) & m_mask]);
+        m_head.store(head + count, std::memory_order_release);
+        return count;
+    }
+
+    // Positions count pushes and pops since construction and wrap around with size_t
+    alignas(CacheLineSize) std::atomic<size_t> m_tail = 0;
+    size_t m_cached_head = 0;
+    alignas(CacheLineSize) std::atomic<size_t> m_head = 0;
+    size_t m_cached_tail = 0;
+    alignas(CacheLineSize) const size_t m_mask;
+    std::unique_ptr<T[]> m_slots;
+};
+
+// Bounded lock-free queue for any number of producers and consumers, after Dmitry Vyukov's
+// bounded MPMC queue. The capacity must be a power of two and T default constructible. Every
+// cell carries a sequence number that tells whether it is ready to be written or read in the
+// current lap, so producers and consumers only contend on their own position. The batch
+// operations claim a run of ready cells with a single compare-and-swap.
+template <typename T> struct MpmcQueue {
+    MpmcQueue(size_t capacity) : m_mask(capacity - 1), m_cells(std::make_unique<Cell[]>(capacity)) {
+        BRTOY_ASSERT(capacity > 0 && (capacity & (capacity - 1)) == 0);
+        for (size_t i = 0; i < capacity; ++i)
+            m_cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+    MpmcQueue(const MpmcQueue &) = delete;
+    MpmcQueue &operator=(const MpmcQueue &) = delete;
+
+    size_t capacity() const { return m_mask + 1; }
+
+    // Returns false if the queue is full
+    template <typename U> bool push(U &&item) {
+        size_t pos = claim(m_enqueue_pos, 0);
+        if (pos == NoPosition)
+            return false;
+        Cell &cell = m_cells[pos & m_mask];
+        cell.item = std::forward<U>(item);
+        cell.sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Pushes up to count items, as many as there are consecutive free cells, and returns how many
+    // were pushed. Pass a std::move_iterator to move the items.
+    template <typename InputIt> size_t pushBatch(InputIt first, size_t count) {
+        size_t claimed = count;
+        size_t pos = claimBatch(m_enqueue_pos, 0, claimed);
+        for (size_t i = 0; i < claimed; ++i, ++first) {
+            Cell &cell = m_cells[(pos + i) & m_mask];
+            cell.item = *first;
+            cell.sequence.store(pos + i + 1, std::memory_order_release);
+        }
+        return claimed;
+    }
+
+    // Returns false if the queue is empty
+    bool pop(T &out_item) {
+        size_t pos = claim(m_dequeue_pos, 1);
+        if (pos == NoPosition)
+            return false;
+        Cell &cell = m_cells[pos & m_mask];
+        out_item = std::move(cell.item);
+        cell.sequence.store(pos + m_mask + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Pops up to count items, as many as there are consecutive full cells, and returns how many
+    // were popped
+    template <typename OutputIt> size_t popBatch(OutputIt out, size_t count) {
+        size_t claimed = count;
+        size_t pos = claimBatch(m_dequeue_pos, 1, claimed);
+        for (size_t i = 0; i < claimed; ++i, ++out) {
+            Cell &cell = m_cells[(pos + i) & m_mask];
+            *out = std::move(cell.item);
+            cell.sequence.store(pos + i + m_mask + 1, std::memory_order_release);
+        }
+        return claimed;
+    }
+
+    static constexpr size_t NoPosition = ~size_t(0);
+
+    struct Cell {
+        std::atomic<size_t> sequence;
+        T item;
+    };
+
+    // A cell at position pos is ready for a producer when its sequence is pos and for a consumer
+    // when it is pos + 1. Returns the claimed position, or NoPosition if the cell isn't ready.
+    size_t claim(std::atomic<size_t> &position, size_t ready_offset) {
+        size_t pos = position.load(std::memory_order_relaxed);
+        while (true) {
+            size_t sequence = m_cells[pos & m_mask].sequence.load(std::memory_order_acquire);
+            ptrdiff_t diff = ptrdiff_t(sequence - (pos + ready_offset));
+            if (diff == 0) {
+                if (position.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    return pos;
+            } else if (diff < 0) {
+                return NoPosition;
+            } else {
+                pos = position.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // Claims the longest run of up to count ready cells and sets count to its length
+    size_t claimBatch(std::atomic<size_t> &position, size_t ready_offset, size_t &count) {
+        size_t pos = position.load(std::memory_order_relaxed);
+        while (true) {
+            size_t ready = 0;
+            size_t max_count = std::min(count, capacity());
+            while (ready < max_count) {
+                size_t cell_pos = pos + ready;
+                size_t sequence =
+                    m_cells[cell_pos & m_mask].sequence.load(std::memory_order_acquire);
+                ptrdiff_t diff = ptrdiff_t(sequence - (cell_pos + ready_offset));
+                if (diff != 0) {
+                    // Another thread got ahead of pos, start over from the new position
+                    if (diff > 0 && ready == 0)
+                        ready = NoPosition;
+                    break;
+                }
+                ++ready;
+            }
+            if (ready == NoPosition) {
+                pos = position.load(std::memory_order_relaxed);
+                continue;
+            }
+            if (ready == 0) {
+                count = 0;
+                return pos;
+            }
+            if (position.compare_exchange_weak(pos, pos + ready, std::memory_order_relaxed)) {
+                count = ready;
+                return pos;
+            }
+        }
+    }
+
+    alignas(CacheLineSize) std::atomic<size_t> m_enqueue_pos = 0;
+    alignas(CacheLineSize) std::atomic<size_t> m_dequeue_pos = 0;
+    alignas(CacheLineSize) const size_t m_mask;
+    std::unique_ptr<Cell[]> m_cells;
+};
+
+// Hands the latest of a stream of values from one writer thread to one reader thread without
+// locking or copying. The writer fills back() and publishes it, which swaps it with the middle
+// slot; the reader's acquire() swaps the middle slot with front() if a newer value is there.
+// Values the reader didn't get to before the next publish are dropped, so the writer either
+// publishes complete states or paces itself on the reader.
+template <typename T> struct TripleBuffer {
+    static constexpr u32 FreshBit = 4;
+
+    // Writer only
+    T &back() { return m_slots[m_back]; }
+    void publish() {
+        u32 middle = m_middle.exchange(m_back | FreshBit, std::memory_order_acq_rel);
+        m_back = middle & ~FreshBit;
+    }
+
+    // Reader only. Returns false, keeping the front slot, if nothing was published since the last
+    // acquire.
+    bool acquire() {
+        if (!(m_middle.load(std::memory_order_relaxed) & FreshBit))
+            return false;
+        u32 middle = m_middle.exchange(m_front, std::memory_order_acq_rel);
+        m_front = middle & ~FreshBit;
+        return true;
+    }
+    const T &front() const { return m_slots[m_front]; }
+
+    std::array<T, 3> m_slots = {};
+    alignas(CacheLineSize) u32 m_back = 0;
+    alignas(CacheLineSize) std::atomic<u32> m_middle = 1;
+    alignas(CacheLineSize) u32 m_front = 2;
+};
+
+} // namespace brtoy
@@ -0,0 +1,65 @@
+#pragma once
+#include <brtoy/brtoy.h>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace brtoy {
+
+// Fixed set of worker threads running jobs in submission order. The destructor finishes all
+// queued jobs before joining the workers.
+struct ThreadPool {
+    // A thread count of 0 uses one thread per hardware thread.
+    ThreadPool(u32 thread_count = 0);
+    ~ThreadPool();
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    template <typename F> std::future<std::invoke_result_t<F>> submit(F &&f) {
+        using Result = std::invoke_result_t<F>;
+        // std::function needs a copyable target, so the task is kept in a shared_ptr
+        auto task = std::make_shared<std::packaged_task<Result()>>(std::forward<F>(f));
+        std::future<Result> future = task->get_future();
+        enqueue([task]() { (*task)(); });
+        return future;
+    }
+
+    void enqueue(std::function<void()> job);
+    u32 threadCount() const;
+
+    void workerMain();
+
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::deque<std::function<void()>> m_jobs;
+    std::vector<std::thread> m_threads;
+    bool m_stopping = false;
+};
+
+// Runs body(begin, end) over [0, count) in one chunk per thread of the pool, or in one chunk on
+// the calling thread without a pool. Waits for the chunks, so it must not be called from a job of
+// the same pool.
+template <typename F> void parallelFor(ThreadPool *thread_pool, size_t count, F &&body) {
+    u32 chunk_count = thread_pool ? thread_pool->threadCount() : 1;
+    if (chunk_count <= 1) {
+        body(size_t(0), count);
+        return;
+    }
+    std::vector<std::future<void>> chunks;
+    chunks.reserve(chunk_count);
+    for (u32 chunk = 0; chunk < chunk_count; ++chunk) {
+        size_t begin = count * chunk / chunk_count;
+        size_t end = count * (chunk + 1) / chunk_count;
+        chunks.push_back(thread_pool->submit([&body, begin, end]() { body(begin, end); }));
+    }
+    for (std::future<void> &chunk : chunks)
+        chunk.get();
+}
+
+} // namespace brtoy
@@ -0,0 +1,40 @@
+#pragma once
+#include <brtoy/vec.h>
+#include <cstddef>
+
+namespace brtoy {
+
+struct Aabb {
+    V3f min;
+    V3f max;
+};
+
+Aabb computeBounds(const V3f *positions, size_t count);
+
+// Position quantized to 16 bits per axis relative to the mesh's bounds. Padded to 8 bytes so that
+// a shader fetches it with a single aligned load.
+struct PackedPosition {
+    u16 x, y, z, pad;
+};
+
+// Unit vectors in octahedral encoding, snorm per component
+struct OctNormal16 {
+    i16 x, y;
+};
+
+struct OctNormal8 {
+    i8 x, y;
+};
+
+// The encoders process four vertices at a time with SSE2 where it's available. Positions outside
+// the bounds are clamped to them. Normals need not be normalized, zero vectors encode +Z.
+void encodePositions(const V3f *positions, size_t count, const Aabb &bounds, PackedPosition *out);
+void encodeNormals(const V3f *normals, size_t count, OctNormal16 *out);
+void encodeNormals(const V3f *normals, size_t count, OctNormal8 *out);
+
+// Same as the shaders' decoding, for tools and for checking the encoders
+V3f decodePosition(PackedPosition position, const Aabb &bounds);
+V3f decodeNormal(OctNormal16 normal);
+V3f decodeNormal(OctNormal8 normal);
+
+} // namespace brtoy
@@ -0,0 +1,392 @@
+#include <algorithm>
+#include <brtoy/mesh_optimizer.h>
+#include <brtoy/thread_pool.h>
+#include <cmath>
+#include <cstring>
+#include <future>
+#include <vector>
+
+namespace brtoy {
+
+namespace {
+
+// FIFO cache by timestamps: a vertex is cached if it missed within the last size misses
+struct FifoCacheSim {
+    FifoCacheSim(u32 vertex_count, u32 size) : m_timestamps(vertex_count, 0), m_size(size) {}
+
+    // Returns true on a miss
+    bool access(u32 vertex) {
+        if (m_time - m_timestamps[vertex] < m_size)
+            return false;
+        m_timestamps[vertex] = m_time++;
+        return true;
+    }
+
+    void clear() { m_time += m_size + 1; }
+
+    std::vector<u32> m_timestamps;
+    u32 m_size;
+    // Starts past the cache size so that zeroed timestamps read as evicted
+    u32 m_time = m_size + 1;
+};
+
+// Forsyth's scoring, see "Linear-Speed Vertex Cache Optimisation"
+constexpr u32 ForsythCacheSize = 32;
+constexpr float CacheDecayPower = 1.5f;
+constexpr float LastTriangleScore = 0.75f;
+constexpr float ValenceBoostScale = 2.0f;
+constexpr float ValenceBoostPower = 0.5f;
+
+float forsythScore(i32 cache_position, u32 live_triangles) {
+    if (live_triangles == 0)
+        return -1.0f;
+    float score = 0.0f;
+    if (cache_position >= 0) {
+        if (cache_position < 3) {
+            score = LastTriangleScore;
+        } else {
+            float t = 1.0f - float(cache_position - 3) / float(ForsythCacheSize - 3);
+            score = std::pow(t, CacheDecayPower);
+        }
+    }
+    return score + ValenceBoostScale * std::pow(float(live_triangles), -ValenceBoostPower);
+}
+
+constexpr u32 NoTriangle = ~0u;
+
+// Below this, welding isn't worth handing to the thread pool
+constexpr u32 ParallelWeldVertexCountMin = 64 * 1024;
+
+// Welding key of a component: its bits, or its grid cell with an epsilon. Negative zero is made
+// positive so that it matches zero.
+i64 weldKey(float value, float epsilon) {
+    if (epsilon > 0.0f)
+        return std::llround(value / epsilon);
+    value += 0.0f;
+    u32 bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+u64 hashWeldKeys(std::span<const WeldStream> streams, u32 vertex) {
+    // FNV-1a over the keys, with a final mix so that the top bits pick the shard
+    u64 hash = 14695981039346656037ull;
+    for (const WeldStream &stream : streams) {
+        const float *components = stream.data + size_t(stream.stride) * vertex;
+        for (u32 c = 0; c < stream.components; ++c) {
+            hash ^= u64(weldKey(components[c], stream.epsilon));
+            hash *= 1099511628211ull;
+        }
+    }
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdull;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+bool weldKeysEqual(std::span<const WeldStream> streams, u32 a, u32 b) {
+    for (const WeldStream &stream : streams) {
+        const float *components_a = stream.data + size_t(stream.stride) * a;
+        const float *components_b = stream.data + size_t(stream.stride) * b;
+        for (u32 c = 0; c < stream.components; ++c) {
+            if (weldKey(components_a[c], stream.epsilon) !=
+                weldKey(components_b[c], stream.epsilon))
+                return false;
+        }
+    }
+    return true;
+}
+
+} // namespace
+
+VertexCacheStats analyzeVertexCache(std::span<const u32> indices, u32 vertex_count,
+                                    u32 cache_size) {
+    FifoCacheSim cache(vertex_count, cache_size);
+    std::vector<bool> referenced(vertex_count, false);
+    u32 referenced_count = 0;
+    u32 misses = 0;
+    for (u32 index : indices) {
+        misses += cache.access(index);
+        if (!referenced[index]) {
+            referenced[index] = true;
+            ++referenced_count;
+        }
+    }
+    size_t triangle_count = indices.size() / 3;
+    return {
+        .transformed_vertices = misses,
+        .acmr = triangle_count ? float(misses) / triangle_count : 0.0f,
+        .atvr = referenced_count ? float(misses) / referenced_count : 0.0f,
+    };
+}
+
+void optimizeVertexCache(std::span<u32> indices, u32 vertex_count) {
+    size_t triangle_count = indices.size() / 3;
+    if (triangle_count == 0)
+        return;
+
+    // Triangles using each vertex that haven't been emitted, in the first live_triangles entries
+    std::vector<u32> adjacency_offsets(vertex_count + 1, 0);
+    for (u32 index : indices)
+        ++adjacency_offsets[index + 1];
+    for (u32 v = 0; v < vertex_count; ++v)
+        adjacency_offsets[v + 1] += adjacency_offsets[v];
+    std::vector<u32> live_triangles(vertex_count, 0);
+    std::vector<u32> adjacency(indices.size());
+    for (size_t i = 0; i < indices.size(); ++i) {
+        u32 v = indices[i];
+        adjacency[adjacency_offsets[v] + live_triangles[v]++] = u32(i / 3);
+    }
+
+    std::vector<i32> cache_positions(vertex_count, -1);
+    std::vector<float> vertex_scores(vertex_count);
+    for (u32 v = 0; v < vertex_count; ++v)
+        vertex_scores[v] = forsythScore(-1, live_triangles[v]);
+    std::vector<bool> emitted(triangle_count, false);
+    u32 best_triangle = 0;
+    float best_score = -1.0f;
+    for (size_t t = 0; t < triangle_count; ++t) {
+        const u32 *tri = &indices[t * 3];
+        float score = vertex_scores[tri[0]] + vertex_scores[tri[1]] + vertex_scores[tri[2]];
+        if (score > best_score) {
+            best_score = score;
+            best_triangle = u32(t);
+        }
+    }
+
+    std::vector<u32> output(indices.size());
+    std::vector<u32> cache;
+    std::vector<u32> next_cache;
+    cache.reserve(ForsythCacheSize + 3);
+    next_cache.reserve(ForsythCacheSize + 3);
+    // Where to look for a triangle when none of the cached vertices has any left
+    size_t dead_end_cursor = 0;
+    for (size_t out = 0; out < triangle_count; ++out) {
+        if (best_triangle == NoTriangle) {
+            while (emitted[dead_end_cursor])
+                ++dead_end_cursor;
+            best_triangle = u32(dead_end_cursor);
+        }
+        const u32 *tri = &indices[best_triangle * 3];
+        std::copy(tri, tri + 3, &output[out * 3]);
+        emitted[best_triangle] = true;
+
+        next_cache.clear();
+        for (int corner = 0; corner < 3; ++corner) {
+            u32 v = tri[corner];
+            u32 *first = &adjacency[adjacency_offsets[v]];
+            u32 *last = first + live_triangles[v];
+            *std::find(first, last, best_triangle) = *(last - 1);
+            --live_triangles[v];
+            if (std::find(next_cache.begin(), next_cache.end(), v) == next_cache.end())
+                next_cache.push_back(v);
+        }
+        for (u32 v : cache) {
+            if (std::find(next_cache.begin(), next_cache.end(), v) == next_cache.end())
+                next_cache.push_back(v);
+        }
+        // The vertices pushed past the end are rescored as evicted and dropped
+        for (size_t i = 0; i < next_cache.size(); ++i) {
+            u32 v = next_cache[i];
+            cache_positions[v] = i < ForsythCacheSize ? i32(i) : -1;
+            vertex_scores[v] = forsythScore(cache_positions[v], live_triangles[v]);
+        }
+
+        best_triangle = NoTriangle;
+        best_score = -1.0f;
+        for (u32 v : next_cache) {
+            for (u32 i = 0; i < live_triangles[v]; ++i) {
+                u32 t = adjacency[adjacency_offsets[v] + i];
+                const u32 *adjacent = &indices[t * 3];
+                float score = vertex_scores[adjacent[0]] + vertex_scores[adjacent[1]] +
+                              vertex_scores[adjacent[2]];
+                if (score > best_score) {
+                    best_score = score;
+                    best_triangle = t;
+                }
+            }
+        }
+        next_cache.resize(std::min<size_t>(next_cache.size(), ForsythCacheSize));
+        std::swap(cache, next_cache);
+    }
+    std::copy(output.begin(), output.end(), indices.begin());
+}
+
+void optimizeOverdraw(std::span<u32> indices, std::span<const V3f> positions, float threshold) {
+    size_t triangle_count = indices.size() / 3;
+    if (triangle_count == 0)
+        return;
+    u32 vertex_count = u32(positions.size());
+    constexpr u32 CacheSize = 16;
+
+    // Hard boundaries are triangles that miss on all three vertices
+    std::vector<u32> hard_clusters;
+    FifoCacheSim cache(vertex_count, CacheSize);
+    for (size_t t = 0; t < triangle_count; ++t) {
+        const u32 *tri = &indices[t * 3];
+        u32 misses = cache.access(tri[0]) + cache.access(tri[1]) + cache.access(tri[2]);
+        if (t == 0 || misses == 3)
+            hard_clusters.push_back(u32(t));
+    }
+    hard_clusters.push_back(u32(triangle_count));
+
+    // Soft boundaries split the hard clusters wherever the part so far, from a cold cache, is
+    // within threshold of the whole cluster's ACMR
+    std::vector<u32> clusters;
+    for (size_t c = 0; c + 1 < hard_clusters.size(); ++c) {
+        u32 begin = hard_clusters[c];
+        u32 end = hard_clusters[c + 1];
+        cache.clear();
+        u32 cluster_misses = 0;
+        for (u32 t = begin; t < end; ++t) {
+            const u32 *tri = &indices[t * 3];
+            cluster_misses += cache.access(tri[0]) + cache.access(tri[1]) + cache.access(tri[2]);
+        }
+        float cluster_acmr = float(cluster_misses) / float(end - begin);
+
+        cache.clear();
+        u32 misses = 0;
+        u32 part_begin = begin;
+        clusters.push_back(begin);
+        for (u32 t = begin; t < end; ++t) {
+            const u32 *tri = &indices[t * 3];
+            misses += cache.access(tri[0]) + cache.access(tri[1]) + cache.access(tri[2]);
+            float part_acmr = float(misses) / float(t + 1 - part_begin);
+            if (t + 1 < end && part_acmr <= cluster_acmr * threshold) {
+                part_begin = t + 1;
+                clusters.push_back(part_begin);
+                misses = 0;
+                cache.clear();
+            }
+        }
+    }
+    clusters.push_back(u32(triangle_count));
+
+    // Sort key of a cluster is how far its area weighted centroid lies in front of the mesh
+    // centroid along its average normal
+    size_t cluster_count = clusters.size() - 1;
+    std::vector<V3f> centroids(cluster_count, V3f{0.0f, 0.0f, 0.0f});
+    std::vector<V3f> normals(cluster_count, V3f{0.0f, 0.0f, 0.0f});
+    V3f mesh_centroid = {0.0f, 0.0f, 0.0f};
+    float mesh_area = 0.0f;
+    for (size_t c = 0; c < cluster_count; ++c) {
+        float cluster_area = 0.0f;
+        for (u32 t = clusters[c]; t < clusters[c + 1]; ++t) {
+            const V3f &p0 = positions[indices[t * 3 + 0]];
+            const V3f &p1 = positions[indices[t * 3 + 1]];
+            const V3f &p2 = positions[indices[t * 3 + 2]];
+            // Twice the area in length
+            V3f normal = cross(p1 - p0, p2 - p0);
+            float area = length(normal);
+            centroids[c] += (p0 + p1 + p2) * area;
+            normals[c] += normal;
+            cluster_area += area;
+        }
+        mesh_centroid += centroids[c];
+        mesh_area += cluster_area;
+        centroids[c] = cluster_area > 0.0f ? centroids[c] / (3.0f * cluster_area)
+                                           : positions[indices[clusters[c] * 3]];
+    }
+    mesh_centroid = mesh_area > 0.0f ? mesh_centroid / (3.0f * mesh_area) : mesh_centroid;
+
+    std::vector<float> keys(cluster_count);
+    std::vector<u32> order(cluster_count);
+    for (size_t c = 0; c < cluster_count; ++c) {
+        float normal_length = length(normals[c]);
+        V3f normal = normal_length > 0.0f ? normals[c] / normal_length : normals[c];
+        keys[c] = dot(centroids[c] - mesh_centroid, normal);
+        order[c] = u32(c);
+    }
+    std::stable_sort(order.begin(), order.end(),
+                     [&](u32 a, u32 b) { return keys[a] > keys[b]; });
+
+    std::vector<u32> output;
+    output.reserve(indices.size());
+    for (u32 c : order)
+        output.insert(output.end(), &indices[clusters[c] * 3], &indices[clusters[c + 1] * 3]);
+    std::copy(output.begin(), output.end(), indices.begin());
+}
+
+u32 optimizeVertexFetch(std::span<u32> indices, u32 vertex_count, std::span<u32> remap) {
+    BRTOY_ASSERT(remap.size() >= vertex_count);
+    std::fill_n(remap.begin(), vertex_count, NotReferenced);
+    u32 next = 0;
+    for (u32 &index : indices) {
+        if (remap[index] == NotReferenced)
+            remap[index] = next++;
+        index = remap[index];
+    }
+    return next;
+}
+
+u32 weldVertices(std::span<const WeldStream> streams, u32 vertex_count, std::span<u32> remap,
+                 ThreadPool *thread_pool) {
+    BRTOY_ASSERT(remap.size() >= vertex_count);
+    if (vertex_count < ParallelWeldVertexCountMin)
+        thread_pool = nullptr;
+
+    std::vector<u64> hashes(vertex_count);
+    parallelFor(thread_pool, vertex_count, [&](size_t begin, size_t end) {
+        for (size_t v = begin; v < end; ++v)
+            hashes[v] = hashWeldKeys(streams, u32(v));
+    });
+
+    // Equal vertices have equal hashes, so the top bits split the vertices into shards that are
+    // matched independently. A shard lists its vertices in order, so the first of a set of
+    // duplicates is the one found in the table.
+    u32 shard_bits = 0;
+    if (thread_pool) {
+        while ((1u << shard_bits) < thread_pool->threadCount() * 4)
+            ++shard_bits;
+    }
+    u32 shard_count = 1u << shard_bits;
+    auto shardOf = [&](u64 hash) { return shard_bits ? u32(hash >> (64 - shard_bits)) : 0u; };
+    std::vector<u32> shard_offsets(shard_count + 1, 0);
+    for (u64 hash : hashes)
+        ++shard_offsets[shardOf(hash) + 1];
+    for (u32 shard = 0; shard < shard_count; ++shard)
+        shard_offsets[shard + 1] += shard_offsets[shard];
+    std::vector<u32> shard_vertices(vertex_count);
+    {
+        std::vector<u32> cursors(shard_offsets.begin(), shard_offsets.end() - 1);
+        for (u32 v = 0; v < vertex_count; ++v)
+            shard_vertices[cursors[shardOf(hashes[v])]++] = v;
+    }
+
+    // First duplicate of every vertex, found with an open addressing table per shard
+    std::vector<u32> firsts(vertex_count);
+    parallelFor(thread_pool, shard_count, [&](size_t shard_begin, size_t shard_end) {
+        std::vector<u32> table;
+        for (size_t shard = shard_begin; shard < shard_end; ++shard) {
+            u32 begin = shard_offsets[shard];
+            u32 end = shard_offsets[shard + 1];
+            size_t table_size = 16;
+            while (table_size < size_t(end - begin) * 2)
+                table_size *= 2;
+            table.assign(table_size, NotReferenced);
+            for (u32 i = begin; i < end; ++i) {
+                u32 v = shard_vertices[i];
+                size_t slot = hashes[v] & (table_size - 1);
+                while (table[slot] != NotReferenced &&
+                       (hashes[table[slot]] != hashes[v] ||
+                        !weldKeysEqual(streams, table[slot], v)))
+                    slot = (slot + 1) & (table_size - 1);
+                if (table[slot] == NotReferenced)
+                    table[slot] = v;
+                firsts[v] = table[slot];
+            }
+        }
+    });
+
+    u32 unique_count = 0;
+    for (u32 v = 0; v < vertex_count; ++v)
+        remap[v] = firsts[v] == v ? unique_count++ : remap[firsts[v]];
+    return unique_count;
+}
+
+void remapIndices(std::span<u32> indices, std::span<const u32> remap) {
+    for (u32 &index : indices)
+        index = remap[index];
+}
+
+} // namespace brtoy
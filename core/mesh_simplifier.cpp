@@ -0,0 +1,354 @@
+#include <algorithm>
+#include <brtoy/mesh_optimizer.h>
+#include <brtoy/mesh_simplifier.h>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+namespace brtoy {
+
+namespace {
+
+// Sum of weighted squared distances to a set of planes, Q(p) = p'Ap + 2b'p + c. Dividing by the
+// summed weight gives a mean squared distance, independent of how finely the mesh is tessellated.
+struct Quadric {
+    double a00, a01, a02, a11, a12, a22;
+    double b0, b1, b2;
+    double c;
+    double weight;
+};
+
+Quadric &operator+=(Quadric &q, const Quadric &r) {
+    q.a00 += r.a00;
+    q.a01 += r.a01;
+    q.a02 += r.a02;
+    q.a11 += r.a11;
+    q.a12 += r.a12;
+    q.a22 += r.a22;
+    q.b0 += r.b0;
+    q.b1 += r.b1;
+    q.b2 += r.b2;
+    q.c += r.c;
+    q.weight += r.weight;
+    return q;
+}
+
+Quadric operator+(Quadric q, const Quadric &r) { return q += r; }
+
+// Plane through point with unit normal n
+void addPlane(Quadric &q, const V3f &n, const V3f &point, double weight) {
+    double x = n.x, y = n.y, z = n.z;
+    double d = -dot(n, point);
+    q.a00 += weight * x * x;
+    q.a01 += weight * x * y;
+    q.a02 += weight * x * z;
+    q.a11 += weight * y * y;
+    q.a12 += weight * y * z;
+    q.a22 += weight * z * z;
+    q.b0 += weight * d * x;
+    q.b1 += weight * d * y;
+    q.b2 += weight * d * z;
+    q.c += weight * d * d;
+    q.weight += weight;
+}
+
+double meanSquaredDistance(const Quadric &q, const V3f &p) {
+    if (q.weight <= 0.0)
+        return 0.0;
+    double x = p.x, y = p.y, z = p.z;
+    double ax = q.a00 * x + q.a01 * y + q.a02 * z;
+    double ay = q.a01 * x + q.a11 * y + q.a12 * z;
+    double az = q.a02 * x + q.a12 * y + q.a22 * z;
+    double e = x * ax + y * ay + z * az + 2.0 * (q.b0 * x + q.b1 * y + q.b2 * z) + q.c;
+    return std::max(e / q.weight, 0.0);
+}
+
+enum class VertexKind : u8 {
+    // Interior of a manifold surface, may collapse onto any neighbour
+    Manifold,
+    // On a single open border, away from its corners, may only collapse along it
+    Border,
+    // Attribute seam or non-manifold, never moves
+    Locked,
+};
+
+// Border planes are perpendicular to the surface, weighted up so that borders keep their shape
+// while the interior is simplified
+constexpr double BorderWeight = 10.0;
+
+// Border vertices where the border turns by more than 30 degrees are corners of the outline and
+// stay in place
+constexpr float BorderCornerCos = 0.866f;
+
+constexpr double DeferredCostScale = 1.5;
+
+constexpr u32 NoVertex = ~0u;
+
+u64 edgeKey(u32 a, u32 b) { return u64(a) << 32 | b; }
+
+bool hasEdge(const std::vector<u64> &sorted_edges, u32 a, u32 b) {
+    return std::binary_search(sorted_edges.begin(), sorted_edges.end(), edgeKey(a, b));
+}
+
+V3f triangleNormal(const V3f &p0, const V3f &p1, const V3f &p2) {
+    return cross(p1 - p0, p2 - p0);
+}
+
+} // namespace
+
+size_t simplifyMesh(std::span<u32> destination, std::span<const u32> indices,
+                    std::span<const V3f> positions, size_t target_index_count, float target_error,
+                    float *out_error) {
+    BRTOY_ASSERT(indices.size() % 3 == 0);
+    BRTOY_ASSERT(destination.size() >= indices.size());
+    if (indices.empty()) {
+        if (out_error)
+            *out_error = 0.0f;
+        return 0;
+    }
+    u32 vertex_count = (u32)positions.size();
+
+    // Topology is tracked per position so that seams don't read as borders
+    std::vector<u32> position_ids(vertex_count);
+    WeldStream position_stream = {.data = &positions[0].x, .stride = 3, .components = 3};
+    u32 position_count = weldVertices({&position_stream, 1}, vertex_count, position_ids);
+
+    size_t index_count = 0;
+    for (size_t i = 0; i < indices.size(); i += 3) {
+        u32 a = position_ids[indices[i]];
+        u32 b = position_ids[indices[i + 1]];
+        u32 c = position_ids[indices[i + 2]];
+        if (a == b || b == c || c == a)
+            continue;
+        std::copy_n(&indices[i], 3, &destination[index_count]);
+        index_count += 3;
+    }
+
+    std::vector<u64> edges;
+    edges.reserve(index_count);
+    for (size_t i = 0; i < index_count; i += 3) {
+        for (size_t k = 0; k < 3; ++k) {
+            edges.push_back(edgeKey(position_ids[destination[i + k]],
+                                    position_ids[destination[i + (k + 1) % 3]]));
+        }
+    }
+    std::sort(edges.begin(), edges.end());
+
+    std::vector<VertexKind> kinds(position_count, VertexKind::Manifold);
+    std::vector<u32> border_edge_counts(position_count, 0);
+    // The neighbours along the border, by position
+    std::vector<u32> border_next(position_count, NoVertex);
+    std::vector<u32> border_prev(position_count, NoVertex);
+    std::vector<u32> position_vertices(position_count);
+    {
+        std::vector<u32> vertices_per_position(position_count, 0);
+        for (u32 v = 0; v < vertex_count; ++v) {
+            ++vertices_per_position[position_ids[v]];
+            position_vertices[position_ids[v]] = v;
+        }
+        for (u32 p = 0; p < position_count; ++p) {
+            if (vertices_per_position[p] > 1)
+                kinds[p] = VertexKind::Locked;
+        }
+    }
+    for (size_t i = 0; i < edges.size(); ++i) {
+        u32 a = u32(edges[i] >> 32);
+        u32 b = u32(edges[i]);
+        if (i + 1 < edges.size() && edges[i + 1] == edges[i]) {
+            kinds[a] = kinds[b] = VertexKind::Locked;
+        } else if (!hasEdge(edges, b, a)) {
+            ++border_edge_counts[a];
+            ++border_edge_counts[b];
+            border_next[a] = b;
+            border_prev[b] = a;
+        }
+    }
+    for (u32 p = 0; p < position_count; ++p) {
+        if (border_edge_counts[p] == 0 || kinds[p] == VertexKind::Locked)
+            continue;
+        kinds[p] = VertexKind::Locked;
+        if (border_edge_counts[p] != 2 || border_next[p] == NoVertex ||
+            border_prev[p] == NoVertex)
+            continue;
+        const V3f &prev = positions[position_vertices[border_prev[p]]];
+        const V3f &point = positions[position_vertices[p]];
+        const V3f &next = positions[position_vertices[border_next[p]]];
+        if (dot(normalize(point - prev), normalize(next - point)) >= BorderCornerCos)
+            kinds[p] = VertexKind::Border;
+    }
+
+    std::vector<Quadric> quadrics(vertex_count, Quadric{});
+    for (size_t i = 0; i < index_count; i += 3) {
+        const u32 *tri = &destination[i];
+        V3f normal = triangleNormal(positions[tri[0]], positions[tri[1]], positions[tri[2]]);
+        float double_area = length(normal);
+        if (double_area == 0.0f)
+            continue;
+        normal /= double_area;
+        for (size_t k = 0; k < 3; ++k)
+            addPlane(quadrics[tri[k]], normal, positions[tri[0]], 0.5 * double_area);
+
+        for (size_t k = 0; k < 3; ++k) {
+            u32 a = tri[k];
+            u32 b = tri[(k + 1) % 3];
+            if (hasEdge(edges, position_ids[b], position_ids[a]))
+                continue;
+            V3f edge = positions[b] - positions[a];
+            float edge_length = length(edge);
+            if (edge_length == 0.0f)
+                continue;
+            V3f border_normal = normalize(cross(edge, normal));
+            double weight = BorderWeight * edge_length * edge_length;
+            addPlane(quadrics[a], border_normal, positions[a], weight);
+            addPlane(quadrics[b], border_normal, positions[a], weight);
+        }
+    }
+
+    auto can_collapse = [&](u32 from, u32 to) {
+        u32 from_position = position_ids[from];
+        u32 to_position = position_ids[to];
+        switch (kinds[from_position]) {
+        case VertexKind::Manifold:
+            return true;
+        case VertexKind::Border:
+            return kinds[to_position] != VertexKind::Manifold &&
+                   (!hasEdge(edges, from_position, to_position) ||
+                    !hasEdge(edges, to_position, from_position));
+        case VertexKind::Locked:
+            return false;
+        }
+        return false;
+    };
+
+    double error_limit = double(target_error) * double(target_error);
+    double result_error = 0.0;
+    std::vector<u32> collapse_targets(vertex_count);
+    std::vector<double> collapse_costs(vertex_count);
+    std::vector<u32> collapse_order;
+    std::vector<u32> triangle_offsets(vertex_count + 1);
+    std::vector<u32> vertex_triangles;
+    std::vector<u32> remap(vertex_count);
+    std::vector<bool> pass_locked(position_count);
+
+    while (index_count > target_index_count) {
+        // The cheapest collapse per vertex
+        std::fill(collapse_targets.begin(), collapse_targets.end(), NoVertex);
+        std::fill(collapse_costs.begin(), collapse_costs.end(),
+                  std::numeric_limits<double>::infinity());
+        for (size_t i = 0; i < index_count; ++i) {
+            u32 a = destination[i];
+            u32 b = destination[i - i % 3 + (i % 3 + 1) % 3];
+            for (auto [from, to] : {std::pair{a, b}, std::pair{b, a}}) {
+                if (!can_collapse(from, to))
+                    continue;
+                double cost = meanSquaredDistance(quadrics[from] + quadrics[to], positions[to]);
+                if (cost < collapse_costs[from]) {
+                    collapse_costs[from] = cost;
+                    collapse_targets[from] = to;
+                }
+            }
+        }
+        collapse_order.clear();
+        for (u32 v = 0; v < vertex_count; ++v) {
+            if (collapse_targets[v] != NoVertex && collapse_costs[v] <= error_limit)
+                collapse_order.push_back(v);
+        }
+        std::sort(collapse_order.begin(), collapse_order.end(),
+                  [&](u32 a, u32 b) { return collapse_costs[a] < collapse_costs[b]; });
+
+        std::fill(triangle_offsets.begin(), triangle_offsets.end(), 0);
+        for (size_t i = 0; i < index_count; ++i)
+            ++triangle_offsets[destination[i] + 1];
+        for (u32 v = 0; v < vertex_count; ++v)
+            triangle_offsets[v + 1] += triangle_offsets[v];
+        vertex_triangles.resize(index_count);
+        {
+            std::vector<u32> cursors(triangle_offsets.begin(), triangle_offsets.end() - 1);
+            for (size_t i = 0; i < index_count; ++i)
+                vertex_triangles[cursors[destination[i]]++] = u32(i / 3);
+        }
+
+        // A pass that took the cheapest collapses only would end around collapse_goal. Once some
+        // progress is made, costlier ones are left for the next pass to rank against the merged
+        // quadrics instead.
+        size_t collapse_goal = (index_count - target_index_count) / 6;
+        double deferred_cost = 0.0;
+        if (!collapse_order.empty()) {
+            size_t goal = std::min(collapse_goal, collapse_order.size() - 1);
+            deferred_cost = DeferredCostScale * collapse_costs[collapse_order[goal]];
+        }
+
+        // Collapses in a pass don't share any triangles, so each one's flip test holds
+        for (u32 v = 0; v < vertex_count; ++v)
+            remap[v] = v;
+        std::fill(pass_locked.begin(), pass_locked.end(), false);
+        size_t remaining_index_count = index_count;
+        size_t collapse_count = 0;
+        for (u32 from : collapse_order) {
+            if (remaining_index_count <= target_index_count)
+                break;
+            if (collapse_costs[from] > deferred_cost && collapse_count > collapse_goal / 10)
+                break;
+            u32 to = collapse_targets[from];
+            if (pass_locked[position_ids[from]] || pass_locked[position_ids[to]])
+                continue;
+
+            bool flips = false;
+            size_t removed_triangles = 0;
+            for (u32 t = triangle_offsets[from]; t < triangle_offsets[from + 1] && !flips; ++t) {
+                const u32 *tri = &destination[vertex_triangles[t] * 3];
+                V3f p[3];
+                bool has_to = false;
+                for (size_t k = 0; k < 3; ++k) {
+                    has_to |= position_ids[tri[k]] == position_ids[to];
+                    p[k] = positions[tri[k]];
+                }
+                if (has_to) {
+                    ++removed_triangles;
+                    continue;
+                }
+                V3f before = triangleNormal(p[0], p[1], p[2]);
+                for (size_t k = 0; k < 3; ++k) {
+                    if (tri[k] == from)
+                        p[k] = positions[to];
+                }
+                flips = dot(before, triangleNormal(p[0], p[1], p[2])) <= 0.0f;
+            }
+            if (flips)
+                continue;
+
+            remap[from] = to;
+            quadrics[to] += quadrics[from];
+            result_error = std::max(result_error, collapse_costs[from]);
+            remaining_index_count -= 3 * removed_triangles;
+            ++collapse_count;
+            for (u32 t = triangle_offsets[from]; t < triangle_offsets[from + 1]; ++t) {
+                const u32 *tri = &destination[vertex_triangles[t] * 3];
+                for (size_t k = 0; k < 3; ++k)
+                    pass_locked[position_ids[tri[k]]] = true;
+            }
+        }
+        if (collapse_count == 0)
+            break;
+
+        size_t write = 0;
+        for (size_t i = 0; i < index_count; i += 3) {
+            u32 tri[3] = {remap[destination[i]], remap[destination[i + 1]],
+                          remap[destination[i + 2]]};
+            u32 a = position_ids[tri[0]];
+            u32 b = position_ids[tri[1]];
+            u32 c = position_ids[tri[2]];
+            if (a == b || b == c || c == a)
+                continue;
+            std::copy_n(tri, 3, &destination[write]);
+            write += 3;
+        }
+        index_count = write;
+    }
+
+    if (out_error)
+        *out_error = float(std::sqrt(result_error));
+    return index_count;
+}
+
+} // namespace brtoy
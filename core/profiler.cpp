@@ -0,0 +1,198 @@
+#include <brtoy/profiler.h>
+
+#ifdef BRTOY_PROFILE
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <stdio.h>
+#include <vector>
+
+namespace brtoy {
+
+namespace {
+
+struct TraceEvent {
+    const char *name;
+    u64 begin;
+    u64 end;
+    TraceTrack track;
+};
+
+// Written by the owning thread only. count is published with release so that writeTrace() can
+// read the events below it from any thread.
+struct TraceChunk {
+    static constexpr u32 Capacity = 4096;
+    std::atomic<u32> count = 0;
+    std::atomic<TraceChunk *> next = nullptr;
+    TraceEvent events[Capacity];
+};
+
+struct TraceThread {
+    u32 id;
+    std::atomic<const char *> name = nullptr;
+    TraceChunk *head;
+    TraceChunk *tail;
+};
+
+// Chunks are taken from spare_chunks, which beginTrace() fills, so that recording a zone doesn't
+// allocate while tracing unless a thread fills more chunks than were set aside for it
+static constexpr size_t SpareChunksPerThread = 2;
+
+struct TraceState {
+    std::atomic<bool> tracing = false;
+    std::atomic<u64> begin_timestamp = 0;
+    std::mutex mutex;
+    std::vector<std::unique_ptr<TraceThread>> threads;
+    std::vector<const char *> track_names;
+    std::mutex spare_mutex;
+    std::vector<TraceChunk *> spare_chunks;
+};
+
+// Never destroyed, along with the threads' chunks, since threads may record zones during static
+// destruction
+TraceState &traceState() {
+    static TraceState *state = new TraceState;
+    return *state;
+}
+
+TraceChunk *takeChunk(TraceState &state) {
+    {
+        std::lock_guard lock(state.spare_mutex);
+        if (!state.spare_chunks.empty()) {
+            TraceChunk *chunk = state.spare_chunks.back();
+            state.spare_chunks.pop_back();
+            return chunk;
+        }
+    }
+    return new TraceChunk;
+}
+
+TraceThread &traceThread() {
+    thread_local TraceThread *thread = []() {
+        TraceState &state = traceState();
+        auto thread = std::make_unique<TraceThread>();
+        thread->head = takeChunk(state);
+        thread->tail = thread->head;
+        std::lock_guard lock(state.mutex);
+        thread->id = (u32)state.threads.size() + 1;
+        state.threads.push_back(std::move(thread));
+        return state.threads.back().get();
+    }();
+    return *thread;
+}
+
+void writeEscaped(FILE *file, const char *str) {
+    for (; *str; ++str) {
+        if (*str == '"' || *str == '\\')
+            fputc('\\', file);
+        fputc(*str, file);
+    }
+}
+
+} // namespace
+
+// The spare chunks cover the threads recorded so far and one more that starts recording
+void beginTrace() {
+    TraceState &state = traceState();
+    size_t thread_count;
+    {
+        std::lock_guard lock(state.mutex);
+        thread_count = state.threads.size();
+    }
+    {
+        std::lock_guard lock(state.spare_mutex);
+        while (state.spare_chunks.size() < (thread_count + 1) * SpareChunksPerThread)
+            state.spare_chunks.push_back(new TraceChunk);
+    }
+    state.begin_timestamp.store(cpuTimestamp(), std::memory_order_relaxed);
+    state.tracing.store(true, std::memory_order_release);
+}
+
+void endTrace() { traceState().tracing.store(false, std::memory_order_release); }
+
+bool isTracing() { return traceState().tracing.load(std::memory_order_relaxed); }
+
+void setTraceThreadName(const char *name) {
+    traceThread().name.store(name, std::memory_order_release);
+}
+
+TraceTrack createTraceTrack(const char *name) {
+    TraceState &state = traceState();
+    std::lock_guard lock(state.mutex);
+    state.track_names.push_back(name);
+    return (TraceTrack)state.track_names.size();
+}
+
+void recordTraceZone(TraceTrack track, const char *name, u64 begin, u64 end) {
+    if (!isTracing())
+        return;
+    TraceThread &thread = traceThread();
+    TraceChunk *chunk = thread.tail;
+    u32 count = chunk->count.load(std::memory_order_relaxed);
+    if (count == TraceChunk::Capacity) {
+        TraceChunk *next = takeChunk(traceState());
+        chunk->next.store(next, std::memory_order_release);
+        thread.tail = next;
+        chunk = next;
+        count = 0;
+    }
+    chunk->events[count] = {name, begin, end, track};
+    chunk->count.store(count + 1, std::memory_order_release);
+}
+
+// Threads are written as tids 1..N and tracks after them, all in the same process
+bool writeTrace(const char *path) {
+    FILE *file = fopen(path, "w");
+    if (!file)
+        return false;
+
+    TraceState &state = traceState();
+    std::lock_guard lock(state.mutex);
+    u64 begin_timestamp = state.begin_timestamp.load(std::memory_order_relaxed);
+    double us_per_tick = 1e6 / double(cpuTimestampFrequency());
+    u32 track_tid_base = (u32)state.threads.size();
+
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    bool first = true;
+    auto writeName = [&](u32 tid, const char *name) {
+        fprintf(file, "%s{\"ph\":\"M\",\"pid\":1,\"tid\":%u,", first ? "" : ",\n", tid);
+        fprintf(file, "\"name\":\"thread_name\",\"args\":{\"name\":\"");
+        writeEscaped(file, name);
+        fprintf(file, "\"}}");
+        first = false;
+    };
+    for (const auto &thread : state.threads) {
+        const char *name = thread->name.load(std::memory_order_acquire);
+        if (name)
+            writeName(thread->id, name);
+    }
+    for (u32 track = 0; track < state.track_names.size(); ++track)
+        writeName(track_tid_base + track + 1, state.track_names[track]);
+
+    for (const auto &thread : state.threads) {
+        for (TraceChunk *chunk = thread->head; chunk;
+             chunk = chunk->next.load(std::memory_order_acquire)) {
+            u32 count = chunk->count.load(std::memory_order_acquire);
+            for (u32 i = 0; i < count; ++i) {
+                const TraceEvent &event = chunk->events[i];
+                if (event.begin < begin_timestamp)
+                    continue;
+                u32 tid = event.track == ThreadTrack ? thread->id : track_tid_base + event.track;
+                fprintf(file, "%s{\"ph\":\"X\",\"pid\":1,\"tid\":%u,", first ? "" : ",\n",
+                        tid);
+                fprintf(file, "\"ts\":%.3f,\"dur\":%.3f,\"name\":\"",
+                        double(event.begin - begin_timestamp) * us_per_tick,
+                        double(event.end - event.begin) * us_per_tick);
+                writeEscaped(file, event.name);
+                fprintf(file, "\"}");
+                first = false;
+            }
+        }
+    }
+    fprintf(file, "\n]}\n");
+    return fclose(file) == 0;
+}
+
+} // namespace brtoy
+
+#endif
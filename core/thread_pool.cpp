@@ -0,0 +1,60 @@
+#include <brtoy/profiler.h>
+#include <brtoy/thread_pool.h>
+
+namespace brtoy {
+
+ThreadPool::ThreadPool(u32 thread_count) {
+    if (thread_count == 0) {
+        thread_count = std::thread::hardware_concurrency();
+        if (thread_count == 0)
+            thread_count = 1;
+    }
+    m_threads.reserve(thread_count);
+    for (u32 i = 0; i < thread_count; ++i)
+        m_threads.emplace_back(&ThreadPool::workerMain, this);
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard lock(m_mutex);
+        m_stopping = true;
+    }
+    m_cv.notify_all();
+    for (std::thread &thread : m_threads)
+        thread.join();
+}
+
+void ThreadPool::enqueue(std::function<void()> job) {
+    {
+        std::lock_guard lock(m_mutex);
+        BRTOY_ASSERT(!m_stopping);
+        m_jobs.push_back(std::move(job));
+    }
+    m_cv.notify_one();
+}
+
+u32 ThreadPool::threadCount() const { return (u32)m_threads.size(); }
+
+void ThreadPool::workerMain() {
+    // Workers usually start before tracing does, and naming a thread registers it with the trace,
+    // so they are named at their first job while tracing instead
+    bool named = false;
+    for (;;) {
+        std::function<void()> job;
+        {
+            std::unique_lock lock(m_mutex);
+            m_cv.wait(lock, [this]() { return m_stopping || !m_jobs.empty(); });
+            if (m_jobs.empty())
+                return;
+            job = std::move(m_jobs.front());
+            m_jobs.pop_front();
+        }
+        if (!named && isTracing()) {
+            setTraceThreadName("ThreadPool worker");
+            named = true;
+        }
+        job();
+    }
+}
+
+} // namespace brtoy
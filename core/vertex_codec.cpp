@@ -0,0 +1,205 @@
+#include <algorithm>
+#include <brtoy/vertex_codec.h>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define BRTOY_VERTEX_CODEC_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace brtoy {
+
+namespace {
+
+constexpr float Unorm16Max = 65535.0f;
+constexpr float Snorm16Max = 32767.0f;
+constexpr float Snorm8Max = 127.0f;
+// Keeps zero vectors from dividing by zero
+constexpr float MinL1Norm = 1e-20f;
+
+// Rounds to nearest even like the SIMD conversions
+float quantize(float value, float lo, float hi, float scale) {
+    return std::nearbyint(std::clamp(value, lo, hi) * scale);
+}
+
+float axisScale(float lo, float hi) { return hi > lo ? 1.0f / (hi - lo) : 0.0f; }
+
+void octahedralEncode(const V3f &n, float &u, float &v) {
+    float l1 = std::max(std::fabs(n.x) + std::fabs(n.y) + std::fabs(n.z), MinL1Norm);
+    u = n.x / l1;
+    v = n.y / l1;
+    if (n.z < 0.0f) {
+        float folded_u = (1.0f - std::fabs(v)) * std::copysign(1.0f, n.x);
+        float folded_v = (1.0f - std::fabs(u)) * std::copysign(1.0f, n.y);
+        u = folded_u;
+        v = folded_v;
+    }
+}
+
+V3f octahedralDecode(float u, float v) {
+    V3f n = {u, v, 1.0f - std::fabs(u) - std::fabs(v)};
+    float t = std::max(-n.z, 0.0f);
+    n.x += n.x >= 0.0f ? -t : t;
+    n.y += n.y >= 0.0f ? -t : t;
+    return normalize(n);
+}
+
+template <typename T>
+void encodeNormalsScalar(const V3f *normals, size_t count, T *out, float max) {
+    for (size_t i = 0; i < count; ++i) {
+        float u, v;
+        octahedralEncode(normals[i], u, v);
+        out[i].x = (decltype(T::x))quantize(u, -1.0f, 1.0f, max);
+        out[i].y = (decltype(T::y))quantize(v, -1.0f, 1.0f, max);
+    }
+}
+
+#ifdef BRTOY_VERTEX_CODEC_SSE2
+
+struct Soa4 {
+    __m128 x, y, z;
+};
+
+Soa4 loadSoa4(const V3f *v) {
+    return {_mm_setr_ps(v[0].x, v[1].x, v[2].x, v[3].x),
+            _mm_setr_ps(v[0].y, v[1].y, v[2].y, v[3].y),
+            _mm_setr_ps(v[0].z, v[1].z, v[2].z, v[3].z)};
+}
+
+__m128i quantize4(__m128 value, __m128 lo, __m128 hi, __m128 scale) {
+    return _mm_cvtps_epi32(_mm_mul_ps(_mm_min_ps(_mm_max_ps(value, lo), hi), scale));
+}
+
+// Octahedral coordinates of four vectors, as in octahedralEncode
+void octahedralEncode4(const Soa4 &n, __m128 &u, __m128 &v) {
+    const __m128 sign_mask = _mm_set1_ps(-0.0f);
+    const __m128 one = _mm_set1_ps(1.0f);
+    __m128 l1 = _mm_add_ps(_mm_add_ps(_mm_andnot_ps(sign_mask, n.x), _mm_andnot_ps(sign_mask, n.y)),
+                           _mm_andnot_ps(sign_mask, n.z));
+    l1 = _mm_max_ps(l1, _mm_set1_ps(MinL1Norm));
+    u = _mm_div_ps(n.x, l1);
+    v = _mm_div_ps(n.y, l1);
+    __m128 sign_u = _mm_or_ps(_mm_and_ps(n.x, sign_mask), one);
+    __m128 sign_v = _mm_or_ps(_mm_and_ps(n.y, sign_mask), one);
+    __m128 folded_u = _mm_mul_ps(_mm_sub_ps(one, _mm_andnot_ps(sign_mask, v)), sign_u);
+    __m128 folded_v = _mm_mul_ps(_mm_sub_ps(one, _mm_andnot_ps(sign_mask, u)), sign_v);
+    __m128 below = _mm_cmplt_ps(n.z, _mm_setzero_ps());
+    u = _mm_or_ps(_mm_and_ps(below, folded_u), _mm_andnot_ps(below, u));
+    v = _mm_or_ps(_mm_and_ps(below, folded_v), _mm_andnot_ps(below, v));
+}
+
+#endif
+
+} // namespace
+
+Aabb computeBounds(const V3f *positions, size_t count) {
+    if (count == 0)
+        return {};
+    Aabb bounds = {positions[0], positions[0]};
+    for (size_t i = 1; i < count; ++i) {
+        for (int axis = 0; axis < 3; ++axis) {
+            bounds.min.e[axis] = std::min(bounds.min.e[axis], positions[i].e[axis]);
+            bounds.max.e[axis] = std::max(bounds.max.e[axis], positions[i].e[axis]);
+        }
+    }
+    return bounds;
+}
+
+void encodePositions(const V3f *positions, size_t count, const Aabb &bounds, PackedPosition *out) {
+    V3f scale = {axisScale(bounds.min.x, bounds.max.x), axisScale(bounds.min.y, bounds.max.y),
+                 axisScale(bounds.min.z, bounds.max.z)};
+    size_t i = 0;
+#ifdef BRTOY_VERTEX_CODEC_SSE2
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 unorm_max = _mm_set1_ps(Unorm16Max);
+    // packs_epi32 saturates to signed 16 bits, so the values are biased into that range and the
+    // bias is flipped back afterwards
+    const __m128i bias = _mm_set1_epi32(0x8000);
+    const __m128i flip = _mm_set1_epi16(-0x8000);
+    for (; i + 4 <= count; i += 4) {
+        Soa4 p = loadSoa4(positions + i);
+        __m128i x = quantize4(
+            _mm_mul_ps(_mm_sub_ps(p.x, _mm_set1_ps(bounds.min.x)), _mm_set1_ps(scale.x)), zero,
+            one, unorm_max);
+        __m128i y = quantize4(
+            _mm_mul_ps(_mm_sub_ps(p.y, _mm_set1_ps(bounds.min.y)), _mm_set1_ps(scale.y)), zero,
+            one, unorm_max);
+        __m128i z = quantize4(
+            _mm_mul_ps(_mm_sub_ps(p.z, _mm_set1_ps(bounds.min.z)), _mm_set1_ps(scale.z)), zero,
+            one, unorm_max);
+        __m128i xz = _mm_xor_si128(
+            _mm_packs_epi32(_mm_sub_epi32(x, bias), _mm_sub_epi32(z, bias)), flip);
+        __m128i y_pad = _mm_xor_si128(
+            _mm_packs_epi32(_mm_sub_epi32(y, bias), _mm_sub_epi32(_mm_setzero_si128(), bias)),
+            flip);
+        __m128i xy = _mm_unpacklo_epi16(xz, y_pad);
+        __m128i z_pad = _mm_unpackhi_epi16(xz, y_pad);
+        _mm_storeu_si128((__m128i *)(out + i), _mm_unpacklo_epi32(xy, z_pad));
+        _mm_storeu_si128((__m128i *)(out + i + 2), _mm_unpackhi_epi32(xy, z_pad));
+    }
+#endif
+    for (; i < count; ++i) {
+        const V3f &p = positions[i];
+        out[i] = {(u16)quantize((p.x - bounds.min.x) * scale.x, 0.0f, 1.0f, Unorm16Max),
+                  (u16)quantize((p.y - bounds.min.y) * scale.y, 0.0f, 1.0f, Unorm16Max),
+                  (u16)quantize((p.z - bounds.min.z) * scale.z, 0.0f, 1.0f, Unorm16Max), 0};
+    }
+}
+
+void encodeNormals(const V3f *normals, size_t count, OctNormal16 *out) {
+    size_t i = 0;
+#ifdef BRTOY_VERTEX_CODEC_SSE2
+    const __m128 lo = _mm_set1_ps(-1.0f);
+    const __m128 hi = _mm_set1_ps(1.0f);
+    const __m128 snorm_max = _mm_set1_ps(Snorm16Max);
+    for (; i + 4 <= count; i += 4) {
+        __m128 u, v;
+        octahedralEncode4(loadSoa4(normals + i), u, v);
+        __m128i packed_u =
+            _mm_packs_epi32(quantize4(u, lo, hi, snorm_max), _mm_setzero_si128());
+        __m128i packed_v =
+            _mm_packs_epi32(quantize4(v, lo, hi, snorm_max), _mm_setzero_si128());
+        _mm_storeu_si128((__m128i *)(out + i), _mm_unpacklo_epi16(packed_u, packed_v));
+    }
+#endif
+    encodeNormalsScalar(normals + i, count - i, out + i, Snorm16Max);
+}
+
+void encodeNormals(const V3f *normals, size_t count, OctNormal8 *out) {
+    size_t i = 0;
+#ifdef BRTOY_VERTEX_CODEC_SSE2
+    const __m128 lo = _mm_set1_ps(-1.0f);
+    const __m128 hi = _mm_set1_ps(1.0f);
+    const __m128 snorm_max = _mm_set1_ps(Snorm8Max);
+    for (; i + 4 <= count; i += 4) {
+        __m128 u, v;
+        octahedralEncode4(loadSoa4(normals + i), u, v);
+        // Bytes u0..u3 v0..v3, interleaved into u0 v0 u1 v1 ...
+        __m128i uv16 =
+            _mm_packs_epi32(quantize4(u, lo, hi, snorm_max), quantize4(v, lo, hi, snorm_max));
+        __m128i uv8 = _mm_packs_epi16(uv16, uv16);
+        _mm_storel_epi64((__m128i *)(out + i), _mm_unpacklo_epi8(uv8, _mm_srli_si128(uv8, 4)));
+    }
+#endif
+    encodeNormalsScalar(normals + i, count - i, out + i, Snorm8Max);
+}
+
+V3f decodePosition(PackedPosition position, const Aabb &bounds) {
+    V3f extent = bounds.max - bounds.min;
+    return {bounds.min.x + position.x / Unorm16Max * extent.x,
+            bounds.min.y + position.y / Unorm16Max * extent.y,
+            bounds.min.z + position.z / Unorm16Max * extent.z};
+}
+
+V3f decodeNormal(OctNormal16 normal) {
+    return octahedralDecode(std::max(normal.x / Snorm16Max, -1.0f),
+                            std::max(normal.y / Snorm16Max, -1.0f));
+}
+
+V3f decodeNormal(OctNormal8 normal) {
+    return octahedralDecode(std::max(normal.x / Snorm8Max, -1.0f),
+                            std::max(normal.y / Snorm8Max, -1.0f));
+}
+
+} // namespace brtoy
@@ -0,0 +1,298 @@
+#include "benchmark.h"
+#include <algorithm>
+#include <brtoy/arena.h>
+#include <charconv>
+#include <cmath>
+#include <limits>
+#include <stdio.h>
+#include <string_view>
+
+namespace brtoy {
+
+static void printUsage(const char *program) {
+    printf("usage: %s [options]\n"
+           "  --instances N       number of instances (default 1000000)\n"
+           "  --mesh-mix T,D,H    relative weights of triangles, disks and tetrahedra "
+           "(default 0,0,1)\n"
+           "  --mesh PATH         draw a mesh cooked by brtoy_cook in place of the tetrahedra\n"
+           "  --size WxH          window size\n"
+           "  --vertex-format F   float, q16 or q8 (default q16): quantized positions with\n"
+           "                      16- or 8-bit octahedral normals\n"
+           "  --lod-error PX      largest simplification error on screen in pixels (default 1),\n"
+           "                      0 always draws the full meshes\n"
+           "  --min-size PX       cull instances smaller than this on screen (default 1, 0 off)\n"
+           "  --impostors         draw the instances culled for size as single points\n"
+           "  --benchmark         run the scripted camera path and report frame times\n"
+           "  --frames N          measured frames in benchmark mode (default 1000)\n"
+           "  --warmup N          frames run before measuring (default 100)\n"
+           "  --output PATH       per-frame results, JSON if PATH ends with .json, else CSV\n"
+           "  --trace PATH        write a Chrome trace of the run\n"
+           "  --memory-report PATH  write device memory usage per subsystem at exit\n"
+           "  --check-allocations fail if a measured frame allocates on the heap\n"
+           "  --pipeline          simulate on a separate thread, one frame ahead of rendering\n",
+           program);
+}
+
+template <typename T> static bool parseNumber(std::string_view str, T &out_value) {
+    const char *end = str.data() + str.size();
+    auto [ptr, ec] = std::from_chars(str.data(), end, out_value);
+    return ec == std::errc() && ptr == end;
+}
+
+std::optional<ExampleOptions> parseExampleOptions(int argc, char **argv) {
+    ExampleOptions options;
+    bool valid = true;
+    for (int i = 1; i < argc && valid; ++i) {
+        std::string_view arg = argv[i];
+        std::string_view value = i + 1 < argc ? argv[i + 1] : "";
+        if (arg == "--benchmark") {
+            options.benchmark = true;
+        } else if (arg == "--instances") {
+            valid = parseNumber(value, options.instance_count);
+            ++i;
+        } else if (arg == "--frames") {
+            valid = parseNumber(value, options.frame_count) && options.frame_count > 0;
+            ++i;
+        } else if (arg == "--warmup") {
+            valid = parseNumber(value, options.warmup_frame_count);
+            ++i;
+        } else if (arg == "--output") {
+            options.output_path = value;
+            valid = !value.empty();
+            ++i;
+        } else if (arg == "--mesh") {
+            options.mesh_path = value;
+            valid = !value.empty();
+            ++i;
+        } else if (arg == "--trace") {
+            options.trace_path = value;
+            valid = !value.empty();
+            ++i;
+        } else if (arg == "--check-allocations") {
+            options.check_allocations = true;
+            if (!IsCountingHeapAllocations) {
+                fprintf(stderr, "--check-allocations needs a build with BRTOY_COUNT_ALLOCATIONS\n");
+                valid = false;
+            }
+        } else if (arg == "--pipeline") {
+            options.pipelined = true;
+        } else if (arg == "--memory-report") {
+            options.memory_report_path = value;
+            valid = !value.empty();
+            ++i;
+        } else if (arg == "--vertex-format") {
+            if (value == "float")
+                options.vertex_packing = VertexPacking::Float;
+            else if (value == "q16")
+                options.vertex_packing = VertexPacking::Quantized16;
+            else if (value == "q8")
+                options.vertex_packing = VertexPacking::Quantized8;
+            else
+                valid = false;
+            ++i;
+        } else if (arg == "--lod-error") {
+            valid =
+                parseNumber(value, options.lod_error_pixels) && options.lod_error_pixels >= 0.0f;
+            ++i;
+        } else if (arg == "--min-size") {
+            valid = parseNumber(value, options.min_size_pixels) && options.min_size_pixels >= 0.0f;
+            ++i;
+        } else if (arg == "--impostors") {
+            options.impostors = true;
+        } else if (arg == "--size") {
+            size_t x = value.find('x');
+            valid = x != std::string_view::npos &&
+                    parseNumber(value.substr(0, x), options.window_dim.x) &&
+                    parseNumber(value.substr(x + 1), options.window_dim.y);
+            ++i;
+        } else if (arg == "--mesh-mix") {
+            float total = 0.0f;
+            for (size_t m = 0; m < options.mesh_mix.size() && valid; ++m) {
+                size_t comma = value.find(',');
+                valid = parseNumber(value.substr(0, comma), options.mesh_mix[m]) &&
+                        options.mesh_mix[m] >= 0.0f && (comma != std::string_view::npos) ==
+                                                           (m + 1 < options.mesh_mix.size());
+                total += options.mesh_mix[m];
+                value = comma == std::string_view::npos ? "" : value.substr(comma + 1);
+            }
+            valid = valid && total > 0.0f;
+            ++i;
+        } else {
+            valid = false;
+        }
+    }
+
+    if (!valid) {
+        printUsage(argc > 0 ? argv[0] : "example_gpu_driven_rendering");
+        return std::nullopt;
+    }
+    return options;
+}
+
+static CameraPose lookAt(V3f position, V3f target) {
+    // The camera looks along -k = (-sin(yaw) cos(pitch), sin(pitch), -cos(yaw) cos(pitch))
+    V3f dir = normalize(target - position);
+    CameraPose pose = {
+        .position = position,
+        .yaw = std::atan2(-dir.x, -dir.z),
+        .pitch = std::asin(std::clamp(dir.y, -1.0f, 1.0f)),
+    };
+    return pose;
+}
+
+CameraPose scriptedCamera(float t) {
+    t = std::clamp(t, 0.0f, 1.0f);
+    if (t < 0.5f) {
+        // Lissajous curve through the instance cloud, which is a normal distribution with a
+        // standard deviation of 200 around the origin
+        float s = t * 2.0f * TwoPi;
+        V3f position = {350.0f * std::sin(s), 120.0f * std::sin(2.0f * s),
+                        -350.0f * std::cos(s)};
+        float ahead = s + 0.05f;
+        V3f target = {350.0f * std::sin(ahead), 120.0f * std::sin(2.0f * ahead),
+                      -350.0f * std::cos(ahead)};
+        return lookAt(position, target);
+    }
+
+    constexpr auto static_views = std::to_array<std::array<V3f, 2>>({
+        {V3f{0.0f, 0.0f, -3.0f}, V3f{0.0f, 0.0f, 1.0f}},      // inside, looking ahead
+        {V3f{0.0f, 0.0f, -1200.0f}, V3f{0.0f, 0.0f, 0.0f}},   // outside, everything visible
+        {V3f{0.0f, 0.0f, 0.0f}, V3f{0.0f, 1.0f, 0.0f}},       // centre, looking up
+        {V3f{3000.0f, 0.0f, 0.0f}, V3f{3001.0f, 0.0f, 0.0f}}, // far away, nothing visible
+    });
+    size_t view = std::min(size_t((t - 0.5f) * 2.0f * static_views.size()),
+                           static_views.size() - 1);
+    return lookAt(static_views[view][0], static_views[view][1]);
+}
+
+BenchmarkRecorder::BenchmarkRecorder(u32 warmup_frame_count, u32 frame_count)
+    : m_warmup_frame_count(warmup_frame_count) {
+    constexpr float Unset = std::numeric_limits<float>::quiet_NaN();
+    m_frames.resize(frame_count, Frame{Unset, Unset, 0, 0, 0});
+}
+
+void BenchmarkRecorder::recordCpu(u64 frame, float cpu_ms, u32 visible_instances,
+                                  u32 impostor_instances, u32 heap_allocations) {
+    if (frame >= m_warmup_frame_count && frame - m_warmup_frame_count < m_frames.size()) {
+        Frame &f = m_frames[frame - m_warmup_frame_count];
+        f.cpu_ms = cpu_ms;
+        f.visible_instances = visible_instances;
+        f.impostor_instances = impostor_instances;
+        f.heap_allocations = heap_allocations;
+    }
+}
+
+void BenchmarkRecorder::recordGpu(u64 frame, float gpu_ms) {
+    if (frame >= m_warmup_frame_count && frame - m_warmup_frame_count < m_frames.size())
+        m_frames[frame - m_warmup_frame_count].gpu_ms = gpu_ms;
+}
+
+struct Summary {
+    size_t count;
+    float min, mean, p50, p95, p99, max;
+};
+
+// Nearest-rank percentiles over the recorded values. Frames without a value are skipped.
+template <typename F> static Summary summarize(const std::vector<BenchmarkRecorder::Frame> &frames,
+                                               F value) {
+    std::vector<float> values;
+    values.reserve(frames.size());
+    for (const BenchmarkRecorder::Frame &frame : frames) {
+        float v = value(frame);
+        if (!std::isnan(v))
+            values.push_back(v);
+    }
+    Summary summary = {};
+    if (!values.empty()) {
+        std::sort(values.begin(), values.end());
+        auto percentile = [&](float p) {
+            size_t rank = (size_t)std::ceil(p / 100.0f * values.size());
+            return values[std::clamp<size_t>(rank, 1, values.size()) - 1];
+        };
+        double sum = 0.0;
+        for (float v : values)
+            sum += v;
+        summary = {values.size(), values.front(), float(sum / values.size()), percentile(50.0f),
+                   percentile(95.0f), percentile(99.0f), values.back()};
+    }
+    return summary;
+}
+
+static const std::array<const char *, 5> MetricNames = {
+    "cpu_ms", "gpu_ms", "visible_instances", "impostor_instances", "heap_allocations"};
+
+static std::array<Summary, 5> summarizeAll(const std::vector<BenchmarkRecorder::Frame> &frames) {
+    return {
+        summarize(frames, [](const BenchmarkRecorder::Frame &f) { return f.cpu_ms; }),
+        summarize(frames, [](const BenchmarkRecorder::Frame &f) { return f.gpu_ms; }),
+        summarize(frames,
+                  [](const BenchmarkRecorder::Frame &f) { return (float)f.visible_instances; }),
+        summarize(frames,
+                  [](const BenchmarkRecorder::Frame &f) { return (float)f.impostor_instances; }),
+        summarize(frames,
+                  [](const BenchmarkRecorder::Frame &f) { return (float)f.heap_allocations; }),
+    };
+}
+
+bool BenchmarkRecorder::write(const std::string &path) const {
+    FILE *file = fopen(path.c_str(), "w");
+    if (!file)
+        return false;
+
+    bool json = path.size() >= 5 && path.compare(path.size() - 5, 5, ".json") == 0;
+    if (json) {
+        std::array<Summary, 5> summaries = summarizeAll(m_frames);
+        fprintf(file, "{\n  \"summary\": {\n");
+        for (size_t m = 0; m < summaries.size(); ++m) {
+            const Summary &s = summaries[m];
+            fprintf(file,
+                    "    \"%s\": {\"count\": %zu, \"min\": %.4f, \"mean\": %.4f, \"p50\": %.4f, "
+                    "\"p95\": %.4f, \"p99\": %.4f, \"max\": %.4f}%s\n",
+                    MetricNames[m], s.count, s.min, s.mean, s.p50, s.p95, s.p99, s.max,
+                    m + 1 < summaries.size() ? "," : "");
+        }
+        fprintf(file, "  },\n  \"frames\": [\n");
+        for (size_t i = 0; i < m_frames.size(); ++i) {
+            const Frame &f = m_frames[i];
+            // JSON has no NaN, frames without a value get null
+            auto number = [](float v) {
+                return std::isnan(v) ? std::string("null") : std::to_string(v);
+            };
+            fprintf(file,
+                    "    {\"frame\": %zu, \"cpu_ms\": %s, \"gpu_ms\": %s, "
+                    "\"visible_instances\": %u, \"impostor_instances\": %u, "
+                    "\"heap_allocations\": %u}%s\n",
+                    i, number(f.cpu_ms).c_str(), number(f.gpu_ms).c_str(), f.visible_instances,
+                    f.impostor_instances, f.heap_allocations, i + 1 < m_frames.size() ? "," : "");
+        }
+        fprintf(file, "  ]\n}\n");
+    } else {
+        fprintf(file,
+                "frame,cpu_ms,gpu_ms,visible_instances,impostor_instances,heap_allocations\n");
+        for (size_t i = 0; i < m_frames.size(); ++i) {
+            const Frame &f = m_frames[i];
+            fprintf(file, "%zu,%.4f,%.4f,%u,%u,%u\n", i, f.cpu_ms, f.gpu_ms, f.visible_instances,
+                    f.impostor_instances, f.heap_allocations);
+        }
+    }
+    bool result = ferror(file) == 0;
+    result = fclose(file) == 0 && result;
+    return result;
+}
+
+void BenchmarkRecorder::printSummary() const {
+    std::array<Summary, 5> summaries = summarizeAll(m_frames);
+    printf("metric,count,min,mean,p50,p95,p99,max\n");
+    for (size_t m = 0; m < summaries.size(); ++m) {
+        const Summary &s = summaries[m];
+        printf("%s,%zu,%.4f,%.4f,%.4f,%.4f,%.4f,%.4f\n", MetricNames[m], s.count, s.min, s.mean,
+               s.p50, s.p95, s.p99, s.max);
+    }
+}
+
+u32 BenchmarkRecorder::allocatingFrameCount() const {
+    return (u32)std::count_if(m_frames.begin(), m_frames.end(),
+                              [](const Frame &f) { return f.heap_allocations > 0; });
+}
+
+} // namespace brtoy
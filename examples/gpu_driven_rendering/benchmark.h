@@ -0,0 +1,89 @@
+#pragma once
+#include <array>
+#include <brtoy/vec.h>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace brtoy {
+
+enum class VertexPacking : u8 {
+    Float,
+    // 16-bit positions relative to the mesh bounds and 16-bit octahedral normals
+    Quantized16,
+    // As Quantized16 but with 8-bit octahedral normals
+    Quantized8,
+};
+
+struct ExampleOptions {
+    u32 instance_count = 1000000;
+    // Relative weights of triangles, disks and tetrahedra among the instances
+    std::array<float, 3> mesh_mix = {0.0f, 0.0f, 1.0f};
+    // Mesh file from brtoy_cook drawn in place of the tetrahedra
+    std::string mesh_path;
+    V2u window_dim = {};
+    VertexPacking vertex_packing = VertexPacking::Quantized16;
+    // Each instance draws the coarsest LOD whose simplification error projects to at most this
+    // many pixels
+    float lod_error_pixels = 1.0f;
+    // Instances whose bounding sphere projects to fewer pixels across are culled, or drawn as
+    // impostors if those are enabled
+    float min_size_pixels = 1.0f;
+    bool impostors = false;
+
+    bool benchmark = false;
+    u32 frame_count = 1000;
+    u32 warmup_frame_count = 100;
+    // Written as JSON if the path ends with .json and as CSV otherwise
+    std::string output_path;
+    // Chrome trace event JSON of the CPU zones and, with calibrated timestamps, the GPU zones
+    std::string trace_path;
+    // JSON of the device memory per tag and heap, written at exit
+    std::string memory_report_path;
+    // Fail the benchmark if a measured frame allocates on the heap. Needs BRTOY_COUNT_ALLOCATIONS.
+    bool check_allocations = false;
+    // Run the simulation on its own thread, overlapped with recording the previous frame
+    bool pipelined = false;
+};
+
+// Prints the usage and returns nullopt on invalid arguments
+std::optional<ExampleOptions> parseExampleOptions(int argc, char **argv);
+
+struct CameraPose {
+    V3f position;
+    float yaw;
+    float pitch;
+};
+
+// Deterministic camera for benchmark runs: a fly-through of the instance cloud for the first half
+// of the run, followed by a series of static views. t goes from 0 to 1 over the run.
+CameraPose scriptedCamera(float t);
+
+// Collects per-frame timings of a benchmark run. GPU times arrive a few frames after the CPU
+// times, so both are recorded by frame number. Frames before the warm-up is over are ignored.
+struct BenchmarkRecorder {
+    BenchmarkRecorder(u32 warmup_frame_count, u32 frame_count);
+
+    void recordCpu(u64 frame, float cpu_ms, u32 visible_instances, u32 impostor_instances,
+                   u32 heap_allocations);
+    void recordGpu(u64 frame, float gpu_ms);
+
+    // Writes the per-frame values, plus the percentile summaries in the JSON format
+    bool write(const std::string &path) const;
+    void printSummary() const;
+    // Measured frames that made at least one heap allocation
+    u32 allocatingFrameCount() const;
+
+    struct Frame {
+        float cpu_ms;
+        float gpu_ms;
+        u32 visible_instances;
+        u32 impostor_instances;
+        u32 heap_allocations;
+    };
+
+    u32 m_warmup_frame_count;
+    std::vector<Frame> m_frames;
+};
+
+} // namespace brtoy
@@ -1,32 +1,69 @@
+#include "benchmark.h"
 #include <array>
+#include <brtoy/arena.h>
+#include <brtoy/async_io.h>
 #include <brtoy/container.h>
 #include <brtoy/gfx.h>
+#include <brtoy/gfx_profiler.h>
+#include <brtoy/gfx_render_graph.h>
 #include <brtoy/gfx_swapchain.h>
 #include <brtoy/gfx_utils.h>
 #include <brtoy/linmath.h>
+#include <brtoy/mesh_asset.h>
+#include <brtoy/mesh_file.h>
 #include <brtoy/platform.h>
+#include <brtoy/profiler.h>
+#include <brtoy/queue.h>
+#include <brtoy/thread_pool.h>
 #include <brtoy/vec.h>
-#include <fstream>
+#include <chrono>
+#include <cstring>
+#include <limits>
+#include <optional>
 #include <random>
+#include <span>
+#include <thread>
 #include <vk_mem_alloc.h>
 #include <format>
 
 namespace brtoy {
 
-struct MeshInfo {
+// Index range of one level of detail. All levels of a mesh index the same vertices.
+struct MeshLod {
     uint32_t index_data_ptr;
+    uint32_t index_count;
+    // Distance in mesh units by which the level deviates from the full mesh
+    float error;
+};
+static_assert(sizeof(MeshLod) == 12);
+
+struct MeshInfo {
     uint32_t pos_data_ptr;
     uint32_t pos_data_stride;
     uint32_t attrib_data_ptr;
     uint32_t attrib_data_stride;
-    uint32_t index_count;
+    // 2 or 4 bytes
+    uint32_t index_size;
+    PositionFormat position_format;
+    NormalFormat normal_format;
+    // Unorm16 positions decode to pos_offset + pos_scale * the stored values
+    V3f pos_offset;
+    V3f pos_scale;
+    // Bounding sphere in mesh units
+    V3f bounds_center;
+    float bounds_radius;
+    // The full mesh first, then increasingly coarse ones
+    uint32_t lod_count;
+    MeshLod lods[MeshLodCountMax];
 };
+static_assert(sizeof(MeshInfo) == 72 + sizeof(MeshLod) * MeshLodCountMax);
 
 struct MeshData {
     using Index = uint32_t;
     static constexpr VkDeviceSize StagingBufferSize = 8 * 1024 * 1024;
     static constexpr VkDeviceSize PositionBufferSize = 16 * 1024 * 1024;
     static constexpr VkDeviceSize AttribBufferSize = 16 * 1024 * 1024;
+    // Of 32-bit indices, twice as many 16-bit ones fit
     static constexpr uint32_t IndexCountMax = 1024 * 1024;
     static constexpr VkDeviceSize IndexBufferSize = sizeof(Index) * IndexCountMax;
     static constexpr VkDeviceSize InfoSize = sizeof(MeshInfo);
@@ -34,40 +71,40 @@ struct MeshData {
     static constexpr VkDeviceSize InfoBufferSize = InfoSize * MeshCountMax;
 
     struct Creator {
-        uint32_t position_size;
-        uint32_t attrib_size;
-        uint32_t index_count;
-        BufferSubAllocation src_positions;
-        BufferSubAllocation src_attribs;
-        BufferSubAllocation src_indices;
-
-        Index *indices();
+        MeshLayout layout;
+        // The streams at the offsets of the layout
+        BufferSubAllocation src;
+        // The rest is reserved along with src, so that update can't run out of room
+        BufferSubAllocation src_info;
+        BufferSubAllocation dst_positions;
+        BufferSubAllocation dst_attribs;
+        BufferSubAllocation dst_indices;
+        BufferSubAllocation dst_info;
     };
 
-    template <typename PosT, typename AttribT> struct CreatorT : public Creator {
-        PosT *positions() { return (PosT *)src_positions.ptr(); }
-
-        AttribT *attribs() { return (AttribT *)src_attribs.ptr(); }
-    };
-
-    MeshData(VmaAllocator allocator);
+    MeshData(VmaAllocator allocator, MemoryTracker *memory_tracker = nullptr);
     ~MeshData();
 
-    template <typename PosT, typename AttribT>
-    CreatorT<PosT, AttribT> create(uint32_t vertex_count, uint32_t index_count) {
-        CreatorT<PosT, AttribT> creator;
-        creator.position_size = sizeof(PosT);
-        creator.attrib_size = sizeof(AttribT);
-        creator.index_count = index_count;
-        creator.src_positions = m_staging.allocate<PosT>(vertex_count);
-        creator.src_attribs = m_staging.allocate<AttribT>(vertex_count);
-        creator.src_indices = m_staging.allocate<Index>(index_count);
-        return creator;
-    }
-
+    // Whether the staging and mesh buffers have room for the mesh
+    bool fits(const MeshLayout &layout) const;
+    // Allocates staging memory for the streams of the layout, to be filled by the caller along
+    // with the bounds and errors of the layout if they aren't set yet, and reserves the mesh's
+    // ranges of the mesh buffers. The mesh must fit.
+    Creator create(const MeshLayout &layout);
+    // Encodes the mesh and its levels of detail in the format and records the copies like
+    // update, or returns nullopt if the mesh doesn't fit
+    std::optional<uint32_t> add(VkCommandBuffer cmd, VertexFormat format, const MeshSource &mesh);
+
+    // Only records the copies from the staging buffer, the caller synchronizes access to
+    // m_buffer, e.g. with a render graph pass using it as RenderGraphUsage::TransferDst.
     uint32_t update(VkCommandBuffer cmd, const Creator &creator);
 
+    // Meshes are numbered in the order they were added
+    uint32_t meshIndex(uint32_t mesh_info_ptr) const;
+    uint32_t meshCount() const;
+
     VmaAllocator m_allocator;
+    MemoryTracker *m_memory_tracker;
     VkBuffer m_staging_buffer;
     VmaAllocation m_staging_allocation;
     VkBuffer m_buffer;
@@ -79,9 +116,8 @@ struct MeshData {
     LinearAllocator m_infos;
 };
 
-MeshData::Index *MeshData::Creator::indices() { return (Index *)src_indices.ptr(); }
-
-MeshData::MeshData(VmaAllocator allocator) : m_allocator(allocator) {
+MeshData::MeshData(VmaAllocator allocator, MemoryTracker *memory_tracker)
+    : m_allocator(allocator), m_memory_tracker(memory_tracker) {
     VkBufferCreateInfo staging_create_info = {
         .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
         .pNext = nullptr,
@@ -116,6 +152,10 @@ MeshData::MeshData(VmaAllocator allocator) : m_allocator(allocator) {
     };
     vmaCreateBuffer(m_allocator, &buffer_create_info, &buffer_alloc_info, &m_buffer, &m_allocation,
                     nullptr);
+    if (m_memory_tracker) {
+        m_memory_tracker->track(m_staging_allocation, MemoryTag::Staging);
+        m_memory_tracker->track(m_allocation, MemoryTag::MeshData);
+    }
 
     m_positions = LinearAllocator(m_buffer, 0, PositionBufferSize, 4);
     m_attribs = LinearAllocator(m_buffer, PositionBufferSize, AttribBufferSize, 4);
@@ -126,65 +166,131 @@ MeshData::MeshData(VmaAllocator allocator) : m_allocator(allocator) {
 }
 
 MeshData::~MeshData() {
+    if (m_memory_tracker) {
+        m_memory_tracker->untrack(m_staging_allocation);
+        m_memory_tracker->untrack(m_allocation);
+    }
     vmaDestroyBuffer(m_allocator, m_staging_buffer, m_staging_allocation);
     vmaDestroyBuffer(m_allocator, m_buffer, m_allocation);
 }
 
-uint32_t MeshData::update(VkCommandBuffer cmd, const Creator &creator) {
-    BufferSubAllocation dst_positions = m_positions.allocateBytes(creator.src_positions.size);
-    BufferSubAllocation dst_attribs = m_attribs.allocateBytes(creator.src_attribs.size);
-    BufferSubAllocation dst_indices = m_indices.allocateBytes(creator.src_indices.size);
+static bool hasRoom(const LinearAllocator &allocator, VkDeviceSize size,
+                    VkDeviceSize alignment) {
+    return alignUp(allocator.m_cur, alignment) + size <= allocator.m_end;
+}
+
+bool MeshData::fits(const MeshLayout &layout) const {
+    VkDeviceSize staging_size = alignUp(layout.size(), alignof(MeshInfo)) + sizeof(MeshInfo);
+    return hasRoom(m_staging, staging_size, MeshStreamAlignment) &&
+           hasRoom(m_positions, layout.positionsSize(), m_positions.m_min_alignment) &&
+           hasRoom(m_attribs, layout.attribsSize(), m_attribs.m_min_alignment) &&
+           hasRoom(m_indices, layout.indicesSize(), m_indices.m_min_alignment) &&
+           hasRoom(m_infos, sizeof(MeshInfo), m_infos.m_min_alignment);
+}
+
+MeshData::Creator MeshData::create(const MeshLayout &layout) {
+    // In the order fits() assumes for the staging memory
+    Creator creator = {
+        .layout = layout,
+        .src = m_staging.allocateBytes(layout.size(), MeshStreamAlignment),
+        .src_info = m_staging.allocate<MeshInfo>(),
+        .dst_positions = m_positions.allocateBytes(layout.positionsSize()),
+        .dst_attribs = m_attribs.allocateBytes(layout.attribsSize()),
+        .dst_indices = m_indices.allocateBytes(layout.indicesSize()),
+        .dst_info = m_infos.allocate<MeshInfo>(),
+    };
+    // A failed allocation comes back with no buffer
+    BRTOY_ASSERT(creator.src.buffer != VK_NULL_HANDLE &&
+                 creator.src_info.buffer != VK_NULL_HANDLE &&
+                 creator.dst_positions.buffer != VK_NULL_HANDLE &&
+                 creator.dst_attribs.buffer != VK_NULL_HANDLE &&
+                 creator.dst_indices.buffer != VK_NULL_HANDLE &&
+                 creator.dst_info.buffer != VK_NULL_HANDLE);
+    return creator;
+}
 
-    BufferSubAllocation dst_info = m_infos.allocate<MeshInfo>();
-    BufferSubAllocation src_info = m_staging.allocate<MeshInfo>();
+std::optional<uint32_t> MeshData::add(VkCommandBuffer cmd, VertexFormat format,
+                                      const MeshSource &mesh) {
+    MeshLayout layout = layoutMesh(mesh, format);
+    if (!fits(layout))
+        return std::nullopt;
+    Creator creator = create(layout);
+    encodeMesh(mesh, creator.layout, (std::byte *)creator.src.ptr());
+    return update(cmd, creator);
+}
+
+uint32_t MeshData::update(VkCommandBuffer cmd, const Creator &creator) {
+    const MeshLayout &layout = creator.layout;
+    const BufferSubAllocation &dst_positions = creator.dst_positions;
+    const BufferSubAllocation &dst_attribs = creator.dst_attribs;
+    const BufferSubAllocation &dst_indices = creator.dst_indices;
+    const BufferSubAllocation &dst_info = creator.dst_info;
+    BufferSubAllocation src_info = creator.src_info;
 
     MeshInfo *info = (MeshInfo *)src_info.ptr();
-    info->index_data_ptr = dst_indices.offset;
     info->pos_data_ptr = dst_positions.offset;
-    info->pos_data_stride = creator.position_size;
+    info->pos_data_stride = vertexSize(layout.format.position);
     info->attrib_data_ptr = dst_attribs.offset;
-    info->attrib_data_stride = creator.attrib_size;
-    info->index_count = creator.index_count;
-
-    {
-        VkMemoryBarrier barrier = {VK_STRUCTURE_TYPE_MEMORY_BARRIER, nullptr, VK_ACCESS_NONE,
-                                   VK_ACCESS_TRANSFER_WRITE_BIT};
-        vkCmdPipelineBarrier(
-            cmd, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT,
-            VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+    info->attrib_data_stride = vertexSize(layout.format.normal);
+    info->index_size = layout.index_size;
+    info->position_format = layout.format.position;
+    info->normal_format = layout.format.normal;
+    info->pos_offset = layout.pos_offset;
+    info->pos_scale = layout.pos_scale;
+    info->bounds_center = layout.bounds_center;
+    info->bounds_radius = layout.bounds_radius;
+    info->lod_count = layout.lod_count;
+    std::fill(std::begin(info->lods), std::end(info->lods), MeshLod{});
+    for (uint32_t lod = 0; lod < layout.lod_count; ++lod) {
+        info->lods[lod] = {
+            .index_data_ptr = (uint32_t)dst_indices.offset +
+                              layout.index_size * layout.lod_first_indices[lod],
+            .index_count = layout.lod_index_counts[lod],
+            .error = layout.lod_errors[lod],
+        };
     }
 
+    VkDeviceSize src = creator.src.offset;
     std::array copy_regions = std::to_array<VkBufferCopy>({
-        {creator.src_positions.offset, dst_positions.offset, creator.src_positions.size},
-        {creator.src_attribs.offset, dst_attribs.offset, creator.src_attribs.size},
-        {creator.src_indices.offset, dst_indices.offset, creator.src_indices.size},
+        {src, dst_positions.offset, layout.positionsSize()},
+        {src + layout.attribsOffset(), dst_attribs.offset, layout.attribsSize()},
+        {src + layout.indicesOffset(), dst_indices.offset, layout.indicesSize()},
         {src_info.offset, dst_info.offset, src_info.size},
     });
     vkCmdCopyBuffer(cmd, m_staging_buffer, m_buffer, copy_regions.size(), copy_regions.data());
 
-    {
-        VkMemoryBarrier barrier = {VK_STRUCTURE_TYPE_MEMORY_BARRIER, nullptr,
-                                   VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT};
-        vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
-                             VK_PIPELINE_STAGE_VERTEX_INPUT_BIT |
-                                 VK_PIPELINE_STAGE_VERTEX_SHADER_BIT,
-                             0, 1, &barrier, 0, nullptr, 0, nullptr);
-    }
-
     return dst_info.offset;
 }
 
+uint32_t MeshData::meshIndex(uint32_t mesh_info_ptr) const {
+    BRTOY_ASSERT(mesh_info_ptr >= m_infos.m_start && mesh_info_ptr < m_infos.m_cur);
+    return (uint32_t)((mesh_info_ptr - m_infos.m_start) / InfoSize);
+}
+
+uint32_t MeshData::meshCount() const {
+    return (uint32_t)((m_infos.m_cur - m_infos.m_start) / InfoSize);
+}
+
 struct Instance {
     M44f transform;
     uint32_t mesh_info_ptr;
-    uint32_t pad[3];
+    // Picks the instance's draw buckets, see DrawBucketsPerMesh in world.hlsl
+    uint32_t mesh_index;
+    uint32_t pad[2];
 };
 static_assert(sizeof(Instance) == 64 + 16);
 
+struct InstanceRange {
+    uint32_t first;
+    uint32_t count;
+};
+
 struct World {
     MeshData &m_mesh_data;
 
     M44f m_view_proj;
+    // Pixels covered by a unit length one unit in front of the camera
+    float m_projection_scale = 1.0f;
     std::vector<Instance> m_instances;
 
     void addInstance(M44f transform, uint32_t mesh);
@@ -194,27 +300,144 @@ void World::addInstance(M44f transform, uint32_t mesh) {
     Instance instance;
     instance.transform = transpose(transform);
     instance.mesh_info_ptr = mesh;
+    instance.mesh_index = m_mesh_data.meshIndex(mesh);
     m_instances.push_back(std::move(instance));
 }
 
+// What the simulation hands to the renderer for one frame. The instances are static and belong
+// to the render thread's World, so only the camera is carried over.
+struct WorldSnapshot {
+    // Set for the frames the benchmark measures
+    std::optional<u64> benchmark_frame;
+    // The projection depends on the backbuffer, which is the renderer's business
+    M44f view;
+};
+
+// Runs either inline before the frame is recorded or, with --pipeline, on its own thread one
+// frame ahead of the renderer.
+struct Simulation {
+    Simulation(const ExampleOptions &options) : m_options(options) {}
+
+    // Advances by one frame and writes the result to snapshot. pipelines_ready starts the
+    // benchmark's frame count.
+    void step(const Input &input, bool pipelines_ready, WorldSnapshot &snapshot);
+
+    const ExampleOptions &m_options;
+    float m_yaw = TwoPi * 0.5f;
+    float m_pitch = 0.0f;
+    V3f m_cam_p = {0.0f, 0.0f, -3.0f};
+    u64 m_benchmark_frame = 0;
+};
+
+void Simulation::step(const Input &input, bool pipelines_ready, WorldSnapshot &snapshot) {
+    BRTOY_PROFILE_ZONE("simulate");
+    snapshot.benchmark_frame.reset();
+
+    bool is_scripted = m_options.benchmark;
+    if (is_scripted) {
+        float t = m_benchmark_frame < m_options.warmup_frame_count
+                      ? 0.0f
+                      : float(m_benchmark_frame - m_options.warmup_frame_count) /
+                            m_options.frame_count;
+        CameraPose pose = scriptedCamera(t);
+        m_cam_p = pose.position;
+        m_yaw = pose.yaw;
+        m_pitch = pose.pitch;
+        if (pipelines_ready)
+            snapshot.benchmark_frame = m_benchmark_frame++;
+    }
+
+    M44f cam;
+    setTranslate(cam, m_cam_p);
+    bool is_looking = input.lmb_is_down && !is_scripted;
+    if (is_looking) {
+        constexpr float look_speed = 0.005f;
+        m_yaw += input.mouse_dx * -look_speed;
+        m_pitch = std::max(-HalfPi, std::min(m_pitch + input.mouse_dy * -look_speed, HalfPi));
+    }
+    rotateY(cam, m_yaw);
+    rotateX(cam, m_pitch);
+    if (is_looking) {
+        float move_speed = 0.1f;
+        if (input.key_is_down[0xA0]) { // VK_LSHIFT
+            move_speed *= 10;
+        }
+        if (input.key_is_down['W']) {
+            m_cam_p += V3f{cam.k.x, cam.k.y, cam.k.z} * -move_speed;
+        }
+        if (input.key_is_down['A']) {
+            m_cam_p += V3f{cam.i.x, cam.i.y, cam.i.z} * -move_speed;
+        }
+        if (input.key_is_down['S']) {
+            m_cam_p += V3f{cam.k.x, cam.k.y, cam.k.z} * move_speed;
+        }
+        if (input.key_is_down['D']) {
+            m_cam_p += V3f{cam.i.x, cam.i.y, cam.i.z} * move_speed;
+        }
+    }
+    snapshot.view = invert(cam);
+}
+
 struct RenderTarget {
-    VkImageView color_view;
-    VkImageView depth_view;
-    VkImageView resolve_view;
+    RenderGraph::Resource color;
+    RenderGraph::Resource depth;
+    RenderGraph::Resource resolve;
     VkRect2D area;
 };
 
 struct WorldConstants {
     M44f view_proj;
+    float projection_scale;
+    float lod_error_pixels;
+    float min_size_pixels;
+    uint32_t draw_impostors;
+    uint32_t instance_count;
+    uint32_t draw_bucket_count;
+};
+
+// Counters written by cullInstances next to the draw command, see CullOutput in world.hlsl
+struct CullStats {
+    uint32_t tested_instances;
+    uint32_t frustum_culled_instances;
+    // Smaller on screen than ExampleOptions::min_size_pixels, drawn as impostors or not at all
+    uint32_t small_culled_instances;
+    // There is no occlusion culling yet, so this stays 0
+    uint32_t occlusion_culled_instances;
+    uint32_t drawn_triangles;
+};
+
+// Followed by the bucket draws at DrawBucketsOffset
+struct CullOutput {
+    // One point per impostor
+    VkDrawIndirectCommand impostor_draw_cmd;
+    CullStats stats;
+    // Sum of the instance counts of the bucket draws
+    uint32_t drawn_instances;
+};
+
+// Statistics of the most recent frame the GPU has completed
+struct DrawWorldStats {
+    uint64_t frame;
+    uint32_t drawn_instances;
+    uint32_t impostor_instances;
+    CullStats cull;
+    // Pipeline statistics need the pipelineStatisticsQuery feature
+    bool has_pipeline_statistics;
+    uint64_t vs_invocations;
+    uint64_t clipping_primitives;
+    uint64_t fs_invocations;
+    uint64_t cs_invocations;
 };
 
 struct Buffer {
-    void free(VmaAllocator allocator);
+    void free(VmaAllocator allocator, MemoryTracker *memory_tracker);
     VkBuffer handle = VK_NULL_HANDLE;
     VmaAllocation mem = VK_NULL_HANDLE;
 };
 
-void Buffer::free(VmaAllocator allocator) {
+void Buffer::free(VmaAllocator allocator, MemoryTracker *memory_tracker) {
+    if (memory_tracker)
+        memory_tracker->untrack(mem);
     vmaDestroyBuffer(allocator, handle, mem);
     handle = VK_NULL_HANDLE;
     mem = VK_NULL_HANDLE;
@@ -223,23 +446,41 @@ void Buffer::free(VmaAllocator allocator) {
 struct DrawWorldPipeline {
     const GfxDevice &m_device;
     VmaAllocator m_allocator;
+    MemoryTracker *m_memory_tracker;
+    PipelineBuilder &m_pipeline_builder;
+    GpuTimeline &m_timeline;
     const World &m_world;
+    const ExampleOptions &m_options;
     VkShaderModule m_cull_cs;
+    VkShaderModule m_build_draws_cs;
+    VkShaderModule m_scatter_visible_cs;
     VkShaderModule m_draw_vs;
     VkShaderModule m_draw_fs;
+    VkShaderModule m_impostor_vs;
+    VkShaderModule m_impostor_fs;
     VkDescriptorSetLayout m_cull_data_layout;
     VkDescriptorSetLayout m_mesh_data_layout;
     VkDescriptorSetLayout m_instance_data_layout;
     VkPipelineLayout m_cull_pipeline_layout;
-    VkPipeline m_cull_pipeline = VK_NULL_HANDLE;
+    PipelineBuilder::Handle m_cull_pipeline;
+    PipelineBuilder::Handle m_build_draws_pipeline;
+    PipelineBuilder::Handle m_scatter_visible_pipeline;
     VkPipelineLayout m_draw_pipeline_layout;
-    VkPipeline m_draw_pipeline = VK_NULL_HANDLE;
+    PipelineBuilder::Handle m_draw_pipeline;
+    PipelineBuilder::Handle m_impostor_pipeline;
     VkDescriptorPool m_descriptor_pool;
     VkDescriptorSet m_mesh_data_descriptor_set;
+    // Two queries per frame, one for the cull dispatches and one for the draw
+    VkQueryPool m_statistics_pool = VK_NULL_HANDLE;
 
     Buffer m_constants;
     Buffer m_instances;
     Buffer m_visible_instances;
+    // Position of each visible instance within its draw bucket
+    Buffer m_bucket_slots;
+    // Centers of the instances drawn as impostors, only sized for them if enabled
+    Buffer m_impostors;
+    VkDeviceSize m_impostors_size;
     Buffer m_draw_cmds;
     Buffer m_readback;
 
@@ -248,71 +489,91 @@ struct DrawWorldPipeline {
         Instance *instances;
         VkDescriptorSet descriptor_set;
         VkDescriptorSet cull_descriptor_set;
-        VkDrawIndirectCommand* draw_cmd_readback;
+        CullOutput *cull_readback;
+        // Signaled by the submission that last used the frame
+        uint64_t timeline_value;
+        uint64_t frame_number;
+        bool has_results;
+        // Instances changed since the frame's buffer was last written
+        SmallVector<InstanceRange, 4> dirty_instances;
     };
-    std::array<Frame, 3> m_frames;
+    std::array<Frame, 3> m_frames = {};
     uint32_t m_frame_index = 0;
+    DrawWorldStats m_stats = {};
 
-    DrawWorldPipeline(const GfxDevice &m_device, VmaAllocator allocator, const World &world);
+    DrawWorldPipeline(const GfxDevice &m_device, VmaAllocator allocator,
+                      MemoryTracker *memory_tracker, PipelineBuilder &pipeline_builder,
+                      GpuTimeline &timeline, const World &world, const ExampleOptions &options);
     ~DrawWorldPipeline();
 
-    uint32_t execute(VkCommandBuffer cmd, const RenderTarget &render_target);
+    bool isReady();
+    // Schedules the instances in the range to be copied from the world into each frame's buffer
+    // the next time that frame is executed
+    void markInstancesDirty(InstanceRange range);
+    // Adds the cull, draw and readback passes to the graph. Until the pipelines are ready, only a
+    // pass clearing the resolve target is added. The commands must be submitted with the next
+    // value of the timeline. Before a frame's buffers are reused, waits for that submission and
+    // reads its statistics into m_stats.
+    void execute(RenderGraph &graph, const RenderTarget &render_target);
+    void readStats(const Frame &frame, uint32_t buffer_index);
 };
 
-static std::vector<std::byte> readEntireFile(const char *filename) {
-    std::vector<std::byte> result;
-    std::ifstream ifs(filename, std::ios::in | std::ios::binary);
-    while (ifs) {
-        std::array<std::byte, 128> buffer;
-        ifs.read((char *)buffer.data(), buffer.size());
-        if (ifs.gcount())
-            result.insert(result.end(), buffer.begin(), buffer.begin() + ifs.gcount());
-    }
-    return result;
-}
-
 inline constexpr VkDeviceSize InstanceCountMax = 1000000;
+// Visible instance entries hold the LOD above the instance index, see VisibleLodShift in world.hlsl
+static_assert(InstanceCountMax <= (1 << 29) && MeshLodCountMax <= 8);
 inline constexpr VkDeviceSize InstancesBufferSize = sizeof(Instance) * InstanceCountMax;
 inline constexpr VkDeviceSize VisibleInstancesBufferSize = sizeof(uint32_t) * InstanceCountMax;
+inline constexpr VkDeviceSize BucketSlotsBufferSize = sizeof(uint32_t) * InstanceCountMax;
+// One draw per mesh and LOD, see DrawBucketsPerMesh in world.hlsl
+inline constexpr uint32_t DrawBucketsPerMesh = 8;
+inline constexpr uint32_t DrawBucketCountMax = MeshData::MeshCountMax * DrawBucketsPerMesh;
+// The largest minStorageBufferOffsetAlignment there is, the bucket draws are bound on their own
+inline constexpr VkDeviceSize DrawBucketsOffset = 256;
+static_assert(sizeof(CullOutput) <= DrawBucketsOffset);
+// World space center, see g_impostors in world.hlsl
+inline constexpr VkDeviceSize ImpostorSize = sizeof(V3f);
 inline constexpr VkDeviceSize ConstantBufferSize = sizeof(WorldConstants);
-inline constexpr VkDeviceSize DrawCmdBufferSize = sizeof(VkDrawIndirectCommand);
-
-DrawWorldPipeline::DrawWorldPipeline(const GfxDevice &device, VmaAllocator allocator,
-                                     const World &world)
-    : m_device(device), m_allocator(allocator), m_world(world) {
-    VkResult result;
-
-    auto cull_cs_code = readEntireFile("cull_instances.spv");
-    struct VkShaderModuleCreateInfo cull_cs_create_info = {
+inline constexpr VkDeviceSize DrawCmdBufferSize =
+    DrawBucketsOffset + sizeof(VkDrawIndirectCommand) * DrawBucketCountMax;
+// Only the CullOutput is read back
+inline constexpr VkDeviceSize ReadbackSize = sizeof(CullOutput);
+// Grows to the high-water mark if a frame overflows it
+inline constexpr size_t FrameArenaSize = 256 * 1024;
+
+static VkShaderModule loadShaderModule(VkDevice device, const char *path) {
+    std::optional<MappedFile> code = mapFile(path);
+    BRTOY_ASSERT(code);
+    VkShaderModuleCreateInfo create_info = {
         .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
         .pNext = nullptr,
         .flags = 0,
-        .codeSize = cull_cs_code.size(),
-        .pCode = (uint32_t *)cull_cs_code.data(),
+        .codeSize = code->size(),
+        .pCode = (const uint32_t *)code->data().data(),
     };
-    result = vkCreateShaderModule(m_device.m_device, &cull_cs_create_info, nullptr, &m_cull_cs);
+    VkShaderModule module = VK_NULL_HANDLE;
+    VkResult result = vkCreateShaderModule(device, &create_info, nullptr, &module);
     BRTOY_ASSERT(result == VK_SUCCESS);
+    return module;
+}
 
-    auto vs_code = readEntireFile("world_vs.spv");
-    struct VkShaderModuleCreateInfo vs_create_info = {
-        .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
-        .pNext = nullptr,
-        .flags = 0,
-        .codeSize = vs_code.size(),
-        .pCode = (uint32_t *)vs_code.data(),
-    };
-    result = vkCreateShaderModule(m_device.m_device, &vs_create_info, nullptr, &m_draw_vs);
-    BRTOY_ASSERT(result == VK_SUCCESS);
+DrawWorldPipeline::DrawWorldPipeline(const GfxDevice &device, VmaAllocator allocator,
+                                     MemoryTracker *memory_tracker,
+                                     PipelineBuilder &pipeline_builder, GpuTimeline &timeline,
+                                     const World &world, const ExampleOptions &options)
+    : m_device(device), m_allocator(allocator), m_memory_tracker(memory_tracker),
+      m_pipeline_builder(pipeline_builder), m_timeline(timeline), m_world(world),
+      m_options(options) {
+    VkResult result;
+    // The bucket draws start at their range of the visible instances
+    BRTOY_ASSERT(m_device.m_enabled_features.drawIndirectFirstInstance);
 
-    auto fs_code = readEntireFile("world_fs.spv");
-    struct VkShaderModuleCreateInfo fs_create_info = {
-        .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
-        .pNext = nullptr,
-        .flags = 0,
-        .codeSize = fs_code.size(),
-        .pCode = (uint32_t *)fs_code.data()};
-    result = vkCreateShaderModule(m_device.m_device, &fs_create_info, nullptr, &m_draw_fs);
-    BRTOY_ASSERT(result == VK_SUCCESS);
+    m_cull_cs = loadShaderModule(m_device.m_device, "cull_instances.spv");
+    m_build_draws_cs = loadShaderModule(m_device.m_device, "build_draws.spv");
+    m_scatter_visible_cs = loadShaderModule(m_device.m_device, "scatter_visible.spv");
+    m_draw_vs = loadShaderModule(m_device.m_device, "world_vs.spv");
+    m_draw_fs = loadShaderModule(m_device.m_device, "world_fs.spv");
+    m_impostor_vs = loadShaderModule(m_device.m_device, "impostor_vs.spv");
+    m_impostor_fs = loadShaderModule(m_device.m_device, "impostor_fs.spv");
 
     std::array mesh_data_bindings = std::to_array<VkDescriptorSetLayoutBinding>({
         {
@@ -355,6 +616,13 @@ DrawWorldPipeline::DrawWorldPipeline(const GfxDevice &device, VmaAllocator alloc
              .descriptorCount = 1,
              .stageFlags = VK_SHADER_STAGE_ALL,
              .pImmutableSamplers = nullptr,
+         },
+         {
+             .binding = 3,
+             .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+             .descriptorCount = 1,
+             .stageFlags = VK_SHADER_STAGE_ALL,
+             .pImmutableSamplers = nullptr,
          }});
     VkDescriptorSetLayoutCreateInfo instance_data_layout_create_info = {
         .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
@@ -375,6 +643,20 @@ DrawWorldPipeline::DrawWorldPipeline(const GfxDevice &device, VmaAllocator alloc
             .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
             .pImmutableSamplers = nullptr,
         },
+        {
+            .binding = 1,
+            .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            .descriptorCount = 1,
+            .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+            .pImmutableSamplers = nullptr,
+        },
+        {
+            .binding = 2,
+            .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            .descriptorCount = 1,
+            .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+            .pImmutableSamplers = nullptr,
+        },
     });
     VkDescriptorSetLayoutCreateInfo cull_data_layout_create_info = {
         .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
@@ -387,16 +669,6 @@ DrawWorldPipeline::DrawWorldPipeline(const GfxDevice &device, VmaAllocator alloc
                                          &m_cull_data_layout);
     BRTOY_ASSERT(result == VK_SUCCESS);
 
-    VkPipelineShaderStageCreateInfo cull_pipeline_shader_stage = {
-        .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
-        .pNext = nullptr,
-        .flags = 0,
-        .stage = VK_SHADER_STAGE_COMPUTE_BIT,
-        .module = m_cull_cs,
-        .pName = "cullInstances",
-        .pSpecializationInfo = nullptr,
-    };
-
     std::array cull_set_layouts = {m_mesh_data_layout, m_instance_data_layout, m_cull_data_layout};
     VkPipelineLayoutCreateInfo cull_pipeline_layout_create_info = {
         .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
@@ -412,144 +684,40 @@ DrawWorldPipeline::DrawWorldPipeline(const GfxDevice &device, VmaAllocator alloc
                                     &m_cull_pipeline_layout);
     BRTOY_ASSERT(result == VK_SUCCESS);
 
-    VkComputePipelineCreateInfo cull_pipeline_create_info = {
-        .sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
-        .pNext = nullptr,
-        .flags = 0,
-        .stage = cull_pipeline_shader_stage,
-        .layout = m_cull_pipeline_layout,
-        .basePipelineHandle = VK_NULL_HANDLE,
-        .basePipelineIndex = 0,
-    };
-
-    vkCreateComputePipelines(m_device.m_device, VK_NULL_HANDLE, 1, &cull_pipeline_create_info,
-                             nullptr, &m_cull_pipeline);
-
-    VkPipelineShaderStageCreateInfo vs_stage = {
-        .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
-        .pNext = nullptr,
-        .flags = 0,
-        .stage = VK_SHADER_STAGE_VERTEX_BIT,
-        .module = m_draw_vs,
-        .pName = "vsMain",
-        .pSpecializationInfo = nullptr,
-    };
-    VkPipelineShaderStageCreateInfo fs_stage = {
-        .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
-        .pNext = nullptr,
-        .flags = 0,
-        .stage = VK_SHADER_STAGE_FRAGMENT_BIT,
-        .module = m_draw_fs,
-        .pName = "fsMain",
-        .pSpecializationInfo = nullptr,
-    };
-    std::array stages = std::to_array({vs_stage, fs_stage});
-
-    VkPipelineVertexInputStateCreateInfo vertex_input_state = {
-        .sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
-        .pNext = nullptr,
-        .flags = 0,
-        .vertexBindingDescriptionCount = 0,
-        .pVertexBindingDescriptions = nullptr,
-        .vertexAttributeDescriptionCount = 0,
-        .pVertexAttributeDescriptions = nullptr,
-    };
-    VkPipelineInputAssemblyStateCreateInfo input_assembly_state = {
-        .sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO,
-        .pNext = nullptr,
-        .flags = 0,
-        .topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST,
-        .primitiveRestartEnable = VK_FALSE,
-    };
-    VkPipelineTessellationStateCreateInfo tessellation_state = {
-        .sType = VK_STRUCTURE_TYPE_PIPELINE_TESSELLATION_STATE_CREATE_INFO,
-        .pNext = nullptr,
-        .flags = 0,
-        .patchControlPoints = 0,
-    };
-    VkPipelineViewportStateCreateInfo viewport_state = {
-        .sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO,
-        .pNext = nullptr,
-        .flags = 0,
-        .viewportCount = 1,
-        .pViewports = nullptr,
-        .scissorCount = 1,
-        .pScissors = nullptr,
-    };
-    VkPipelineRasterizationStateCreateInfo rasterization_state = {
-        .sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO,
-        .pNext = nullptr,
-        .flags = 0,
-        .depthClampEnable = VK_FALSE,
-        .rasterizerDiscardEnable = VK_FALSE,
-        .polygonMode = VK_POLYGON_MODE_FILL,
-        .cullMode = VK_CULL_MODE_BACK_BIT,
-        .frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE,
-        .depthBiasEnable = VK_FALSE,
-        .depthBiasConstantFactor = 0.0f,
-        .depthBiasClamp = 0.0f,
-        .depthBiasSlopeFactor = 0.0f,
-        .lineWidth = 1.0f,
-    };
-    VkPipelineMultisampleStateCreateInfo multisample_state = {
-        .sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO,
-        .pNext = nullptr,
-        .flags = 0,
-        .rasterizationSamples = VK_SAMPLE_COUNT_8_BIT,
-        .sampleShadingEnable = VK_FALSE,
-        .minSampleShading = 0.0f,
-        .pSampleMask = nullptr,
-        .alphaToCoverageEnable = VK_FALSE,
-        .alphaToOneEnable = VK_FALSE,
-    };
-    VkPipelineDepthStencilStateCreateInfo depth_stencil_state = {
-        .sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO,
-        .pNext = nullptr,
-        .flags = 0,
-        .depthTestEnable = VK_TRUE,
-        .depthWriteEnable = VK_TRUE,
-        .depthCompareOp = VK_COMPARE_OP_LESS,
-        .depthBoundsTestEnable = VK_FALSE,
-        .stencilTestEnable = VK_FALSE,
-        .front = {},
-        .back = {},
-        .minDepthBounds = 0.0f,
-        .maxDepthBounds = 1.0f,
-    };
-    VkBool32 blendEnable;
-    VkBlendFactor srcColorBlendFactor;
-    VkBlendFactor dstColorBlendFactor;
-    VkBlendOp colorBlendOp;
-    VkBlendFactor srcAlphaBlendFactor;
-    VkBlendFactor dstAlphaBlendFactor;
-    VkBlendOp alphaBlendOp;
-    VkColorComponentFlags colorWriteMask;
-    std::array blend_attachments = std::to_array<VkPipelineColorBlendAttachmentState>(
-        {{VK_FALSE, VK_BLEND_FACTOR_ZERO, VK_BLEND_FACTOR_ZERO, VK_BLEND_OP_ADD,
-          VK_BLEND_FACTOR_ZERO, VK_BLEND_FACTOR_ZERO, VK_BLEND_OP_ADD,
-          VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT |
-              VK_COLOR_COMPONENT_A_BIT}});
-    VkPipelineColorBlendStateCreateInfo color_blend_state = {
-        .sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO,
-        .pNext = nullptr,
-        .flags = 0,
-        .logicOpEnable = VK_FALSE,
-        .logicOp = VK_LOGIC_OP_CLEAR,
-        .attachmentCount = blend_attachments.size(),
-        .pAttachments = blend_attachments.data(),
-        .blendConstants = {},
-    };
-    std::array dynamic_states = std::to_array<VkDynamicState>({
-        VK_DYNAMIC_STATE_VIEWPORT,
-        VK_DYNAMIC_STATE_SCISSOR,
-    });
-    VkPipelineDynamicStateCreateInfo dynamic_state = {
-        .sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO,
-        .pNext = nullptr,
-        .flags = 0,
-        .dynamicStateCount = dynamic_states.size(),
-        .pDynamicStates = dynamic_states.data(),
+    // The cull, build draws and scatter passes share the layout and differ in shaders only
+    auto cull_pipeline_build_fn = [layout = m_cull_pipeline_layout](VkShaderModule cs,
+                                                                    const char *cs_entry_point) {
+        VkComputePipelineCreateInfo create_info = {
+            .sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+            .pNext = nullptr,
+            .flags = 0,
+            .stage =
+                {
+                    .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+                    .pNext = nullptr,
+                    .flags = 0,
+                    .stage = VK_SHADER_STAGE_COMPUTE_BIT,
+                    .module = cs,
+                    .pName = cs_entry_point,
+                    .pSpecializationInfo = nullptr,
+                },
+            .layout = layout,
+            .basePipelineHandle = VK_NULL_HANDLE,
+            .basePipelineIndex = 0,
+        };
+        return [create_info](VkDevice device, VkPipelineCache pipeline_cache) {
+            VkPipeline pipeline = VK_NULL_HANDLE;
+            VkResult result = vkCreateComputePipelines(device, pipeline_cache, 1, &create_info,
+                                                       nullptr, &pipeline);
+            BRTOY_ASSERT(result == VK_SUCCESS);
+            return pipeline;
+        };
     };
+    m_cull_pipeline = m_pipeline_builder.build(cull_pipeline_build_fn(m_cull_cs, "cullInstances"));
+    m_build_draws_pipeline =
+        m_pipeline_builder.build(cull_pipeline_build_fn(m_build_draws_cs, "buildDraws"));
+    m_scatter_visible_pipeline =
+        m_pipeline_builder.build(cull_pipeline_build_fn(m_scatter_visible_cs, "scatterVisible"));
 
     std::array set_layouts = std::to_array({m_mesh_data_layout, m_instance_data_layout});
     VkPipelineLayoutCreateInfo layout_create_info = {
@@ -565,42 +733,176 @@ DrawWorldPipeline::DrawWorldPipeline(const GfxDevice &device, VmaAllocator alloc
                                     &m_draw_pipeline_layout);
     BRTOY_ASSERT(result == VK_SUCCESS);
 
-    VkGraphicsPipelineCreateInfo pipeline_create_info = {
-        .sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
-        .pNext = nullptr,
-        .flags = 0,
-        .stageCount = stages.size(),
-        .pStages = stages.data(),
-        .pVertexInputState = &vertex_input_state,
-        .pInputAssemblyState = &input_assembly_state,
-        .pTessellationState = &tessellation_state,
-        .pViewportState = &viewport_state,
-        .pRasterizationState = &rasterization_state,
-        .pMultisampleState = &multisample_state,
-        .pDepthStencilState = &depth_stencil_state,
-        .pColorBlendState = &color_blend_state,
-        .pDynamicState = &dynamic_state,
-        .layout = m_draw_pipeline_layout,
-        .renderPass = VK_NULL_HANDLE,
-        .subpass = 0,
-        .basePipelineHandle = VK_NULL_HANDLE,
-        .basePipelineIndex = 0,
-    };
+    // The create info points to state on the stack, so it's all set up on the worker thread. The
+    // meshes and the impostors differ in shaders and topology only.
+    auto draw_pipeline_build_fn = [layout = m_draw_pipeline_layout](
+                                      VkShaderModule vs, const char *vs_entry_point,
+                                      VkShaderModule fs, const char *fs_entry_point,
+                                      VkPrimitiveTopology topology) {
+        return [=](VkDevice device, VkPipelineCache pipeline_cache) {
+            VkPipelineShaderStageCreateInfo vs_stage = {
+                .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+                .pNext = nullptr,
+                .flags = 0,
+                .stage = VK_SHADER_STAGE_VERTEX_BIT,
+                .module = vs,
+                .pName = vs_entry_point,
+                .pSpecializationInfo = nullptr,
+            };
+            VkPipelineShaderStageCreateInfo fs_stage = {
+                .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+                .pNext = nullptr,
+                .flags = 0,
+                .stage = VK_SHADER_STAGE_FRAGMENT_BIT,
+                .module = fs,
+                .pName = fs_entry_point,
+                .pSpecializationInfo = nullptr,
+            };
+            std::array stages = std::to_array({vs_stage, fs_stage});
+
+            VkPipelineVertexInputStateCreateInfo vertex_input_state = {
+                .sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
+                .pNext = nullptr,
+                .flags = 0,
+                .vertexBindingDescriptionCount = 0,
+                .pVertexBindingDescriptions = nullptr,
+                .vertexAttributeDescriptionCount = 0,
+                .pVertexAttributeDescriptions = nullptr,
+            };
+            VkPipelineInputAssemblyStateCreateInfo input_assembly_state = {
+                .sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO,
+                .pNext = nullptr,
+                .flags = 0,
+                .topology = topology,
+                .primitiveRestartEnable = VK_FALSE,
+            };
+            VkPipelineTessellationStateCreateInfo tessellation_state = {
+                .sType = VK_STRUCTURE_TYPE_PIPELINE_TESSELLATION_STATE_CREATE_INFO,
+                .pNext = nullptr,
+                .flags = 0,
+                .patchControlPoints = 0,
+            };
+            VkPipelineViewportStateCreateInfo viewport_state = {
+                .sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO,
+                .pNext = nullptr,
+                .flags = 0,
+                .viewportCount = 1,
+                .pViewports = nullptr,
+                .scissorCount = 1,
+                .pScissors = nullptr,
+            };
+            VkPipelineRasterizationStateCreateInfo rasterization_state = {
+                .sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO,
+                .pNext = nullptr,
+                .flags = 0,
+                .depthClampEnable = VK_FALSE,
+                .rasterizerDiscardEnable = VK_FALSE,
+                .polygonMode = VK_POLYGON_MODE_FILL,
+                .cullMode = VK_CULL_MODE_BACK_BIT,
+                .frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE,
+                .depthBiasEnable = VK_FALSE,
+                .depthBiasConstantFactor = 0.0f,
+                .depthBiasClamp = 0.0f,
+                .depthBiasSlopeFactor = 0.0f,
+                .lineWidth = 1.0f,
+            };
+            VkPipelineMultisampleStateCreateInfo multisample_state = {
+                .sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO,
+                .pNext = nullptr,
+                .flags = 0,
+                .rasterizationSamples = VK_SAMPLE_COUNT_8_BIT,
+                .sampleShadingEnable = VK_FALSE,
+                .minSampleShading = 0.0f,
+                .pSampleMask = nullptr,
+                .alphaToCoverageEnable = VK_FALSE,
+                .alphaToOneEnable = VK_FALSE,
+            };
+            VkPipelineDepthStencilStateCreateInfo depth_stencil_state = {
+                .sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO,
+                .pNext = nullptr,
+                .flags = 0,
+                .depthTestEnable = VK_TRUE,
+                .depthWriteEnable = VK_TRUE,
+                .depthCompareOp = VK_COMPARE_OP_LESS,
+                .depthBoundsTestEnable = VK_FALSE,
+                .stencilTestEnable = VK_FALSE,
+                .front = {},
+                .back = {},
+                .minDepthBounds = 0.0f,
+                .maxDepthBounds = 1.0f,
+            };
+            std::array blend_attachments = std::to_array<VkPipelineColorBlendAttachmentState>(
+                {{VK_FALSE, VK_BLEND_FACTOR_ZERO, VK_BLEND_FACTOR_ZERO, VK_BLEND_OP_ADD,
+                  VK_BLEND_FACTOR_ZERO, VK_BLEND_FACTOR_ZERO, VK_BLEND_OP_ADD,
+                  VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT |
+                      VK_COLOR_COMPONENT_A_BIT}});
+            VkPipelineColorBlendStateCreateInfo color_blend_state = {
+                .sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO,
+                .pNext = nullptr,
+                .flags = 0,
+                .logicOpEnable = VK_FALSE,
+                .logicOp = VK_LOGIC_OP_CLEAR,
+                .attachmentCount = blend_attachments.size(),
+                .pAttachments = blend_attachments.data(),
+                .blendConstants = {},
+            };
+            std::array dynamic_states = std::to_array<VkDynamicState>({
+                VK_DYNAMIC_STATE_VIEWPORT,
+                VK_DYNAMIC_STATE_SCISSOR,
+            });
+            VkPipelineDynamicStateCreateInfo dynamic_state = {
+                .sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO,
+                .pNext = nullptr,
+                .flags = 0,
+                .dynamicStateCount = dynamic_states.size(),
+                .pDynamicStates = dynamic_states.data(),
+            };
 
-    std::array color_formats = {VK_FORMAT_B8G8R8A8_SRGB};
-    VkPipelineRenderingCreateInfo rendering_create_info = {
-        .sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO,
-        .pNext = pipeline_create_info.pNext,
-        .viewMask = 0,
-        .colorAttachmentCount = color_formats.size(),
-        .pColorAttachmentFormats = color_formats.data(),
-        .depthAttachmentFormat = VK_FORMAT_D32_SFLOAT,
-        .stencilAttachmentFormat = VK_FORMAT_UNDEFINED,
+            VkGraphicsPipelineCreateInfo pipeline_create_info = {
+                .sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
+                .pNext = nullptr,
+                .flags = 0,
+                .stageCount = stages.size(),
+                .pStages = stages.data(),
+                .pVertexInputState = &vertex_input_state,
+                .pInputAssemblyState = &input_assembly_state,
+                .pTessellationState = &tessellation_state,
+                .pViewportState = &viewport_state,
+                .pRasterizationState = &rasterization_state,
+                .pMultisampleState = &multisample_state,
+                .pDepthStencilState = &depth_stencil_state,
+                .pColorBlendState = &color_blend_state,
+                .pDynamicState = &dynamic_state,
+                .layout = layout,
+                .renderPass = VK_NULL_HANDLE,
+                .subpass = 0,
+                .basePipelineHandle = VK_NULL_HANDLE,
+                .basePipelineIndex = 0,
+            };
+
+            std::array color_formats = {VK_FORMAT_B8G8R8A8_SRGB};
+            VkPipelineRenderingCreateInfo rendering_create_info = {
+                .sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO,
+                .pNext = pipeline_create_info.pNext,
+                .viewMask = 0,
+                .colorAttachmentCount = color_formats.size(),
+                .pColorAttachmentFormats = color_formats.data(),
+                .depthAttachmentFormat = VK_FORMAT_D32_SFLOAT,
+                .stencilAttachmentFormat = VK_FORMAT_UNDEFINED,
+            };
+            pipeline_create_info.pNext = &rendering_create_info;
+            VkPipeline pipeline = VK_NULL_HANDLE;
+            VkResult result = vkCreateGraphicsPipelines(device, pipeline_cache, 1,
+                                                        &pipeline_create_info, nullptr, &pipeline);
+            BRTOY_ASSERT(result == VK_SUCCESS);
+            return pipeline;
+        };
     };
-    pipeline_create_info.pNext = &rendering_create_info;
-    result = vkCreateGraphicsPipelines(m_device.m_device, VK_NULL_HANDLE, 1, &pipeline_create_info,
-                                       nullptr, &m_draw_pipeline);
-    BRTOY_ASSERT(result == VK_SUCCESS);
+    m_draw_pipeline = m_pipeline_builder.build(draw_pipeline_build_fn(
+        m_draw_vs, "vsMain", m_draw_fs, "fsMain", VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST));
+    m_impostor_pipeline = m_pipeline_builder.build(
+        draw_pipeline_build_fn(m_impostor_vs, "vsImpostor", m_impostor_fs, "fsImpostor",
+                               VK_PRIMITIVE_TOPOLOGY_POINT_LIST));
 
     std::array descriptor_set_layouts = {
         m_mesh_data_layout, m_instance_data_layout, m_cull_data_layout, m_instance_data_layout,
@@ -699,6 +1001,32 @@ DrawWorldPipeline::DrawWorldPipeline(const GfxDevice &device, VmaAllocator alloc
                     &visible_instances_allocation_create_info, &m_visible_instances.handle,
                     &m_visible_instances.mem, nullptr);
 
+    VkBufferCreateInfo bucket_slots_buffer_create_info = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+        .pNext = nullptr,
+        .flags = 0,
+        .size = BucketSlotsBufferSize * m_frames.size(),
+        .usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+    };
+    vmaCreateBuffer(m_allocator, &bucket_slots_buffer_create_info,
+                    &visible_instances_allocation_create_info, &m_bucket_slots.handle,
+                    &m_bucket_slots.mem, nullptr);
+
+    // The cull shader doesn't write to it unless impostors are enabled, but it must be bound
+    m_impostors_size =
+        alignUp(ImpostorSize * (m_options.impostors ? InstanceCountMax : 1),
+                physical_device_properties.limits.minStorageBufferOffsetAlignment);
+    VkBufferCreateInfo impostors_buffer_create_info = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+        .pNext = nullptr,
+        .flags = 0,
+        .size = m_impostors_size * m_frames.size(),
+        .usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+    };
+    vmaCreateBuffer(m_allocator, &impostors_buffer_create_info,
+                    &visible_instances_allocation_create_info, &m_impostors.handle,
+                    &m_impostors.mem, nullptr);
+
     VkBufferCreateInfo draw_cmds_buffer_create_info = {
         .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
         .pNext = nullptr,
@@ -719,7 +1047,7 @@ DrawWorldPipeline::DrawWorldPipeline(const GfxDevice &device, VmaAllocator alloc
         .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
         .pNext = nullptr,
         .flags = 0,
-        .size = DrawCmdBufferSize * m_frames.size(),
+        .size = ReadbackSize * m_frames.size(),
         .usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT,
     };
     VmaAllocationCreateInfo readback_allocation_create_info = {
@@ -730,13 +1058,24 @@ DrawWorldPipeline::DrawWorldPipeline(const GfxDevice &device, VmaAllocator alloc
     vmaCreateBuffer(m_allocator, &readback_buffer_create_info, &readback_allocation_create_info,
                     &m_readback.handle, &m_readback.mem, &readback_allocation_info);
 
+    if (m_memory_tracker) {
+        m_memory_tracker->track(m_constants.mem, MemoryTag::Other);
+        m_memory_tracker->track(m_instances.mem, MemoryTag::Instances);
+        m_memory_tracker->track(m_visible_instances.mem, MemoryTag::Instances);
+        m_memory_tracker->track(m_bucket_slots.mem, MemoryTag::Culling);
+        m_memory_tracker->track(m_impostors.mem, MemoryTag::Instances);
+        m_memory_tracker->track(m_draw_cmds.mem, MemoryTag::Culling);
+        m_memory_tracker->track(m_readback.mem, MemoryTag::Readback);
+    }
+
     for (size_t i = 0; i < m_frames.size(); ++i) {
         Frame &frame = m_frames[i];
         frame.constants = (WorldConstants *)((uint8_t *)constants_allocation_info.pMappedData +
                                              alignedConstantBufferSize * i);
         frame.instances = (Instance *)((uint8_t *)instances_allocation_info.pMappedData +
                                        InstancesBufferSize * i);
-        frame.draw_cmd_readback = (VkDrawIndirectCommand*)((uint8_t*)readback_allocation_info.pMappedData + DrawCmdBufferSize * i);
+        frame.cull_readback = (CullOutput *)((uint8_t *)readback_allocation_info.pMappedData +
+                                             ReadbackSize * i);
 
         VkDescriptorBufferInfo constant_descriptor_info = {
             m_constants.handle, alignedConstantBufferSize * i, alignedConstantBufferSize};
@@ -744,8 +1083,15 @@ DrawWorldPipeline::DrawWorldPipeline(const GfxDevice &device, VmaAllocator alloc
             m_instances.handle, InstancesBufferSize * i, InstancesBufferSize};
         VkDescriptorBufferInfo visible_instances_descriptor_info = {
             m_visible_instances.handle, VisibleInstancesBufferSize * i, VisibleInstancesBufferSize};
+        VkDescriptorBufferInfo impostors_descriptor_info = {
+            m_impostors.handle, m_impostors_size * i, m_impostors_size};
         VkDescriptorBufferInfo draw_cmd_descriptor_info = {
-            m_draw_cmds.handle, DrawCmdBufferSize * i, DrawCmdBufferSize};
+            m_draw_cmds.handle, DrawCmdBufferSize * i, sizeof(CullOutput)};
+        VkDescriptorBufferInfo bucket_draws_descriptor_info = {
+            m_draw_cmds.handle, DrawCmdBufferSize * i + DrawBucketsOffset,
+            DrawCmdBufferSize - DrawBucketsOffset};
+        VkDescriptorBufferInfo bucket_slots_descriptor_info = {
+            m_bucket_slots.handle, BucketSlotsBufferSize * i, BucketSlotsBufferSize};
 
         frame.descriptor_set = descriptor_sets[1 + i * 2 + 0];
         frame.cull_descriptor_set = descriptor_sets[1 + i * 2 + 1];
@@ -757,232 +1103,462 @@ DrawWorldPipeline::DrawWorldPipeline(const GfxDevice &device, VmaAllocator alloc
              nullptr},
             {VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET, nullptr, frame.descriptor_set, 2, 0, 1,
              VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, nullptr, &constant_descriptor_info, nullptr},
+            {VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET, nullptr, frame.descriptor_set, 3, 0, 1,
+             VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, nullptr, &impostors_descriptor_info, nullptr},
             {VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET, nullptr, frame.cull_descriptor_set, 0, 0, 1,
              VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, nullptr, &draw_cmd_descriptor_info, nullptr},
+            {VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET, nullptr, frame.cull_descriptor_set, 1, 0, 1,
+             VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, nullptr, &bucket_draws_descriptor_info, nullptr},
+            {VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET, nullptr, frame.cull_descriptor_set, 2, 0, 1,
+             VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, nullptr, &bucket_slots_descriptor_info, nullptr},
         });
         vkUpdateDescriptorSets(m_device.m_device, descriptor_writes.size(),
                                descriptor_writes.data(), 0, nullptr);
     }
+    markInstancesDirty({0, (uint32_t)m_world.m_instances.size()});
+
+    if (m_device.m_enabled_features.pipelineStatisticsQuery) {
+        VkQueryPoolCreateInfo statistics_pool_create_info = {
+            .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+            .pNext = nullptr,
+            .flags = 0,
+            .queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS,
+            .queryCount = 2 * (uint32_t)m_frames.size(),
+            .pipelineStatistics = VK_QUERY_PIPELINE_STATISTIC_VERTEX_SHADER_INVOCATIONS_BIT |
+                                  VK_QUERY_PIPELINE_STATISTIC_CLIPPING_PRIMITIVES_BIT |
+                                  VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT |
+                                  VK_QUERY_PIPELINE_STATISTIC_COMPUTE_SHADER_INVOCATIONS_BIT,
+        };
+        result = vkCreateQueryPool(m_device.m_device, &statistics_pool_create_info, nullptr,
+                                   &m_statistics_pool);
+        BRTOY_ASSERT(result == VK_SUCCESS);
+    }
 }
 
 DrawWorldPipeline::~DrawWorldPipeline() {
     VkDevice dev = m_device.m_device;
 
-    m_readback.free(m_allocator);
-    m_draw_cmds.free(m_allocator);
-    m_visible_instances.free(m_allocator);
-    m_instances.free(m_allocator);
-    m_constants.free(m_allocator);
+    // The builder owns the pipelines, but the builds must finish before the modules go away
+    m_pipeline_builder.wait(m_cull_pipeline);
+    m_pipeline_builder.wait(m_build_draws_pipeline);
+    m_pipeline_builder.wait(m_scatter_visible_pipeline);
+    m_pipeline_builder.wait(m_draw_pipeline);
+    m_pipeline_builder.wait(m_impostor_pipeline);
+
+    vkDestroyQueryPool(dev, m_statistics_pool, nullptr);
+    m_readback.free(m_allocator, m_memory_tracker);
+    m_draw_cmds.free(m_allocator, m_memory_tracker);
+    m_impostors.free(m_allocator, m_memory_tracker);
+    m_bucket_slots.free(m_allocator, m_memory_tracker);
+    m_visible_instances.free(m_allocator, m_memory_tracker);
+    m_instances.free(m_allocator, m_memory_tracker);
+    m_constants.free(m_allocator, m_memory_tracker);
 
     vkDestroyDescriptorPool(dev, m_descriptor_pool, nullptr);
-    vkDestroyPipeline(dev, m_draw_pipeline, nullptr);
     vkDestroyPipelineLayout(dev, m_draw_pipeline_layout, nullptr);
-    vkDestroyPipeline(dev, m_cull_pipeline, nullptr);
     vkDestroyPipelineLayout(dev, m_cull_pipeline_layout, nullptr);
     vkDestroyDescriptorSetLayout(dev, m_cull_data_layout, nullptr);
     vkDestroyDescriptorSetLayout(dev, m_instance_data_layout, nullptr);
     vkDestroyDescriptorSetLayout(dev, m_mesh_data_layout, nullptr);
     vkDestroyShaderModule(dev, m_cull_cs, nullptr);
+    vkDestroyShaderModule(dev, m_build_draws_cs, nullptr);
+    vkDestroyShaderModule(dev, m_scatter_visible_cs, nullptr);
     vkDestroyShaderModule(dev, m_draw_vs, nullptr);
     vkDestroyShaderModule(dev, m_draw_fs, nullptr);
+    vkDestroyShaderModule(dev, m_impostor_vs, nullptr);
+    vkDestroyShaderModule(dev, m_impostor_fs, nullptr);
 }
 
-uint32_t DrawWorldPipeline::execute(VkCommandBuffer cmd, const RenderTarget &render_target) {
-    uint32_t buffer_index = m_frame_index % m_frames.size();
-    Frame &frame = m_frames[buffer_index];
-    vkCmdFillBuffer(cmd, m_draw_cmds.handle, buffer_index * DrawCmdBufferSize, DrawCmdBufferSize,
-                    0);
+bool DrawWorldPipeline::isReady() {
+    return m_pipeline_builder.get(m_cull_pipeline) != VK_NULL_HANDLE &&
+           m_pipeline_builder.get(m_build_draws_pipeline) != VK_NULL_HANDLE &&
+           m_pipeline_builder.get(m_scatter_visible_pipeline) != VK_NULL_HANDLE &&
+           m_pipeline_builder.get(m_draw_pipeline) != VK_NULL_HANDLE &&
+           m_pipeline_builder.get(m_impostor_pipeline) != VK_NULL_HANDLE;
+}
 
-    VkMemoryBarrier barrier = {
-        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
-        .pNext = nullptr,
-        .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
-        .dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
-    };
-    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
-                         0, 1, &barrier, 0, nullptr, 0, nullptr);
-
-    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, m_cull_pipeline);
-    std::array cull_descriptor_sets = std::to_array(
-        {m_mesh_data_descriptor_set, frame.descriptor_set, frame.cull_descriptor_set});
-    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, m_cull_pipeline_layout, 0,
-                            cull_descriptor_sets.size(), cull_descriptor_sets.data(), 0, nullptr);
-    uint32_t thread_group_size = 256;
-    uint32_t thread_group_count =
-        (m_world.m_instances.size() + thread_group_size - 1) / thread_group_size;
-    vkCmdDispatch(cmd, thread_group_count, 1, 1);
-
-    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
-    barrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
-    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
-                         VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT,
-                         0, 1, &barrier, 0, nullptr, 0, nullptr);
-
-    VkClearValue color_clear;
-    color_clear.color.float32[0] = 0.04f;
-    color_clear.color.float32[1] = 0.04f;
-    color_clear.color.float32[2] = 0.04f;
-    color_clear.color.float32[3] = 0;
-    VkRenderingAttachmentInfo color_attachment = {
-        .sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO,
-        .pNext = nullptr,
-        .imageView = render_target.color_view,
-        .imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
-        .resolveMode = VK_RESOLVE_MODE_AVERAGE_BIT,
-        .resolveImageView = render_target.resolve_view,
-        .resolveImageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
-        .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
-        .storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
-        .clearValue = color_clear,
-    };
+void DrawWorldPipeline::markInstancesDirty(InstanceRange range) {
+    BRTOY_ASSERT(range.first + range.count <= m_world.m_instances.size());
+    for (Frame &frame : m_frames)
+        frame.dirty_instances.push_back(range);
+}
 
-    VkClearValue depth_clear;
-    depth_clear.depthStencil.depth = 1.0f;
-    VkRenderingAttachmentInfo depth_attachment = {
-        .sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO,
-        .pNext = nullptr,
-        .imageView = render_target.depth_view,
-        .imageLayout = VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL,
-        .resolveMode = VK_RESOLVE_MODE_NONE,
-        .resolveImageView = VK_NULL_HANDLE,
-        .resolveImageLayout = VK_IMAGE_LAYOUT_UNDEFINED,
-        .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
-        .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
-        .clearValue = depth_clear,
-    };
+void DrawWorldPipeline::readStats(const Frame &frame, uint32_t buffer_index) {
+    vmaInvalidateAllocation(m_allocator, m_readback.mem, ReadbackSize * buffer_index,
+                            ReadbackSize);
+    m_stats.frame = frame.frame_number;
+    m_stats.drawn_instances = frame.cull_readback->drawn_instances;
+    m_stats.impostor_instances = frame.cull_readback->impostor_draw_cmd.vertexCount;
+    m_stats.cull = frame.cull_readback->stats;
+    m_stats.has_pipeline_statistics = false;
+    if (m_statistics_pool) {
+        // Values come in the order of the statistic bits: VS, clipping primitives, FS, CS
+        std::array<std::array<uint64_t, 4>, 2> results;
+        VkResult result = vkGetQueryPoolResults(
+            m_device.m_device, m_statistics_pool, 2 * buffer_index, (uint32_t)results.size(),
+            sizeof(results), results.data(), sizeof(results[0]), VK_QUERY_RESULT_64_BIT);
+        if (result == VK_SUCCESS) {
+            m_stats.has_pipeline_statistics = true;
+            m_stats.vs_invocations = results[0][0] + results[1][0];
+            m_stats.clipping_primitives = results[0][1] + results[1][1];
+            m_stats.fs_invocations = results[0][2] + results[1][2];
+            m_stats.cs_invocations = results[0][3] + results[1][3];
+        }
+    }
+}
 
-    VkRenderingInfo rendering_info = {
-        .sType = VK_STRUCTURE_TYPE_RENDERING_INFO,
-        .pNext = nullptr,
-        .flags = 0,
-        .renderArea = render_target.area,
-        .layerCount = 1,
-        .viewMask = 0,
-        .colorAttachmentCount = 1,
-        .pColorAttachments = &color_attachment,
-        .pDepthAttachment = &depth_attachment,
-        .pStencilAttachment = nullptr,
-    };
+void DrawWorldPipeline::execute(RenderGraph &graph, const RenderTarget &render_target) {
+    BRTOY_PROFILE_ZONE("DrawWorldPipeline::execute");
+    if (!isReady()) {
+        graph
+            .addPass("clear_resolve",
+                     [=](VkCommandBuffer cmd, const RenderGraph &graph) {
+                         VkClearColorValue clear_color = {{0.04f, 0.04f, 0.04f, 0.0f}};
+                         VkImageSubresourceRange range = {
+                             .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                             .baseMipLevel = 0,
+                             .levelCount = 1,
+                             .baseArrayLayer = 0,
+                             .layerCount = 1,
+                         };
+                         vkCmdClearColorImage(cmd, graph.image(render_target.resolve),
+                                              VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, &clear_color,
+                                              1, &range);
+                     })
+            .use(render_target.resolve, RenderGraphUsage::TransferDst);
+        return;
+    }
 
-    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, m_draw_pipeline);
-    vkCmdBeginRendering(cmd, &rendering_info);
-    std::array viewports = std::to_array<VkViewport>(
-        {{(float)render_target.area.offset.x, (float)render_target.area.offset.y,
-          (float)render_target.area.extent.width, (float)render_target.area.extent.height, 0.0f,
-          1.0f}});
-    vkCmdSetViewport(cmd, 0, viewports.size(), viewports.data());
-    std::array scissors = std::to_array({render_target.area});
-    vkCmdSetScissor(cmd, 0, scissors.size(), scissors.data());
-    std::array draw_descriptor_sets =
-        std::to_array({m_mesh_data_descriptor_set, frame.descriptor_set});
-    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, m_draw_pipeline_layout, 0,
-                            draw_descriptor_sets.size(), draw_descriptor_sets.data(), 0, nullptr);
+    VkPipeline cull_pipeline = m_pipeline_builder.get(m_cull_pipeline);
+    VkPipeline build_draws_pipeline = m_pipeline_builder.get(m_build_draws_pipeline);
+    VkPipeline scatter_visible_pipeline = m_pipeline_builder.get(m_scatter_visible_pipeline);
+    VkPipeline draw_pipeline = m_pipeline_builder.get(m_draw_pipeline);
+    VkPipeline impostor_pipeline = m_pipeline_builder.get(m_impostor_pipeline);
+    uint32_t buffer_index = m_frame_index % m_frames.size();
+    Frame &frame = m_frames[buffer_index];
+    m_timeline.wait(frame.timeline_value);
+    if (frame.has_results)
+        readStats(frame, buffer_index);
+    frame.timeline_value = m_timeline.m_submitted_value + 1;
+    frame.frame_number = m_frame_index;
+    frame.has_results = true;
 
     frame.constants->view_proj = transpose(m_world.m_view_proj);
-    std::copy(m_world.m_instances.begin(), m_world.m_instances.end(), frame.instances);
-
-    vkCmdDrawIndirect(cmd, m_draw_cmds.handle, buffer_index * sizeof(VkDrawIndirectCommand), 1,
-                      sizeof(VkDrawIndirectCommand));
-    vkCmdEndRendering(cmd);
-
+    frame.constants->projection_scale = m_world.m_projection_scale;
+    frame.constants->lod_error_pixels = m_options.lod_error_pixels;
+    frame.constants->min_size_pixels = m_options.min_size_pixels;
+    frame.constants->draw_impostors = m_options.impostors;
+    uint32_t instance_count = (uint32_t)m_world.m_instances.size();
+    uint32_t bucket_count = m_world.m_mesh_data.meshCount() * DrawBucketsPerMesh;
+    frame.constants->instance_count = instance_count;
+    frame.constants->draw_bucket_count = bucket_count;
+    for (InstanceRange range : frame.dirty_instances) {
+        auto first = m_world.m_instances.begin() + range.first;
+        std::copy(first, first + range.count, frame.instances + range.first);
+    }
+    frame.dirty_instances.clear();
+
+    // Host writes to the instances are made visible by the queue submission
+    RenderGraph::Resource instances =
+        graph.importBuffer("instances", m_instances.handle, InstancesBufferSize * buffer_index,
+                           InstancesBufferSize);
+    RenderGraph::Resource visible_instances = graph.importBuffer(
+        "visible_instances", m_visible_instances.handle, VisibleInstancesBufferSize * buffer_index,
+        VisibleInstancesBufferSize);
+    RenderGraph::Resource bucket_slots =
+        graph.importBuffer("bucket_slots", m_bucket_slots.handle,
+                           BucketSlotsBufferSize * buffer_index, BucketSlotsBufferSize);
+    RenderGraph::Resource impostors = graph.importBuffer(
+        "impostors", m_impostors.handle, m_impostors_size * buffer_index, m_impostors_size);
+    RenderGraph::Resource draw_cmds = graph.importBuffer(
+        "draw_cmds", m_draw_cmds.handle, DrawCmdBufferSize * buffer_index, DrawCmdBufferSize);
+    RenderGraph::Resource readback =
+        graph.importBuffer("draw_cmd_readback", m_readback.handle, ReadbackSize * buffer_index,
+                           ReadbackSize, RenderGraphUsage::None, RenderGraphUsage::HostRead);
+
+    // Buckets past those of the loaded meshes are never used, so they aren't cleared
+    VkDeviceSize used_draw_cmds_size =
+        DrawBucketsOffset + sizeof(VkDrawIndirectCommand) * bucket_count;
+    graph
+        .addPass("clear_draw_cmds",
+                 [=, this](VkCommandBuffer cmd, const RenderGraph &graph) {
+                     vkCmdFillBuffer(cmd, graph.buffer(draw_cmds), graph.bufferOffset(draw_cmds),
+                                     used_draw_cmds_size, 0);
+                     if (m_statistics_pool)
+                         vkCmdResetQueryPool(cmd, m_statistics_pool, 2 * buffer_index, 2);
+                 })
+        .use(draw_cmds, RenderGraphUsage::TransferDst);
+
+    // The cull, build draws and scatter passes count the visible instances of each bucket, give
+    // the buckets their ranges of the visible instances and move the instances there
+    auto bind_cull_pipeline = [=, this](VkCommandBuffer cmd, VkPipeline pipeline) {
+        vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+        std::array cull_descriptor_sets = std::to_array(
+            {m_mesh_data_descriptor_set, frame.descriptor_set, frame.cull_descriptor_set});
+        vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, m_cull_pipeline_layout, 0,
+                                cull_descriptor_sets.size(), cull_descriptor_sets.data(), 0,
+                                nullptr);
+    };
+    uint32_t thread_group_size = 256;
+    uint32_t thread_group_count = (instance_count + thread_group_size - 1) / thread_group_size;
+
+    graph
+        .addPass("cull_instances",
+                 [=, this](VkCommandBuffer cmd, const RenderGraph &) {
+                     bind_cull_pipeline(cmd, cull_pipeline);
+                     // Ended after the scatter pass, so that it counts all three dispatches
+                     if (m_statistics_pool)
+                         vkCmdBeginQuery(cmd, m_statistics_pool, 2 * buffer_index, 0);
+                     vkCmdDispatch(cmd, thread_group_count, 1, 1);
+                 })
+        .use(instances, RenderGraphUsage::ComputeShaderRead)
+        .use(bucket_slots, RenderGraphUsage::ComputeShaderWrite)
+        .use(impostors, RenderGraphUsage::ComputeShaderWrite)
+        .use(draw_cmds, RenderGraphUsage::ComputeShaderReadWrite);
+
+    graph
+        .addPass("build_draws",
+                 [=](VkCommandBuffer cmd, const RenderGraph &) {
+                     bind_cull_pipeline(cmd, build_draws_pipeline);
+                     vkCmdDispatch(cmd, 1, 1, 1);
+                 })
+        .use(draw_cmds, RenderGraphUsage::ComputeShaderReadWrite);
+
+    graph
+        .addPass("scatter_visible",
+                 [=, this](VkCommandBuffer cmd, const RenderGraph &) {
+                     bind_cull_pipeline(cmd, scatter_visible_pipeline);
+                     vkCmdDispatch(cmd, thread_group_count, 1, 1);
+                     if (m_statistics_pool)
+                         vkCmdEndQuery(cmd, m_statistics_pool, 2 * buffer_index);
+                 })
+        .use(instances, RenderGraphUsage::ComputeShaderRead)
+        .use(bucket_slots, RenderGraphUsage::ComputeShaderRead)
+        .use(draw_cmds, RenderGraphUsage::ComputeShaderRead)
+        .use(visible_instances, RenderGraphUsage::ComputeShaderWrite);
+
+    graph
+        .addPass(
+            "draw_world",
+            [=, this](VkCommandBuffer cmd, const RenderGraph &graph) {
+                VkClearValue color_clear;
+                color_clear.color.float32[0] = 0.04f;
+                color_clear.color.float32[1] = 0.04f;
+                color_clear.color.float32[2] = 0.04f;
+                color_clear.color.float32[3] = 0;
+                VkRenderingAttachmentInfo color_attachment = {
+                    .sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO,
+                    .pNext = nullptr,
+                    .imageView = graph.imageView(render_target.color),
+                    .imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+                    .resolveMode = VK_RESOLVE_MODE_AVERAGE_BIT,
+                    .resolveImageView = graph.imageView(render_target.resolve),
+                    .resolveImageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+                    .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
+                    .storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+                    .clearValue = color_clear,
+                };
+
+                VkClearValue depth_clear;
+                depth_clear.depthStencil.depth = 1.0f;
+                VkRenderingAttachmentInfo depth_attachment = {
+                    .sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO,
+                    .pNext = nullptr,
+                    .imageView = graph.imageView(render_target.depth),
+                    .imageLayout = VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL,
+                    .resolveMode = VK_RESOLVE_MODE_NONE,
+                    .resolveImageView = VK_NULL_HANDLE,
+                    .resolveImageLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+                    .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
+                    .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
+                    .clearValue = depth_clear,
+                };
+
+                VkRenderingInfo rendering_info = {
+                    .sType = VK_STRUCTURE_TYPE_RENDERING_INFO,
+                    .pNext = nullptr,
+                    .flags = 0,
+                    .renderArea = render_target.area,
+                    .layerCount = 1,
+                    .viewMask = 0,
+                    .colorAttachmentCount = 1,
+                    .pColorAttachments = &color_attachment,
+                    .pDepthAttachment = &depth_attachment,
+                    .pStencilAttachment = nullptr,
+                };
+
+                // The query must begin and end outside of the rendering
+                if (m_statistics_pool)
+                    vkCmdBeginQuery(cmd, m_statistics_pool, 2 * buffer_index + 1, 0);
+                vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, draw_pipeline);
+                vkCmdBeginRendering(cmd, &rendering_info);
+                std::array viewports = std::to_array<VkViewport>(
+                    {{(float)render_target.area.offset.x, (float)render_target.area.offset.y,
+                      (float)render_target.area.extent.width,
+                      (float)render_target.area.extent.height, 0.0f, 1.0f}});
+                vkCmdSetViewport(cmd, 0, viewports.size(), viewports.data());
+                std::array scissors = std::to_array({render_target.area});
+                vkCmdSetScissor(cmd, 0, scissors.size(), scissors.data());
+                std::array draw_descriptor_sets =
+                    std::to_array({m_mesh_data_descriptor_set, frame.descriptor_set});
+                vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                                        m_draw_pipeline_layout, 0, draw_descriptor_sets.size(),
+                                        draw_descriptor_sets.data(), 0, nullptr);
+                // One draw per bucket, those of the buckets with no visible instances are empty
+                VkDeviceSize bucket_draws_offset =
+                    graph.bufferOffset(draw_cmds) + DrawBucketsOffset;
+                if (m_device.m_enabled_features.multiDrawIndirect) {
+                    vkCmdDrawIndirect(cmd, graph.buffer(draw_cmds), bucket_draws_offset,
+                                      bucket_count, sizeof(VkDrawIndirectCommand));
+                } else {
+                    for (uint32_t bucket = 0; bucket < bucket_count; ++bucket) {
+                        vkCmdDrawIndirect(cmd, graph.buffer(draw_cmds),
+                                          bucket_draws_offset +
+                                              sizeof(VkDrawIndirectCommand) * bucket,
+                                          1, sizeof(VkDrawIndirectCommand));
+                    }
+                }
+                if (m_options.impostors) {
+                    // Same layout and descriptor sets, so they stay bound
+                    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, impostor_pipeline);
+                    vkCmdDrawIndirect(cmd, graph.buffer(draw_cmds),
+                                      graph.bufferOffset(draw_cmds) +
+                                          offsetof(CullOutput, impostor_draw_cmd),
+                                      1, sizeof(VkDrawIndirectCommand));
+                }
+                vkCmdEndRendering(cmd);
+                if (m_statistics_pool)
+                    vkCmdEndQuery(cmd, m_statistics_pool, 2 * buffer_index + 1);
+            })
+        .use(draw_cmds, RenderGraphUsage::IndirectRead)
+        .use(visible_instances, RenderGraphUsage::VertexShaderRead)
+        .use(instances, RenderGraphUsage::VertexShaderRead)
+        .use(impostors, RenderGraphUsage::VertexShaderRead)
+        .use(render_target.color, RenderGraphUsage::ColorAttachment)
+        .use(render_target.depth, RenderGraphUsage::DepthAttachment)
+        .use(render_target.resolve, RenderGraphUsage::ColorAttachment);
+
+    graph
+        .addPass("readback_draw_cmds",
+                 [=](VkCommandBuffer cmd, const RenderGraph &graph) {
+                     VkBufferCopy copy_region = {.srcOffset = graph.bufferOffset(draw_cmds),
+                                                 .dstOffset = graph.bufferOffset(readback),
+                                                 .size = ReadbackSize};
+                     vkCmdCopyBuffer(cmd, graph.buffer(draw_cmds), graph.buffer(readback), 1,
+                                     &copy_region);
+                 })
+        .use(draw_cmds, RenderGraphUsage::TransferSrc)
+        .use(readback, RenderGraphUsage::TransferDst);
 
-    VkBufferCopy copy_region = {.srcOffset = buffer_index * sizeof(VkDrawIndirectCommand),
-                                .dstOffset = buffer_index * sizeof(VkDrawIndirectCommand),
-                                .size = sizeof(VkDrawIndirectCommand)};
-    vkCmdCopyBuffer(cmd, m_draw_cmds.handle, m_readback.handle, 1, &copy_region);
     ++m_frame_index;
-
-    return m_frames[m_frame_index % m_frames.size()].draw_cmd_readback->instanceCount;
 }
 
-struct VertexNormal {
-    V3f normal;
-};
-
-static uint32_t createTriangleGeo(MeshData &mesh_data, VkCommandBuffer cmd) {
-    auto mesh = mesh_data.create<V3f, VertexNormal>(3, 3);
-    mesh.positions()[0] = {0.0f, 0.5f, 0.0f};
-    mesh.positions()[1] = {-0.5f, -0.5f, 0.0f};
-    mesh.positions()[2] = {0.5f, -0.5f, 0.0f};
-    mesh.indices()[0] = 0;
-    mesh.indices()[1] = 1;
-    mesh.indices()[2] = 2;
-    return mesh_data.update(cmd, mesh);
+static MeshSource createTriangleGeo() {
+    MeshSource mesh;
+    mesh.positions = {{0.0f, 0.5f, 0.0f}, {-0.5f, -0.5f, 0.0f}, {0.5f, -0.5f, 0.0f}};
+    mesh.normals.assign(3, {0.0f, 0.0f, -1.0f});
+    mesh.indices = {0, 1, 2};
+    return mesh;
 }
 
-static uint32_t createDiskGeo(MeshData &mesh_data, VkCommandBuffer cmd) {
+static MeshSource createDiskGeo() {
     constexpr uint32_t SegmentCount = 40;
-    auto mesh = mesh_data.create<V3f, VertexNormal>(SegmentCount + 1, SegmentCount * 3);
-    mesh.positions()[0] = {0.0f, 0.0f, 0.0f};
+    MeshSource mesh;
+    mesh.positions.resize(SegmentCount + 1);
+    mesh.normals.assign(SegmentCount + 1, {0.0f, 0.0f, -1.0f});
+    mesh.indices.resize(SegmentCount * 3);
+    mesh.positions[0] = {0.0f, 0.0f, 0.0f};
     for (uint32_t i = 0; i < SegmentCount; ++i) {
         float angle = TwoPi * (float)i / (float)SegmentCount;
-        uint16_t i0 = i + 1;
-        uint16_t i1 = i < SegmentCount - 1 ? i + 2 : 1;
-        uint16_t i2 = 0;
-        mesh.positions()[i0] = {cosf(angle) * 0.5f, sinf(angle) * 0.5f, 0.0f};
-        mesh.indices()[i * 3 + 0] = i0;
-        mesh.indices()[i * 3 + 1] = i1;
-        mesh.indices()[i * 3 + 2] = i2;
+        uint32_t i0 = i + 1;
+        uint32_t i1 = i < SegmentCount - 1 ? i + 2 : 1;
+        uint32_t i2 = 0;
+        mesh.positions[i0] = {cosf(angle) * 0.5f, sinf(angle) * 0.5f, 0.0f};
+        mesh.indices[i * 3 + 0] = i0;
+        mesh.indices[i * 3 + 1] = i1;
+        mesh.indices[i * 3 + 2] = i2;
     }
-    return mesh_data.update(cmd, mesh);
+    return mesh;
 }
 
-static uint32_t createTetrahedron(MeshData &mesh_data, VkCommandBuffer cmd) {
-    auto mesh = mesh_data.create<V3f, VertexNormal>(12, 12);
+static MeshSource createTetrahedron() {
     std::array p = std::to_array<V3f>({
         {0.0f, -0.5f, 0.5f},
         {-0.5f, -0.5f, -0.5f},
         {0.5f, -0.5f, -0.5f},
         {0.0f, 0.5f, 0.0f},
     });
-
-    std::array positions = {
-        p[0], p[1], p[2], p[0], p[3], p[1], p[1], p[3], p[2], p[2], p[3], p[0],
-    };
-    std::copy(positions.begin(), positions.end(), mesh.positions());
-
     std::array n = {
         normalize(cross(p[1] - p[0], p[2] - p[0])),
         normalize(cross(p[3] - p[0], p[1] - p[0])),
         normalize(cross(p[3] - p[1], p[2] - p[1])),
         normalize(cross(p[3] - p[2], p[0] - p[2])),
     };
-    std::array attribs = std::to_array<VertexNormal>({
-        {n[0]},
-        {n[0]},
-        {n[0]},
-        {n[1]},
-        {n[1]},
-        {n[1]},
-        {n[2]},
-        {n[2]},
-        {n[2]},
-        {n[3]},
-        {n[3]},
-        {n[3]},
-    });
-    std::copy(attribs.begin(), attribs.end(), mesh.attribs());
-
-    std::array indices = std::to_array<uint16_t>({
-        0,
-        1,
-        2,
-        3,
-        4,
-        5,
-        6,
-        7,
-        8,
-        9,
-        10,
-        11,
-    });
-    std::copy(indices.begin(), indices.end(), mesh.indices());
-    return mesh_data.update(cmd, mesh);
+
+    MeshSource mesh;
+    mesh.positions = {
+        p[0], p[1], p[2], p[0], p[3], p[1], p[1], p[3], p[2], p[2], p[3], p[0],
+    };
+    mesh.normals = {
+        n[0], n[0], n[0], n[1], n[1], n[1], n[2], n[2], n[2], n[3], n[3], n[3],
+    };
+    mesh.indices = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11};
+    return mesh;
+}
+
+static void printMeshStats(const char *name, const MeshSource &mesh,
+                           const MeshOptimizeStats &stats) {
+    printf("%s: %zu triangles, %u -> %zu vertices, ACMR %.3f -> %.3f, ATVR %.3f -> %.3f\n", name,
+           mesh.indices.size() / 3, stats.source_vertex_count, mesh.positions.size(),
+           stats.before.acmr, stats.after.acmr, stats.before.atvr, stats.after.atvr);
+    for (size_t lod = 0; lod < mesh.lods.size(); ++lod) {
+        printf("  LOD %zu: %zu triangles, error %.4f\n", lod + 1, mesh.lods[lod].indices.size() / 3,
+               mesh.lods[lod].error);
+    }
+}
+
+// Cooked mesh streams are read into staging in chunks of this size, so that many reads are in
+// flight at once
+static constexpr u64 MeshReadChunkSize = 256 * 1024;
+
+// Reads the header of a cooked mesh file and issues the reads of its streams straight into
+// staging memory allocated for them. Sets failed from the callbacks of any read that comes up
+// short, so failed must outlive the reads.
+static std::optional<MeshData::Creator> readMeshFile(AsyncFileReader &reader, Handle file,
+                                                     const char *path, MeshData &mesh_data,
+                                                     bool &failed) {
+    // The header decides where the streams go, so it's waited for
+    MeshFileHeader header;
+    i64 header_result = -1;
+    reader.read(file, 0, std::as_writable_bytes(std::span(&header, 1)),
+                [&header_result](i64 result) { header_result = result; });
+    reader.waitAll();
+    if (header_result != (i64)sizeof(header) || !validateMeshFileHeader(header)) {
+        fprintf(stderr, "%s isn't a cooked mesh\n", path);
+        return std::nullopt;
+    }
+    if (!mesh_data.fits(header.layout)) {
+        fprintf(stderr, "%s doesn't fit in the mesh buffers\n", path);
+        return std::nullopt;
+    }
+
+    MeshData::Creator creator = mesh_data.create(header.layout);
+    std::span<std::byte> streams((std::byte *)creator.src.ptr(), header.layout.size());
+    for (u64 offset = 0; offset < streams.size(); offset += MeshReadChunkSize) {
+        std::span<std::byte> chunk =
+            streams.subspan(offset, std::min(MeshReadChunkSize, streams.size() - offset));
+        reader.read(file, MeshFileStreamsOffset + offset, chunk,
+                    [size = (i64)chunk.size(), &failed](i64 result) {
+                        if (result != size)
+                            failed = true;
+                    });
+    }
+    return creator;
 }
 
 static void populateWorld(const GfxDevice &device, CommandBufferPool &cb_pool, VkFence fence,
-                          World &world) {
+                          ThreadPool &thread_pool, const ExampleOptions &options, World &world) {
+    BRTOY_PROFILE_ZONE("populateWorld");
     std::mt19937 rng;
     std::normal_distribution<float> pos_distribution(0.0f, 200.0f);
     std::uniform_real_distribution<float> angle_distribution(0.0f, TwoPi);
@@ -993,9 +1569,70 @@ static void populateWorld(const GfxDevice &device, CommandBufferPool &cb_pool, V
                                            VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT};
     vkBeginCommandBuffer(cmd, &begin_info);
 
-    uint32_t triangle_geo = createTriangleGeo(world.m_mesh_data, cmd);
-    uint32_t disk_geo = createDiskGeo(world.m_mesh_data, cmd);
-    uint32_t tet_geo = createTetrahedron(world.m_mesh_data, cmd);
+    MeshData &mesh_data = world.m_mesh_data;
+    VertexFormat vertex_format = {PositionFormat::Float3, NormalFormat::Float3};
+    if (options.vertex_packing == VertexPacking::Quantized16)
+        vertex_format = {PositionFormat::Unorm16, NormalFormat::Oct16};
+    else if (options.vertex_packing == VertexPacking::Quantized8)
+        vertex_format = {PositionFormat::Unorm16, NormalFormat::Oct8};
+    // The cooked mesh streams into staging while the procedural meshes are optimized and
+    // encoded, and is waited for only when its copies are recorded
+    std::optional<AsyncFileReader> reader;
+    Handle cooked_file;
+    std::optional<MeshData::Creator> cooked_mesh;
+    bool cooked_read_failed = false;
+    if (!options.mesh_path.empty()) {
+        reader = AsyncFileReader::create();
+        cooked_file = reader->openFile(options.mesh_path.c_str());
+        if (cooked_file) {
+            cooked_mesh = readMeshFile(*reader, cooked_file, options.mesh_path.c_str(),
+                                       mesh_data, cooked_read_failed);
+        } else {
+            fprintf(stderr, "can't open %s\n", options.mesh_path.c_str());
+        }
+    }
+    std::optional<uint32_t> triangle_geo, disk_geo, tet_geo;
+    RenderGraph graph;
+    RenderGraph::Resource staging = graph.importBuffer("mesh_staging", mesh_data.m_staging_buffer,
+                                                       0, VK_WHOLE_SIZE);
+    RenderGraph::Resource meshes =
+        graph.importBuffer("mesh_data", mesh_data.m_buffer, 0, VK_WHOLE_SIZE,
+                           RenderGraphUsage::AnyShaderRead, RenderGraphUsage::AnyShaderRead);
+    graph
+        .addPass("upload_meshes",
+                 [&](VkCommandBuffer cmd, const RenderGraph &) {
+                     // The example draws without an index buffer, so the GPU gets no
+                     // post-transform reuse out of the optimization yet, but the vertex fetches
+                     // get more local
+                     auto upload = [&](const char *name, MeshSource mesh) {
+                         MeshOptimizeStats stats = optimizeMesh(mesh, &thread_pool);
+                         printMeshStats(name, mesh, stats);
+                         std::optional<uint32_t> mesh_info_ptr =
+                             mesh_data.add(cmd, vertex_format, mesh);
+                         if (!mesh_info_ptr)
+                             fprintf(stderr, "%s doesn't fit in the mesh buffers\n", name);
+                         return mesh_info_ptr;
+                     };
+                     triangle_geo = upload("triangle", createTriangleGeo());
+                     disk_geo = upload("disk", createDiskGeo());
+                     std::optional<uint32_t> cooked_geo;
+                     if (cooked_mesh) {
+                         reader->waitAll();
+                         // A failed read leaves the ranges reserved for it unused
+                         if (!cooked_read_failed)
+                             cooked_geo = mesh_data.update(cmd, *cooked_mesh);
+                         else
+                             fprintf(stderr, "can't read %s\n", options.mesh_path.c_str());
+                     }
+                     if (cooked_file)
+                         reader->closeFile(cooked_file);
+                     tet_geo = cooked_geo ? cooked_geo
+                                          : upload("tetrahedron", createTetrahedron());
+                 })
+        .use(staging, RenderGraphUsage::TransferSrc)
+        .use(meshes, RenderGraphUsage::TransferDst);
+    graph.compile();
+    graph.execute(cmd);
 
     VkSubmitInfo submit_info = {
         .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
@@ -1012,7 +1649,23 @@ static void populateWorld(const GfxDevice &device, CommandBufferPool &cb_pool, V
     vkQueueSubmit(device.m_queue, 1, &submit_info, fence);
     cb_pool.release(cmd, fence);
 
-    for (int i = 0; i < InstanceCountMax; ++i) {
+    // Meshes are assigned by index in the proportions of the mix. Positions are random, so this
+    // still spreads every mesh over the whole cloud.
+    // Only a cooked mesh can leave too little room for the others, and then it stands in for them
+    std::optional<uint32_t> fallback_geo =
+        tet_geo ? tet_geo : triangle_geo ? triangle_geo : disk_geo;
+    BRTOY_ASSERT(fallback_geo);
+    std::array<uint32_t, 3> mix_meshes = {triangle_geo.value_or(*fallback_geo),
+                                          disk_geo.value_or(*fallback_geo),
+                                          tet_geo.value_or(*fallback_geo)};
+    std::array<float, 3> mix_ends;
+    float mix_total = 0.0f;
+    for (size_t m = 0; m < mix_ends.size(); ++m) {
+        mix_total += options.mesh_mix[m];
+        mix_ends[m] = mix_total;
+    }
+
+    for (u32 i = 0; i < options.instance_count; ++i) {
         float theta = angle_distribution(rng);
         float z = z_distribution(rng);
         float zz = std::sqrtf(1 - z * z);
@@ -1037,12 +1690,16 @@ static void populateWorld(const GfxDevice &device, CommandBufferPool &cb_pool, V
             V4f{translation.x, translation.y, translation.z, 1},
         };
 
-        world.addInstance(transform, tet_geo);
+        float mix_pos = (i + 0.5f) / options.instance_count * mix_total;
+        size_t mix_index = 0;
+        while (mix_index + 1 < mix_ends.size() && mix_pos >= mix_ends[mix_index])
+            ++mix_index;
+        world.addInstance(transform, mix_meshes[mix_index]);
     }
 }
 
 struct GfxContext {
-    static std::optional<GfxContext> create();
+    static std::optional<GfxContext> create(GfxDebugFlag debug_flags);
     GfxContext(GfxInstance &&instance, GfxDevice &&device, VmaAllocator allocator);
     GfxContext(GfxContext &&) = default;
     ~GfxContext();
@@ -1055,14 +1712,18 @@ struct GfxContext {
 GfxContext::GfxContext(GfxInstance &&instance, GfxDevice &&device, VmaAllocator allocator)
     : m_instance(std::move(instance)), m_device(std::move(device)), m_memory_allocator(allocator) {}
 
-std::optional<GfxContext> GfxContext::create() {
+std::optional<GfxContext> GfxContext::create(GfxDebugFlag debug_flags) {
     std::optional<GfxContext> ctx;
-    auto instance = GfxInstance::create("gpu_driven_rendering", 0, GfxDebugFlag::ValidationEnable);
+    auto instance = GfxInstance::create("gpu_driven_rendering", 0, debug_flags);
     if (instance) {
         auto device = GfxDevice::createDefault(*instance);
         if (device) {
+            VmaAllocatorCreateFlags allocator_flags =
+                VMA_ALLOCATOR_CREATE_EXTERNALLY_SYNCHRONIZED_BIT;
+            if (device->m_has_memory_budget)
+                allocator_flags |= VMA_ALLOCATOR_CREATE_EXT_MEMORY_BUDGET_BIT;
             VmaAllocatorCreateInfo create_info = {
-                .flags = VMA_ALLOCATOR_CREATE_EXTERNALLY_SYNCHRONIZED_BIT,
+                .flags = allocator_flags,
                 .physicalDevice = device->m_physical_device,
                 .device = device->m_device,
                 .preferredLargeHeapBlockSize = 0,
@@ -1099,28 +1760,100 @@ GfxContext::~GfxContext() {
         vmaDestroyAllocator(m_memory_allocator);
 }
 
-int runExample() {
+int runExample(int argc, char **argv) {
+    std::optional<ExampleOptions> options = parseExampleOptions(argc, argv);
+    if (!options) {
+        return -1;
+    }
+    if (options->instance_count > InstanceCountMax) {
+        Platform::errorMessage(
+            std::format("At most {} instances are supported", InstanceCountMax).c_str());
+        return -1;
+    }
+
+    if (!options->trace_path.empty()) {
+        beginTrace();
+        setTraceThreadName("main");
+    }
+
     auto platform = Platform::init();
     if (!platform) {
         Platform::errorMessage("Could not initialize platform layer");
         return -1;
     }
 
-    Window window = platform->createWindow("Example - GPU Driven Rendering");
+    Window window = platform->createWindow("Example - GPU Driven Rendering", options->window_dim);
     if (!window) {
         Platform::errorMessage("Could not create window.");
         return -1;
     }
 
-    auto ctx = GfxContext::create();
+    // Without a window system the example renders to offscreen images, for automated runs on
+    // machines without a display. Validation would skew the timings of those runs.
+    bool offscreen = platform->isHeadless();
+    auto ctx = GfxContext::create(offscreen ? GfxDebugFlag::None : GfxDebugFlag::ValidationEnable);
     if (!ctx) {
         return -1;
     }
+    // Declared before everything that allocates through it
+    MemoryTracker memory_tracker(ctx->m_memory_allocator);
+    const char *pipeline_cache_path = "gpu_driven_rendering.pipeline_cache";
+    bool pipeline_cache_warm = ctx->m_device.loadPipelineCache(pipeline_cache_path);
 
     WindowState window_state = platform->windowState(window);
 
-    Swapchain swapchain(ctx->m_instance, platform->appInstanceHandle(), window_state.native_handle,
-                        ctx->m_device.m_physical_device, ctx->m_device.m_device);
+    std::optional<Swapchain> swapchain;
+    std::optional<TexturePool> offscreen_pool;
+    VkFormat backbuffer_format = VK_FORMAT_B8G8R8A8_SRGB;
+    if (offscreen) {
+        VkImageCreateInfo offscreen_image_create_info = {
+            .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+            .pNext = nullptr,
+            .flags = 0,
+            .imageType = VK_IMAGE_TYPE_2D,
+            .format = backbuffer_format,
+            .extent = {},
+            .mipLevels = 1,
+            .arrayLayers = 1,
+            .samples = VK_SAMPLE_COUNT_1_BIT,
+            .tiling = VK_IMAGE_TILING_OPTIMAL,
+            .usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT |
+                     VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+            .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+            .queueFamilyIndexCount = 0,
+            .pQueueFamilyIndices = nullptr,
+            .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+        };
+        VkImageViewCreateInfo offscreen_view_create_info = {
+            .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+            .pNext = nullptr,
+            .flags = 0,
+            .image = VK_NULL_HANDLE,
+            .viewType = VK_IMAGE_VIEW_TYPE_2D,
+            .format = backbuffer_format,
+            .components = {},
+            .subresourceRange =
+                {
+                    .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                    .baseMipLevel = 0,
+                    .levelCount = 1,
+                    .baseArrayLayer = 0,
+                    .layerCount = 1,
+                },
+        };
+        // The render graph transitions the offscreen images from an undefined layout, like it
+        // does for swapchain images, so the pool never records its init barrier.
+        offscreen_pool.emplace(ctx->m_device, ctx->m_memory_allocator, offscreen_image_create_info,
+                               offscreen_view_create_info, VkImageMemoryBarrier{},
+                               VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, nullptr, &memory_tracker,
+                               MemoryTag::Backbuffers);
+    } else {
+        swapchain.emplace(ctx->m_instance, platform->appInstanceHandle(),
+                          window_state.native_handle, ctx->m_device.m_physical_device,
+                          ctx->m_device.m_device);
+        backbuffer_format = swapchain->m_format.format;
+    }
+    // Declared after the offscreen pool, which it returns its textures to
     std::optional<Backbuffer> backbuffer;
 
     VkSemaphoreCreateInfo sem_create_info = {VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO, nullptr, 0};
@@ -1129,13 +1862,16 @@ int runExample() {
     vkCreateSemaphore(ctx->m_device.m_device, &sem_create_info, nullptr, &end_sem);
 
     CommandBufferPool cb_pool(ctx->m_device);
+    GpuTimeline timeline(ctx->m_device);
+    DeletionQueue deletion_queue(ctx->m_device, ctx->m_memory_allocator, timeline);
+    TransientAttachmentHeap transient_heap(ctx->m_memory_allocator, &memory_tracker);
 
     VkImageCreateInfo color_image_create_info = {
         .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
         .pNext = nullptr,
         .flags = 0,
         .imageType = VK_IMAGE_TYPE_2D,
-        .format = swapchain.m_format.format,
+        .format = backbuffer_format,
         .extent = {},
         .mipLevels = 1,
         .arrayLayers = 1,
@@ -1177,7 +1913,7 @@ int runExample() {
     };
     TexturePool color_texture_pool(ctx->m_device, ctx->m_memory_allocator, color_image_create_info,
                                    color_view_create_info, color_init_barrier,
-                                   VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT);
+                                   VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, &transient_heap);
 
     VkImageCreateInfo depth_image_create_info = {
         .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
@@ -1227,90 +1963,201 @@ int runExample() {
     TexturePool ds_pool(ctx->m_device, ctx->m_memory_allocator, depth_image_create_info,
                         depth_view_create_info, depth_init_barrier,
                         VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT |
-                            VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT);
+                            VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+                        &transient_heap);
 
-    MeshData mesh_data(ctx->m_memory_allocator);
+    MeshData mesh_data(ctx->m_memory_allocator, &memory_tracker);
     World world{mesh_data};
 
     VkFence init_fence;
     VkFenceCreateInfo init_fence_info = {VK_STRUCTURE_TYPE_FENCE_CREATE_INFO};
     vkCreateFence(ctx->m_device.m_device, &init_fence_info, nullptr, &init_fence);
-    populateWorld(ctx->m_device, cb_pool, init_fence, world);
-
-    DrawWorldPipeline world_pipeline(ctx->m_device, ctx->m_memory_allocator, world);
+    ThreadPool thread_pool;
+    populateWorld(ctx->m_device, cb_pool, init_fence, thread_pool, *options, world);
+
+    PipelineBuilder pipeline_builder(ctx->m_device, thread_pool);
+    // Pipelines are compiled in the background while the first frames are rendered
+    auto pipeline_create_start = std::chrono::steady_clock::now();
+    DrawWorldPipeline world_pipeline(ctx->m_device, ctx->m_memory_allocator, &memory_tracker,
+                                     pipeline_builder, timeline, world, *options);
+    bool pipelines_ready = false;
+    FrameArena frame_arena(FrameArenaSize);
+    RenderGraph frame_graph(&frame_arena);
 
     auto synchronizePools = [&]() {
         cb_pool.sync();
         color_texture_pool.sync();
         ds_pool.sync();
+        if (offscreen_pool)
+            offscreen_pool->sync();
+        transient_heap.sync();
+        deletion_queue.collect();
+    };
+
+    // Pipelined, the render thread passes its input to the simulation thread and takes the
+    // snapshot simulated from the previous frame's input, so that the CPU frame time is the longer
+    // of the two rather than their sum, at the cost of a frame of input latency. The simulation
+    // waits for each snapshot to be taken before it starts on the next, so none are dropped.
+    Simulation simulation(*options);
+    WorldSnapshot serial_snapshot;
+    TripleBuffer<WorldSnapshot> snapshots;
+    SpscQueue<Input> simulation_inputs(4);
+    std::atomic<u64> published_snapshots = 0;
+    std::atomic<u64> taken_snapshots = 0;
+    std::atomic<bool> simulation_pipelines_ready = false;
+    std::atomic<bool> stop_simulation = false;
+    std::thread simulation_thread;
+    if (options->pipelined) {
+        simulation_thread = std::thread([&]() {
+            if (isTracing())
+                setTraceThreadName("simulation");
+            Input input = {};
+            Input queued;
+            for (u64 published = 0;; ++published) {
+                for (u64 taken; (taken = taken_snapshots.load(std::memory_order_acquire)) <
+                                published;)
+                    taken_snapshots.wait(taken, std::memory_order_acquire);
+                if (stop_simulation.load(std::memory_order_relaxed))
+                    break;
+                // Mouse motion adds up over the inputs that arrived since the last step, the
+                // buttons and keys are as of the latest one
+                input.mouse_dx = 0.0f;
+                input.mouse_dy = 0.0f;
+                while (simulation_inputs.pop(queued)) {
+                    queued.mouse_dx += input.mouse_dx;
+                    queued.mouse_dy += input.mouse_dy;
+                    input = queued;
+                }
+                simulation.step(input,
+                                simulation_pipelines_ready.load(std::memory_order_relaxed),
+                                snapshots.back());
+                snapshots.publish();
+                published_snapshots.store(published + 1, std::memory_order_release);
+                published_snapshots.notify_one();
+            }
+        });
+    }
+
+    // Benchmark frames are counted by the simulation from the first frame drawn with the final
+    // pipelines. Their GPU time is the frame zone of the profiler, read back once the
+    // backbuffer's fence has been waited on.
+    BenchmarkRecorder recorder(options->warmup_frame_count, options->frame_count);
+    GpuProfiler gpu_profiler(ctx->m_device, Backbuffer::BufferCountMax);
+    std::array<std::optional<u64>, Backbuffer::BufferCountMax> profiled_frames = {};
+    TraceTrack gpu_track = createTraceTrack("GPU");
+    auto resolveProfile = [&](u32 buffer_index) {
+        gpu_profiler.resolve(buffer_index);
+        for (const GpuProfiler::ZoneResult &zone : gpu_profiler.m_resolved) {
+            if (zone.cpu_begin)
+                recordTraceZone(gpu_track, zone.name, zone.cpu_begin, zone.cpu_end);
+        }
+        const GpuProfiler::ZoneResult *frame_zone = gpu_profiler.findResolved("frame");
+        if (frame_zone && profiled_frames[buffer_index])
+            recorder.recordGpu(*profiled_frames[buffer_index], frame_zone->ms);
+        profiled_frames[buffer_index].reset();
     };
 
-    float view_a = 0.0f;
-    float yaw = TwoPi * 0.5f;
-    float pitch = 0.0f;
-    V3f look_p = {0.0f, 0.0f, 0.0f};
-    V3f cam_p = {0.0f, 0.0f, -3.0f};
     Input input;
+    u64 heap_allocation_count = heapAllocationCount();
     while (platform->tick(input)) {
+        BRTOY_PROFILE_ZONE("frame");
         u64 start_timestamp = platform->getTimestamp();
+        // The graph holds pass callbacks in the arena from the previous frame
+        frame_graph.reset();
+        frame_arena.reset();
         window_state = platform->windowState(window);
         if (window_state.is_closing) {
             platform->requestQuit();
             continue;
         }
 
-        if (window_state.dim != swapchain.m_dim) {
-            vkDeviceWaitIdle(ctx->m_device.m_device);
+        if (offscreen) {
+            if (!backbuffer || window_state.dim != backbuffer->m_dim) {
+                synchronizePools();
+                if (backbuffer) {
+                    backbuffer->recreateOffscreen(window_state.dim);
+                } else {
+                    backbuffer = Backbuffer::createOffscreen(ctx->m_device.m_device,
+                                                             *offscreen_pool, window_state.dim);
+                }
+            }
+        } else if (window_state.dim != swapchain->m_dim) {
             synchronizePools();
-            backbuffer.reset();
-            swapchain.recreate(window_state.dim);
-            backbuffer = Backbuffer::createFromSwapchain(ctx->m_device.m_device, swapchain);
+            if (backbuffer) {
+                backbuffer->recreate(*swapchain, window_state.dim, deletion_queue);
+            } else {
+                swapchain->recreate(window_state.dim);
+                backbuffer = Backbuffer::createFromSwapchain(ctx->m_device.m_device, *swapchain);
+            }
         }
 
         if (!backbuffer)
             continue;
 
         u32 image_index;
-        vkAcquireNextImageKHR(ctx->m_device.m_device, swapchain.m_swapchain, UINT64_MAX, begin_sem,
-                              VK_NULL_HANDLE, &image_index);
+        if (offscreen) {
+            image_index = backbuffer->acquireOffscreen();
+        } else {
+            vkAcquireNextImageKHR(ctx->m_device.m_device, swapchain->m_swapchain, UINT64_MAX,
+                                  begin_sem, VK_NULL_HANDLE, &image_index);
+        }
         const Backbuffer::Buffer &current_buffer = backbuffer->m_buffers[image_index];
 
-        vkWaitForFences(ctx->m_device.m_device, 1, &current_buffer.fence, VK_TRUE, UINT64_MAX);
+        {
+            BRTOY_PROFILE_ZONE("wait_frame");
+            vkWaitForFences(ctx->m_device.m_device, 1, &current_buffer.fence, VK_TRUE,
+                            UINT64_MAX);
+        }
         synchronizePools();
         vkResetFences(ctx->m_device.m_device, 1, &current_buffer.fence);
+        resolveProfile(image_index);
+
+        // Pooled images are the only memory that can be given back without stalling, so that's
+        // what goes when a heap nears its budget. The pools refill on demand.
+        bool was_over_budget = memory_tracker.isOverBudget();
+        if (memory_tracker.update((u32)timeline.m_submitted_value)) {
+            if (!was_over_budget)
+                fprintf(stderr, "Device memory near budget, trimming pools\n");
+            color_texture_pool.trim();
+            ds_pool.trim();
+            transient_heap.trim();
+            if (offscreen_pool)
+                offscreen_pool->trim();
+        }
 
-        M44f cam;
-        setTranslate(cam, cam_p);
-        if (input.lmb_is_down) {
-            constexpr float look_speed = 0.005f;
-            yaw += input.mouse_dx * -look_speed;
-            pitch = std::max(-HalfPi, std::min(pitch + input.mouse_dy * -look_speed, HalfPi));
+        if (!pipelines_ready && world_pipeline.isReady()) {
+            std::chrono::duration<float, std::milli> pipeline_create_time =
+                std::chrono::steady_clock::now() - pipeline_create_start;
+            printf("Pipelines created in %.1f ms (%s cache)\n", pipeline_create_time.count(),
+                   pipeline_cache_warm ? "warm" : "cold");
+            pipelines_ready = true;
         }
-        rotateY(cam, yaw);
-        rotateX(cam, pitch);
-        if (input.lmb_is_down) {
-            float move_speed = 0.1f;
-            if (input.key_is_down[0xA0]) { // VK_LSHIFT
-                move_speed *= 10;
-            }
-            if (input.key_is_down['W']) {
-                cam_p += V3f{cam.k.x, cam.k.y, cam.k.z} * -move_speed;
-            }
-            if (input.key_is_down['A']) {
-                cam_p += V3f{cam.i.x, cam.i.y, cam.i.z} * -move_speed;
-            }
-            if (input.key_is_down['S']) {
-                cam_p += V3f{cam.k.x, cam.k.y, cam.k.z} * move_speed;
-            }
-            if (input.key_is_down['D']) {
-                cam_p += V3f{cam.i.x, cam.i.y, cam.i.z} * move_speed;
+
+        const WorldSnapshot *snapshot = &serial_snapshot;
+        if (options->pipelined) {
+            simulation_pipelines_ready.store(pipelines_ready, std::memory_order_relaxed);
+            // Never full, the simulation drains the queue before every step
+            simulation_inputs.push(input);
+            {
+                BRTOY_PROFILE_ZONE("wait_simulation");
+                u64 taken = taken_snapshots.load(std::memory_order_relaxed);
+                for (u64 published;
+                     (published = published_snapshots.load(std::memory_order_acquire)) == taken;)
+                    published_snapshots.wait(published, std::memory_order_acquire);
             }
+            snapshots.acquire();
+            snapshot = &snapshots.front();
+            // The front slot stays ours until the next acquire, so the simulation can go ahead
+            taken_snapshots.fetch_add(1, std::memory_order_release);
+            taken_snapshots.notify_one();
+        } else {
+            simulation.step(input, pipelines_ready, serial_snapshot);
         }
-
-        M44f view = invert(cam);
         float aspect_ratio = float(backbuffer->m_dim.x) / float(backbuffer->m_dim.y);
-        M44f proj = perspectiveProjection(toRadians(45.0f), aspect_ratio, 0.1f, 1000.0f);
-        world.m_view_proj = proj * view;
+        float fov_y = toRadians(45.0f);
+        M44f proj = perspectiveProjection(fov_y, aspect_ratio, 0.1f, 1000.0f);
+        world.m_view_proj = proj * snapshot->view;
+        world.m_projection_scale = 0.5f * float(backbuffer->m_dim.y) / tanf(0.5f * fov_y);
 
         VkCommandBuffer cmd = cb_pool.acquire();
         VkCommandBufferBeginInfo cmd_begin_info = {
@@ -1319,103 +2166,116 @@ int runExample() {
             .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
             .pInheritanceInfo = nullptr};
         vkBeginCommandBuffer(cmd, &cmd_begin_info);
-
-        {
-            VkImageMemoryBarrier image_barrier = {
-                .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
-                .pNext = nullptr,
-                .srcAccessMask = VK_ACCESS_NONE,
-                .dstAccessMask =
-                    VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
-                .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
-                .newLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
-                .srcQueueFamilyIndex = ctx->m_device.m_queue_family_index,
-                .dstQueueFamilyIndex = ctx->m_device.m_queue_family_index,
-                .image = current_buffer.image,
-                .subresourceRange =
-                    {
-                        .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-                        .baseMipLevel = 0,
-                        .levelCount = 1,
-                        .baseArrayLayer = 0,
-                        .layerCount = 1,
-                    },
-            };
-            vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
-                                 VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, 0, 0, nullptr, 0,
-                                 nullptr, 1, &image_barrier);
-        }
-
-        auto color_texture = color_texture_pool.acquire(cmd, backbuffer->m_dim);
-        auto depth_stencil = ds_pool.acquire(cmd, backbuffer->m_dim);
+        std::optional<u64> benchmark_frame = snapshot->benchmark_frame;
+        gpu_profiler.beginFrame(cmd, image_index);
+        u32 frame_zone = gpu_profiler.beginZone(cmd, "frame");
+
+        RenderGraph::Resource backbuffer_image =
+            frame_graph.importImage("backbuffer", current_buffer.image, current_buffer.view,
+                                    VK_IMAGE_ASPECT_COLOR_BIT, RenderGraphUsage::None,
+                                    offscreen ? RenderGraphUsage::TransferSrc
+                                              : RenderGraphUsage::Present);
+        RenderGraph::Resource color_image = frame_graph.createImage(
+            "msaa_color", {backbuffer->m_dim, color_image_create_info.format,
+                           color_image_create_info.samples, VK_IMAGE_ASPECT_COLOR_BIT});
+        RenderGraph::Resource depth_image = frame_graph.createImage(
+            "depth", {backbuffer->m_dim, depth_image_create_info.format,
+                      depth_image_create_info.samples, VK_IMAGE_ASPECT_DEPTH_BIT});
         RenderTarget render_target{
-            .color_view = color_texture.view,
-            .depth_view = depth_stencil.view,
-            .resolve_view = current_buffer.view,
+            .color = color_image,
+            .depth = depth_image,
+            .resolve = backbuffer_image,
             .area = {.offset = {0, 0}, .extent = {backbuffer->m_dim.x, backbuffer->m_dim.y}},
         };
-        uint32_t instance_count = world_pipeline.execute(cmd, render_target);
-        std::string window_title = std::format("Example - GPU Driven Rendering -- (lclick+drag to look, lclick+wasd to move) -- visible instances: {}/{}", instance_count, InstanceCountMax);
+        world_pipeline.execute(frame_graph, render_target);
+        const DrawWorldStats &world_stats = world_pipeline.m_stats;
+        ArenaString window_title(&frame_arena);
+        window_title.reserve(128);
+        std::format_to(std::back_inserter(window_title),
+                       "Example - GPU Driven Rendering -- (lclick+drag to look, lclick+wasd to "
+                       "move) -- visible instances: {}/{}",
+                       world_stats.drawn_instances, world.m_instances.size());
         platform->setWindowTitle(window, window_title);
 
-        ds_pool.release(cmd, depth_stencil, current_buffer.fence);
-        color_texture_pool.release(cmd, color_texture, current_buffer.fence);
-
-        {
-            std::array image_barriers = {
-                VkImageMemoryBarrier{
-                    .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
-                    .pNext = nullptr,
-                    .srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
-                    .dstAccessMask = VK_ACCESS_NONE,
-                    .oldLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
-                    .newLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
-                    .srcQueueFamilyIndex = ctx->m_device.m_queue_family_index,
-                    .dstQueueFamilyIndex = ctx->m_device.m_queue_family_index,
-                    .image = current_buffer.image,
-                    .subresourceRange =
-                        {
-                            .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-                            .baseMipLevel = 0,
-                            .levelCount = 1,
-                            .baseArrayLayer = 0,
-                            .layerCount = 1,
-                        },
-                },
-            };
-
-            vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
-                                 VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 0, nullptr,
-                                 image_barriers.size(), image_barriers.data());
+        frame_graph.compile();
+        for (u32 slot = 0; slot < frame_graph.m_transient_slots.size(); ++slot) {
+            const RenderGraph::ImageDesc &desc = frame_graph.m_transient_slots[slot].desc;
+            TexturePool &pool = desc.format == depth_image_create_info.format ? ds_pool
+                                                                              : color_texture_pool;
+            auto texture = pool.acquire(cmd, desc.dim, desc.format);
+            frame_graph.bindTransient(slot, texture.image, texture.view);
+            pool.release(cmd, texture, current_buffer.fence);
         }
+        frame_graph.execute(cmd, &gpu_profiler);
+        gpu_profiler.endZone(cmd, frame_zone);
+        profiled_frames[image_index] = benchmark_frame;
         vkEndCommandBuffer(cmd);
 
+        // Offscreen frames neither wait for an acquired image nor signal a present
         VkPipelineStageFlags sem_wait_stage = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+        u32 wait_sem_count = offscreen ? 0 : 1;
+        u32 first_signal_sem = offscreen ? 1 : 0;
+        std::array signal_sems = {end_sem, timeline.m_semaphore};
+        std::array signal_values = std::to_array<u64>({0, timeline.advance()});
+        VkTimelineSemaphoreSubmitInfo timeline_submit_info = {
+            .sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO,
+            .pNext = nullptr,
+            .waitSemaphoreValueCount = 0,
+            .pWaitSemaphoreValues = nullptr,
+            .signalSemaphoreValueCount = (u32)signal_values.size() - first_signal_sem,
+            .pSignalSemaphoreValues = signal_values.data() + first_signal_sem,
+        };
         VkSubmitInfo submit_info = {
             .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-            .pNext = nullptr,
-            .waitSemaphoreCount = 1,
+            .pNext = &timeline_submit_info,
+            .waitSemaphoreCount = wait_sem_count,
             .pWaitSemaphores = &begin_sem,
             .pWaitDstStageMask = &sem_wait_stage,
             .commandBufferCount = 1,
             .pCommandBuffers = &cmd,
-            .signalSemaphoreCount = 1,
-            .pSignalSemaphores = &end_sem,
+            .signalSemaphoreCount = (u32)signal_sems.size() - first_signal_sem,
+            .pSignalSemaphores = signal_sems.data() + first_signal_sem,
         };
-        vkQueueSubmit(ctx->m_device.m_queue, 1, &submit_info, current_buffer.fence);
+        {
+            BRTOY_PROFILE_ZONE("submit");
+            vkQueueSubmit(ctx->m_device.m_queue, 1, &submit_info, current_buffer.fence);
+        }
         cb_pool.release(cmd, current_buffer.fence);
 
+        // Counted from submit to submit, so the tick and the present are included
+        u64 heap_allocations = heapAllocationCount() - heap_allocation_count;
+        heap_allocation_count += heap_allocations;
+        if (benchmark_frame) {
+            u64 end_timestamp = platform->getTimestamp();
+            float cpu_ms = float(end_timestamp - start_timestamp) * 1000.0f /
+                           platform->getTimestampTicksPerSecond();
+            recorder.recordCpu(*benchmark_frame, cpu_ms, world_stats.drawn_instances,
+                               world_stats.impostor_instances, (u32)heap_allocations);
+            if (*benchmark_frame + 1 == options->warmup_frame_count + options->frame_count)
+                platform->requestQuit();
+        }
+
+        if (offscreen)
+            continue;
+
         VkPresentInfoKHR present_info = {.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR,
                                          .pNext = nullptr,
                                          .waitSemaphoreCount = 1,
                                          .pWaitSemaphores = &end_sem,
                                          .swapchainCount = 1,
-                                         .pSwapchains = &swapchain.m_swapchain,
+                                         .pSwapchains = &swapchain->m_swapchain,
                                          .pImageIndices = &image_index,
                                          .pResults = nullptr};
+        BRTOY_PROFILE_ZONE("present");
         vkQueuePresentKHR(ctx->m_device.m_queue, &present_info);
     }
 
+    if (simulation_thread.joinable()) {
+        stop_simulation.store(true, std::memory_order_relaxed);
+        taken_snapshots.fetch_add(1, std::memory_order_release);
+        taken_snapshots.notify_one();
+        simulation_thread.join();
+    }
     vkDestroyFence(ctx->m_device.m_device, init_fence, nullptr);
 
     VkFence flush_fence;
@@ -1436,12 +2296,45 @@ int runExample() {
     vkWaitForFences(ctx->m_device.m_device, 1, &flush_fence, VK_TRUE, UINT64_MAX);
     vkDestroyFence(ctx->m_device.m_device, flush_fence, nullptr);
 
+    for (u32 buffer_index = 0; buffer_index < profiled_frames.size(); ++buffer_index)
+        resolveProfile(buffer_index);
+    if (options->benchmark) {
+        if (!options->output_path.empty() && !recorder.write(options->output_path)) {
+            Platform::errorMessage(
+                std::format("Could not write {}", options->output_path).c_str());
+        }
+        recorder.printSummary();
+    }
+    for (const GpuProfiler::ZoneStats &stats : gpu_profiler.m_stats)
+        printf("GPU %s: %.3f ms mean of the last %u samples\n", stats.name.c_str(), stats.mean_ms,
+               stats.sample_count);
+    int exit_code = 0;
+    if (options->check_allocations && recorder.allocatingFrameCount() > 0) {
+        fprintf(stderr, "%u measured frames allocated on the heap\n",
+                recorder.allocatingFrameCount());
+        exit_code = 1;
+    }
+    if (!options->trace_path.empty()) {
+        endTrace();
+        if (!writeTrace(options->trace_path.c_str())) {
+            Platform::errorMessage(std::format("Could not write {}", options->trace_path).c_str());
+        }
+    }
+    if (!options->memory_report_path.empty() &&
+        !memory_tracker.writeReport(options->memory_report_path.c_str())) {
+        Platform::errorMessage(
+            std::format("Could not write {}", options->memory_report_path).c_str());
+    }
+
+    pipeline_builder.waitAll();
+    ctx->m_device.savePipelineCache(pipeline_cache_path);
+
     vkDestroySemaphore(ctx->m_device.m_device, begin_sem, nullptr);
     vkDestroySemaphore(ctx->m_device.m_device, end_sem, nullptr);
 
-    return 0;
+    return exit_code;
 }
 
 } // namespace brtoy
 
-int main(int argc, char **argv) { return brtoy::runExample(); }
+int main(int argc, char **argv) { return brtoy::runExample(argc, argv); }
@@ -1,17 +1,55 @@
-struct MeshInfo
+// PositionFormat and NormalFormat in brtoy/mesh_asset.h
+static const uint PositionFormatFloat3 = 0;
+static const uint PositionFormatUnorm16 = 1;
+static const uint NormalFormatFloat3 = 0;
+static const uint NormalFormatOct16 = 1;
+static const uint NormalFormatOct8 = 2;
+
+// MeshLod and MeshInfo in gpu_driven_rendering.cpp. The levels are loaded one at a time, from
+// MeshInfoLodsOffset on.
+static const uint MeshInfoLodsOffset = 72;
+static const uint MeshLodSize = 12;
+
+// Visible instance entries hold the instance index in the low bits and the LOD in the high ones
+static const uint VisibleLodShift = 29;
+static const uint VisibleInstanceMask = (1u << VisibleLodShift) - 1;
+
+// Visible instances are drawn in buckets of one mesh and LOD each, bucket mesh_index *
+// DrawBucketsPerMesh + lod. Each bucket is one indirect draw of its level's index count, whose
+// instances are a contiguous range of g_visible_instances starting at its first_instance.
+static const uint DrawBucketsPerMesh = 1u << (32 - VisibleLodShift);
+// g_bucket_slots entry of the instances that aren't drawn as meshes. The others hold the
+// instance's position in its bucket in the low bits and the LOD in the high ones.
+static const uint NotInBucket = 0xffffffff;
+
+struct MeshLod
 {
     uint index_data_ptr;
+    uint index_count;
+    float error;
+};
+
+struct MeshInfo
+{
     uint pos_data_ptr;
     uint pos_data_stride;
     uint attrib_data_ptr;
     uint attrib_data_stride;
-    uint index_count;
+    uint index_size;
+    uint position_format;
+    uint normal_format;
+    float3 pos_offset;
+    float3 pos_scale;
+    float3 bounds_center;
+    float bounds_radius;
+    uint lod_count;
 };
 
 struct InstanceInfo
 {
     float4x4 transform;
     uint mesh_info_ptr;
+    uint mesh_index;
 };
 
 struct DrawParams
@@ -22,9 +60,32 @@ struct DrawParams
     uint first_instance;
 };
 
+struct CullStats
+{
+    uint tested_instances;
+    uint frustum_culled_instances;
+    uint small_culled_instances;
+    uint occlusion_culled_instances;
+    uint drawn_triangles;
+};
+
+struct CullOutput
+{
+    DrawParams impostor_draw_params;
+    CullStats stats;
+    // Sum of the instance counts of the bucket draws
+    uint drawn_instances;
+};
+
 struct WorldConstants
 {
     float4x4 view_projection;
+    float projection_scale;
+    float lod_error_pixels;
+    float min_size_pixels;
+    uint draw_impostors;
+    uint instance_count;
+    uint draw_bucket_count;
 };
 
 ByteAddressBuffer g_mesh_data : register(t0, space0);
@@ -32,88 +93,309 @@ ByteAddressBuffer g_mesh_data : register(t0, space0);
 StructuredBuffer<InstanceInfo> g_instances : register(t0, space1);
 RWByteAddressBuffer g_visible_instances_rw : register(u1, space1);
 ByteAddressBuffer g_visible_instances : register(t1, space1);
+// World space centers of the instances drawn as impostors
+RWByteAddressBuffer g_impostors_rw : register(u3, space1);
+ByteAddressBuffer g_impostors : register(t3, space1);
 
 cbuffer WorldConstants : register(b2, space1)
 {
     WorldConstants g_constants;
 }
 
-RWStructuredBuffer<DrawParams> g_draw_params : register(u0, space2);
+RWStructuredBuffer<CullOutput> g_cull_output : register(u0, space2);
+RWStructuredBuffer<DrawParams> g_bucket_draws : register(u1, space2);
+// One entry per instance, see NotInBucket
+RWByteAddressBuffer g_bucket_slots : register(u2, space2);
 
 MeshInfo loadMeshInfo(uint offset)
 {
     MeshInfo mesh;
-    mesh.index_data_ptr = g_mesh_data.Load(offset);
-    mesh.pos_data_ptr = g_mesh_data.Load(offset += 4);
+    mesh.pos_data_ptr = g_mesh_data.Load(offset);
     mesh.pos_data_stride = g_mesh_data.Load(offset += 4);
     mesh.attrib_data_ptr = g_mesh_data.Load(offset += 4);
     mesh.attrib_data_stride = g_mesh_data.Load(offset += 4);
-    mesh.index_count = g_mesh_data.Load(offset += 4);
+    mesh.index_size = g_mesh_data.Load(offset += 4);
+    mesh.position_format = g_mesh_data.Load(offset += 4);
+    mesh.normal_format = g_mesh_data.Load(offset += 4);
+    mesh.pos_offset = asfloat(g_mesh_data.Load3(offset += 4));
+    mesh.pos_scale = asfloat(g_mesh_data.Load3(offset += 12));
+    mesh.bounds_center = asfloat(g_mesh_data.Load3(offset += 12));
+    mesh.bounds_radius = asfloat(g_mesh_data.Load(offset += 12));
+    mesh.lod_count = g_mesh_data.Load(offset += 4);
     return mesh;
 }
 
+MeshLod loadMeshLod(uint mesh_offset, uint lod_index)
+{
+    uint3 words = g_mesh_data.Load3(mesh_offset + MeshInfoLodsOffset + MeshLodSize * lod_index);
+    MeshLod lod;
+    lod.index_data_ptr = words.x;
+    lod.index_count = words.y;
+    lod.error = asfloat(words.z);
+    return lod;
+}
+
+uint loadIndex(MeshInfo mesh, MeshLod lod, uint i)
+{
+    if (mesh.index_size == 2) {
+        // Two indices per word, index_data_ptr is only 2-byte aligned for the coarser levels
+        uint address = lod.index_data_ptr + 2 * i;
+        return (g_mesh_data.Load(address & ~3u) >> ((address & 2u) * 8)) & 0xffff;
+    }
+    return g_mesh_data.Load(lod.index_data_ptr + 4 * i);
+}
+
+float3 loadPosition(MeshInfo mesh, uint index)
+{
+    uint address = mesh.pos_data_ptr + mesh.pos_data_stride * index;
+    if (mesh.position_format == PositionFormatUnorm16) {
+        uint2 packed = g_mesh_data.Load2(address);
+        float3 unorm = float3(packed.x & 0xffff, packed.x >> 16, packed.y & 0xffff);
+        return mesh.pos_offset + unorm * mesh.pos_scale;
+    }
+    return asfloat(g_mesh_data.Load3(address));
+}
+
+float3 decodeOctahedral(float2 f)
+{
+    float3 n = float3(f, 1.0 - abs(f.x) - abs(f.y));
+    float t = saturate(-n.z);
+    n.x += n.x >= 0.0 ? -t : t;
+    n.y += n.y >= 0.0 ? -t : t;
+    return normalize(n);
+}
+
+float3 loadNormal(MeshInfo mesh, uint index)
+{
+    uint address = mesh.attrib_data_ptr + mesh.attrib_data_stride * index;
+    if (mesh.normal_format == NormalFormatOct16) {
+        int packed = int(g_mesh_data.Load(address));
+        int2 snorm = int2(packed << 16, packed) >> 16;
+        return decodeOctahedral(max(float2(snorm) / 32767.0, -1.0));
+    }
+    if (mesh.normal_format == NormalFormatOct8) {
+        // Two byte vertices, so the load is of the aligned word holding them
+        int packed = int(g_mesh_data.Load(address & ~3u) >> ((address & 2u) * 8));
+        int2 snorm = int2(packed << 24, packed << 16) >> 24;
+        return decodeOctahedral(max(float2(snorm) / 127.0, -1.0));
+    }
+    return asfloat(g_mesh_data.Load3(address));
+}
+
+// Bounding sphere of an instance in world space
+struct InstanceBounds
+{
+    float3 center;
+    float radius;
+    // Largest scale of the instance transform's axes
+    float scale;
+    // Distance along the view direction to the sphere's nearest point, not positive if the
+    // sphere reaches behind the camera
+    float nearest;
+};
+
+InstanceBounds instanceBounds(InstanceInfo instance, MeshInfo mesh)
+{
+    InstanceBounds bounds;
+    bounds.center = mul(float4(mesh.bounds_center, 1.0), instance.transform).xyz;
+    bounds.scale = max(length(mul(float4(1, 0, 0, 0), instance.transform).xyz),
+                       max(length(mul(float4(0, 1, 0, 0), instance.transform).xyz),
+                           length(mul(float4(0, 0, 1, 0), instance.transform).xyz)));
+    bounds.radius = mesh.bounds_radius * bounds.scale;
+    // w is the distance along the view direction
+    bounds.nearest = mul(float4(bounds.center, 1.0), g_constants.view_projection).w - bounds.radius;
+    return bounds;
+}
+
+// Whether the sphere's diameter, projected at its nearest point, is under min_size_pixels
+bool isSmall(InstanceBounds bounds)
+{
+    return bounds.nearest > 0.0 &&
+           2.0 * bounds.radius * g_constants.projection_scale <
+               g_constants.min_size_pixels * bounds.nearest;
+}
+
+// Picks the coarsest level whose error stays within lod_error_pixels on screen. The error is
+// scaled like the bounding sphere, so this is its fraction of the sphere's projected radius,
+// taken at the sphere's nearest point.
+uint selectLod(InstanceInfo instance, MeshInfo mesh, InstanceBounds bounds)
+{
+    if (bounds.nearest <= 0.0)
+        return 0;
+
+    float pixels_per_unit = g_constants.projection_scale / bounds.nearest;
+    uint lod_index = 0;
+    for (uint i = 1; i < mesh.lod_count; ++i) {
+        MeshLod lod = loadMeshLod(instance.mesh_info_ptr, i);
+        if (lod.error * bounds.scale * pixels_per_unit > g_constants.lod_error_pixels)
+            break;
+        lod_index = i;
+    }
+    return lod_index;
+}
+
 [numthreads(256, 1, 1)]
 void cullInstances(uint3 thread_id : SV_DispatchThreadID)
 {
-    g_draw_params[0].vertex_count = 45;
+    bool tested = false;
+    bool small = false;
+    bool impostor = false;
     bool visible = false;
+    uint triangle_count = 0;
+    uint lod_index = 0;
+    uint lod_index_count = 0;
+    uint mesh_index = 0;
+    float3 impostor_center = float3(0, 0, 0);
 
-    uint instance_count;
-    g_instances.GetDimensions(instance_count);
     uint instance_index = thread_id.x;
-    if (instance_index < instance_count)
+    if (instance_index < g_constants.instance_count)
     {
         InstanceInfo instance = g_instances[instance_index];
+        mesh_index = instance.mesh_index;
         MeshInfo mesh = loadMeshInfo(instance.mesh_info_ptr);
+        InstanceBounds bounds = instanceBounds(instance, mesh);
+        tested = true;
+        small = isSmall(bounds);
+        if (small) {
+            if (g_constants.draw_impostors != 0) {
+                float4 clip_center = mul(float4(bounds.center, 1.0), g_constants.view_projection);
+                impostor = clip_center.w > 0.0 && all(abs(clip_center.xy) < clip_center.w);
+                impostor_center = bounds.center;
+            }
+        } else {
+            lod_index = selectLod(instance, mesh, bounds);
+            MeshLod lod = loadMeshLod(instance.mesh_info_ptr, lod_index);
+            lod_index_count = lod.index_count;
+            triangle_count = lod.index_count / 3;
 
-        for (uint i = 0; i < mesh.index_count; ++i) {
-            uint index = g_mesh_data.Load(mesh.index_data_ptr + 4 * i);
-            float3 v_pos = asfloat(g_mesh_data.Load3(mesh.pos_data_ptr + mesh.pos_data_stride * index));
-            float3 world_pos = mul(float4(v_pos, 1), instance.transform).xyz;
-            float4 clip_pos = mul(float4(world_pos, 1), g_constants.view_projection);
-            if (clip_pos.x > -clip_pos.w && clip_pos.x < clip_pos.w &&
-                clip_pos.x > -clip_pos.w && clip_pos.x < clip_pos.w &&
-                clip_pos.x > -clip_pos.w && clip_pos.x < clip_pos.w &&
-                clip_pos.x > -clip_pos.w && clip_pos.x < clip_pos.w) {
-                visible = true;
-                break;
-            } 
+            for (uint i = 0; i < lod.index_count; ++i) {
+                uint index = loadIndex(mesh, lod, i);
+                float3 v_pos = loadPosition(mesh, index);
+                float3 world_pos = mul(float4(v_pos, 1), instance.transform).xyz;
+                float4 clip_pos = mul(float4(world_pos, 1), g_constants.view_projection);
+                if (clip_pos.x > -clip_pos.w && clip_pos.x < clip_pos.w &&
+                    clip_pos.x > -clip_pos.w && clip_pos.x < clip_pos.w &&
+                    clip_pos.x > -clip_pos.w && clip_pos.x < clip_pos.w &&
+                    clip_pos.x > -clip_pos.w && clip_pos.x < clip_pos.w) {
+                    visible = true;
+                    break;
+                } 
+            }
         }
     }
 
+    // buildDraws places the buckets once they are all counted, scatterVisible then moves the
+    // instances to their bucket's range
     if (visible) {
-        uint out_instance_index;
-        InterlockedAdd(g_draw_params[0].instance_count, 1, out_instance_index);
-        g_visible_instances_rw.Store(out_instance_index * 4, instance_index);
+        uint bucket = mesh_index * DrawBucketsPerMesh + lod_index;
+        uint bucket_slot;
+        // All instances of a bucket store the same count
+        g_bucket_draws[bucket].vertex_count = lod_index_count;
+        InterlockedAdd(g_bucket_draws[bucket].instance_count, 1, bucket_slot);
+        g_bucket_slots.Store(instance_index * 4, bucket_slot | (lod_index << VisibleLodShift));
+    } else if (tested) {
+        g_bucket_slots.Store(instance_index * 4, NotInBucket);
+    }
+
+    // Most of the far field ends up here, so the slots are allocated per wave
+    if (thread_id.x == 0)
+        g_cull_output[0].impostor_draw_params.instance_count = 1;
+    uint wave_impostors = WaveActiveCountBits(impostor);
+    uint impostor_base = 0;
+    if (WaveIsFirstLane() && wave_impostors != 0)
+        InterlockedAdd(g_cull_output[0].impostor_draw_params.vertex_count, wave_impostors,
+                       impostor_base);
+    impostor_base = WaveReadLaneFirst(impostor_base);
+    if (impostor) {
+        uint impostor_index = impostor_base + WavePrefixCountBits(impostor);
+        g_impostors_rw.Store3(impostor_index * 12, asuint(impostor_center));
+    }
+
+    // One atomic per wave and counter instead of one per thread
+    uint wave_tested = WaveActiveCountBits(tested);
+    uint wave_visible = WaveActiveCountBits(visible);
+    uint wave_small = WaveActiveCountBits(small);
+    uint wave_culled = WaveActiveCountBits(tested && !small && !visible);
+    uint wave_triangles = WaveActiveSum(visible ? triangle_count : 0);
+    if (WaveIsFirstLane()) {
+        InterlockedAdd(g_cull_output[0].drawn_instances, wave_visible);
+        InterlockedAdd(g_cull_output[0].stats.tested_instances, wave_tested);
+        InterlockedAdd(g_cull_output[0].stats.frustum_culled_instances, wave_culled);
+        InterlockedAdd(g_cull_output[0].stats.small_culled_instances, wave_small);
+        InterlockedAdd(g_cull_output[0].stats.drawn_triangles, wave_triangles);
+    }
+}
+
+static const uint BuildDrawsThreadCount = 256;
+groupshared uint g_chunk_instance_counts[BuildDrawsThreadCount];
+
+// Runs as a single group. Every thread sums the instance counts of a contiguous chunk of the
+// buckets, then sets their first instances from the counts of the chunks before it.
+[numthreads(BuildDrawsThreadCount, 1, 1)]
+void buildDraws(uint thread_index : SV_GroupIndex)
+{
+    uint bucket_count = g_constants.draw_bucket_count;
+    uint chunk_size = (bucket_count + BuildDrawsThreadCount - 1) / BuildDrawsThreadCount;
+    uint first_bucket = min(thread_index * chunk_size, bucket_count);
+    uint end_bucket = min(first_bucket + chunk_size, bucket_count);
+
+    uint chunk_instance_count = 0;
+    for (uint i = first_bucket; i < end_bucket; ++i)
+        chunk_instance_count += g_bucket_draws[i].instance_count;
+    g_chunk_instance_counts[thread_index] = chunk_instance_count;
+    GroupMemoryBarrierWithGroupSync();
+
+    uint first_instance = 0;
+    for (uint chunk = 0; chunk < thread_index; ++chunk)
+        first_instance += g_chunk_instance_counts[chunk];
+    for (uint bucket = first_bucket; bucket < end_bucket; ++bucket) {
+        g_bucket_draws[bucket].first_instance = first_instance;
+        first_instance += g_bucket_draws[bucket].instance_count;
     }
 }
 
+[numthreads(256, 1, 1)]
+void scatterVisible(uint3 thread_id : SV_DispatchThreadID)
+{
+    uint instance_index = thread_id.x;
+    if (instance_index >= g_constants.instance_count)
+        return;
+    uint bucket_slot = g_bucket_slots.Load(instance_index * 4);
+    if (bucket_slot == NotInBucket)
+        return;
+
+    uint lod_index = bucket_slot >> VisibleLodShift;
+    uint bucket = g_instances[instance_index].mesh_index * DrawBucketsPerMesh + lod_index;
+    uint visible_index =
+        g_bucket_draws[bucket].first_instance + (bucket_slot & VisibleInstanceMask);
+    g_visible_instances_rw.Store(visible_index * 4,
+                                 instance_index | (lod_index << VisibleLodShift));
+}
+
 struct ClipVertex
 {
     float4 pos : SV_Position;
     float3 normal : Normal;
 };
 
+// The instance ID includes the first instance of the bucket's draw, and the draw has as many
+// vertices as the bucket's level has indices
 ClipVertex vsMain(uint instance_id : SV_InstanceID, uint vertex_id : SV_VertexID)
 {
-    uint instance_index = g_visible_instances.Load(instance_id * 4);
-    InstanceInfo instance = g_instances[instance_index];
+    uint visible_instance = g_visible_instances.Load(instance_id * 4);
+    InstanceInfo instance = g_instances[visible_instance & VisibleInstanceMask];
     MeshInfo mesh = loadMeshInfo(instance.mesh_info_ptr);
+    MeshLod lod = loadMeshLod(instance.mesh_info_ptr, visible_instance >> VisibleLodShift);
+
+    uint index = loadIndex(mesh, lod, vertex_id);
+    float3 v_pos = loadPosition(mesh, index);
+    float3 v_normal = loadNormal(mesh, index);
+    float3 world_pos = mul(float4(v_pos, 1.0), instance.transform).xyz;
+    float3 world_normal = mul(float4(v_normal, 0.0), instance.transform).xyz;
 
     ClipVertex out_vertex;
-    out_vertex.pos = float4(0,0,0,1);
-    out_vertex.normal = float3(0,0,0);
-    if (vertex_id < mesh.index_count)
-    {
-        uint index = g_mesh_data.Load(mesh.index_data_ptr + 4 * vertex_id);
-        float3 v_pos = asfloat(g_mesh_data.Load3(mesh.pos_data_ptr + mesh.pos_data_stride * index));
-        float3 v_normal = asfloat(g_mesh_data.Load3(mesh.attrib_data_ptr + mesh.attrib_data_stride * index));
-        float3 world_pos = mul(float4(v_pos, 1.0), instance.transform).xyz;
-        float3 world_normal = mul(float4(v_normal, 0.0), instance.transform).xyz;
-
-        out_vertex.pos = mul(float4(world_pos, 1.0), g_constants.view_projection);
-        out_vertex.normal = world_normal;
-    }
+    out_vertex.pos = mul(float4(world_pos, 1.0), g_constants.view_projection);
+    out_vertex.normal = world_normal;
     return out_vertex;
 }
 
@@ -123,3 +405,27 @@ float4 fsMain(ClipVertex vertex) : SV_Target0
     float n_dot_l = clamp(dot(vertex.normal, light_dir), 0.0, 1.0);
     return float4(float3(1, 1, 1) * n_dot_l, 1.0);
 }
+
+struct ImpostorVertex
+{
+    float4 pos : SV_Position;
+    [[vk::builtin("PointSize")]] float point_size : PSIZE;
+};
+
+// Impostors are below min_size_pixels, so a single pixel stands in for the whole instance
+ImpostorVertex vsImpostor(uint vertex_id : SV_VertexID)
+{
+    float3 center = asfloat(g_impostors.Load3(vertex_id * 12));
+    ImpostorVertex out_vertex;
+    out_vertex.pos = mul(float4(center, 1.0), g_constants.view_projection);
+    out_vertex.point_size = 1.0;
+    return out_vertex;
+}
+
+// What fsMain averages to over all normal directions
+static const float ImpostorShade = 0.25;
+
+float4 fsImpostor() : SV_Target0
+{
+    return float4(ImpostorShade.xxx, 1.0);
+}
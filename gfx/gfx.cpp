@@ -2,6 +2,10 @@
 #include <array>
 #include <brtoy/brtoy.h>
 #include <brtoy/gfx.h>
+#include <brtoy/hash.h>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
 #include <set>
 #include <span>
 #include <string>
@@ -37,9 +41,10 @@ static std::vector<VkExtensionProperties> getInstanceExtensions(const char *laye
     return extensions;
 }
 
+// The surface and swapchain extensions are only required by platforms with a window system
 std::set<std::string_view> getRequiredPlatformInstanceExtensions();
 static std::set<std::string_view> getRequiredInstanceExtensions(GfxDebugFlag flags) {
-    std::set<std::string_view> extensions = {VK_KHR_SURFACE_EXTENSION_NAME};
+    std::set<std::string_view> extensions = {};
     if (hasFlag(flags, GfxDebugFlag::ValidationEnable)) {
         extensions.insert(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
     }
@@ -68,7 +73,6 @@ static std::vector<VkExtensionProperties> getDeviceExtensions(VkPhysicalDevice p
 std::set<std::string_view> getRequiredPlatformDeviceExtensions();
 static std::set<std::string_view> getRequiredDeviceExtensions() {
     std::set<std::string_view> extensions = {
-        VK_KHR_SWAPCHAIN_EXTENSION_NAME,
         VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME,
     };
     extensions.merge(getRequiredPlatformDeviceExtensions());
@@ -198,6 +202,34 @@ static VkPhysicalDevice selectPhysicalDevice(VkInstance instance) {
     return selected_device;
 }
 
+static bool hasExtension(std::span<const VkExtensionProperties> extensions,
+                         std::string_view name) {
+    return std::any_of(extensions.begin(), extensions.end(), [&](const VkExtensionProperties &ext) {
+        return name == ext.extensionName;
+    });
+}
+
+VkTimeDomainEXT getHostTimeDomain();
+// Calibrated timestamps are optional. They let GPU timestamps be placed on the CPU timeline.
+static bool supportsCalibratedTimestamps(VkInstance instance, VkPhysicalDevice physical_device,
+                                         std::span<const VkExtensionProperties> extensions) {
+    if (!hasExtension(extensions, VK_EXT_CALIBRATED_TIMESTAMPS_EXTENSION_NAME))
+        return false;
+    auto get_time_domains = (PFN_vkGetPhysicalDeviceCalibrateableTimeDomainsEXT)
+        vkGetInstanceProcAddr(instance, "vkGetPhysicalDeviceCalibrateableTimeDomainsEXT");
+    if (!get_time_domains)
+        return false;
+    u32 time_domain_count = 0;
+    get_time_domains(physical_device, &time_domain_count, nullptr);
+    std::vector<VkTimeDomainEXT> time_domains(time_domain_count);
+    get_time_domains(physical_device, &time_domain_count, time_domains.data());
+    auto hasTimeDomain = [&](VkTimeDomainEXT time_domain) {
+        return std::find(time_domains.begin(), time_domains.end(), time_domain) !=
+               time_domains.end();
+    };
+    return hasTimeDomain(VK_TIME_DOMAIN_DEVICE_EXT) && hasTimeDomain(getHostTimeDomain());
+}
+
 std::optional<GfxDevice> GfxDevice::createDefault(GfxInstance &instance) {
     std::optional<GfxDevice> result;
     VkPhysicalDevice physical_device = selectPhysicalDevice(instance.m_instance);
@@ -266,6 +298,10 @@ std::optional<GfxDevice> GfxDevice::createDefault(GfxInstance &instance) {
                     enabled_extensions.insert(ext.extensionName);
                 }
             }
+            bool has_calibrated_timestamps =
+                supportsCalibratedTimestamps(instance.m_instance, physical_device, impl_extensions);
+            bool has_memory_budget =
+                hasExtension(impl_extensions, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
 
             if (std::includes(enabled_layers.begin(), enabled_layers.end(), required_layers.begin(),
                               required_layers.end()) &&
@@ -278,9 +314,29 @@ std::optional<GfxDevice> GfxDevice::createDefault(GfxInstance &instance) {
                 std::vector<const char *> extension_names;
                 for (const auto &n : enabled_extensions)
                     extension_names.push_back(n.c_str());
+                if (has_calibrated_timestamps)
+                    extension_names.push_back(VK_EXT_CALIBRATED_TIMESTAMPS_EXTENSION_NAME);
+                if (has_memory_budget)
+                    extension_names.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+
+                // Optional core features are enabled where supported
+                VkPhysicalDeviceFeatures supported_features;
+                vkGetPhysicalDeviceFeatures(physical_device, &supported_features);
+                VkPhysicalDeviceFeatures enabled_features{};
+                enabled_features.pipelineStatisticsQuery =
+                    supported_features.pipelineStatisticsQuery;
+                enabled_features.multiDrawIndirect = supported_features.multiDrawIndirect;
+                enabled_features.drawIndirectFirstInstance =
+                    supported_features.drawIndirectFirstInstance;
+
+                VkPhysicalDeviceVulkan12Features features12{};
+                features12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+                features12.timelineSemaphore = true;
 
                 VkPhysicalDeviceVulkan13Features features{};
                 features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_3_FEATURES;
+                features.pNext = &features12;
+                features.synchronization2 = true;
                 features.dynamicRendering = true;
                 features.maintenance4 = true;
 
@@ -294,7 +350,7 @@ std::optional<GfxDevice> GfxDevice::createDefault(GfxInstance &instance) {
                     .ppEnabledLayerNames = layer_names.data(),
                     .enabledExtensionCount = (u32)extension_names.size(),
                     .ppEnabledExtensionNames = extension_names.data(),
-                    .pEnabledFeatures = nullptr,
+                    .pEnabledFeatures = &enabled_features,
                 };
 
                 VkDevice vk_device;
@@ -305,11 +361,29 @@ std::optional<GfxDevice> GfxDevice::createDefault(GfxInstance &instance) {
                     VkQueue queue;
                     vkGetDeviceQueue(vk_device, selected_queue_family_index, 0, &queue);
 
+                    VkPipelineCacheCreateInfo cache_create_info = {
+                        .sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
+                        .pNext = nullptr,
+                        .flags = 0,
+                        .initialDataSize = 0,
+                        .pInitialData = nullptr,
+                    };
+                    // Pipelines can be created without a cache, just more slowly
+                    VkPipelineCache pipeline_cache = VK_NULL_HANDLE;
+                    if (vkCreatePipelineCache(vk_device, &cache_create_info, nullptr,
+                                              &pipeline_cache) != VK_SUCCESS)
+                        pipeline_cache = VK_NULL_HANDLE;
+
                     result.emplace();
                     result->m_physical_device = physical_device;
                     result->m_device = vk_device;
                     result->m_queue = queue;
                     result->m_queue_family_index = selected_queue_family_index;
+                    result->m_pipeline_cache = pipeline_cache;
+                    result->m_enabled_features = enabled_features;
+                    result->m_has_calibrated_timestamps = has_calibrated_timestamps;
+                    result->m_host_time_domain = getHostTimeDomain();
+                    result->m_has_memory_budget = has_memory_budget;
                 }
             }
         }
@@ -326,18 +400,152 @@ GfxDevice &GfxDevice::operator=(GfxDevice &&that) {
     this->m_physical_device = that.m_physical_device;
     this->m_queue = that.m_queue;
     this->m_queue_family_index = that.m_queue_family_index;
+    this->m_pipeline_cache = that.m_pipeline_cache;
+    this->m_enabled_features = that.m_enabled_features;
+    this->m_has_calibrated_timestamps = that.m_has_calibrated_timestamps;
+    this->m_host_time_domain = that.m_host_time_domain;
+    this->m_has_memory_budget = that.m_has_memory_budget;
     that.m_device = VK_NULL_HANDLE;
     that.m_physical_device = VK_NULL_HANDLE;
     that.m_queue = VK_NULL_HANDLE;
     that.m_queue_family_index = 0;
+    that.m_pipeline_cache = VK_NULL_HANDLE;
+    that.m_has_calibrated_timestamps = false;
+    that.m_has_memory_budget = false;
     return *this;
 }
 
 GfxDevice::~GfxDevice() { destroy(); }
 
 void GfxDevice::destroy() {
-    if (m_device != VK_NULL_HANDLE)
+    if (m_device != VK_NULL_HANDLE) {
+        vkDestroyPipelineCache(m_device, m_pipeline_cache, nullptr);
         vkDestroyDevice(m_device, nullptr);
+    }
+}
+
+// Written in front of the driver's cache data. The driver validates its own header too, but not
+// all drivers handle data from another driver version gracefully.
+struct PipelineCacheFileHeader {
+    static constexpr u32 Magic = 0x43505442; // "BTPC"
+    static constexpr u32 Version = 1;
+
+    u32 magic;
+    u32 version;
+    u32 vendor_id;
+    u32 device_id;
+    u32 driver_version;
+    u8 driver_uuid[VK_UUID_SIZE];
+    u8 pipeline_cache_uuid[VK_UUID_SIZE];
+    u64 data_size;
+    u64 data_hash;
+};
+
+static PipelineCacheFileHeader pipelineCacheFileHeader(VkPhysicalDevice physical_device) {
+    VkPhysicalDeviceIDProperties id_properties{};
+    id_properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ID_PROPERTIES;
+    VkPhysicalDeviceProperties2 properties{};
+    properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+    properties.pNext = &id_properties;
+    vkGetPhysicalDeviceProperties2(physical_device, &properties);
+
+    PipelineCacheFileHeader header{};
+    header.magic = PipelineCacheFileHeader::Magic;
+    header.version = PipelineCacheFileHeader::Version;
+    header.vendor_id = properties.properties.vendorID;
+    header.device_id = properties.properties.deviceID;
+    header.driver_version = properties.properties.driverVersion;
+    std::copy_n(id_properties.driverUUID, VK_UUID_SIZE, header.driver_uuid);
+    std::copy_n(properties.properties.pipelineCacheUUID, VK_UUID_SIZE,
+                header.pipeline_cache_uuid);
+    return header;
+}
+
+static bool isCompatible(const PipelineCacheFileHeader &a, const PipelineCacheFileHeader &b) {
+    return a.magic == b.magic && a.version == b.version && a.vendor_id == b.vendor_id &&
+           a.device_id == b.device_id && a.driver_version == b.driver_version &&
+           std::equal(a.driver_uuid, a.driver_uuid + VK_UUID_SIZE, b.driver_uuid) &&
+           std::equal(a.pipeline_cache_uuid, a.pipeline_cache_uuid + VK_UUID_SIZE,
+                      b.pipeline_cache_uuid);
+}
+
+bool GfxDevice::loadPipelineCache(const char *path) {
+    std::ifstream ifs(path, std::ios::in | std::ios::binary);
+    if (!ifs)
+        return false;
+
+    PipelineCacheFileHeader header;
+    if (!ifs.read((char *)&header, sizeof(header)))
+        return false;
+    PipelineCacheFileHeader expected = pipelineCacheFileHeader(m_physical_device);
+    if (!isCompatible(header, expected) ||
+        header.data_size < sizeof(VkPipelineCacheHeaderVersionOne))
+        return false;
+    // A corrupt size mustn't decide the allocation, so it's checked against the rest of the file
+    std::streamoff data_offset = ifs.tellg();
+    if (!ifs.seekg(0, std::ios::end))
+        return false;
+    std::streamoff file_size = ifs.tellg();
+    if (data_offset < 0 || file_size < data_offset ||
+        header.data_size > (u64)(file_size - data_offset) || !ifs.seekg(data_offset))
+        return false;
+
+    std::vector<std::byte> data(header.data_size);
+    if (!ifs.read((char *)data.data(), data.size()) || hashBytes(data) != header.data_hash)
+        return false;
+
+    VkPipelineCacheHeaderVersionOne vk_header;
+    std::memcpy(&vk_header, data.data(), sizeof(vk_header));
+    if (vk_header.headerVersion != VK_PIPELINE_CACHE_HEADER_VERSION_ONE ||
+        vk_header.vendorID != expected.vendor_id || vk_header.deviceID != expected.device_id ||
+        !std::equal(vk_header.pipelineCacheUUID, vk_header.pipelineCacheUUID + VK_UUID_SIZE,
+                    expected.pipeline_cache_uuid))
+        return false;
+
+    VkPipelineCacheCreateInfo cache_create_info = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
+        .pNext = nullptr,
+        .flags = 0,
+        .initialDataSize = data.size(),
+        .pInitialData = data.data(),
+    };
+    VkPipelineCache pipeline_cache;
+    if (vkCreatePipelineCache(m_device, &cache_create_info, nullptr, &pipeline_cache) !=
+        VK_SUCCESS)
+        return false;
+    vkDestroyPipelineCache(m_device, m_pipeline_cache, nullptr);
+    m_pipeline_cache = pipeline_cache;
+    return true;
+}
+
+bool GfxDevice::savePipelineCache(const char *path) const {
+    if (m_pipeline_cache == VK_NULL_HANDLE)
+        return false;
+    size_t data_size = 0;
+    if (vkGetPipelineCacheData(m_device, m_pipeline_cache, &data_size, nullptr) != VK_SUCCESS)
+        return false;
+    std::vector<std::byte> data(data_size);
+    if (vkGetPipelineCacheData(m_device, m_pipeline_cache, &data_size, data.data()) !=
+        VK_SUCCESS)
+        return false;
+    data.resize(data_size);
+
+    PipelineCacheFileHeader header = pipelineCacheFileHeader(m_physical_device);
+    header.data_size = data.size();
+    header.data_hash = hashBytes(data);
+
+    // Write to a temporary file first so that an interrupted write never leaves a truncated cache
+    std::filesystem::path tmp_path = std::string(path) + ".tmp";
+    {
+        std::ofstream ofs(tmp_path, std::ios::out | std::ios::binary | std::ios::trunc);
+        ofs.write((const char *)&header, sizeof(header));
+        ofs.write((const char *)data.data(), data.size());
+        if (!ofs)
+            return false;
+    }
+    std::error_code ec;
+    std::filesystem::rename(tmp_path, path, ec);
+    return !ec;
 }
 
 } // namespace brtoy
@@ -0,0 +1,17 @@
+#include <brtoy/gfx.h>
+#include <set>
+#include <string_view>
+
+namespace brtoy {
+
+// Rendering goes to offscreen images only, so neither surfaces nor swapchains are needed. This
+// lets the device be created on ICDs without window system integration, such as lavapipe.
+std::set<std::string_view> getRequiredPlatformInstanceExtensions() { return {}; }
+
+std::set<std::string_view> getRequiredPlatformDeviceExtensions() { return {}; }
+
+VkTimeDomainEXT getHostTimeDomain() { return VK_TIME_DOMAIN_CLOCK_MONOTONIC_EXT; }
+
+VkSurfaceKHR GfxInstance::createSurface(OsHandle, OsHandle) { return VK_NULL_HANDLE; }
+
+} // namespace brtoy
@@ -0,0 +1,108 @@
+#include <algorithm>
+#include <brtoy/gfx_memory.h>
+#include <stdio.h>
+
+namespace brtoy {
+
+const char *memoryTagName(MemoryTag tag) {
+    switch (tag) {
+    case MemoryTag::Other:
+        return "other";
+    case MemoryTag::MeshData:
+        return "mesh_data";
+    case MemoryTag::Instances:
+        return "instances";
+    case MemoryTag::Culling:
+        return "culling";
+    case MemoryTag::Readback:
+        return "readback";
+    case MemoryTag::Staging:
+        return "staging";
+    case MemoryTag::RenderTargets:
+        return "render_targets";
+    case MemoryTag::TransientAttachments:
+        return "transient_attachments";
+    case MemoryTag::Backbuffers:
+        return "backbuffers";
+    case MemoryTag::Count:
+        break;
+    }
+    return "unknown";
+}
+
+MemoryTracker::MemoryTracker(VmaAllocator memory_allocator, float budget_threshold)
+    : m_memory_allocator(memory_allocator), m_budget_threshold(budget_threshold) {
+    const VkPhysicalDeviceMemoryProperties *memory_properties;
+    vmaGetMemoryProperties(m_memory_allocator, &memory_properties);
+    m_heap_count = memory_properties->memoryHeapCount;
+}
+
+void MemoryTracker::track(VmaAllocation allocation, MemoryTag tag) {
+    if (!allocation)
+        return;
+    VmaAllocationInfo info;
+    vmaGetAllocationInfo(m_memory_allocator, allocation, &info);
+    vmaSetAllocationName(m_memory_allocator, allocation, memoryTagName(tag));
+    auto [it, inserted] = m_allocations.try_emplace(allocation, Entry{tag, info.size});
+    BRTOY_ASSERT(inserted);
+    TagUsage &usage = m_usage[(size_t)tag];
+    ++usage.allocation_count;
+    usage.bytes += info.size;
+    usage.peak_bytes = std::max(usage.peak_bytes, usage.bytes);
+}
+
+void MemoryTracker::untrack(VmaAllocation allocation) {
+    auto it = m_allocations.find(allocation);
+    if (it == m_allocations.end())
+        return;
+    TagUsage &usage = m_usage[(size_t)it->second.tag];
+    --usage.allocation_count;
+    usage.bytes -= it->second.size;
+    m_allocations.erase(it);
+}
+
+bool MemoryTracker::update(u32 frame_index) {
+    vmaSetCurrentFrameIndex(m_memory_allocator, frame_index);
+    vmaGetHeapBudgets(m_memory_allocator, m_budgets.data());
+    m_over_budget_heaps = 0;
+    for (u32 heap = 0; heap < m_heap_count; ++heap) {
+        const VmaBudget &budget = m_budgets[heap];
+        if (budget.budget > 0 && budget.usage > VkDeviceSize(budget.budget * m_budget_threshold))
+            m_over_budget_heaps |= 1u << heap;
+    }
+    return isOverBudget();
+}
+
+std::string MemoryTracker::buildStatsString(bool detailed_map) const {
+    char *stats = nullptr;
+    vmaBuildStatsString(m_memory_allocator, &stats, detailed_map ? VK_TRUE : VK_FALSE);
+    std::string result = stats ? stats : "";
+    vmaFreeStatsString(m_memory_allocator, stats);
+    return result;
+}
+
+bool MemoryTracker::writeReport(const char *path) const {
+    FILE *file = fopen(path, "w");
+    if (!file)
+        return false;
+    fprintf(file, "{\n  \"tags\": {");
+    for (size_t tag = 0; tag < m_usage.size(); ++tag) {
+        const TagUsage &usage = m_usage[tag];
+        fprintf(file,
+                "%s\n    \"%s\": {\"allocations\": %u, \"bytes\": %llu, \"peak_bytes\": %llu}",
+                tag == 0 ? "" : ",", memoryTagName((MemoryTag)tag), usage.allocation_count,
+                (unsigned long long)usage.bytes, (unsigned long long)usage.peak_bytes);
+    }
+    fprintf(file, "\n  },\n  \"heaps\": [");
+    for (u32 heap = 0; heap < m_heap_count; ++heap) {
+        const VmaBudget &budget = m_budgets[heap];
+        fprintf(file, "%s\n    {\"usage\": %llu, \"budget\": %llu, \"allocation_bytes\": %llu}",
+                heap == 0 ? "" : ",", (unsigned long long)budget.usage,
+                (unsigned long long)budget.budget,
+                (unsigned long long)budget.statistics.allocationBytes);
+    }
+    fprintf(file, "\n  ],\n  \"vma\": %s\n}\n", buildStatsString().c_str());
+    return fclose(file) == 0;
+}
+
+} // namespace brtoy
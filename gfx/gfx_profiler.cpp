@@ -0,0 +1,175 @@
+#include <algorithm>
+#include <brtoy/gfx_profiler.h>
+#include <brtoy/profiler.h>
+
+namespace brtoy {
+
+GpuProfiler::GpuProfiler(const GfxDevice &device, u32 frame_count)
+    : m_device(device), m_frames(frame_count) {
+    BRTOY_ASSERT(frame_count > 0);
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(m_device.m_physical_device, &properties);
+    m_timestamp_period_ns = properties.limits.timestampPeriod;
+
+    u32 queue_family_count = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(m_device.m_physical_device, &queue_family_count,
+                                             nullptr);
+    std::vector<VkQueueFamilyProperties> queue_families(queue_family_count);
+    vkGetPhysicalDeviceQueueFamilyProperties(m_device.m_physical_device, &queue_family_count,
+                                             queue_families.data());
+    u32 valid_bits = queue_families[m_device.m_queue_family_index].timestampValidBits;
+    m_timestamp_mask = valid_bits >= 64 ? ~0ull : (1ull << valid_bits) - 1;
+    if (!isSupported())
+        return;
+
+    VkQueryPoolCreateInfo query_pool_create_info = {
+        .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+        .pNext = nullptr,
+        .flags = 0,
+        .queryType = VK_QUERY_TYPE_TIMESTAMP,
+        .queryCount = 2 * ZoneCountMax * frame_count,
+        .pipelineStatistics = 0,
+    };
+    VkResult result =
+        vkCreateQueryPool(m_device.m_device, &query_pool_create_info, nullptr, &m_query_pool);
+    BRTOY_ASSERT(result == VK_SUCCESS);
+    for (Frame &frame : m_frames)
+        frame.zones.reserve(ZoneCountMax);
+
+    if (m_device.m_has_calibrated_timestamps) {
+        m_get_calibrated_timestamps = (PFN_vkGetCalibratedTimestampsEXT)vkGetDeviceProcAddr(
+            m_device.m_device, "vkGetCalibratedTimestampsEXT");
+    }
+}
+
+GpuProfiler::~GpuProfiler() { vkDestroyQueryPool(m_device.m_device, m_query_pool, nullptr); }
+
+bool GpuProfiler::isSupported() const {
+    return m_timestamp_mask != 0 && m_timestamp_period_ns > 0.0f;
+}
+
+void GpuProfiler::resolve(u32 frame_index) {
+    m_resolved.clear();
+    Frame &frame = m_frames[frame_index];
+    if (frame.zones.empty())
+        return;
+
+    // Each query yields its timestamp followed by its availability
+    std::array<std::array<u64, 2>, 2 * ZoneCountMax> results;
+    u32 query_count = 2 * (u32)frame.zones.size();
+    vkGetQueryPoolResults(m_device.m_device, m_query_pool, 2 * ZoneCountMax * frame_index,
+                          query_count, query_count * sizeof(results[0]), results.data(),
+                          sizeof(results[0]),
+                          VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+    // The zones have completed, so they lie before the calibration point
+    u64 gpu_now = 0;
+    u64 cpu_now = 0;
+    bool calibrated = calibrate(gpu_now, cpu_now);
+    double cpu_ticks_per_tick = m_timestamp_period_ns * 1e-9 * double(cpuTimestampFrequency());
+    auto toCpu = [&](u64 timestamp) -> u64 {
+        if (!calibrated)
+            return 0;
+        u64 age = (gpu_now - timestamp) & m_timestamp_mask;
+        return cpu_now - u64(double(age) * cpu_ticks_per_tick);
+    };
+
+    for (u32 z = 0; z < frame.zones.size(); ++z) {
+        const std::array<u64, 2> &begin = results[2 * z];
+        const std::array<u64, 2> &end = results[2 * z + 1];
+        if (!begin[1] || !end[1])
+            continue;
+        u64 ticks = (end[0] - begin[0]) & m_timestamp_mask;
+        float ms = float(double(ticks) * m_timestamp_period_ns * 1e-6);
+        m_resolved.push_back(
+            {frame.zones[z].name, frame.zones[z].depth, ms, toCpu(begin[0]), toCpu(end[0])});
+        addSample(frame.zones[z].name, ms);
+    }
+    frame.zones.clear();
+}
+
+void GpuProfiler::beginFrame(VkCommandBuffer cmd, u32 frame_index) {
+    BRTOY_ASSERT(m_depth == 0);
+    if (!m_frames[frame_index].zones.empty())
+        resolve(frame_index);
+    m_frame_index = frame_index;
+    if (m_query_pool)
+        vkCmdResetQueryPool(cmd, m_query_pool, 2 * ZoneCountMax * frame_index, 2 * ZoneCountMax);
+}
+
+// Both timestamps are written at ALL_COMMANDS so that a zone starts once the work recorded before
+// it has finished, instead of overlapping it and inflating the zone.
+u32 GpuProfiler::beginZone(VkCommandBuffer cmd, const char *name) {
+    Frame &frame = m_frames[m_frame_index];
+    if (!m_query_pool || frame.zones.size() == ZoneCountMax)
+        return NoZone;
+    u32 zone = (u32)frame.zones.size();
+    frame.zones.push_back({name, m_depth++});
+    vkCmdWriteTimestamp2(cmd, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, m_query_pool,
+                         2 * ZoneCountMax * m_frame_index + 2 * zone);
+    return zone;
+}
+
+void GpuProfiler::endZone(VkCommandBuffer cmd, u32 zone) {
+    if (zone == NoZone)
+        return;
+    BRTOY_ASSERT(m_depth > 0);
+    --m_depth;
+    vkCmdWriteTimestamp2(cmd, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, m_query_pool,
+                         2 * ZoneCountMax * m_frame_index + 2 * zone + 1);
+}
+
+const GpuProfiler::ZoneResult *GpuProfiler::findResolved(std::string_view name) const {
+    auto it = std::find_if(m_resolved.begin(), m_resolved.end(),
+                           [&](const ZoneResult &result) { return name == result.name; });
+    return it != m_resolved.end() ? &*it : nullptr;
+}
+
+const GpuProfiler::ZoneStats *GpuProfiler::findStats(std::string_view name) const {
+    auto it = std::find_if(m_stats.begin(), m_stats.end(),
+                           [&](const ZoneStats &stats) { return name == stats.name; });
+    return it != m_stats.end() ? &*it : nullptr;
+}
+
+bool GpuProfiler::calibrate(u64 &gpu_timestamp, u64 &cpu_timestamp) const {
+    if (!m_get_calibrated_timestamps)
+        return false;
+    std::array<VkCalibratedTimestampInfoEXT, 2> infos = {{
+        {VK_STRUCTURE_TYPE_CALIBRATED_TIMESTAMP_INFO_EXT, nullptr, VK_TIME_DOMAIN_DEVICE_EXT},
+        {VK_STRUCTURE_TYPE_CALIBRATED_TIMESTAMP_INFO_EXT, nullptr, m_device.m_host_time_domain},
+    }};
+    std::array<u64, 2> timestamps;
+    u64 max_deviation = 0;
+    VkResult result = m_get_calibrated_timestamps(m_device.m_device, (u32)infos.size(),
+                                                  infos.data(), timestamps.data(), &max_deviation);
+    if (result != VK_SUCCESS)
+        return false;
+    gpu_timestamp = timestamps[0];
+    cpu_timestamp = timestamps[1];
+    return true;
+}
+
+void GpuProfiler::addSample(const char *name, float ms) {
+    auto it = std::find_if(m_stats.begin(), m_stats.end(),
+                           [&](const ZoneStats &stats) { return stats.name == name; });
+    if (it == m_stats.end()) {
+        m_stats.push_back({.name = name});
+        it = m_stats.end() - 1;
+    }
+    ZoneStats &stats = *it;
+    stats.samples[stats.next_sample] = ms;
+    stats.next_sample = (stats.next_sample + 1) % StatsWindow;
+    stats.sample_count = std::min(stats.sample_count + 1, StatsWindow);
+    stats.last_ms = ms;
+
+    float sum = 0.0f;
+    stats.min_ms = ms;
+    stats.max_ms = ms;
+    for (u32 i = 0; i < stats.sample_count; ++i) {
+        sum += stats.samples[i];
+        stats.min_ms = std::min(stats.min_ms, stats.samples[i]);
+        stats.max_ms = std::max(stats.max_ms, stats.samples[i]);
+    }
+    stats.mean_ms = sum / stats.sample_count;
+}
+
+} // namespace brtoy
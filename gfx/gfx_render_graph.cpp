@@ -0,0 +1,500 @@
+#include <algorithm>
+#include <brtoy/gfx_profiler.h>
+#include <brtoy/gfx_render_graph.h>
+#include <brtoy/profiler.h>
+
+namespace brtoy {
+
+static constexpr VkAccessFlags2 WriteAccessMask =
+    VK_ACCESS_2_SHADER_WRITE_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT |
+    VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT |
+    VK_ACCESS_2_TRANSFER_WRITE_BIT | VK_ACCESS_2_HOST_WRITE_BIT | VK_ACCESS_2_MEMORY_WRITE_BIT;
+
+RenderGraphUsageInfo renderGraphUsageInfo(RenderGraphUsage usage) {
+    switch (usage) {
+    case RenderGraphUsage::None:
+        return {VK_PIPELINE_STAGE_2_NONE, VK_ACCESS_2_NONE, VK_IMAGE_LAYOUT_UNDEFINED, false,
+                false};
+    case RenderGraphUsage::TransferSrc:
+        return {VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_READ_BIT,
+                VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, true, false};
+    case RenderGraphUsage::TransferDst:
+        return {VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT,
+                VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, false, true};
+    case RenderGraphUsage::IndirectRead:
+        return {VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT, VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT,
+                VK_IMAGE_LAYOUT_UNDEFINED, true, false};
+    case RenderGraphUsage::VertexShaderRead:
+        return {VK_PIPELINE_STAGE_2_VERTEX_SHADER_BIT, VK_ACCESS_2_SHADER_READ_BIT,
+                VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, true, false};
+    case RenderGraphUsage::FragmentShaderRead:
+        return {VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT, VK_ACCESS_2_SHADER_READ_BIT,
+                VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, true, false};
+    case RenderGraphUsage::ComputeShaderRead:
+        return {VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_READ_BIT,
+                VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, true, false};
+    case RenderGraphUsage::ComputeShaderWrite:
+        return {VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_WRITE_BIT,
+                VK_IMAGE_LAYOUT_GENERAL, false, true};
+    case RenderGraphUsage::ComputeShaderReadWrite:
+        return {VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+                VK_ACCESS_2_SHADER_READ_BIT | VK_ACCESS_2_SHADER_WRITE_BIT,
+                VK_IMAGE_LAYOUT_GENERAL, true, true};
+    case RenderGraphUsage::AnyShaderRead:
+        return {VK_PIPELINE_STAGE_2_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT |
+                    VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+                VK_ACCESS_2_SHADER_READ_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, true,
+                false};
+    case RenderGraphUsage::ColorAttachment:
+        // Counted as a read as well since the attachment may be loaded
+        return {VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT,
+                VK_ACCESS_2_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT,
+                VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, true, true};
+    case RenderGraphUsage::DepthAttachment:
+        return {VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT |
+                    VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT,
+                VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_READ_BIT |
+                    VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+                VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL, true, true};
+    case RenderGraphUsage::HostRead:
+        return {VK_PIPELINE_STAGE_2_HOST_BIT, VK_ACCESS_2_HOST_READ_BIT, VK_IMAGE_LAYOUT_GENERAL,
+                true, false};
+    case RenderGraphUsage::Present:
+        // Presentation is synchronized with a semaphore, only the layout transition is needed
+        return {VK_PIPELINE_STAGE_2_NONE, VK_ACCESS_2_NONE, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR, true,
+                false};
+    }
+    BRTOY_ASSERT(false);
+    return {};
+}
+
+RenderGraph::RenderGraph(FrameArena *arena) : m_arena(arena) {}
+
+RenderGraph::~RenderGraph() { destroyCallables(); }
+
+RenderGraph::PassBuilder &RenderGraph::PassBuilder::use(Resource resource,
+                                                        RenderGraphUsage usage) {
+    BRTOY_ASSERT(resource < m_graph.m_resources.size());
+    m_graph.m_passes[m_pass].uses.push_back({resource, usage});
+    return *this;
+}
+
+RenderGraph::PassBuilder &RenderGraph::PassBuilder::sideEffect() {
+    m_graph.m_passes[m_pass].side_effect = true;
+    return *this;
+}
+
+RenderGraph::Resource RenderGraph::importBuffer(const char *name, VkBuffer buffer,
+                                                VkDeviceSize offset, VkDeviceSize size,
+                                                RenderGraphUsage initial_usage,
+                                                RenderGraphUsage final_usage) {
+    ResourceInfo &resource = m_resources.emplace_back();
+    resource.name = name;
+    resource.initial_usage = initial_usage;
+    resource.final_usage = final_usage;
+    resource.buffer = buffer;
+    resource.offset = offset;
+    resource.size = size;
+    resource.transient_slot = NoSlot;
+    return m_resources.size() - 1;
+}
+
+RenderGraph::Resource RenderGraph::importImage(const char *name, VkImage image, VkImageView view,
+                                               VkImageAspectFlags aspect,
+                                               RenderGraphUsage initial_usage,
+                                               RenderGraphUsage final_usage) {
+    ResourceInfo &resource = m_resources.emplace_back();
+    resource.name = name;
+    resource.is_image = true;
+    resource.initial_usage = initial_usage;
+    resource.final_usage = final_usage;
+    resource.image = image;
+    resource.view = view;
+    resource.desc.aspect = aspect;
+    resource.transient_slot = NoSlot;
+    return m_resources.size() - 1;
+}
+
+RenderGraph::Resource RenderGraph::createImage(const char *name, const ImageDesc &desc) {
+    ResourceInfo &resource = m_resources.emplace_back();
+    resource.name = name;
+    resource.is_image = true;
+    resource.is_transient = true;
+    resource.desc = desc;
+    resource.transient_slot = NoSlot;
+    return m_resources.size() - 1;
+}
+
+RenderGraph::PassBuilder RenderGraph::addPass(const char *name, void *callable,
+                                              ExecuteFn execute, DestroyFn destroy) {
+    m_passes.push_back({
+        .name = name,
+        .uses = ArenaVector<Use>(m_arena),
+        .callable = callable,
+        .execute = execute,
+        .destroy = destroy,
+        .side_effect = false,
+        .culled = false,
+    });
+    return {*this, (u32)m_passes.size() - 1};
+}
+
+void *RenderGraph::allocateCallable(size_t size, size_t alignment) {
+    if (m_arena)
+        return m_arena->allocate(size, alignment);
+    BRTOY_ASSERT(alignment <= __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+    return ::operator new(size);
+}
+
+void RenderGraph::destroyCallables() {
+    for (Pass &pass : m_passes) {
+        if (!pass.callable)
+            continue;
+        pass.destroy(pass.callable);
+        if (!m_arena)
+            ::operator delete(pass.callable);
+    }
+}
+
+namespace {
+
+struct ResourceState {
+    VkPipelineStageFlags2 write_stages;
+    VkAccessFlags2 write_access;
+    // Stages that have read the resource since the last write
+    VkPipelineStageFlags2 read_stages;
+    // Stages and accesses that the last write has been made visible to
+    VkPipelineStageFlags2 visible_stages;
+    VkAccessFlags2 visible_access;
+    VkImageLayout layout;
+};
+
+struct MergedUse {
+    RenderGraph::Resource resource;
+    RenderGraphUsageInfo info;
+};
+
+} // namespace
+
+static ResourceState initialState(RenderGraphUsage usage) {
+    RenderGraphUsageInfo info = renderGraphUsageInfo(usage);
+    ResourceState state = {};
+    state.layout = info.layout;
+    if (info.write) {
+        state.write_stages = info.stages;
+        state.write_access = info.access & WriteAccessMask;
+        state.visible_stages = info.stages;
+        state.visible_access = info.access;
+    } else {
+        state.read_stages = info.stages;
+    }
+    return state;
+}
+
+// Updates the state for an access and appends the barrier needed before it, if any
+static void transition(RenderGraph::Resource resource, bool is_image, ResourceState &state,
+                       const RenderGraphUsageInfo &info, ArenaVector<RenderGraph::Barrier> &out) {
+    bool layout_change = is_image && state.layout != info.layout;
+    if (info.write || layout_change) {
+        VkPipelineStageFlags2 src_stages = state.write_stages | state.read_stages;
+        if (src_stages != VK_PIPELINE_STAGE_2_NONE || layout_change) {
+            // With no earlier access, wait on the destination stages so that the transition is
+            // ordered after semaphore waits on those stages.
+            if (src_stages == VK_PIPELINE_STAGE_2_NONE)
+                src_stages = info.stages;
+            out.push_back({
+                .resource = resource,
+                .src_stages = src_stages,
+                .src_access = state.write_access,
+                .dst_stages = info.stages,
+                .dst_access = info.access,
+                .old_layout = is_image ? state.layout : VK_IMAGE_LAYOUT_UNDEFINED,
+                .new_layout = is_image ? info.layout : VK_IMAGE_LAYOUT_UNDEFINED,
+            });
+        }
+        // A layout transition is a write of its own which later reads must wait for
+        state.write_stages = info.stages;
+        state.write_access = info.access & WriteAccessMask;
+        state.read_stages = info.write ? VK_PIPELINE_STAGE_2_NONE : info.stages;
+        state.visible_stages = info.stages;
+        state.visible_access = info.access;
+        state.layout = info.layout;
+        return;
+    }
+
+    if (state.write_stages != VK_PIPELINE_STAGE_2_NONE &&
+        ((info.stages & ~state.visible_stages) != 0 ||
+         (info.access & ~state.visible_access) != 0)) {
+        out.push_back({
+            .resource = resource,
+            .src_stages = state.write_stages,
+            .src_access = state.write_access,
+            .dst_stages = info.stages,
+            .dst_access = info.access,
+            .old_layout = is_image ? state.layout : VK_IMAGE_LAYOUT_UNDEFINED,
+            .new_layout = is_image ? state.layout : VK_IMAGE_LAYOUT_UNDEFINED,
+        });
+        state.visible_stages |= info.stages;
+        state.visible_access |= info.access;
+    }
+    state.read_stages |= info.stages;
+}
+
+void RenderGraph::compile() {
+    BRTOY_PROFILE_ZONE("RenderGraph::compile");
+    const u32 pass_count = m_passes.size();
+    m_barrier_batches.clear();
+    m_transient_slots.clear();
+
+    ArenaAllocator<std::byte> allocator(m_arena);
+
+    // Merge multiple uses of a resource within a pass
+    ArenaVector<ArenaVector<MergedUse>> merged_uses(pass_count, ArenaVector<MergedUse>(allocator),
+                                                    allocator);
+    for (u32 p = 0; p < pass_count; ++p) {
+        for (const Use &use : m_passes[p].uses) {
+            RenderGraphUsageInfo info = renderGraphUsageInfo(use.usage);
+            auto it = std::find_if(merged_uses[p].begin(), merged_uses[p].end(),
+                                   [&](const MergedUse &m) { return m.resource == use.resource; });
+            if (it == merged_uses[p].end()) {
+                merged_uses[p].push_back({use.resource, info});
+            } else {
+                BRTOY_ASSERT(!m_resources[use.resource].is_image || it->info.layout == info.layout);
+                it->info.stages |= info.stages;
+                it->info.access |= info.access;
+                it->info.read |= info.read;
+                it->info.write |= info.write;
+            }
+        }
+    }
+
+    // Cull passes, walking backwards from the outputs
+    ArenaVector<bool> needed(m_resources.size(), allocator);
+    for (u32 r = 0; r < m_resources.size(); ++r)
+        needed[r] = m_resources[r].final_usage != RenderGraphUsage::None;
+    for (u32 p = pass_count; p-- > 0;) {
+        Pass &pass = m_passes[p];
+        bool alive = pass.side_effect;
+        for (const MergedUse &use : merged_uses[p])
+            alive |= use.info.write && needed[use.resource];
+        pass.culled = !alive;
+        if (alive) {
+            for (const MergedUse &use : merged_uses[p]) {
+                if (use.info.read)
+                    needed[use.resource] = true;
+            }
+        }
+    }
+
+    // Lifetimes
+    for (ResourceInfo &resource : m_resources) {
+        resource.first_pass = NoSlot;
+        resource.last_pass = 0;
+        resource.transient_slot = NoSlot;
+    }
+    for (u32 p = 0; p < pass_count; ++p) {
+        if (m_passes[p].culled)
+            continue;
+        for (const MergedUse &use : merged_uses[p]) {
+            ResourceInfo &resource = m_resources[use.resource];
+            resource.first_pass = std::min(resource.first_pass, p);
+            resource.last_pass = std::max(resource.last_pass, p);
+        }
+    }
+
+    // Assign transient images to slots in order of first use. A slot is reused by an image with
+    // the same description once the previous image in it is dead.
+    ArenaVector<Resource> transients(allocator);
+    for (Resource r = 0; r < m_resources.size(); ++r) {
+        if (m_resources[r].is_transient && m_resources[r].first_pass != NoSlot)
+            transients.push_back(r);
+    }
+    // Ties are broken by index rather than with std::stable_sort, which allocates a buffer
+    std::sort(transients.begin(), transients.end(), [&](Resource a, Resource b) {
+        u32 first_a = m_resources[a].first_pass;
+        u32 first_b = m_resources[b].first_pass;
+        return first_a < first_b || (first_a == first_b && a < b);
+    });
+    for (Resource r : transients) {
+        ResourceInfo &resource = m_resources[r];
+        for (u32 s = 0; s < m_transient_slots.size(); ++s) {
+            TransientSlot &slot = m_transient_slots[s];
+            if (slot.desc == resource.desc && slot.last_pass < resource.first_pass) {
+                resource.transient_slot = s;
+                slot.last_pass = resource.last_pass;
+                break;
+            }
+        }
+        if (resource.transient_slot == NoSlot) {
+            resource.transient_slot = m_transient_slots.size();
+            m_transient_slots.push_back({resource.desc, resource.last_pass, VK_NULL_HANDLE,
+                                         VK_NULL_HANDLE});
+        }
+    }
+
+    // Barriers
+    ArenaVector<ResourceState> states(m_resources.size(), allocator);
+    for (u32 r = 0; r < m_resources.size(); ++r)
+        states[r] = initialState(m_resources[r].initial_usage);
+    ArenaVector<Resource> slot_owner(m_transient_slots.size(), NoSlot, allocator);
+
+    for (u32 p = 0; p < pass_count; ++p) {
+        if (m_passes[p].culled)
+            continue;
+        BarrierBatch batch = {p, ArenaVector<Barrier>(allocator)};
+        for (const MergedUse &use : merged_uses[p]) {
+            ResourceInfo &resource = m_resources[use.resource];
+            if (resource.transient_slot != NoSlot) {
+                // An image taking over a slot must wait for the previous image in it, but its
+                // contents are undefined.
+                Resource &owner = slot_owner[resource.transient_slot];
+                if (owner != use.resource) {
+                    if (owner != NoSlot) {
+                        states[use.resource] = states[owner];
+                        states[use.resource].layout = VK_IMAGE_LAYOUT_UNDEFINED;
+                    }
+                    owner = use.resource;
+                }
+            }
+            transition(use.resource, resource.is_image, states[use.resource], use.info,
+                       batch.barriers);
+        }
+        if (!batch.barriers.empty())
+            m_barrier_batches.push_back(std::move(batch));
+    }
+
+    BarrierBatch final_batch = {pass_count, ArenaVector<Barrier>(allocator)};
+    for (u32 r = 0; r < m_resources.size(); ++r) {
+        const ResourceInfo &resource = m_resources[r];
+        if (resource.final_usage == RenderGraphUsage::None)
+            continue;
+        transition(r, resource.is_image, states[r], renderGraphUsageInfo(resource.final_usage),
+                   final_batch.barriers);
+    }
+    if (!final_batch.barriers.empty())
+        m_barrier_batches.push_back(std::move(final_batch));
+}
+
+void RenderGraph::bindTransient(u32 slot, VkImage image, VkImageView view) {
+    m_transient_slots[slot].image = image;
+    m_transient_slots[slot].view = view;
+}
+
+void RenderGraph::execute(VkCommandBuffer cmd, GpuProfiler *profiler) {
+    BRTOY_PROFILE_ZONE("RenderGraph::execute");
+    ArenaVector<VkBufferMemoryBarrier2> buffer_barriers(m_arena);
+    ArenaVector<VkImageMemoryBarrier2> image_barriers(m_arena);
+    auto recordBarriers = [&](const BarrierBatch &batch) {
+        buffer_barriers.clear();
+        image_barriers.clear();
+        for (const Barrier &barrier : batch.barriers) {
+            const ResourceInfo &resource = m_resources[barrier.resource];
+            if (resource.is_image) {
+                image_barriers.push_back({
+                    .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
+                    .pNext = nullptr,
+                    .srcStageMask = barrier.src_stages,
+                    .srcAccessMask = barrier.src_access,
+                    .dstStageMask = barrier.dst_stages,
+                    .dstAccessMask = barrier.dst_access,
+                    .oldLayout = barrier.old_layout,
+                    .newLayout = barrier.new_layout,
+                    .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                    .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                    .image = image(barrier.resource),
+                    .subresourceRange =
+                        {
+                            .aspectMask = resource.desc.aspect,
+                            .baseMipLevel = 0,
+                            .levelCount = VK_REMAINING_MIP_LEVELS,
+                            .baseArrayLayer = 0,
+                            .layerCount = VK_REMAINING_ARRAY_LAYERS,
+                        },
+                });
+            } else {
+                buffer_barriers.push_back({
+                    .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER_2,
+                    .pNext = nullptr,
+                    .srcStageMask = barrier.src_stages,
+                    .srcAccessMask = barrier.src_access,
+                    .dstStageMask = barrier.dst_stages,
+                    .dstAccessMask = barrier.dst_access,
+                    .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                    .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                    .buffer = resource.buffer,
+                    .offset = resource.offset,
+                    .size = resource.size,
+                });
+            }
+        }
+        VkDependencyInfo dependency_info = {
+            .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+            .pNext = nullptr,
+            .dependencyFlags = 0,
+            .memoryBarrierCount = 0,
+            .pMemoryBarriers = nullptr,
+            .bufferMemoryBarrierCount = (u32)buffer_barriers.size(),
+            .pBufferMemoryBarriers = buffer_barriers.data(),
+            .imageMemoryBarrierCount = (u32)image_barriers.size(),
+            .pImageMemoryBarriers = image_barriers.data(),
+        };
+        vkCmdPipelineBarrier2(cmd, &dependency_info);
+    };
+
+    auto batch = m_barrier_batches.begin();
+    for (u32 p = 0; p < m_passes.size(); ++p) {
+        if (m_passes[p].culled)
+            continue;
+        if (batch != m_barrier_batches.end() && batch->pass == p)
+            recordBarriers(*batch++);
+        if (m_passes[p].execute) {
+            GpuZone zone(profiler, cmd, m_passes[p].name);
+            m_passes[p].execute(m_passes[p].callable, cmd, *this);
+        }
+    }
+    if (batch != m_barrier_batches.end())
+        recordBarriers(*batch++);
+    BRTOY_ASSERT(batch == m_barrier_batches.end());
+}
+
+void RenderGraph::reset() {
+    destroyCallables();
+    m_resources.clear();
+    m_passes.clear();
+    m_barrier_batches.clear();
+    m_transient_slots.clear();
+}
+
+VkBuffer RenderGraph::buffer(Resource resource) const { return m_resources[resource].buffer; }
+
+VkDeviceSize RenderGraph::bufferOffset(Resource resource) const {
+    return m_resources[resource].offset;
+}
+
+// A transient image only gets a slot if a pass that isn't culled uses it, so its image and view
+// are only there for those passes
+static const RenderGraph::TransientSlot *transientSlot(const RenderGraph &graph,
+                                                       const RenderGraph::ResourceInfo &info) {
+    BRTOY_ASSERT(info.transient_slot != RenderGraph::NoSlot);
+    if (info.transient_slot == RenderGraph::NoSlot)
+        return nullptr;
+    return &graph.m_transient_slots[info.transient_slot];
+}
+
+VkImage RenderGraph::image(Resource resource) const {
+    const ResourceInfo &info = m_resources[resource];
+    if (!info.is_transient)
+        return info.image;
+    const TransientSlot *slot = transientSlot(*this, info);
+    return slot ? slot->image : VK_NULL_HANDLE;
+}
+
+VkImageView RenderGraph::imageView(Resource resource) const {
+    const ResourceInfo &info = m_resources[resource];
+    if (!info.is_transient)
+        return info.view;
+    const TransientSlot *slot = transientSlot(*this, info);
+    return slot ? slot->view : VK_NULL_HANDLE;
+}
+
+} // namespace brtoy
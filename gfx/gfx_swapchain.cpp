@@ -1,4 +1,5 @@
 #include <brtoy/gfx_swapchain.h>
+#include <brtoy/gfx_utils.h>
 #include <vector>
 
 namespace brtoy {
@@ -32,7 +33,7 @@ Swapchain::~Swapchain() {
         vkDestroySurfaceKHR(m_instance, m_surface, nullptr);
 }
 
-void Swapchain::recreate(V2u dim) {
+void Swapchain::recreate(V2u dim, DeletionQueue *deletion_queue) {
 
     VkSwapchainCreateInfoKHR sc_create_info = {
         .sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR,
@@ -44,7 +45,7 @@ void Swapchain::recreate(V2u dim) {
         .imageColorSpace = m_format.colorSpace,
         .imageExtent = {dim.x, dim.y},
         .imageArrayLayers = 1,
-        .imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
+        .imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT,
         .imageSharingMode = VK_SHARING_MODE_EXCLUSIVE,
         .queueFamilyIndexCount = 0,
         .pQueueFamilyIndices = nullptr,
@@ -58,7 +59,10 @@ void Swapchain::recreate(V2u dim) {
     VkSwapchainKHR new_swapchain;
     VkResult result = vkCreateSwapchainKHR(m_device, &sc_create_info, nullptr, &new_swapchain);
     if (result == VK_SUCCESS) {
-        vkDestroySwapchainKHR(m_device, m_swapchain, nullptr);
+        if (deletion_queue && m_swapchain != VK_NULL_HANDLE)
+            deletion_queue->retire(m_swapchain);
+        else
+            vkDestroySwapchainKHR(m_device, m_swapchain, nullptr);
         m_swapchain = new_swapchain;
         m_dim = dim;
     }
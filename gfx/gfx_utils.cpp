@@ -1,5 +1,6 @@
 #include <brtoy/gfx_swapchain.h>
 #include <brtoy/gfx_utils.h>
+#include <brtoy/profiler.h>
 #include <vk_mem_alloc.h>
 
 namespace brtoy {
@@ -8,14 +9,27 @@ Backbuffer::Backbuffer(VkDevice device) : m_device(device), m_dim({}) {}
 
 Backbuffer::~Backbuffer() {
     if (!m_buffers.empty()) {
-        StackVector<VkFence, BufferCountMax> fences;
+        SmallVector<VkFence, BufferCountMax> fences;
         for (const Buffer &buffer : m_buffers) {
             fences.push_back(buffer.fence);
         }
         vkWaitForFences(m_device, fences.size(), fences.data(), true, UINT64_MAX);
-        for (const Buffer &buffer : m_buffers) {
-            vkDestroyImageView(m_device, buffer.view, nullptr);
-            vkDestroyFence(m_device, buffer.fence, nullptr);
+        for (size_t i = 0; i < m_buffers.size(); ++i) {
+            const Buffer &buffer = m_buffers[i];
+            if (m_texture_pool) {
+                TexturePool::Texture texture = {m_dim, m_texture_pool->m_image_create_info.format,
+                                                buffer.memory, buffer.image, buffer.view};
+                m_texture_pool->free(texture);
+            } else {
+                vkDestroyImageView(m_device, buffer.view, nullptr);
+            }
+        }
+        // Textures released by recreateOffscreen() are pending on the fences about to be
+        // destroyed. All of them have signaled, so a sync moves the textures back to the pool.
+        if (m_texture_pool)
+            m_texture_pool->sync();
+        for (size_t i = 0; i < m_buffers.size(); ++i) {
+            vkDestroyFence(m_device, m_buffers[i].fence, nullptr);
         }
     }
     m_device = VK_NULL_HANDLE;
@@ -23,38 +37,101 @@ Backbuffer::~Backbuffer() {
     m_buffers.clear();
 }
 
+static VkImageView createBackbufferView(VkDevice device, const Swapchain &swapchain,
+                                        VkImage image) {
+    VkImageViewCreateInfo view_create_info = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+        .pNext = nullptr,
+        .flags = 0,
+        .image = image,
+        .viewType = VK_IMAGE_VIEW_TYPE_2D,
+        .format = swapchain.m_format.format,
+        .components = {},
+        .subresourceRange =
+            {
+                .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                .baseMipLevel = 0,
+                .levelCount = 1,
+                .baseArrayLayer = 0,
+                .layerCount = 1,
+            },
+    };
+    VkImageView view = VK_NULL_HANDLE;
+    vkCreateImageView(device, &view_create_info, nullptr, &view);
+    return view;
+}
+
 Backbuffer Backbuffer::createFromSwapchain(VkDevice device, const Swapchain &swapchain) {
     Backbuffer result(device);
 
     u32 image_count;
     vkGetSwapchainImagesKHR(device, swapchain.m_swapchain, &image_count, nullptr);
-    BRTOY_ASSERT(image_count <= result.m_buffers.capacity());
-    StackVector<VkImage, BufferCountMax> images(image_count);
+    BRTOY_ASSERT(image_count <= BufferCountMax);
+    SmallVector<VkImage, BufferCountMax> images(image_count);
     vkGetSwapchainImagesKHR(device, swapchain.m_swapchain, &image_count, images.data());
 
     result.m_dim = swapchain.m_dim;
     for (const VkImage image : images) {
-        VkImageViewCreateInfo view_create_info = {
-            .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
-            .pNext = nullptr,
-            .flags = 0,
-            .image = image,
-            .viewType = VK_IMAGE_VIEW_TYPE_2D,
-            .format = swapchain.m_format.format,
-            .components = {},
-            .subresourceRange =
-                {
-                    .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-                    .baseMipLevel = 0,
-                    .levelCount = 1,
-                    .baseArrayLayer = 0,
-                    .layerCount = 1,
-                },
-        };
-
         Buffer buffer;
         buffer.image = image;
-        vkCreateImageView(device, &view_create_info, nullptr, &buffer.view);
+        buffer.view = createBackbufferView(device, swapchain, image);
+
+        VkFenceCreateInfo fence_create_info = {VK_STRUCTURE_TYPE_FENCE_CREATE_INFO, nullptr,
+                                               VK_FENCE_CREATE_SIGNALED_BIT};
+        vkCreateFence(device, &fence_create_info, nullptr, &buffer.fence);
+        result.m_buffers.push_back(std::move(buffer));
+    }
+    return result;
+}
+
+void Backbuffer::recreate(Swapchain &swapchain, V2u dim, DeletionQueue &deletion_queue) {
+    // Views go first so they are destroyed before the swapchain owning their images.
+    for (Buffer &buffer : m_buffers) {
+        deletion_queue.retire(buffer.view);
+        buffer.image = VK_NULL_HANDLE;
+        buffer.view = VK_NULL_HANDLE;
+    }
+
+    swapchain.recreate(dim, &deletion_queue);
+
+    u32 image_count;
+    vkGetSwapchainImagesKHR(m_device, swapchain.m_swapchain, &image_count, nullptr);
+    BRTOY_ASSERT(image_count <= BufferCountMax);
+    SmallVector<VkImage, BufferCountMax> images(image_count);
+    vkGetSwapchainImagesKHR(m_device, swapchain.m_swapchain, &image_count, images.data());
+
+    // Fences may still be referenced by pools with work in flight, so they are reused for the
+    // new images rather than retired. Surplus buffers keep their fence with no image.
+    m_dim = swapchain.m_dim;
+    for (u32 i = 0; i < image_count; ++i) {
+        if (i < m_buffers.size()) {
+            m_buffers[i].image = images[i];
+            m_buffers[i].view = createBackbufferView(m_device, swapchain, images[i]);
+        } else {
+            Buffer buffer;
+            buffer.image = images[i];
+            buffer.view = createBackbufferView(m_device, swapchain, images[i]);
+            VkFenceCreateInfo fence_create_info = {VK_STRUCTURE_TYPE_FENCE_CREATE_INFO, nullptr,
+                                                   VK_FENCE_CREATE_SIGNALED_BIT};
+            vkCreateFence(m_device, &fence_create_info, nullptr, &buffer.fence);
+            m_buffers.push_back(std::move(buffer));
+        }
+    }
+}
+
+Backbuffer Backbuffer::createOffscreen(VkDevice device, TexturePool &texture_pool, V2u dim,
+                                       u32 buffer_count) {
+    BRTOY_ASSERT(buffer_count <= BufferCountMax);
+    Backbuffer result(device);
+    result.m_texture_pool = &texture_pool;
+    result.m_dim = dim;
+    for (u32 i = 0; i < buffer_count; ++i) {
+        TexturePool::Texture texture = texture_pool.acquire(VK_NULL_HANDLE, dim);
+        BRTOY_ASSERT(texture.image != VK_NULL_HANDLE);
+        Buffer buffer;
+        buffer.image = texture.image;
+        buffer.view = texture.view;
+        buffer.memory = texture.memory;
 
         VkFenceCreateInfo fence_create_info = {VK_STRUCTURE_TYPE_FENCE_CREATE_INFO, nullptr,
                                                VK_FENCE_CREATE_SIGNALED_BIT};
@@ -64,6 +141,29 @@ Backbuffer Backbuffer::createFromSwapchain(VkDevice device, const Swapchain &swa
     return result;
 }
 
+void Backbuffer::recreateOffscreen(V2u dim) {
+    BRTOY_ASSERT(m_texture_pool);
+    VkFormat format = m_texture_pool->m_image_create_info.format;
+    for (Buffer &buffer : m_buffers) {
+        TexturePool::Texture old_texture = {m_dim, format, buffer.memory, buffer.image,
+                                            buffer.view};
+        m_texture_pool->release(VK_NULL_HANDLE, old_texture, buffer.fence);
+
+        TexturePool::Texture texture = m_texture_pool->acquire(VK_NULL_HANDLE, dim);
+        BRTOY_ASSERT(texture.image != VK_NULL_HANDLE);
+        buffer.image = texture.image;
+        buffer.view = texture.view;
+        buffer.memory = texture.memory;
+    }
+    m_dim = dim;
+}
+
+u32 Backbuffer::acquireOffscreen() {
+    u32 index = m_next_offscreen;
+    m_next_offscreen = (m_next_offscreen + 1) % m_buffers.size();
+    return index;
+}
+
 CommandBufferPool::CommandBufferPool(const GfxDevice &device) : m_device(device) {
     VkCommandPoolCreateInfo cmd_pool_create_info = {
         .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
@@ -75,7 +175,7 @@ CommandBufferPool::CommandBufferPool(const GfxDevice &device) : m_device(device)
 }
 
 CommandBufferPool::~CommandBufferPool() {
-    std::vector<VkFence> fences;
+    SmallVector<VkFence, 8> fences;
     fences.reserve(m_pending.size());
     for (const auto &alloc : m_pending) {
         fences.push_back(alloc.fence);
@@ -121,16 +221,110 @@ void CommandBufferPool::release(VkCommandBuffer cmd, VkFence fence) {
     m_pending.emplace_back(cmd, fence);
 }
 
+TransientAttachmentHeap::TransientAttachmentHeap(VmaAllocator memory_allocator,
+                                                 MemoryTracker *memory_tracker)
+    : m_memory_allocator(memory_allocator), m_memory_tracker(memory_tracker) {}
+
+TransientAttachmentHeap::~TransientAttachmentHeap() {
+    BRTOY_ASSERT(m_live_count == 0);
+    trim();
+}
+
+void TransientAttachmentHeap::sync() {
+    ++m_sync_index;
+    for (auto it = m_free.begin(); it != m_free.end();) {
+        if (it->last_used_sync + IdleFrameLimit < m_sync_index) {
+            freeMemory(it->memory);
+            it = m_free.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void TransientAttachmentHeap::trim() {
+    for (const Block &block : m_free)
+        freeMemory(block.memory);
+    m_free.clear();
+}
+
+void TransientAttachmentHeap::freeMemory(VmaAllocation memory) {
+    if (m_memory_tracker)
+        m_memory_tracker->untrack(memory);
+    vmaFreeMemory(m_memory_allocator, memory);
+}
+
+// Rounds up to 1/8 of the next power of two so that blocks can be reused across small changes in
+// attachment size, e.g. while resizing a window.
+static VkDeviceSize roundUpBlockSize(VkDeviceSize size) {
+    VkDeviceSize pow2 = 1;
+    while (pow2 < size)
+        pow2 <<= 1;
+    VkDeviceSize granularity = pow2 >= 8 ? pow2 / 8 : 1;
+    return alignUp(size, granularity);
+}
+
+VmaAllocation TransientAttachmentHeap::acquire(const VkMemoryRequirements &requirements) {
+    auto best = m_free.end();
+    for (auto it = m_free.begin(); it != m_free.end(); ++it) {
+        bool compatible = (requirements.memoryTypeBits & (1u << it->memory_type)) != 0 &&
+                          it->size >= requirements.size &&
+                          it->offset % requirements.alignment == 0;
+        if (compatible && (best == m_free.end() || it->size < best->size))
+            best = it;
+    }
+
+    VmaAllocation memory = VK_NULL_HANDLE;
+    if (best != m_free.end()) {
+        memory = best->memory;
+        m_free.erase(best);
+    } else {
+        VkMemoryRequirements block_requirements = requirements;
+        block_requirements.size = roundUpBlockSize(requirements.size);
+        VmaAllocationCreateInfo allocation_info = {
+            .flags = 0,
+            .usage = VMA_MEMORY_USAGE_UNKNOWN,
+            .requiredFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+            .preferredFlags = VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT,
+        };
+        VkResult result = vmaAllocateMemory(m_memory_allocator, &block_requirements,
+                                            &allocation_info, &memory, nullptr);
+        if (result != VK_SUCCESS)
+            return VK_NULL_HANDLE;
+        if (m_memory_tracker)
+            m_memory_tracker->track(memory, MemoryTag::TransientAttachments);
+    }
+    ++m_live_count;
+    return memory;
+}
+
+void TransientAttachmentHeap::release(VmaAllocation memory) {
+    BRTOY_ASSERT(m_live_count > 0);
+    --m_live_count;
+    VmaAllocationInfo info;
+    vmaGetAllocationInfo(m_memory_allocator, memory, &info);
+    m_free.push_back({
+        .memory = memory,
+        .offset = info.offset,
+        .size = info.size,
+        .memory_type = info.memoryType,
+        .last_used_sync = m_sync_index,
+    });
+}
+
 TexturePool::TexturePool(const GfxDevice &device, VmaAllocator memory_allocator,
                          VkImageCreateInfo image_create_info,
                          VkImageViewCreateInfo view_create_info, VkImageMemoryBarrier init_barrier,
-                         VkPipelineStageFlags init_dst_stage_mask)
-    : m_device(device), m_memory_allocator(memory_allocator),
+                         VkPipelineStageFlags init_dst_stage_mask,
+                         TransientAttachmentHeap *transient_heap, MemoryTracker *memory_tracker,
+                         MemoryTag memory_tag)
+    : m_device(device), m_memory_allocator(memory_allocator), m_transient_heap(transient_heap),
+      m_memory_tracker(memory_tracker), m_memory_tag(memory_tag),
       m_image_create_info(image_create_info), m_view_create_info(view_create_info),
       m_init_barrier(init_barrier), m_init_dst_stage_mask(init_dst_stage_mask) {}
 
 TexturePool::~TexturePool() {
-    std::vector<VkFence> fences;
+    SmallVector<VkFence, 8> fences;
     fences.reserve(m_pending.size());
     for (const auto &alloc : m_pending) {
         fences.push_back(alloc.fence);
@@ -138,64 +332,117 @@ TexturePool::~TexturePool() {
     vkWaitForFences(m_device.m_device, fences.size(), fences.data(), VK_TRUE, UINT64_MAX);
     sync();
     BRTOY_ASSERT(m_pending.empty());
-    for (auto &texture : m_free)
-        free(texture);
+    trim();
+}
+
+void TexturePool::trim() {
+    for (auto &bucket : m_free) {
+        for (auto &texture : bucket.textures)
+            free(texture);
+    }
+    m_free.clear();
+}
+
+TexturePool::Bucket &TexturePool::bucket(V2u dim, VkFormat format) {
+    for (Bucket &bucket : m_free) {
+        if (bucket.dim == dim && bucket.format == format)
+            return bucket;
+    }
+    return m_free.emplace_back(dim, format, m_sync_index);
 }
 
 void TexturePool::sync() {
+    ++m_sync_index;
     for (auto it = m_pending.begin(); it != m_pending.end();) {
         VkResult fence_status = vkGetFenceStatus(m_device.m_device, it->fence);
         if (fence_status == VK_SUCCESS) {
-            m_free.push_back(it->texture);
+            bucket(it->texture.dim, it->texture.format).textures.push_back(it->texture);
             it = m_pending.erase(it);
         } else {
             ++it;
         }
     }
-}
 
-TexturePool::Texture TexturePool::acquire(VkCommandBuffer cmd, V2u dim) {
-    Texture texture = {};
-    while (texture.image == VK_NULL_HANDLE && !m_free.empty()) {
-        texture = m_free.back();
-        m_free.pop_back();
-        if (texture.dim != dim) {
-            free(texture);
-            texture = {};
+    for (auto it = m_free.begin(); it != m_free.end();) {
+        if (it->last_used_sync + IdleFrameLimit < m_sync_index) {
+            for (auto &texture : it->textures)
+                free(texture);
+            it = m_free.erase(it);
+        } else {
+            ++it;
         }
     }
+}
+
+TexturePool::Texture TexturePool::acquire(VkCommandBuffer cmd, V2u dim, VkFormat format) {
+    if (format == VK_FORMAT_UNDEFINED)
+        format = m_image_create_info.format;
+
+    Bucket &free_bucket = bucket(dim, format);
+    free_bucket.last_used_sync = m_sync_index;
+    if (!free_bucket.textures.empty()) {
+        Texture texture = free_bucket.textures.back();
+        free_bucket.textures.pop_back();
+        return texture;
+    }
 
-    if (texture.image == VK_NULL_HANDLE) {
-        texture.dim = dim;
+    Texture texture = {};
+    texture.dim = dim;
+    texture.format = format;
 
+    VkImageCreateInfo image_create_info = m_image_create_info;
+    image_create_info.format = format;
+    image_create_info.extent = {dim.x, dim.y, 1};
+    VkResult result;
+    if (m_transient_heap) {
+        result = vkCreateImage(m_device.m_device, &image_create_info, nullptr, &texture.image);
+        if (result == VK_SUCCESS) {
+            VkMemoryRequirements requirements;
+            vkGetImageMemoryRequirements(m_device.m_device, texture.image, &requirements);
+            texture.memory = m_transient_heap->acquire(requirements);
+            result = texture.memory ? vmaBindImageMemory(m_memory_allocator, texture.memory,
+                                                         texture.image)
+                                    : VK_ERROR_OUT_OF_DEVICE_MEMORY;
+            if (result != VK_SUCCESS) {
+                if (texture.memory)
+                    m_transient_heap->release(texture.memory);
+                vkDestroyImage(m_device.m_device, texture.image, nullptr);
+                return {};
+            }
+        }
+    } else {
         VmaAllocationCreateInfo allocation_info = {
             .flags = 0,
             .usage = VMA_MEMORY_USAGE_AUTO,
             .requiredFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+            .preferredFlags = (image_create_info.usage & VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT)
+                                  ? (VkMemoryPropertyFlags)VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT
+                                  : 0,
         };
-
-        VkImageCreateInfo image_create_info = m_image_create_info;
-        image_create_info.extent = {dim.x, dim.y, 1};
-        VkResult result;
         result = vmaCreateImage(m_memory_allocator, &image_create_info, &allocation_info,
                                 &texture.image, &texture.memory, nullptr);
-        if (result == VK_SUCCESS) {
-            VkImageViewCreateInfo view_create_info = m_view_create_info;
-            view_create_info.image = texture.image;
-            result =
-                vkCreateImageView(m_device.m_device, &view_create_info, nullptr, &texture.view);
-            if (result == VK_SUCCESS) {
-                VkImageMemoryBarrier barrier = m_init_barrier;
-                barrier.image = texture.image;
-                std::array image_barriers = {barrier};
-                vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, m_init_dst_stage_mask,
-                                     0, 0, nullptr, 0, nullptr, image_barriers.size(),
-                                     image_barriers.data());
-            } else {
-                vmaDestroyImage(m_memory_allocator, texture.image, texture.memory);
-                texture = {};
-            }
+        if (result == VK_SUCCESS && m_memory_tracker)
+            m_memory_tracker->track(texture.memory, m_memory_tag);
+    }
+    if (result != VK_SUCCESS)
+        return {};
+
+    VkImageViewCreateInfo view_create_info = m_view_create_info;
+    view_create_info.image = texture.image;
+    view_create_info.format = format;
+    result = vkCreateImageView(m_device.m_device, &view_create_info, nullptr, &texture.view);
+    if (result == VK_SUCCESS) {
+        if (cmd != VK_NULL_HANDLE) {
+            VkImageMemoryBarrier barrier = m_init_barrier;
+            barrier.image = texture.image;
+            std::array image_barriers = {barrier};
+            vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, m_init_dst_stage_mask, 0,
+                                 0, nullptr, 0, nullptr, image_barriers.size(),
+                                 image_barriers.data());
         }
+    } else {
+        texture.view = VK_NULL_HANDLE;
+        free(texture);
     }
     return texture;
 }
@@ -205,11 +452,177 @@ void TexturePool::release(VkCommandBuffer cmd, const Texture &texture, VkFence f
 }
 
 void TexturePool::free(Texture &texture) {
-    vkDestroyImageView(m_device.m_device, texture.view, nullptr);
-    vmaDestroyImage(m_memory_allocator, texture.image, texture.memory);
+    if (texture.view)
+        vkDestroyImageView(m_device.m_device, texture.view, nullptr);
+    if (m_transient_heap) {
+        vkDestroyImage(m_device.m_device, texture.image, nullptr);
+        m_transient_heap->release(texture.memory);
+    } else {
+        if (m_memory_tracker)
+            m_memory_tracker->untrack(texture.memory);
+        vmaDestroyImage(m_memory_allocator, texture.image, texture.memory);
+    }
     texture = {};
 }
 
+GpuTimeline::GpuTimeline(const GfxDevice &device) : m_device(device) {
+    VkSemaphoreTypeCreateInfo type_create_info = {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO,
+        .pNext = nullptr,
+        .semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE,
+        .initialValue = 0,
+    };
+    VkSemaphoreCreateInfo sem_create_info = {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+        .pNext = &type_create_info,
+        .flags = 0,
+    };
+    VkResult result = vkCreateSemaphore(m_device.m_device, &sem_create_info, nullptr, &m_semaphore);
+    BRTOY_ASSERT(result == VK_SUCCESS);
+}
+
+GpuTimeline::~GpuTimeline() {
+    wait(m_submitted_value);
+    vkDestroySemaphore(m_device.m_device, m_semaphore, nullptr);
+}
+
+u64 GpuTimeline::advance() { return ++m_submitted_value; }
+
+u64 GpuTimeline::completedValue() const {
+    u64 value = 0;
+    vkGetSemaphoreCounterValue(m_device.m_device, m_semaphore, &value);
+    return value;
+}
+
+void GpuTimeline::wait(u64 value) const {
+    VkSemaphoreWaitInfo wait_info = {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO,
+        .pNext = nullptr,
+        .flags = 0,
+        .semaphoreCount = 1,
+        .pSemaphores = &m_semaphore,
+        .pValues = &value,
+    };
+    vkWaitSemaphores(m_device.m_device, &wait_info, UINT64_MAX);
+}
+
+DeletionQueue::DeletionQueue(const GfxDevice &device, VmaAllocator memory_allocator,
+                             GpuTimeline &timeline)
+    : m_device(device), m_memory_allocator(memory_allocator), m_timeline(timeline) {}
+
+DeletionQueue::~DeletionQueue() {
+    m_timeline.wait(m_timeline.m_submitted_value);
+    collect();
+    BRTOY_ASSERT(m_pending.empty());
+}
+
+void DeletionQueue::collect() {
+    if (m_pending.empty())
+        return;
+
+    // Entries are destroyed in the order they were retired, e.g. image views before the swapchain
+    // owning their images.
+    u64 completed_value = m_timeline.completedValue();
+    auto it = m_pending.begin();
+    for (; it != m_pending.end() && it->value <= completed_value; ++it)
+        destroy(*it);
+    m_pending.erase(m_pending.begin(), it);
+}
+
+void DeletionQueue::retire(VkImage image, VmaAllocation memory) {
+    push(Kind::Image, (u64)image, memory);
+}
+
+void DeletionQueue::retire(VkImageView view) { push(Kind::ImageView, (u64)view); }
+
+void DeletionQueue::retire(VkBuffer buffer, VmaAllocation memory) {
+    push(Kind::Buffer, (u64)buffer, memory);
+}
+
+void DeletionQueue::retire(VmaAllocation memory) { push(Kind::Allocation, 0, memory); }
+
+void DeletionQueue::retire(VkSwapchainKHR swapchain) { push(Kind::Swapchain, (u64)swapchain); }
+
+void DeletionQueue::retire(VkFence fence) { push(Kind::Fence, (u64)fence); }
+
+void DeletionQueue::push(Kind kind, u64 handle, VmaAllocation memory) {
+    // The submitted value never decreases, so m_pending stays sorted by value.
+    m_pending.push_back({m_timeline.m_submitted_value, kind, handle, memory});
+}
+
+void DeletionQueue::destroy(const Entry &entry) {
+    VkDevice dev = m_device.m_device;
+    switch (entry.kind) {
+    case Kind::Image:
+        vmaDestroyImage(m_memory_allocator, (VkImage)entry.handle, entry.memory);
+        break;
+    case Kind::ImageView:
+        vkDestroyImageView(dev, (VkImageView)entry.handle, nullptr);
+        break;
+    case Kind::Buffer:
+        vmaDestroyBuffer(m_memory_allocator, (VkBuffer)entry.handle, entry.memory);
+        break;
+    case Kind::Allocation:
+        vmaFreeMemory(m_memory_allocator, entry.memory);
+        break;
+    case Kind::Swapchain:
+        vkDestroySwapchainKHR(dev, (VkSwapchainKHR)entry.handle, nullptr);
+        break;
+    case Kind::Fence:
+        vkDestroyFence(dev, (VkFence)entry.handle, nullptr);
+        break;
+    }
+}
+
+PipelineBuilder::PipelineBuilder(const GfxDevice &device, ThreadPool &thread_pool)
+    : m_device(device), m_thread_pool(thread_pool) {}
+
+PipelineBuilder::~PipelineBuilder() {
+    waitAll();
+    for (const Entry &entry : m_pipelines) {
+        vkDestroyPipeline(m_device.m_device, entry.pipeline, nullptr);
+    }
+}
+
+PipelineBuilder::Handle PipelineBuilder::build(BuildFn build_fn) {
+    Handle handle = (Handle)m_pipelines.size();
+    VkDevice device = m_device.m_device;
+    VkPipelineCache pipeline_cache = m_device.m_pipeline_cache;
+    // VkPipelineCache is internally synchronized, so concurrent builds may share it
+    std::future<VkPipeline> future = m_thread_pool.submit(
+        [build_fn = std::move(build_fn), device, pipeline_cache]() {
+            BRTOY_PROFILE_ZONE("build_pipeline");
+            return build_fn(device, pipeline_cache);
+        });
+    m_pipelines.push_back({std::move(future), VK_NULL_HANDLE});
+    return handle;
+}
+
+VkPipeline PipelineBuilder::get(Handle handle) {
+    BRTOY_ASSERT(handle < m_pipelines.size());
+    Entry &entry = m_pipelines[handle];
+    if (entry.future.valid() &&
+        entry.future.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+        entry.pipeline = entry.future.get();
+    }
+    return entry.pipeline;
+}
+
+VkPipeline PipelineBuilder::wait(Handle handle) {
+    BRTOY_ASSERT(handle < m_pipelines.size());
+    Entry &entry = m_pipelines[handle];
+    if (entry.future.valid()) {
+        entry.pipeline = entry.future.get();
+    }
+    return entry.pipeline;
+}
+
+void PipelineBuilder::waitAll() {
+    for (Handle handle = 0; handle < m_pipelines.size(); ++handle) {
+        wait(handle);
+    }
+}
+
 void *BufferSubAllocation::ptr() { return (std::byte *)mapped_ptr + offset; }
 
 VkDeviceSize alignUp(VkDeviceSize x, VkDeviceSize alignment) {
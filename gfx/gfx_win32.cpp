@@ -7,10 +7,14 @@
 namespace brtoy {
 
 std::set<std::string_view> getRequiredPlatformInstanceExtensions() {
-    return {VK_KHR_WIN32_SURFACE_EXTENSION_NAME};
+    return {VK_KHR_SURFACE_EXTENSION_NAME, VK_KHR_WIN32_SURFACE_EXTENSION_NAME};
 }
 
-std::set<std::string_view> getRequiredPlatformDeviceExtensions() { return {}; }
+std::set<std::string_view> getRequiredPlatformDeviceExtensions() {
+    return {VK_KHR_SWAPCHAIN_EXTENSION_NAME};
+}
+
+VkTimeDomainEXT getHostTimeDomain() { return VK_TIME_DOMAIN_QUERY_PERFORMANCE_COUNTER_EXT; }
 
 VkSurfaceKHR GfxInstance::createSurface(OsHandle app_instance, OsHandle window) {
     VkWin32SurfaceCreateInfoKHR surface_create_info = {
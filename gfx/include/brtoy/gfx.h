@@ -39,10 +39,25 @@ struct GfxDevice {
 
     void destroy();
 
+    // Replaces the pipeline cache with one created from the file at path, provided the file was
+    // written for the same vendor, device and driver. Must be called before any pipelines are
+    // created with m_pipeline_cache. Returns false and keeps the empty cache otherwise.
+    bool loadPipelineCache(const char *path);
+    bool savePipelineCache(const char *path) const;
+
     VkPhysicalDevice m_physical_device = VK_NULL_HANDLE;
     VkDevice m_device = VK_NULL_HANDLE;
     VkQueue m_queue = VK_NULL_HANDLE;
     u32 m_queue_family_index = 0;
+    // VK_NULL_HANDLE if the driver failed to create one
+    VkPipelineCache m_pipeline_cache = VK_NULL_HANDLE;
+    // Optional core features, such as pipelineStatisticsQuery, that were enabled
+    VkPhysicalDeviceFeatures m_enabled_features = {};
+    // VK_EXT_calibrated_timestamps is enabled, with the host time domain matching cpuTimestamp()
+    bool m_has_calibrated_timestamps = false;
+    VkTimeDomainEXT m_host_time_domain = VK_TIME_DOMAIN_DEVICE_EXT;
+    // VK_EXT_memory_budget is enabled
+    bool m_has_memory_budget = false;
 };
 
 } // namespace brtoy
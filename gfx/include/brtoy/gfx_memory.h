@@ -0,0 +1,70 @@
+#pragma once
+#include <array>
+#include <brtoy/gfx.h>
+#include <string>
+#include <unordered_map>
+#include <vk_mem_alloc.h>
+
+namespace brtoy {
+
+enum class MemoryTag : u8 {
+    Other,
+    MeshData,
+    Instances,
+    Culling,
+    Readback,
+    Staging,
+    RenderTargets,
+    TransientAttachments,
+    Backbuffers,
+    Count,
+};
+
+const char *memoryTagName(MemoryTag tag);
+
+// Accounts VMA allocations per subsystem tag and polls the heap budgets once per frame. The
+// allocator should be created with VMA_ALLOCATOR_CREATE_EXT_MEMORY_BUDGET_BIT where the device has
+// VK_EXT_memory_budget, otherwise VMA estimates the budgets. Like the allocator in this repo, the
+// tracker is externally synchronized.
+struct MemoryTracker {
+    struct TagUsage {
+        u32 allocation_count;
+        VkDeviceSize bytes;
+        VkDeviceSize peak_bytes;
+    };
+
+    MemoryTracker(VmaAllocator memory_allocator, float budget_threshold = 0.9f);
+    MemoryTracker(const MemoryTracker &) = delete;
+    MemoryTracker &operator=(const MemoryTracker &) = delete;
+
+    // Allocations are named after their tag in VMA's statistics
+    void track(VmaAllocation allocation, MemoryTag tag);
+    // Allocations that aren't tracked are ignored
+    void untrack(VmaAllocation allocation);
+
+    // Polls the heap budgets. Returns true if any heap uses more than the threshold of its
+    // budget, which is the caller's cue to shed load, e.g. by trimming its pools.
+    bool update(u32 frame_index);
+    bool isOverBudget() const { return m_over_budget_heaps != 0; }
+
+    // The output of vmaBuildStatsString
+    std::string buildStatsString(bool detailed_map = false) const;
+    // JSON with the tag table, the heap budgets and the VMA statistics
+    bool writeReport(const char *path) const;
+
+    VmaAllocator m_memory_allocator;
+    float m_budget_threshold;
+    u32 m_heap_count = 0;
+    std::array<VmaBudget, VK_MAX_MEMORY_HEAPS> m_budgets = {};
+    // Bit per heap over the threshold in the last update
+    u32 m_over_budget_heaps = 0;
+    std::array<TagUsage, (size_t)MemoryTag::Count> m_usage = {};
+
+    struct Entry {
+        MemoryTag tag;
+        VkDeviceSize size;
+    };
+    std::unordered_map<VmaAllocation, Entry> m_allocations;
+};
+
+} // namespace brtoy
@@ -0,0 +1,105 @@
+#pragma once
+#include <brtoy/gfx.h>
+#include <array>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace brtoy {
+
+// Measures the GPU time of named zones with timestamp queries. Every frame in flight records into
+// its own range of the query pool, and the range is read back without waiting when the frame index
+// comes around again, by which point the caller has waited for the frame's fence. Zones may nest.
+// Zone names must outlive the profiler; string literals are the intended use.
+struct GpuProfiler {
+    static constexpr u32 ZoneCountMax = 64;
+    static constexpr u32 StatsWindow = 128;
+    static constexpr u32 NoZone = ~0u;
+
+    GpuProfiler(const GfxDevice &device, u32 frame_count);
+    ~GpuProfiler();
+    GpuProfiler(const GpuProfiler &) = delete;
+    GpuProfiler &operator=(const GpuProfiler &) = delete;
+
+    // False if the queue doesn't support timestamps, in which case zones are not recorded
+    bool isSupported() const;
+
+    // Reads back the zones last recorded for frame_index into m_resolved and the statistics. The
+    // GPU must be done with that frame. Zones whose queries aren't available are dropped.
+    void resolve(u32 frame_index);
+    // Resolves frame_index if that hasn't been done yet and resets its queries
+    void beginFrame(VkCommandBuffer cmd, u32 frame_index);
+    // Returns NoZone if the frame is out of zones
+    u32 beginZone(VkCommandBuffer cmd, const char *name);
+    void endZone(VkCommandBuffer cmd, u32 zone);
+
+    struct ZoneResult {
+        const char *name;
+        u32 depth;
+        float ms;
+        // On the cpuTimestamp() timeline if the device has calibrated timestamps, 0 otherwise
+        u64 cpu_begin;
+        u64 cpu_end;
+    };
+
+    // Statistics over the last StatsWindow samples of all zones with the same name
+    struct ZoneStats {
+        std::string name;
+        float last_ms;
+        float mean_ms;
+        float min_ms;
+        float max_ms;
+        u32 sample_count;
+        u32 next_sample;
+        std::array<float, StatsWindow> samples;
+    };
+
+    const ZoneResult *findResolved(std::string_view name) const;
+    const ZoneStats *findStats(std::string_view name) const;
+
+    struct Zone {
+        const char *name;
+        u32 depth;
+    };
+
+    struct Frame {
+        std::vector<Zone> zones;
+    };
+
+    const GfxDevice &m_device;
+    VkQueryPool m_query_pool = VK_NULL_HANDLE;
+    float m_timestamp_period_ns = 0.0f;
+    u64 m_timestamp_mask = 0;
+    PFN_vkGetCalibratedTimestampsEXT m_get_calibrated_timestamps = nullptr;
+    std::vector<Frame> m_frames;
+    u32 m_frame_index = 0;
+    u32 m_depth = 0;
+
+    // Zones of the frame most recently resolved, in the order they were begun
+    std::vector<ZoneResult> m_resolved;
+    // In order of first appearance
+    std::vector<ZoneStats> m_stats;
+
+    void addSample(const char *name, float ms);
+    // Samples the GPU clock and cpuTimestamp() together. False without calibrated timestamps.
+    bool calibrate(u64 &gpu_timestamp, u64 &cpu_timestamp) const;
+};
+
+// Records a zone for the lifetime of the scope
+struct GpuZone {
+    GpuZone(GpuProfiler *profiler, VkCommandBuffer cmd, const char *name)
+        : m_profiler(profiler), m_cmd(cmd),
+          m_zone(profiler ? profiler->beginZone(cmd, name) : GpuProfiler::NoZone) {}
+    ~GpuZone() {
+        if (m_profiler)
+            m_profiler->endZone(m_cmd, m_zone);
+    }
+    GpuZone(const GpuZone &) = delete;
+    GpuZone &operator=(const GpuZone &) = delete;
+
+    GpuProfiler *m_profiler;
+    VkCommandBuffer m_cmd;
+    u32 m_zone;
+};
+
+} // namespace brtoy
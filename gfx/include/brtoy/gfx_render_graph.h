@@ -0,0 +1,184 @@
+#pragma once
+#include <brtoy/arena.h>
+#include <brtoy/gfx.h>
+#include <brtoy/vec.h>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace brtoy {
+
+struct GpuProfiler;
+
+enum class RenderGraphUsage : u8 {
+    None,
+    TransferSrc,
+    TransferDst,
+    IndirectRead,
+    VertexShaderRead,
+    FragmentShaderRead,
+    ComputeShaderRead,
+    ComputeShaderWrite,
+    ComputeShaderReadWrite,
+    AnyShaderRead,
+    ColorAttachment,
+    DepthAttachment,
+    HostRead,
+    Present,
+};
+
+struct RenderGraphUsageInfo {
+    VkPipelineStageFlags2 stages;
+    VkAccessFlags2 access;
+    VkImageLayout layout;
+    bool read;
+    bool write;
+};
+
+RenderGraphUsageInfo renderGraphUsageInfo(RenderGraphUsage usage);
+
+// Passes declare how they use buffers and images. compile() culls passes that don't contribute to
+// an output, assigns transient images to physical slots and computes the synchronization2
+// barriers needed before each pass, batched into one vkCmdPipelineBarrier2 per pass. compile()
+// makes no Vulkan calls, so its result can be inspected without a device.
+//
+// Imported resources with a final usage other than None are the outputs of the graph. The graph
+// is meant to be rebuilt every frame: reset() keeps the allocated storage. With a frame arena, the
+// pass callbacks, the per-pass lists and the temporaries of compile() and execute() come from the
+// arena, and reset() must be called before the arena is reset.
+struct RenderGraph {
+    using Resource = u32;
+    using ExecuteFn = void (*)(void *callable, VkCommandBuffer cmd, const RenderGraph &graph);
+    using DestroyFn = void (*)(void *callable);
+    static constexpr u32 NoSlot = ~0u;
+
+    RenderGraph(FrameArena *arena = nullptr);
+    ~RenderGraph();
+    RenderGraph(const RenderGraph &) = delete;
+    RenderGraph &operator=(const RenderGraph &) = delete;
+
+    struct ImageDesc {
+        V2u dim;
+        VkFormat format;
+        VkSampleCountFlagBits samples;
+        VkImageAspectFlags aspect;
+
+        bool operator==(const ImageDesc &) const = default;
+    };
+
+    struct ResourceInfo {
+        const char *name;
+        bool is_image;
+        bool is_transient;
+        RenderGraphUsage initial_usage;
+        RenderGraphUsage final_usage;
+        VkBuffer buffer;
+        VkDeviceSize offset;
+        VkDeviceSize size;
+        VkImage image;
+        VkImageView view;
+        ImageDesc desc;
+
+        // Set by compile()
+        u32 first_pass;
+        u32 last_pass;
+        u32 transient_slot;
+    };
+
+    struct Use {
+        Resource resource;
+        RenderGraphUsage usage;
+    };
+
+    struct Pass {
+        const char *name;
+        ArenaVector<Use> uses;
+        // The callback, type-erased. Without an arena the callable is on the heap.
+        void *callable;
+        ExecuteFn execute;
+        DestroyFn destroy;
+        bool side_effect;
+        bool culled;
+    };
+
+    struct Barrier {
+        Resource resource;
+        VkPipelineStageFlags2 src_stages;
+        VkAccessFlags2 src_access;
+        VkPipelineStageFlags2 dst_stages;
+        VkAccessFlags2 dst_access;
+        VkImageLayout old_layout;
+        VkImageLayout new_layout;
+    };
+
+    // Barriers recorded before a pass. Transitions to the final usages are recorded in a batch
+    // with pass == m_passes.size().
+    struct BarrierBatch {
+        u32 pass;
+        ArenaVector<Barrier> barriers;
+    };
+
+    struct TransientSlot {
+        ImageDesc desc;
+        u32 last_pass;
+        VkImage image;
+        VkImageView view;
+    };
+
+    struct PassBuilder {
+        PassBuilder &use(Resource resource, RenderGraphUsage usage);
+        PassBuilder &sideEffect();
+
+        RenderGraph &m_graph;
+        u32 m_pass;
+    };
+
+    Resource importBuffer(const char *name, VkBuffer buffer, VkDeviceSize offset,
+                          VkDeviceSize size, RenderGraphUsage initial_usage = RenderGraphUsage::None,
+                          RenderGraphUsage final_usage = RenderGraphUsage::None);
+    Resource importImage(const char *name, VkImage image, VkImageView view,
+                         VkImageAspectFlags aspect,
+                         RenderGraphUsage initial_usage = RenderGraphUsage::None,
+                         RenderGraphUsage final_usage = RenderGraphUsage::None);
+    // Transient images are only valid within the graph and may share a slot, and thereby memory,
+    // with other transient images of the same description whose lifetimes don't overlap.
+    Resource createImage(const char *name, const ImageDesc &desc);
+    // execute is called as execute(VkCommandBuffer cmd, const RenderGraph &graph)
+    template <typename F> PassBuilder addPass(const char *name, F &&execute) {
+        using Callable = std::decay_t<F>;
+        void *callable = allocateCallable(sizeof(Callable), alignof(Callable));
+        new (callable) Callable(std::forward<F>(execute));
+        return addPass(
+            name, callable,
+            [](void *callable, VkCommandBuffer cmd, const RenderGraph &graph) {
+                (*(Callable *)callable)(cmd, graph);
+            },
+            [](void *callable) { ((Callable *)callable)->~Callable(); });
+    }
+    PassBuilder addPass(const char *name, void *callable, ExecuteFn execute, DestroyFn destroy);
+
+    void compile();
+    // Every slot in m_transient_slots must be bound after compile() and before execute().
+    void bindTransient(u32 slot, VkImage image, VkImageView view);
+    // With a profiler, every pass is recorded in a zone named after the pass. The zone starts
+    // after the barriers before the pass.
+    void execute(VkCommandBuffer cmd, GpuProfiler *profiler = nullptr);
+    void reset();
+
+    VkBuffer buffer(Resource resource) const;
+    VkDeviceSize bufferOffset(Resource resource) const;
+    VkImage image(Resource resource) const;
+    VkImageView imageView(Resource resource) const;
+
+    void *allocateCallable(size_t size, size_t alignment);
+    void destroyCallables();
+
+    FrameArena *m_arena;
+    std::vector<ResourceInfo> m_resources;
+    std::vector<Pass> m_passes;
+    std::vector<BarrierBatch> m_barrier_batches;
+    std::vector<TransientSlot> m_transient_slots;
+};
+
+} // namespace brtoy
@@ -4,12 +4,16 @@
 
 namespace brtoy {
 
+struct DeletionQueue;
+
 struct Swapchain {
     Swapchain(GfxInstance &instance, u64 app_instance, u64 window, VkPhysicalDevice physical_device,
               VkDevice device);
     ~Swapchain();
 
-    void recreate(V2u dim);
+    // The old swapchain is passed as oldSwapchain and, if a deletion queue is given, destroyed
+    // once the GPU is done with it rather than immediately.
+    void recreate(V2u dim, DeletionQueue *deletion_queue = nullptr);
 
     VkInstance m_instance = VK_NULL_HANDLE;
     VkSurfaceKHR m_surface = VK_NULL_HANDLE;
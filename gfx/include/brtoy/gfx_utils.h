@@ -1,7 +1,11 @@
 #pragma once
 #include <brtoy/container.h>
 #include <brtoy/gfx.h>
+#include <brtoy/gfx_memory.h>
+#include <brtoy/thread_pool.h>
 #include <brtoy/vec.h>
+#include <functional>
+#include <future>
 #include <span>
 #include <vector>
 #include <vk_mem_alloc.h>
@@ -9,6 +13,61 @@
 namespace brtoy {
 
 struct Swapchain;
+struct DeletionQueue;
+struct TexturePool;
+
+// Timeline semaphore signaled once per submission. Value N has completed when the GPU has
+// finished the N:th submission that signaled it.
+struct GpuTimeline {
+    GpuTimeline(const GfxDevice &device);
+    ~GpuTimeline();
+    GpuTimeline(const GpuTimeline &) = delete;
+    GpuTimeline &operator=(const GpuTimeline &) = delete;
+
+    // Returns the value the next submission must signal and records it as submitted.
+    u64 advance();
+    u64 completedValue() const;
+    void wait(u64 value) const;
+
+    const GfxDevice &m_device;
+    VkSemaphore m_semaphore = VK_NULL_HANDLE;
+    u64 m_submitted_value = 0;
+};
+
+// Defers destruction of GPU objects until the GPU is done with them. Objects are tagged with the
+// timeline value of the latest submission, so retire an object after the last submission that
+// uses it has been made.
+struct DeletionQueue {
+    DeletionQueue(const GfxDevice &device, VmaAllocator memory_allocator, GpuTimeline &timeline);
+    ~DeletionQueue();
+    DeletionQueue(const DeletionQueue &) = delete;
+    DeletionQueue &operator=(const DeletionQueue &) = delete;
+
+    void collect();
+
+    void retire(VkImage image, VmaAllocation memory);
+    void retire(VkImageView view);
+    void retire(VkBuffer buffer, VmaAllocation memory);
+    void retire(VmaAllocation memory);
+    void retire(VkSwapchainKHR swapchain);
+    void retire(VkFence fence);
+
+    enum class Kind { Image, ImageView, Buffer, Allocation, Swapchain, Fence };
+    struct Entry {
+        u64 value;
+        Kind kind;
+        u64 handle;
+        VmaAllocation memory;
+    };
+
+    void push(Kind kind, u64 handle, VmaAllocation memory = VK_NULL_HANDLE);
+    void destroy(const Entry &entry);
+
+    const GfxDevice &m_device;
+    VmaAllocator m_memory_allocator;
+    GpuTimeline &m_timeline;
+    std::vector<Entry> m_pending;
+};
 
 struct Backbuffer {
     static constexpr size_t BufferCountMax = 3;
@@ -21,15 +80,33 @@ struct Backbuffer {
 
     static Backbuffer createFromSwapchain(VkDevice device, const Swapchain &swapchain);
 
+    // Recreates the swapchain at the new size without waiting for the GPU. The old views and
+    // swapchain go to the deletion queue, the per-image fences are kept.
+    void recreate(Swapchain &swapchain, V2u dim, DeletionQueue &deletion_queue);
+
+    // Offscreen buffers are textures acquired from the pool instead of swapchain images, for
+    // rendering without a window system. Like swapchain images, their contents are undefined when
+    // acquired. The pool must outlive the backbuffer.
+    static Backbuffer createOffscreen(VkDevice device, TexturePool &texture_pool, V2u dim,
+                                      u32 buffer_count = BufferCountMax);
+    // The old textures go back to the pool once their buffer's fence has signaled
+    void recreateOffscreen(V2u dim);
+    // Returns the index of the next offscreen buffer, in round-robin order
+    u32 acquireOffscreen();
+
     VkDevice m_device;
     V2u m_dim;
+    TexturePool *m_texture_pool = nullptr;
+    u32 m_next_offscreen = 0;
 
     struct Buffer {
         VkImage image;
         VkImageView view;
         VkFence fence;
+        // Offscreen buffers only
+        VmaAllocation memory;
     };
-    StackVector<Buffer, BufferCountMax> m_buffers;
+    SmallVector<Buffer, BufferCountMax> m_buffers;
 };
 
 struct CommandBufferPool {
@@ -47,13 +124,52 @@ struct CommandBufferPool {
         VkCommandBuffer cmd_buffer;
         VkFence fence;
     };
-    std::vector<CmdBufferAllocation> m_pending;
-    std::vector<VkCommandBuffer> m_free;
+    // A few command buffers per frame in flight
+    SmallVector<CmdBufferAllocation, 8> m_pending;
+    SmallVector<VkCommandBuffer, 8> m_free;
+};
+
+// Device memory shared by the transient attachments of several TexturePools. Memory released by
+// one pool can back a new image in any pool, so render targets of different pools alias the same
+// blocks over time. Released blocks are kept for IdleFrameLimit syncs before going back to VMA.
+// Lazily allocated memory is preferred where the device has it.
+struct TransientAttachmentHeap {
+    static constexpr u64 IdleFrameLimit = 8;
+
+    TransientAttachmentHeap(VmaAllocator memory_allocator, MemoryTracker *memory_tracker = nullptr);
+    ~TransientAttachmentHeap();
+    TransientAttachmentHeap(const TransientAttachmentHeap &) = delete;
+    TransientAttachmentHeap &operator=(const TransientAttachmentHeap &) = delete;
+
+    void sync();
+    VmaAllocation acquire(const VkMemoryRequirements &requirements);
+    // The memory must no longer be in use by the GPU.
+    void release(VmaAllocation memory);
+    // Frees all released blocks now instead of after IdleFrameLimit syncs
+    void trim();
+    void freeMemory(VmaAllocation memory);
+
+    VmaAllocator m_memory_allocator;
+    MemoryTracker *m_memory_tracker;
+    u64 m_sync_index = 0;
+    u32 m_live_count = 0;
+
+    struct Block {
+        VmaAllocation memory;
+        VkDeviceSize offset;
+        VkDeviceSize size;
+        u32 memory_type;
+        u64 last_used_sync;
+    };
+    SmallVector<Block, 8> m_free;
 };
 
 struct TexturePool {
+    static constexpr u64 IdleFrameLimit = 4;
+
     struct Texture {
         V2u dim;
+        VkFormat format;
         VmaAllocation memory;
         VkImage image;
         VkImageView view;
@@ -61,27 +177,78 @@ struct TexturePool {
 
     TexturePool(const GfxDevice &device, VmaAllocator memory_allocator,
                 VkImageCreateInfo image_create_info, VkImageViewCreateInfo view_create_info,
-                VkImageMemoryBarrier init_barrier, VkPipelineStageFlags init_dst_stage_mask);
+                VkImageMemoryBarrier init_barrier, VkPipelineStageFlags init_dst_stage_mask,
+                TransientAttachmentHeap *transient_heap = nullptr,
+                MemoryTracker *memory_tracker = nullptr,
+                MemoryTag memory_tag = MemoryTag::RenderTargets);
     ~TexturePool();
 
     void sync();
-    Texture acquire(VkCommandBuffer cmd, V2u extent);
+    // Frees all free textures now instead of after IdleFrameLimit syncs
+    void trim();
+    // VK_FORMAT_UNDEFINED selects the format of the image create info. A null cmd skips the init
+    // barrier of new textures, for users that transition them from an undefined layout anyway.
+    Texture acquire(VkCommandBuffer cmd, V2u extent, VkFormat format = VK_FORMAT_UNDEFINED);
     void release(VkCommandBuffer cmd, const Texture &texture, VkFence fence);
     void free(Texture &texture);
 
     const GfxDevice &m_device;
     VmaAllocator m_memory_allocator;
+    TransientAttachmentHeap *m_transient_heap;
+    // Textures backed by the transient heap are tracked by the heap
+    MemoryTracker *m_memory_tracker;
+    MemoryTag m_memory_tag;
     VkImageCreateInfo m_image_create_info;
     VkImageViewCreateInfo m_view_create_info;
     VkImageMemoryBarrier m_init_barrier;
     VkPipelineStageFlags m_init_dst_stage_mask;
+    u64 m_sync_index = 0;
 
     struct TextureAllocation {
         Texture texture;
         VkFence fence;
     };
-    std::vector<TextureAllocation> m_pending;
-    std::vector<Texture> m_free;
+    SmallVector<TextureAllocation, 8> m_pending;
+
+    // Free textures bucketed by extent and format. Buckets not used for IdleFrameLimit syncs are
+    // freed, so a resize doesn't destroy the textures of the previous size right away.
+    struct Bucket {
+        V2u dim;
+        VkFormat format;
+        u64 last_used_sync;
+        SmallVector<Texture, 4> textures;
+    };
+    SmallVector<Bucket, 4> m_free;
+
+    Bucket &bucket(V2u dim, VkFormat format);
+};
+
+// Creates pipelines on a thread pool so that the frame loop can start before all of them are
+// compiled. The build function runs on a worker thread and must not reference state owned by the
+// caller's stack frame. The builder owns the pipelines it has built.
+struct PipelineBuilder {
+    using Handle = u32;
+    using BuildFn = std::function<VkPipeline(VkDevice device, VkPipelineCache pipeline_cache)>;
+
+    PipelineBuilder(const GfxDevice &device, ThreadPool &thread_pool);
+    ~PipelineBuilder();
+    PipelineBuilder(const PipelineBuilder &) = delete;
+    PipelineBuilder &operator=(const PipelineBuilder &) = delete;
+
+    Handle build(BuildFn build_fn);
+    // Returns VK_NULL_HANDLE until the pipeline is ready. Never blocks.
+    VkPipeline get(Handle handle);
+    VkPipeline wait(Handle handle);
+    void waitAll();
+
+    struct Entry {
+        std::future<VkPipeline> future;
+        VkPipeline pipeline;
+    };
+
+    const GfxDevice &m_device;
+    ThreadPool &m_thread_pool;
+    std::vector<Entry> m_pipelines;
 };
 
 struct BufferSubAllocation {
@@ -0,0 +1,210 @@
+#include "platform_internal.h"
+#include <array>
+#include <brtoy/async_io.h>
+#include <brtoy/thread_pool.h>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+namespace brtoy {
+
+struct AsyncFileReader::Impl {
+    struct Request {
+        Handle file;
+        u64 offset;
+        std::span<std::byte> dst;
+        Callback callback;
+        // Bytes read so far. io_uring reads may come back short before the end of the file, and
+        // the rest is read by another request in the same slot.
+        u64 done;
+    };
+
+    ~Impl();
+
+    void issueQueued();
+    u32 poll(bool wait);
+    void waitAll();
+
+    std::vector<OsHandle> m_files;
+    std::vector<bool> m_file_is_open;
+    // Reads in flight are identified by their slot in m_requests
+    std::vector<Request> m_requests;
+    std::vector<u32> m_free_requests;
+    std::deque<Request> m_queued;
+    // Slots of short io_uring reads whose rest is still to be pushed
+    std::vector<u32> m_short_reads;
+    u32 m_in_flight = 0;
+
+    std::unique_ptr<IoRing> m_ring;
+
+    // Thread pool backend. The pool is declared last so that its workers are joined before the
+    // state they signal is destroyed.
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::vector<IoCompletion> m_completions;
+    std::unique_ptr<ThreadPool> m_thread_pool;
+};
+
+AsyncFileReader::Impl::~Impl() {
+    waitAll();
+    for (size_t i = 0; i < m_files.size(); ++i) {
+        if (m_file_is_open[i])
+            closeNativeFile(m_files[i]);
+    }
+}
+
+void AsyncFileReader::Impl::issueQueued() {
+    while (!m_short_reads.empty()) {
+        u32 slot = m_short_reads.back();
+        const Request &request = m_requests[slot];
+        if (!m_ring->pushRead(m_files[request.file.index()], request.offset + request.done,
+                              request.dst.data() + request.done,
+                              (u32)(request.dst.size() - request.done), slot))
+            return;
+        m_short_reads.pop_back();
+    }
+    while (!m_queued.empty() && !m_free_requests.empty()) {
+        Request &request = m_queued.front();
+        u32 slot = m_free_requests.back();
+        OsHandle file = m_files[request.file.index()];
+        if (m_ring) {
+            if (!m_ring->pushRead(file, request.offset, request.dst.data(),
+                                  (u32)request.dst.size(), slot))
+                break;
+        } else {
+            std::span<std::byte> dst = request.dst;
+            m_thread_pool->enqueue([this, file, offset = request.offset, dst, slot]() {
+                i64 result = readNativeFile(file, offset, dst.data(), dst.size());
+                {
+                    std::lock_guard lock(m_mutex);
+                    m_completions.push_back({slot, result});
+                }
+                m_cv.notify_one();
+            });
+        }
+        m_free_requests.pop_back();
+        m_requests[slot] = std::move(request);
+        m_queued.pop_front();
+        ++m_in_flight;
+    }
+}
+
+u32 AsyncFileReader::Impl::poll(bool wait) {
+    issueQueued();
+    wait = wait && m_in_flight > 0;
+
+    std::vector<IoCompletion> completions;
+    if (m_ring) {
+        m_ring->submit(wait);
+        std::array<IoCompletion, 64> reaped;
+        for (;;) {
+            u32 count = m_ring->reap(reaped);
+            completions.insert(completions.end(), reaped.begin(), reaped.begin() + count);
+            if (count < reaped.size())
+                break;
+        }
+    } else {
+        std::unique_lock lock(m_mutex);
+        if (wait)
+            m_cv.wait(lock, [this]() { return !m_completions.empty(); });
+        completions.swap(m_completions);
+    }
+
+    u32 callback_count = 0;
+    for (const IoCompletion &completion : completions) {
+        u32 slot = (u32)completion.user_data;
+        Request &request = m_requests[slot];
+        i64 result = completion.result;
+        if (result > 0) {
+            request.done += (u64)result;
+            // Blocking reads have looped already, only io_uring reads are continued
+            if (m_ring && request.done < request.dst.size()) {
+                m_short_reads.push_back(slot);
+                continue;
+            }
+            result = (i64)request.done;
+        } else if (result == 0) {
+            result = (i64)request.done;
+        }
+        Callback callback = std::move(request.callback);
+        request = {};
+        m_free_requests.push_back(slot);
+        --m_in_flight;
+        ++callback_count;
+        if (callback)
+            callback(result);
+    }
+    return callback_count;
+}
+
+void AsyncFileReader::Impl::waitAll() {
+    while (m_in_flight > 0 || !m_queued.empty())
+        poll(true);
+}
+
+AsyncFileReader::AsyncFileReader(AsyncFileReader &&) = default;
+
+AsyncFileReader &AsyncFileReader::operator=(AsyncFileReader &&) = default;
+
+AsyncFileReader::~AsyncFileReader() = default;
+
+std::optional<AsyncFileReader> AsyncFileReader::create(u32 queue_depth, bool allow_io_uring) {
+    BRTOY_ASSERT(queue_depth > 0);
+    std::optional<AsyncFileReader> result = AsyncFileReader();
+    result->m_impl = std::make_unique<Impl>();
+    Impl &impl = *result->m_impl;
+    impl.m_requests.resize(queue_depth);
+    for (u32 i = queue_depth; i > 0; --i)
+        impl.m_free_requests.push_back(i - 1);
+    if (allow_io_uring)
+        impl.m_ring = createIoRing(queue_depth);
+    if (!impl.m_ring) {
+        // Blocking reads are latency bound, so more threads than cores can be kept busy
+        impl.m_thread_pool = std::make_unique<ThreadPool>(4);
+    }
+    return result;
+}
+
+Handle AsyncFileReader::openFile(const char *path) {
+    Handle result;
+    OsHandle file;
+    if (openNativeFile(path, file)) {
+        size_t index = 0;
+        while (index < m_impl->m_files.size() && m_impl->m_file_is_open[index])
+            ++index;
+        if (index == m_impl->m_files.size()) {
+            m_impl->m_files.push_back(file);
+            m_impl->m_file_is_open.push_back(true);
+        } else {
+            m_impl->m_files[index] = file;
+            m_impl->m_file_is_open[index] = true;
+        }
+        result = Handle::fromIndex(index);
+    }
+    return result;
+}
+
+void AsyncFileReader::closeFile(Handle file) {
+    BRTOY_ASSERT(file && m_impl->m_file_is_open[file.index()]);
+    closeNativeFile(m_impl->m_files[file.index()]);
+    m_impl->m_file_is_open[file.index()] = false;
+}
+
+void AsyncFileReader::read(Handle file, u64 offset, std::span<std::byte> dst, Callback callback) {
+    BRTOY_ASSERT(file && m_impl->m_file_is_open[file.index()]);
+    BRTOY_ASSERT(dst.size() <= MaxReadSize);
+    m_impl->m_queued.push_back({file, offset, dst, std::move(callback), 0});
+}
+
+u32 AsyncFileReader::poll() { return m_impl->poll(false); }
+
+void AsyncFileReader::waitAll() { m_impl->waitAll(); }
+
+u32 AsyncFileReader::outstandingCount() const {
+    return m_impl->m_in_flight + (u32)m_impl->m_queued.size();
+}
+
+bool AsyncFileReader::usesIoUring() const { return m_impl->m_ring != nullptr; }
+
+} // namespace brtoy
@@ -0,0 +1,53 @@
+#pragma once
+#include <brtoy/platform.h>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <span>
+
+namespace brtoy {
+
+// Reads file ranges into caller-owned memory without blocking the calling thread. Uses io_uring
+// where available and positional reads on a small thread pool otherwise.
+//
+// Reads are submitted to the kernel in batches from poll(), which also runs the callbacks of
+// completed reads on the calling thread. The destination memory must stay valid until the
+// callback has run.
+class AsyncFileReader {
+  public:
+    struct Impl;
+    using ImplPtr = std::unique_ptr<Impl>;
+    // Number of bytes read, which is less than requested at the end of the file, or a negative
+    // value on error.
+    using Callback = std::function<void(i64 result)>;
+    // Largest read Linux performs in one request
+    static constexpr size_t MaxReadSize = 0x7ffff000;
+
+    AsyncFileReader() = default;
+    // Out of line, where Impl is complete
+    AsyncFileReader(AsyncFileReader &&);
+    // Waits for the reads of the reader it replaces
+    AsyncFileReader &operator=(AsyncFileReader &&);
+    // Waits for all reads, running their callbacks
+    ~AsyncFileReader();
+
+    // queue_depth bounds the number of reads in flight, further reads are queued
+    static std::optional<AsyncFileReader> create(u32 queue_depth = 128, bool allow_io_uring = true);
+
+    Handle openFile(const char *path);
+    // The file must not have any outstanding reads
+    void closeFile(Handle file);
+
+    void read(Handle file, u64 offset, std::span<std::byte> dst, Callback callback);
+    // Returns the number of callbacks run
+    u32 poll();
+    void waitAll();
+
+    u32 outstandingCount() const;
+    bool usesIoUring() const;
+
+  private:
+    ImplPtr m_impl;
+};
+
+} // namespace brtoy
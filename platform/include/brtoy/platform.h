@@ -4,7 +4,9 @@
 #include <brtoy/vec.h>
 #include <memory>
 #include <optional>
+#include <span>
 #include <string_view>
+#include <vector>
 
 namespace brtoy {
 
@@ -18,6 +20,31 @@ struct Handle {
     size_t m_value = 0;
 };
 
+// Read-only view of the contents of a file. The view is backed by a memory mapping of the file
+// when possible and by a copy of the file in m_buffer otherwise.
+struct MappedFile {
+    MappedFile() = default;
+    ~MappedFile();
+    MappedFile(MappedFile &&other);
+    MappedFile &operator=(MappedFile &&other);
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    std::span<const std::byte> data() const;
+    size_t size() const;
+    bool isMapped() const;
+
+    const std::byte *m_data = nullptr;
+    size_t m_size = 0;
+    bool m_is_mapped = false;
+    std::vector<std::byte> m_buffer;
+};
+
+// Maps the file into memory, falling back to readFile() if the file can't be mapped.
+std::optional<MappedFile> mapFile(const char *path);
+// Reads the whole file with a single read into a buffer of the file's size.
+std::optional<std::vector<std::byte>> readFile(const char *path);
+
 using Window = u64;
 
 struct WindowState {
@@ -48,10 +75,15 @@ class Platform {
     static void errorMessage(const char *msg);
 
     OsHandle appInstanceHandle() const;
+    // Headless platforms have windows without native handles, so there is nothing to present to
+    bool isHeadless() const;
     bool tick(Input &out_input);
     void requestQuit();
+    // Replaces the input returned by the next tick()
+    void injectInput(const Input &input);
 
-    Window createWindow(const char *name);
+    // A zero dim lets the platform choose the size
+    Window createWindow(const char *name, V2u dim = {});
     void setWindowTitle(Window window, std::string_view title);
     WindowState windowState(Window window) const;
 
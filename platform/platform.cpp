@@ -1,4 +1,6 @@
-#include <brtoy/platform.h>
+#include "platform_internal.h"
+#include <stdio.h>
+#include <utility>
 
 namespace brtoy {
 
@@ -10,4 +12,66 @@ Handle::operator bool() const { return valid(); }
 
 size_t Handle::index() const { return m_value - 1; }
 
+MappedFile::~MappedFile() {
+    if (m_is_mapped)
+        unmapFileView(m_data, m_size);
+}
+
+MappedFile::MappedFile(MappedFile &&other)
+    : m_data(std::exchange(other.m_data, nullptr)), m_size(std::exchange(other.m_size, 0)),
+      m_is_mapped(std::exchange(other.m_is_mapped, false)), m_buffer(std::move(other.m_buffer)) {}
+
+MappedFile &MappedFile::operator=(MappedFile &&other) {
+    if (this != &other) {
+        if (m_is_mapped)
+            unmapFileView(m_data, m_size);
+        m_data = std::exchange(other.m_data, nullptr);
+        m_size = std::exchange(other.m_size, 0);
+        m_is_mapped = std::exchange(other.m_is_mapped, false);
+        m_buffer = std::move(other.m_buffer);
+    }
+    return *this;
+}
+
+std::span<const std::byte> MappedFile::data() const { return {m_data, m_size}; }
+
+size_t MappedFile::size() const { return m_size; }
+
+bool MappedFile::isMapped() const { return m_is_mapped; }
+
+std::optional<MappedFile> mapFile(const char *path) {
+    std::optional<MappedFile> result;
+    const std::byte *data = nullptr;
+    size_t size = 0;
+    if (mapFileView(path, data, size)) {
+        result.emplace();
+        result->m_data = data;
+        result->m_size = size;
+        result->m_is_mapped = true;
+    } else if (auto buffer = readFile(path)) {
+        result.emplace();
+        result->m_buffer = std::move(*buffer);
+        result->m_data = result->m_buffer.data();
+        result->m_size = result->m_buffer.size();
+    }
+    return result;
+}
+
+std::optional<std::vector<std::byte>> readFile(const char *path) {
+    std::optional<std::vector<std::byte>> result;
+    FILE *file = fopen(path, "rb");
+    if (file) {
+        if (fseek(file, 0, SEEK_END) == 0) {
+            long size = ftell(file);
+            if (size >= 0 && fseek(file, 0, SEEK_SET) == 0) {
+                std::vector<std::byte> buffer(size);
+                if (fread(buffer.data(), 1, buffer.size(), file) == buffer.size())
+                    result = std::move(buffer);
+            }
+        }
+        fclose(file);
+    }
+    return result;
+}
+
 } // namespace brtoy
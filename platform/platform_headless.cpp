@@ -0,0 +1,111 @@
+#include <atomic>
+#include <brtoy/platform.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string>
+#include <time.h>
+#include <unordered_map>
+
+namespace brtoy {
+
+// Platform without a window system. Windows only have a size and a title, input is whatever was
+// injected, and SIGINT/SIGTERM request a quit so that automated runs can shut down cleanly.
+
+static std::atomic<bool> s_quit_requested = false;
+
+static void handleQuitSignal(int) { s_quit_requested = true; }
+
+struct NativeWindowState {
+    WindowState m_state;
+    std::string m_title;
+};
+
+struct Platform::Impl {
+    static constexpr V2u DefaultWindowDim = {1280, 720};
+
+    std::unordered_map<Window, NativeWindowState> m_windows;
+    Window m_next_window = 1;
+    Input m_cur_input = {};
+    std::optional<Input> m_injected_input;
+
+    bool m_alive = true;
+};
+
+Platform::~Platform() = default;
+
+std::optional<Platform> Platform::init() {
+    struct sigaction action = {};
+    action.sa_handler = handleQuitSignal;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+
+    Platform platform;
+    platform.m_impl = std::make_unique<Platform::Impl>();
+    return platform;
+}
+
+void Platform::errorMessage(const char *msg) { fprintf(stderr, "brtoy: %s\n", msg); }
+
+OsHandle Platform::appInstanceHandle() const { return 0; }
+
+bool Platform::isHeadless() const { return true; }
+
+bool Platform::tick(Input &input) {
+    if (s_quit_requested)
+        m_impl->m_alive = false;
+
+    for (auto it = m_impl->m_windows.begin(); it != m_impl->m_windows.end();) {
+        if (!m_impl->m_alive || it->second.m_state.is_closing) {
+            it = m_impl->m_windows.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    m_impl->m_cur_input.mouse_dx = 0;
+    m_impl->m_cur_input.mouse_dy = 0;
+    if (m_impl->m_injected_input) {
+        m_impl->m_cur_input = *m_impl->m_injected_input;
+        m_impl->m_injected_input.reset();
+    }
+    input = m_impl->m_cur_input;
+    return m_impl->m_alive;
+}
+
+void Platform::requestQuit() { m_impl->m_alive = false; }
+
+void Platform::injectInput(const Input &input) { m_impl->m_injected_input = input; }
+
+Window Platform::createWindow(const char *name, V2u dim) {
+    Window window = m_impl->m_next_window++;
+    if (dim.x == 0 || dim.y == 0)
+        dim = Impl::DefaultWindowDim;
+    m_impl->m_windows[window] = {.m_state = {.native_handle = 0, .is_closing = false, .dim = dim},
+                                 .m_title = name};
+    return window;
+}
+
+void Platform::setWindowTitle(Window window, std::string_view title) {
+    auto it = m_impl->m_windows.find(window);
+    if (it != m_impl->m_windows.end())
+        it->second.m_title = title;
+}
+
+WindowState Platform::windowState(Window window) const {
+    WindowState state{};
+    auto it = m_impl->m_windows.find(window);
+    if (it != m_impl->m_windows.end())
+        state = it->second.m_state;
+    return state;
+}
+
+u64 Platform::getTimestampTicksPerSecond() { return 1000000000; }
+
+u64 Platform::getTimestamp() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u64)ts.tv_sec * 1000000000 + (u64)ts.tv_nsec;
+}
+
+} // namespace brtoy
@@ -0,0 +1,38 @@
+#pragma once
+#include <brtoy/platform.h>
+#include <memory>
+#include <span>
+
+// Implemented per platform
+namespace brtoy {
+
+// Mapping fails for empty files
+bool mapFileView(const char *path, const std::byte *&out_data, size_t &out_size);
+void unmapFileView(const std::byte *data, size_t size);
+
+bool openNativeFile(const char *path, OsHandle &out_file);
+void closeNativeFile(OsHandle file);
+// Returns the number of bytes read or a negative value on error. Safe to call concurrently on
+// the same file.
+i64 readNativeFile(OsHandle file, u64 offset, void *dst, size_t size);
+
+struct IoCompletion {
+    u64 user_data;
+    i64 result;
+};
+
+// Kernel submission and completion queues
+struct IoRing {
+    virtual ~IoRing() = default;
+
+    // Returns false if the submission queue is full
+    virtual bool pushRead(OsHandle file, u64 offset, void *dst, u32 size, u64 user_data) = 0;
+    // Submits the pushed reads and optionally waits for at least one completion
+    virtual void submit(bool wait) = 0;
+    virtual u32 reap(std::span<IoCompletion> out_completions) = 0;
+};
+
+// Returns nullptr where there is no kernel support
+std::unique_ptr<IoRing> createIoRing(u32 queue_depth);
+
+} // namespace brtoy
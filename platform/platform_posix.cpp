@@ -0,0 +1,207 @@
+#include "platform_internal.h"
+#include <algorithm>
+#include <atomic>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#endif
+
+namespace brtoy {
+
+bool mapFileView(const char *path, const std::byte *&out_data, size_t &out_size) {
+    bool result = false;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd >= 0) {
+        struct stat st;
+        if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+            // The mapping keeps the file open
+            void *view = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (view != MAP_FAILED) {
+                madvise(view, st.st_size, MADV_SEQUENTIAL);
+                out_data = (const std::byte *)view;
+                out_size = (size_t)st.st_size;
+                result = true;
+            }
+        }
+        close(fd);
+    }
+    return result;
+}
+
+void unmapFileView(const std::byte *data, size_t size) { munmap((void *)data, size); }
+
+bool openNativeFile(const char *path, OsHandle &out_file) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    out_file = (OsHandle)fd;
+    return fd >= 0;
+}
+
+void closeNativeFile(OsHandle file) { close((int)file); }
+
+i64 readNativeFile(OsHandle file, u64 offset, void *dst, size_t size) {
+    size_t total = 0;
+    while (total < size) {
+        ssize_t count = pread((int)file, (std::byte *)dst + total, size - total, offset + total);
+        if (count < 0) {
+            if (errno == EINTR)
+                continue;
+            return -errno;
+        }
+        if (count == 0)
+            break;
+        total += count;
+    }
+    return (i64)total;
+}
+
+#ifdef __linux__
+
+// io_uring through the raw system calls, so that liburing isn't needed
+struct IoUring : IoRing {
+    ~IoUring() override;
+
+    bool pushRead(OsHandle file, u64 offset, void *dst, u32 size, u64 user_data) override;
+    void submit(bool wait) override;
+    u32 reap(std::span<IoCompletion> out_completions) override;
+
+    int m_fd = -1;
+    void *m_sq_ring = MAP_FAILED;
+    size_t m_sq_ring_size = 0;
+    void *m_cq_ring = MAP_FAILED;
+    size_t m_cq_ring_size = 0;
+    io_uring_sqe *m_sqes = (io_uring_sqe *)MAP_FAILED;
+    size_t m_sqes_size = 0;
+
+    std::atomic<u32> *m_sq_head;
+    std::atomic<u32> *m_sq_tail;
+    u32 m_sq_mask;
+    u32 m_sq_entries;
+    u32 *m_sq_array;
+    std::atomic<u32> *m_cq_head;
+    std::atomic<u32> *m_cq_tail;
+    u32 m_cq_mask;
+    io_uring_cqe *m_cqes;
+    u32 m_unsubmitted = 0;
+};
+
+IoUring::~IoUring() {
+    if (m_sqes != MAP_FAILED)
+        munmap(m_sqes, m_sqes_size);
+    if (m_cq_ring != MAP_FAILED && m_cq_ring != m_sq_ring)
+        munmap(m_cq_ring, m_cq_ring_size);
+    if (m_sq_ring != MAP_FAILED)
+        munmap(m_sq_ring, m_sq_ring_size);
+    if (m_fd >= 0)
+        close(m_fd);
+}
+
+bool IoUring::pushRead(OsHandle file, u64 offset, void *dst, u32 size, u64 user_data) {
+    u32 head = m_sq_head->load(std::memory_order_acquire);
+    u32 tail = m_sq_tail->load(std::memory_order_relaxed);
+    if (tail - head == m_sq_entries)
+        return false;
+
+    u32 index = tail & m_sq_mask;
+    io_uring_sqe &sqe = m_sqes[index];
+    memset(&sqe, 0, sizeof(sqe));
+    sqe.opcode = IORING_OP_READ;
+    sqe.fd = (int)file;
+    sqe.off = offset;
+    sqe.addr = (u64)dst;
+    sqe.len = size;
+    sqe.user_data = user_data;
+    m_sq_array[index] = index;
+    m_sq_tail->store(tail + 1, std::memory_order_release);
+    ++m_unsubmitted;
+    return true;
+}
+
+void IoUring::submit(bool wait) {
+    if (m_unsubmitted == 0 && !wait)
+        return;
+    u32 flags = wait ? IORING_ENTER_GETEVENTS : 0;
+    long result;
+    do {
+        result = syscall(__NR_io_uring_enter, m_fd, m_unsubmitted, wait ? 1 : 0, flags, nullptr, 0);
+    } while (result < 0 && errno == EINTR);
+    if (result > 0)
+        m_unsubmitted -= (u32)result;
+}
+
+u32 IoUring::reap(std::span<IoCompletion> out_completions) {
+    u32 head = m_cq_head->load(std::memory_order_relaxed);
+    u32 tail = m_cq_tail->load(std::memory_order_acquire);
+    u32 count = 0;
+    while (head != tail && count < out_completions.size()) {
+        const io_uring_cqe &cqe = m_cqes[head & m_cq_mask];
+        out_completions[count++] = {cqe.user_data, cqe.res};
+        ++head;
+    }
+    m_cq_head->store(head, std::memory_order_release);
+    return count;
+}
+
+std::unique_ptr<IoRing> createIoRing(u32 queue_depth) {
+    io_uring_params params = {};
+    int fd = (int)syscall(__NR_io_uring_setup, queue_depth, &params);
+    if (fd < 0)
+        return nullptr;
+
+    auto ring = std::make_unique<IoUring>();
+    ring->m_fd = fd;
+    // IORING_OP_READ was added in the same kernel release as this feature
+    if (!(params.features & IORING_FEAT_RW_CUR_POS))
+        return nullptr;
+
+    ring->m_sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(u32);
+    ring->m_cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap) {
+        ring->m_sq_ring_size = std::max(ring->m_sq_ring_size, ring->m_cq_ring_size);
+        ring->m_cq_ring_size = ring->m_sq_ring_size;
+    }
+    ring->m_sq_ring = mmap(nullptr, ring->m_sq_ring_size, PROT_READ | PROT_WRITE,
+                           MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (ring->m_sq_ring == MAP_FAILED)
+        return nullptr;
+    if (single_mmap) {
+        ring->m_cq_ring = ring->m_sq_ring;
+    } else {
+        ring->m_cq_ring = mmap(nullptr, ring->m_cq_ring_size, PROT_READ | PROT_WRITE,
+                               MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (ring->m_cq_ring == MAP_FAILED)
+            return nullptr;
+    }
+    ring->m_sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+    ring->m_sqes = (io_uring_sqe *)mmap(nullptr, ring->m_sqes_size, PROT_READ | PROT_WRITE,
+                                        MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (ring->m_sqes == MAP_FAILED)
+        return nullptr;
+
+    std::byte *sq = (std::byte *)ring->m_sq_ring;
+    std::byte *cq = (std::byte *)ring->m_cq_ring;
+    ring->m_sq_head = (std::atomic<u32> *)(sq + params.sq_off.head);
+    ring->m_sq_tail = (std::atomic<u32> *)(sq + params.sq_off.tail);
+    ring->m_sq_mask = *(u32 *)(sq + params.sq_off.ring_mask);
+    ring->m_sq_entries = *(u32 *)(sq + params.sq_off.ring_entries);
+    ring->m_sq_array = (u32 *)(sq + params.sq_off.array);
+    ring->m_cq_head = (std::atomic<u32> *)(cq + params.cq_off.head);
+    ring->m_cq_tail = (std::atomic<u32> *)(cq + params.cq_off.tail);
+    ring->m_cq_mask = *(u32 *)(cq + params.cq_off.ring_mask);
+    ring->m_cqes = (io_uring_cqe *)(cq + params.cq_off.cqes);
+    return ring;
+}
+
+#else
+
+std::unique_ptr<IoRing> createIoRing(u32) { return nullptr; }
+
+#endif
+
+} // namespace brtoy
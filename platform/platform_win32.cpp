@@ -1,21 +1,25 @@
+#include "platform_internal.h"
 #include <Windows.h>
 #include <array>
-#include <brtoy/platform.h>
 #include <format>
 #include <string>
 #include <unordered_map>
 
 namespace brtoy {
 
-static std::wstring widen(const char *str, size_t size = 0) {
+// Reuses the storage of result
+static void widen(const char *str, size_t size, std::wstring &result) {
     if (size == 0)
         size = std::strlen(str);
-    std::wstring result;
     int result_size = MultiByteToWideChar(CP_UTF8, 0, str, size, nullptr, 0);
-    if (result_size > 0) {
-        result.resize(result_size);
+    result.resize(result_size > 0 ? result_size : 0);
+    if (result_size > 0)
         MultiByteToWideChar(CP_UTF8, 0, str, size, &result[0], result_size);
-    }
+}
+
+static std::wstring widen(const char *str, size_t size = 0) {
+    std::wstring result;
+    widen(str, size, result);
     return result;
 }
 
@@ -33,6 +37,10 @@ struct Platform::Impl {
     std::unordered_map<Window, NativeWindowState> m_windows;
     u64 m_ticks_per_second;
     Input m_cur_input = {};
+    std::optional<Input> m_injected_input;
+    // Kept between ticks so that the frame loop doesn't allocate
+    std::vector<std::byte> m_raw_input_buffer;
+    std::wstring m_title_buffer;
 
     bool m_alive = true;
 };
@@ -80,6 +88,8 @@ void Platform::errorMessage(const char *msg) {
 
 OsHandle Platform::appInstanceHandle() const { return (OsHandle)m_impl->m_instance; }
 
+bool Platform::isHeadless() const { return false; }
+
 LRESULT windowProc(HWND hwnd, UINT msg, WPARAM w_param, LPARAM l_param) {
     LRESULT result = 0;
     bool handled = true;
@@ -180,7 +190,9 @@ bool Platform::tick(Input &input) {
         if (cb_size) {
             constexpr size_t ri_count_max = 16;
             UINT rib_capacity = ri_count_max * cb_size;
-            std::vector<std::byte> rib_bytes(rib_capacity);
+            std::vector<std::byte> &rib_bytes = m_impl->m_raw_input_buffer;
+            if (rib_bytes.size() < rib_capacity)
+                rib_bytes.resize(rib_capacity);
             RAWINPUT *rib = (RAWINPUT *)rib_bytes.data();
             UINT rib_size = rib_capacity;
             UINT ri_count = GetRawInputBuffer(rib, &rib_size, sizeof(RAWINPUTHEADER));
@@ -234,18 +246,33 @@ bool Platform::tick(Input &input) {
         DispatchMessageW(&msg);
     }
 
+    if (m_impl->m_injected_input) {
+        m_impl->m_cur_input = *m_impl->m_injected_input;
+        m_impl->m_injected_input.reset();
+    }
     input = m_impl->m_cur_input;
     return m_impl->m_alive;
 }
 
 void Platform::requestQuit() { m_impl->m_alive = false; }
 
-Window Platform::createWindow(const char *name) {
+void Platform::injectInput(const Input &input) { m_impl->m_injected_input = input; }
+
+Window Platform::createWindow(const char *name, V2u dim) {
     DWORD style_ex = WS_EX_OVERLAPPEDWINDOW;
     DWORD style = WS_OVERLAPPEDWINDOW;
+    int width = CW_USEDEFAULT;
+    int height = CW_USEDEFAULT;
+    if (dim.x > 0 && dim.y > 0) {
+        // dim is the size of the client area
+        RECT rect = {0, 0, (LONG)dim.x, (LONG)dim.y};
+        AdjustWindowRectEx(&rect, style, FALSE, style_ex);
+        width = rect.right - rect.left;
+        height = rect.bottom - rect.top;
+    }
     HWND hwnd = CreateWindowExW(style_ex, Impl::WindowClassName, widen(name).c_str(), style,
-                                CW_USEDEFAULT, CW_USEDEFAULT, CW_USEDEFAULT, CW_USEDEFAULT, NULL,
-                                NULL, GetModuleHandleW(NULL), NULL);
+                                CW_USEDEFAULT, CW_USEDEFAULT, width, height, NULL, NULL,
+                                GetModuleHandleW(NULL), NULL);
 
     Window window = 0;
     if (hwnd != NULL) {
@@ -281,8 +308,8 @@ Window Platform::createWindow(const char *name) {
 }
 
 void Platform::setWindowTitle(Window window, std::string_view title) {
-    std::wstring title_wide = widen(title.data(), title.length());
-    SetWindowTextW((HWND)window, title_wide.c_str());
+    widen(title.data(), title.length(), m_impl->m_title_buffer);
+    SetWindowTextW((HWND)window, m_impl->m_title_buffer.c_str());
 }
 
 WindowState Platform::windowState(Window window) const {
@@ -293,6 +320,56 @@ WindowState Platform::windowState(Window window) const {
     return state;
 }
 
+bool mapFileView(const char *path, const std::byte *&out_data, size_t &out_size) {
+    bool result = false;
+    HANDLE file = CreateFileW(widen(path).c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                              OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file != INVALID_HANDLE_VALUE) {
+        LARGE_INTEGER size;
+        if (GetFileSizeEx(file, &size) && size.QuadPart > 0) {
+            HANDLE mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            if (mapping) {
+                // The view keeps the mapping and the file open
+                void *view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+                if (view) {
+                    out_data = (const std::byte *)view;
+                    out_size = (size_t)size.QuadPart;
+                    result = true;
+                }
+                CloseHandle(mapping);
+            }
+        }
+        CloseHandle(file);
+    }
+    return result;
+}
+
+void unmapFileView(const std::byte *data, size_t size) { UnmapViewOfFile(data); }
+
+bool openNativeFile(const char *path, OsHandle &out_file) {
+    HANDLE file = CreateFileW(widen(path).c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                              OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    out_file = (OsHandle)file;
+    return file != INVALID_HANDLE_VALUE;
+}
+
+void closeNativeFile(OsHandle file) { CloseHandle((HANDLE)file); }
+
+i64 readNativeFile(OsHandle file, u64 offset, void *dst, size_t size) {
+    // Reads with an explicit offset don't use the shared file pointer
+    OVERLAPPED overlapped = {};
+    overlapped.Offset = (DWORD)offset;
+    overlapped.OffsetHigh = (DWORD)(offset >> 32);
+    DWORD count = 0;
+    if (!ReadFile((HANDLE)file, dst, (DWORD)size, &count, &overlapped)) {
+        DWORD error = GetLastError();
+        return error == ERROR_HANDLE_EOF ? 0 : -(i64)error;
+    }
+    return (i64)count;
+}
+
+std::unique_ptr<IoRing> createIoRing(u32) { return nullptr; }
+
 u64 Platform::getTimestampTicksPerSecond() { return m_impl->m_ticks_per_second; }
 
 u64 Platform::getTimestamp() {
@@ -0,0 +1,136 @@
+#include <algorithm>
+#include <array>
+#include <brtoy/mesh_optimizer.h>
+#include <cmath>
+#include <random>
+#include <stdio.h>
+#include <vector>
+
+// Runs the optimizer passes in order on a bumpy grid whose triangles and vertices have been
+// shuffled. The ACMR must go down, the remap from optimizeVertexFetch must be a permutation that
+// numbers vertices by first use, and every pass must keep the set of triangles, winding included.
+
+namespace brtoy {
+
+static constexpr u32 GridSize = 48;
+
+static bool check(bool condition, const char *test, const char *what) {
+    if (!condition)
+        fprintf(stderr, "%s: %s\n", test, what);
+    return condition;
+}
+
+struct Mesh {
+    std::vector<V3f> positions;
+    std::vector<u32> indices;
+};
+
+static Mesh makeShuffledGrid(u32 seed) {
+    std::mt19937 rng(seed);
+    std::vector<u32> vertex_order(GridSize * GridSize);
+    for (u32 v = 0; v < vertex_order.size(); ++v)
+        vertex_order[v] = v;
+    std::shuffle(vertex_order.begin(), vertex_order.end(), rng);
+
+    Mesh mesh;
+    mesh.positions.resize(vertex_order.size());
+    for (u32 y = 0; y < GridSize; ++y) {
+        for (u32 x = 0; x < GridSize; ++x) {
+            float height = 0.1f * std::sin(float(x) * 0.7f) * std::cos(float(y) * 0.5f);
+            mesh.positions[vertex_order[y * GridSize + x]] = {float(x), float(y), height};
+        }
+    }
+    std::vector<std::array<u32, 3>> triangles;
+    for (u32 y = 0; y + 1 < GridSize; ++y) {
+        for (u32 x = 0; x + 1 < GridSize; ++x) {
+            u32 v = y * GridSize + x;
+            triangles.push_back({vertex_order[v], vertex_order[v + 1],
+                                 vertex_order[v + GridSize]});
+            triangles.push_back({vertex_order[v + 1], vertex_order[v + GridSize + 1],
+                                 vertex_order[v + GridSize]});
+        }
+    }
+    std::shuffle(triangles.begin(), triangles.end(), rng);
+    for (const std::array<u32, 3> &triangle : triangles)
+        mesh.indices.insert(mesh.indices.end(), triangle.begin(), triangle.end());
+    return mesh;
+}
+
+// The triangles by original vertex, each rotated to start at its smallest index so that the
+// winding is kept, in sorted order
+static std::vector<std::array<u32, 3>> triangleSet(const std::vector<u32> &indices,
+                                                   const std::vector<u32> &original) {
+    std::vector<std::array<u32, 3>> triangles;
+    for (size_t i = 0; i < indices.size(); i += 3) {
+        std::array<u32, 3> triangle = {original[indices[i]], original[indices[i + 1]],
+                                       original[indices[i + 2]]};
+        std::rotate(triangle.begin(), std::min_element(triangle.begin(), triangle.end()),
+                    triangle.end());
+        triangles.push_back(triangle);
+    }
+    std::sort(triangles.begin(), triangles.end());
+    return triangles;
+}
+
+static bool testGrid(u32 seed) {
+    char name[32];
+    snprintf(name, sizeof(name), "grid seed %u", seed);
+    Mesh mesh = makeShuffledGrid(seed);
+    u32 vertex_count = (u32)mesh.positions.size();
+    std::vector<u32> identity(vertex_count);
+    for (u32 v = 0; v < vertex_count; ++v)
+        identity[v] = v;
+    std::vector<std::array<u32, 3>> triangles = triangleSet(mesh.indices, identity);
+    VertexCacheStats shuffled = analyzeVertexCache(mesh.indices, vertex_count);
+
+    optimizeVertexCache(mesh.indices, vertex_count);
+    VertexCacheStats cache_optimized = analyzeVertexCache(mesh.indices, vertex_count);
+    bool passed = check(cache_optimized.acmr < shuffled.acmr, name,
+                        "optimizeVertexCache didn't lower the ACMR") &&
+                  check(triangleSet(mesh.indices, identity) == triangles, name,
+                        "optimizeVertexCache changed the triangles");
+
+    optimizeOverdraw(mesh.indices, mesh.positions);
+    VertexCacheStats overdraw_optimized = analyzeVertexCache(mesh.indices, vertex_count);
+    passed = check(overdraw_optimized.acmr < shuffled.acmr, name,
+                   "ACMR after optimizeOverdraw not below the shuffled mesh's") &&
+             check(triangleSet(mesh.indices, identity) == triangles, name,
+                   "optimizeOverdraw changed the triangles") &&
+             passed;
+
+    std::vector<u32> remap(vertex_count);
+    u32 referenced = optimizeVertexFetch(mesh.indices, vertex_count, remap);
+    std::vector<u32> original(vertex_count, NotReferenced);
+    for (u32 v = 0; v < vertex_count; ++v) {
+        if (remap[v] < vertex_count)
+            original[remap[v]] = v;
+    }
+    bool first_use_order = true;
+    u32 next = 0;
+    for (u32 index : mesh.indices) {
+        first_use_order = first_use_order && index <= next;
+        next = std::max(next, index + 1);
+    }
+    VertexCacheStats fetch_optimized = analyzeVertexCache(mesh.indices, vertex_count);
+    return check(referenced == vertex_count, name, "referenced vertices miscounted") &&
+           check(std::find(original.begin(), original.end(), NotReferenced) == original.end(),
+                 name, "remap isn't a permutation") &&
+           check(first_use_order, name, "vertices not numbered by first use") &&
+           check(fetch_optimized.transformed_vertices == overdraw_optimized.transformed_vertices,
+                 name, "optimizeVertexFetch changed the cache behaviour") &&
+           check(triangleSet(mesh.indices, original) == triangles, name,
+                 "optimizeVertexFetch changed the triangles") &&
+           passed;
+}
+
+static int runMeshOptimizerTest() {
+    bool passed = true;
+    for (u32 seed : {1u, 2u, 3u})
+        passed = testGrid(seed) && passed;
+    printf("%s\n", passed ? "passed" : "FAILED");
+    return passed ? 0 : 1;
+}
+
+} // namespace brtoy
+
+int main() { return brtoy::runMeshOptimizerTest(); }
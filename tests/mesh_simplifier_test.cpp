@@ -0,0 +1,160 @@
+#include <algorithm>
+#include <brtoy/mesh_asset.h>
+#include <brtoy/mesh_simplifier.h>
+#include <cmath>
+#include <limits>
+#include <stdio.h>
+#include <vector>
+
+// Simplifies a bumpy grid, with and without an attribute seam down the middle, with simplifyMesh
+// directly and through the LOD chain that optimizeMesh builds. Every level must reach its target
+// index count, the errors must not decrease along the chain, the seam vertices must all stay and
+// the outline of the grid must keep its shape: every border edge of a level runs along one side
+// of the grid.
+
+namespace brtoy {
+
+static constexpr u32 GridSize = 33;
+static constexpr u32 SeamColumn = GridSize / 2;
+
+static bool check(bool condition, const char *test, const char *what) {
+    if (!condition)
+        fprintf(stderr, "%s: %s\n", test, what);
+    return condition;
+}
+
+// With a seam, the columns up to and including the seam column are one half of the grid, with
+// their own vertices
+static MeshSource makeGrid(bool seam) {
+    MeshSource mesh;
+    auto addHalf = [&](u32 first_column, u32 last_column, V3f normal) {
+        u32 first_vertex = (u32)mesh.positions.size();
+        u32 columns = last_column - first_column + 1;
+        for (u32 y = 0; y < GridSize; ++y) {
+            for (u32 x = first_column; x <= last_column; ++x) {
+                float height = 0.5f * std::sin(float(x) * 0.4f) * std::cos(float(y) * 0.3f);
+                mesh.positions.push_back({float(x), float(y), height});
+                mesh.normals.push_back(normal);
+            }
+        }
+        for (u32 y = 0; y + 1 < GridSize; ++y) {
+            for (u32 x = 0; x + 1 < columns; ++x) {
+                u32 v = first_vertex + y * columns + x;
+                mesh.indices.insert(mesh.indices.end(), {v, v + 1, v + columns});
+                mesh.indices.insert(mesh.indices.end(), {v + 1, v + columns + 1, v + columns});
+            }
+        }
+    };
+    if (seam) {
+        addHalf(0, SeamColumn, {0.0f, 0.0f, 1.0f});
+        addHalf(SeamColumn, GridSize - 1, {0.0f, 0.6f, 0.8f});
+    } else {
+        addHalf(0, GridSize - 1, {0.0f, 0.0f, 1.0f});
+    }
+    return mesh;
+}
+
+// Which sides of the grid the position lies on, as a bit per side
+static u32 gridSides(const V3f &p) {
+    const float last = float(GridSize - 1);
+    return (p.x == 0.0f ? 1 : 0) | (p.x == last ? 2 : 0) | (p.y == 0.0f ? 4 : 0) |
+           (p.y == last ? 8 : 0);
+}
+
+static bool samePosition(const V3f &a, const V3f &b) {
+    return a.x == b.x && a.y == b.y && a.z == b.z;
+}
+
+// Checks a level simplified from the full mesh against the seam, if there is one, and the outline
+static bool checkLevel(const char *name, const MeshSource &mesh, bool seam,
+                       std::span<const u32> level) {
+    std::vector<bool> referenced(mesh.positions.size(), false);
+    for (u32 index : level)
+        referenced[index] = true;
+    bool seam_kept = true;
+    for (u32 index : mesh.indices) {
+        bool on_seam = seam && mesh.positions[index].x == float(SeamColumn);
+        seam_kept = seam_kept && (!on_seam || referenced[index]);
+    }
+
+    // Edges are matched by position, so that the seam doesn't count as a border
+    bool outline_kept = true;
+    for (size_t i = 0; i < level.size(); ++i) {
+        const V3f &a = mesh.positions[level[i]];
+        const V3f &b = mesh.positions[level[i - i % 3 + (i % 3 + 1) % 3]];
+        bool has_reverse = false;
+        for (size_t j = 0; j < level.size() && !has_reverse; ++j) {
+            has_reverse = samePosition(mesh.positions[level[j]], b) &&
+                          samePosition(mesh.positions[level[j - j % 3 + (j % 3 + 1) % 3]], a);
+        }
+        if (!has_reverse)
+            outline_kept = outline_kept && (gridSides(a) & gridSides(b)) != 0;
+    }
+    return check(seam_kept, name, "seam vertex collapsed") &&
+           check(outline_kept, name, "border edge off the outline of the grid");
+}
+
+static bool testSimplifyMesh() {
+    const char *name = "simplifyMesh";
+    MeshSource mesh = makeGrid(true);
+    std::vector<u32> destination(mesh.indices.size());
+    size_t target_index_count = mesh.indices.size() / 4 / 3 * 3;
+    float error = -1.0f;
+    size_t index_count =
+        simplifyMesh(destination, mesh.indices, mesh.positions, target_index_count,
+                     std::numeric_limits<float>::max(), &error);
+
+    // Without any collapse allowed, the mesh comes back as it is
+    float unchanged_error = -1.0f;
+    std::vector<u32> unchanged(mesh.indices.size());
+    size_t unchanged_count = simplifyMesh(unchanged, mesh.indices, mesh.positions,
+                                          target_index_count, 0.0f, &unchanged_error);
+    return check(index_count > 0 && index_count <= target_index_count, name,
+                 "target index count not reached") &&
+           check(error > 0.0f, name, "no error reported for a simplified bumpy grid") &&
+           check(unchanged_count == mesh.indices.size() && unchanged_error == 0.0f, name,
+                 "mesh simplified beyond a target error of 0") &&
+           checkLevel(name, mesh, true, {destination.data(), index_count});
+}
+
+static bool testLodChain(bool seam) {
+    const char *name = seam ? "LOD chain with seam" : "LOD chain";
+    MeshSource mesh = makeGrid(seam);
+    optimizeMesh(mesh);
+
+    // Without a seam, the grid simplifies all the way. With one, the locked seam vertices stop
+    // the simplifier short of a target at some point, and that level must be the last.
+    bool passed = check(seam || mesh.lods.size() + 1 == MeshLodCountMax, name,
+                        "LOD chain ended early");
+    size_t previous_index_count = mesh.indices.size();
+    float previous_error = 0.0f;
+    for (size_t lod = 0; lod < mesh.lods.size(); ++lod) {
+        char level_name[48];
+        snprintf(level_name, sizeof(level_name), "%s LOD %zu", name, lod + 1);
+        const MeshLodSource &level = mesh.lods[lod];
+        // Each level halves the triangles of the previous one
+        bool reached_target = level.indices.size() <= previous_index_count / 6 * 3;
+        passed = check(!level.indices.empty(), level_name, "empty level") &&
+                 check(reached_target || (seam && lod + 1 == mesh.lods.size()), level_name,
+                       "target index count not reached") &&
+                 check(level.error >= previous_error, level_name,
+                       "error lower than the previous level's") &&
+                 checkLevel(level_name, mesh, seam, level.indices) && passed;
+        previous_index_count = level.indices.size();
+        previous_error = level.error;
+    }
+    return passed;
+}
+
+static int runMeshSimplifierTest() {
+    bool passed = true;
+    passed = testSimplifyMesh() && passed;
+    passed = testLodChain(false) && passed;
+    passed = testLodChain(true) && passed;
+    printf("%s\n", passed ? "passed" : "FAILED");
+    return passed ? 0 : 1;
+}
+
+} // namespace brtoy
+
+int main() { return brtoy::runMeshSimplifierTest(); }
@@ -0,0 +1,128 @@
+#include <algorithm>
+#include <atomic>
+#include <brtoy/queue.h>
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <stdio.h>
+#include <thread>
+#include <vector>
+
+// Throughput of the queues in brtoy/queue.h in million items per second, with equal numbers of
+// producers and consumers up to twice the hardware threads, one item and BatchSize items at a
+// time. A mutex around a std::deque is measured alongside as the baseline the queues replace.
+
+namespace brtoy {
+
+using Clock = std::chrono::steady_clock;
+
+static constexpr u32 ItemCount = 1 << 22;
+static constexpr size_t BatchSize = 32;
+static constexpr size_t Capacity = 1024;
+
+struct MutexQueue {
+    template <typename U> bool push(U &&item) {
+        std::lock_guard lock(m_mutex);
+        if (m_items.size() == Capacity)
+            return false;
+        m_items.push_back(std::forward<U>(item));
+        return true;
+    }
+    bool pop(u64 &out_item) {
+        std::lock_guard lock(m_mutex);
+        if (m_items.empty())
+            return false;
+        out_item = m_items.front();
+        m_items.pop_front();
+        return true;
+    }
+    template <typename InputIt> size_t pushBatch(InputIt first, size_t count) {
+        std::lock_guard lock(m_mutex);
+        count = std::min(count, Capacity - m_items.size());
+        m_items.insert(m_items.end(), first, first + count);
+        return count;
+    }
+    template <typename OutputIt> size_t popBatch(OutputIt out, size_t count) {
+        std::lock_guard lock(m_mutex);
+        count = std::min(count, m_items.size());
+        std::copy_n(m_items.begin(), count, out);
+        m_items.erase(m_items.begin(), m_items.begin() + count);
+        return count;
+    }
+
+    std::mutex m_mutex;
+    std::deque<u64> m_items;
+};
+
+// Returns million items per second through the queue
+template <typename Queue>
+static double measure(Queue &queue, u32 producer_count, u32 consumer_count, bool batch) {
+    u32 per_producer = ItemCount / producer_count;
+    u32 total = per_producer * producer_count;
+    std::atomic<u32> received = 0;
+    std::atomic<bool> start = false;
+
+    std::vector<std::thread> threads;
+    for (u32 p = 0; p < producer_count; ++p) {
+        threads.emplace_back([&]() {
+            u64 items[BatchSize] = {};
+            while (!start.load(std::memory_order_acquire))
+                std::this_thread::yield();
+            for (u32 sent = 0; sent < per_producer;) {
+                size_t count = batch ? queue.pushBatch(
+                                           items, std::min<size_t>(BatchSize, per_producer - sent))
+                                     : queue.push(u64(sent));
+                sent += (u32)count;
+                if (count == 0)
+                    std::this_thread::yield();
+            }
+        });
+    }
+    for (u32 c = 0; c < consumer_count; ++c) {
+        threads.emplace_back([&]() {
+            u64 items[BatchSize];
+            while (!start.load(std::memory_order_acquire))
+                std::this_thread::yield();
+            while (received.load(std::memory_order_relaxed) < total) {
+                size_t count = batch ? queue.popBatch(items, BatchSize) : queue.pop(items[0]);
+                received.fetch_add((u32)count, std::memory_order_relaxed);
+                if (count == 0)
+                    std::this_thread::yield();
+            }
+        });
+    }
+
+    Clock::time_point start_time = Clock::now();
+    start.store(true, std::memory_order_release);
+    for (std::thread &thread : threads)
+        thread.join();
+    std::chrono::duration<double> time = Clock::now() - start_time;
+    return total / time.count() / 1e6;
+}
+
+template <typename Queue, typename... Args>
+static void benchQueue(const char *name, u32 producer_count, u32 consumer_count, Args... args) {
+    double rates[2];
+    for (bool batch : {false, true}) {
+        Queue queue(args...);
+        rates[batch] = measure(queue, producer_count, consumer_count, batch);
+    }
+    printf("%-6s %3u:%-3u %12.2f %12.2f\n", name, producer_count, consumer_count, rates[0],
+           rates[1]);
+}
+
+static int runQueueBench() {
+    u32 thread_count = std::max(1u, std::thread::hardware_concurrency());
+    printf("%u hardware threads, %u items, batches of %zu\n", thread_count, ItemCount, BatchSize);
+    printf("queue  threads   Mitems/s   batch Mitems/s\n");
+    benchQueue<SpscQueue<u64>>("spsc", 1, 1, Capacity);
+    for (u32 count = 1; count <= thread_count * 2; count *= 2) {
+        benchQueue<MpmcQueue<u64>>("mpmc", count, count, Capacity);
+        benchQueue<MutexQueue>("mutex", count, count);
+    }
+    return 0;
+}
+
+} // namespace brtoy
+
+int main() { return brtoy::runQueueBench(); }
@@ -0,0 +1,189 @@
+#include <atomic>
+#include <brtoy/queue.h>
+#include <memory>
+#include <stdio.h>
+#include <thread>
+#include <vector>
+
+// Stress tests for the queues and TripleBuffer in brtoy/queue.h, meant to run under
+// ThreadSanitizer (BRTOY_SANITIZE_THREAD) as well as on their own. Every item pushed must be
+// popped exactly once, in order per producer, with small capacities so that the queues wrap and
+// fill up all the time. Threads yield when their queue is full or empty, so that the tests also
+// finish on machines with fewer cores than threads.
+
+namespace brtoy {
+
+static constexpr u32 ItemCount = 1 << 16;
+static constexpr size_t BatchSize = 16;
+static constexpr size_t Capacity = 64;
+
+static bool check(bool condition, const char *test, const char *what) {
+    if (!condition)
+        fprintf(stderr, "%s: %s\n", test, what);
+    return condition;
+}
+
+// The producer's index in the high bits and its sequence number in the low ones
+static u64 makeItem(u32 producer, u32 sequence) { return (u64)producer << 32 | sequence; }
+
+static bool testSpsc(bool batch) {
+    const char *name = batch ? "spsc batch" : "spsc";
+    SpscQueue<u64> queue(Capacity);
+    std::thread producer([&]() {
+        u64 items[BatchSize];
+        for (u32 sent = 0; sent < ItemCount;) {
+            if (batch) {
+                size_t count = std::min<size_t>(BatchSize, ItemCount - sent);
+                for (size_t i = 0; i < count; ++i)
+                    items[i] = sent + i;
+                size_t pushed = queue.pushBatch(items, count);
+                sent += (u32)pushed;
+                if (pushed == 0)
+                    std::this_thread::yield();
+            } else if (queue.push((u64)sent)) {
+                ++sent;
+            } else {
+                std::this_thread::yield();
+            }
+        }
+    });
+
+    bool in_order = true;
+    u64 items[BatchSize];
+    for (u32 received = 0; received < ItemCount;) {
+        size_t count = batch ? queue.popBatch(items, BatchSize) : queue.pop(items[0]);
+        for (size_t i = 0; i < count; ++i)
+            in_order = in_order && items[i] == received + i;
+        received += (u32)count;
+        if (count == 0)
+            std::this_thread::yield();
+    }
+    producer.join();
+    return check(in_order, name, "items out of order") &&
+           check(queue.sizeApprox() == 0, name, "queue not empty");
+}
+
+static bool testMpmc(u32 producer_count, u32 consumer_count, bool batch) {
+    char name[64];
+    snprintf(name, sizeof(name), "mpmc %u:%u%s", producer_count, consumer_count,
+             batch ? " batch" : "");
+    MpmcQueue<u64> queue(Capacity);
+    u32 per_producer = ItemCount / producer_count;
+    u32 total = per_producer * producer_count;
+    std::unique_ptr<std::atomic<u8>[]> seen = std::make_unique<std::atomic<u8>[]>(total);
+    std::atomic<u32> received = 0;
+    std::atomic<bool> valid = true;
+
+    std::vector<std::thread> threads;
+    for (u32 p = 0; p < producer_count; ++p) {
+        threads.emplace_back([&, p]() {
+            u64 items[BatchSize];
+            for (u32 sent = 0; sent < per_producer;) {
+                if (batch) {
+                    size_t count = std::min<size_t>(BatchSize, per_producer - sent);
+                    for (size_t i = 0; i < count; ++i)
+                        items[i] = makeItem(p, sent + (u32)i);
+                    size_t pushed = queue.pushBatch(items, count);
+                    sent += (u32)pushed;
+                    if (pushed == 0)
+                        std::this_thread::yield();
+                } else if (queue.push(makeItem(p, sent))) {
+                    ++sent;
+                } else {
+                    std::this_thread::yield();
+                }
+            }
+        });
+    }
+    for (u32 c = 0; c < consumer_count; ++c) {
+        threads.emplace_back([&]() {
+            // Positions are claimed in order, so each consumer sees every producer's items in
+            // the order they were pushed
+            std::vector<i64> last(producer_count, -1);
+            u64 items[BatchSize];
+            while (received.load(std::memory_order_relaxed) < total) {
+                size_t count = batch ? queue.popBatch(items, BatchSize) : queue.pop(items[0]);
+                for (size_t i = 0; i < count; ++i) {
+                    u32 p = (u32)(items[i] >> 32);
+                    u32 sequence = (u32)items[i];
+                    if (p >= producer_count || sequence >= per_producer ||
+                        (i64)sequence <= last[p] ||
+                        seen[p * per_producer + sequence].fetch_add(1) != 0) {
+                        valid = false;
+                    } else {
+                        last[p] = sequence;
+                    }
+                }
+                received += (u32)count;
+                if (count == 0)
+                    std::this_thread::yield();
+            }
+        });
+    }
+    for (std::thread &thread : threads)
+        thread.join();
+
+    bool all_seen = true;
+    for (u32 i = 0; i < total; ++i)
+        all_seen = all_seen && seen[i].load() == 1;
+    return check(valid, name, "item duplicated or out of order") &&
+           check(all_seen, name, "item lost");
+}
+
+static bool testTripleBuffer() {
+    const char *name = "triple buffer";
+    // Every element of a published value is the same, so a torn read shows up as a mismatch
+    struct Value {
+        std::array<u32, 64> elements;
+    };
+    TripleBuffer<Value> buffer;
+    std::atomic<bool> done = false;
+    std::thread writer([&]() {
+        for (u32 i = 1; i <= ItemCount; ++i) {
+            buffer.back().elements.fill(i);
+            buffer.publish();
+        }
+        done = true;
+    });
+
+    bool valid = true;
+    u32 last = 0;
+    while (true) {
+        // Read before acquiring, so that once it's set the last value is still seen
+        bool writer_done = done.load();
+        if (!buffer.acquire()) {
+            if (writer_done)
+                break;
+            std::this_thread::yield();
+            continue;
+        }
+        const Value &value = buffer.front();
+        u32 first = value.elements[0];
+        for (u32 element : value.elements)
+            valid = valid && element == first;
+        // Values may be skipped but never repeated or reordered
+        valid = valid && first > last;
+        last = first;
+    }
+    writer.join();
+    return check(valid, name, "torn or stale value") &&
+           check(last == ItemCount, name, "last value lost");
+}
+
+static int runQueueTest() {
+    bool passed = true;
+    for (bool batch : {false, true}) {
+        passed = testSpsc(batch) && passed;
+        for (u32 producer_count : {1u, 2u, 4u}) {
+            for (u32 consumer_count : {1u, 2u, 4u})
+                passed = testMpmc(producer_count, consumer_count, batch) && passed;
+        }
+    }
+    passed = testTripleBuffer() && passed;
+    printf("%s\n", passed ? "passed" : "FAILED");
+    return passed ? 0 : 1;
+}
+
+} // namespace brtoy
+
+int main() { return brtoy::runQueueTest(); }
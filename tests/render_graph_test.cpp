@@ -0,0 +1,231 @@
+#include <brtoy/gfx_render_graph.h>
+#include <stdio.h>
+
+// Checks the barriers, culling and transient slots that RenderGraph::compile() works out. Nothing
+// is executed, so no Vulkan calls are made and the handles are all null.
+
+namespace brtoy {
+
+using Resource = RenderGraph::Resource;
+using Usage = RenderGraphUsage;
+
+static bool check(bool condition, const char *test, const char *what) {
+    if (!condition)
+        fprintf(stderr, "%s: %s\n", test, what);
+    return condition;
+}
+
+static void noop(VkCommandBuffer, const RenderGraph &) {}
+
+static Resource importBuffer(RenderGraph &graph, const char *name,
+                             Usage final_usage = Usage::None) {
+    return graph.importBuffer(name, VK_NULL_HANDLE, 0, 256, Usage::None, final_usage);
+}
+
+static const RenderGraph::BarrierBatch *findBatch(const RenderGraph &graph, u32 pass) {
+    for (const RenderGraph::BarrierBatch &batch : graph.m_barrier_batches) {
+        if (batch.pass == pass)
+            return &batch;
+    }
+    return nullptr;
+}
+
+static size_t barrierCount(const RenderGraph &graph, u32 pass) {
+    const RenderGraph::BarrierBatch *batch = findBatch(graph, pass);
+    return batch ? batch->barriers.size() : 0;
+}
+
+static const RenderGraph::Barrier *findBarrier(const RenderGraph &graph, u32 pass,
+                                               Resource resource) {
+    const RenderGraph::BarrierBatch *batch = findBatch(graph, pass);
+    if (!batch)
+        return nullptr;
+    for (const RenderGraph::Barrier &barrier : batch->barriers) {
+        if (barrier.resource == resource)
+            return &barrier;
+    }
+    return nullptr;
+}
+
+static bool testReadAfterWrite() {
+    const char *name = "read after write";
+    RenderGraph graph;
+    Resource buffer = importBuffer(graph, "buffer");
+    Resource output = importBuffer(graph, "output", Usage::HostRead);
+    graph.addPass("write", noop).use(buffer, Usage::ComputeShaderWrite);
+    graph.addPass("read", noop)
+        .use(buffer, Usage::ComputeShaderRead)
+        .use(output, Usage::TransferDst);
+    graph.compile();
+
+    // Nothing touched the buffer before the first pass, so it needs no barrier
+    const RenderGraph::Barrier *barrier = findBarrier(graph, 1, buffer);
+    const RenderGraph::Barrier *to_host = findBarrier(graph, 2, output);
+    return check(barrierCount(graph, 0) == 0, name, "barrier before the first write") &&
+           check(barrierCount(graph, 1) == 1, name, "expected one barrier before the read") &&
+           check(barrier && barrier->src_stages == VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT &&
+                     barrier->src_access == VK_ACCESS_2_SHADER_WRITE_BIT &&
+                     barrier->dst_stages == VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT &&
+                     barrier->dst_access == VK_ACCESS_2_SHADER_READ_BIT,
+                 name, "read doesn't wait for the write") &&
+           check(to_host && to_host->src_stages == VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT &&
+                     to_host->dst_stages == VK_PIPELINE_STAGE_2_HOST_BIT &&
+                     to_host->dst_access == VK_ACCESS_2_HOST_READ_BIT,
+                 name, "output isn't made visible to the host");
+}
+
+static bool testWriteAfterRead() {
+    const char *name = "write after read";
+    RenderGraph graph;
+    Resource buffer = importBuffer(graph, "buffer", Usage::HostRead);
+    Resource output = importBuffer(graph, "output", Usage::HostRead);
+    graph.addPass("fill", noop).use(buffer, Usage::TransferDst);
+    graph.addPass("read", noop)
+        .use(buffer, Usage::ComputeShaderRead)
+        .use(output, Usage::ComputeShaderWrite);
+    graph.addPass("overwrite", noop).use(buffer, Usage::TransferDst);
+    graph.compile();
+
+    // The overwrite waits for both the read and the fill, whose write it must stay ordered after
+    const RenderGraph::Barrier *barrier = findBarrier(graph, 2, buffer);
+    return check(barrier != nullptr, name, "no barrier before the overwrite") &&
+           check(barrier->src_stages == (VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT |
+                                         VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT),
+                 name, "overwrite doesn't wait for the read") &&
+           check(barrier->src_access == VK_ACCESS_2_TRANSFER_WRITE_BIT &&
+                     barrier->dst_stages == VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT &&
+                     barrier->dst_access == VK_ACCESS_2_TRANSFER_WRITE_BIT,
+                 name, "wrong accesses");
+}
+
+static bool testImageLayout() {
+    const char *name = "image layout";
+    RenderGraph graph;
+    Resource image = graph.importImage("backbuffer", VK_NULL_HANDLE, VK_NULL_HANDLE,
+                                       VK_IMAGE_ASPECT_COLOR_BIT, Usage::None, Usage::Present);
+    graph.addPass("draw", noop).use(image, Usage::ColorAttachment);
+    graph.compile();
+
+    const RenderGraph::Barrier *to_attachment = findBarrier(graph, 0, image);
+    const RenderGraph::Barrier *to_present = findBarrier(graph, 1, image);
+    const VkPipelineStageFlags2 output_stage = VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT;
+    return check(to_attachment && to_attachment->old_layout == VK_IMAGE_LAYOUT_UNDEFINED &&
+                     to_attachment->new_layout == VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL &&
+                     to_attachment->dst_stages == output_stage,
+                 name, "no transition to the attachment layout") &&
+           check(to_present &&
+                     to_present->old_layout == VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL &&
+                     to_present->new_layout == VK_IMAGE_LAYOUT_PRESENT_SRC_KHR &&
+                     to_present->src_stages == output_stage &&
+                     to_present->src_access == VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT,
+                 name, "no transition to the present layout");
+}
+
+static bool testMergedUses() {
+    const char *name = "merged uses";
+    RenderGraph graph;
+    Resource buffer = importBuffer(graph, "buffer", Usage::HostRead);
+    graph.addPass("fill", noop).use(buffer, Usage::TransferDst);
+    graph.addPass("update", noop)
+        .use(buffer, Usage::ComputeShaderRead)
+        .use(buffer, Usage::ComputeShaderWrite);
+    graph.compile();
+
+    const RenderGraph::Barrier *barrier = findBarrier(graph, 1, buffer);
+    return check(barrierCount(graph, 1) == 1, name, "uses of one resource not merged") &&
+           check(barrier && barrier->src_access == VK_ACCESS_2_TRANSFER_WRITE_BIT &&
+                     barrier->dst_access ==
+                         (VK_ACCESS_2_SHADER_READ_BIT | VK_ACCESS_2_SHADER_WRITE_BIT),
+                 name, "merged barrier doesn't cover the read and the write");
+}
+
+static bool testCulling() {
+    const char *name = "culling";
+    RenderGraph graph;
+    Resource unused = importBuffer(graph, "unused");
+    Resource intermediate = importBuffer(graph, "intermediate");
+    Resource output = importBuffer(graph, "output", Usage::HostRead);
+    Resource log = importBuffer(graph, "log");
+    graph.addPass("unused", noop).use(unused, Usage::ComputeShaderWrite);
+    graph.addPass("produce", noop).use(intermediate, Usage::ComputeShaderWrite);
+    graph.addPass("consume", noop)
+        .use(intermediate, Usage::ComputeShaderRead)
+        .use(output, Usage::ComputeShaderWrite);
+    graph.addPass("side effect", noop).use(log, Usage::ComputeShaderWrite).sideEffect();
+    graph.compile();
+
+    return check(graph.m_passes[0].culled, name, "pass writing an unused buffer not culled") &&
+           check(!graph.m_passes[1].culled && !graph.m_passes[2].culled, name,
+                 "pass contributing to an output culled") &&
+           check(!graph.m_passes[3].culled, name, "pass with a side effect culled") &&
+           check(barrierCount(graph, 0) == 0, name, "barrier before a culled pass") &&
+           check(graph.m_resources[unused].first_pass == RenderGraph::NoSlot, name,
+                 "culled pass counted in a lifetime");
+}
+
+static bool testTransientSlots() {
+    const char *name = "transient slots";
+    RenderGraph graph;
+    RenderGraph::ImageDesc desc = {
+        .dim = {64, 64},
+        .format = VK_FORMAT_R8G8B8A8_UNORM,
+        .samples = VK_SAMPLE_COUNT_1_BIT,
+        .aspect = VK_IMAGE_ASPECT_COLOR_BIT,
+    };
+    RenderGraph::ImageDesc depth_desc = {
+        .dim = {64, 64},
+        .format = VK_FORMAT_D32_SFLOAT,
+        .samples = VK_SAMPLE_COUNT_1_BIT,
+        .aspect = VK_IMAGE_ASPECT_DEPTH_BIT,
+    };
+    Resource first = graph.createImage("first", desc);
+    Resource second = graph.createImage("second", desc);
+    Resource depth = graph.createImage("depth", depth_desc);
+    Resource unused = graph.createImage("unused", desc);
+    Resource output = graph.importImage("output", VK_NULL_HANDLE, VK_NULL_HANDLE,
+                                        VK_IMAGE_ASPECT_COLOR_BIT, Usage::None, Usage::Present);
+    graph.addPass("draw first", noop)
+        .use(first, Usage::ColorAttachment)
+        .use(depth, Usage::DepthAttachment);
+    graph.addPass("read first", noop)
+        .use(first, Usage::FragmentShaderRead)
+        .use(output, Usage::ColorAttachment);
+    graph.addPass("draw second", noop).use(second, Usage::ColorAttachment);
+    graph.addPass("read second", noop)
+        .use(second, Usage::FragmentShaderRead)
+        .use(output, Usage::ColorAttachment);
+    graph.compile();
+
+    // The second image takes over the first's slot, waiting for its last read, with its contents
+    // undefined
+    const RenderGraph::Barrier *takeover = findBarrier(graph, 2, second);
+    return check(graph.m_transient_slots.size() == 2, name, "expected two slots") &&
+           check(graph.m_resources[first].transient_slot ==
+                     graph.m_resources[second].transient_slot,
+                 name, "slot of a dead image not reused") &&
+           check(graph.m_resources[depth].transient_slot !=
+                     graph.m_resources[first].transient_slot,
+                 name, "slot shared by images of different descriptions") &&
+           check(graph.m_resources[unused].transient_slot == RenderGraph::NoSlot, name,
+                 "unused image given a slot") &&
+           check(takeover && takeover->old_layout == VK_IMAGE_LAYOUT_UNDEFINED &&
+                     takeover->new_layout == VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL &&
+                     (takeover->src_stages & VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT) != 0,
+                 name, "takeover doesn't wait for the previous image");
+}
+
+static int runRenderGraphTest() {
+    bool passed = true;
+    passed = testReadAfterWrite() && passed;
+    passed = testWriteAfterRead() && passed;
+    passed = testImageLayout() && passed;
+    passed = testMergedUses() && passed;
+    passed = testCulling() && passed;
+    passed = testTransientSlots() && passed;
+    printf("%s\n", passed ? "passed" : "FAILED");
+    return passed ? 0 : 1;
+}
+
+} // namespace brtoy
+
+int main() { return brtoy::runRenderGraphTest(); }
@@ -0,0 +1,242 @@
+#include <brtoy/container.h>
+#include <stdio.h>
+
+// Tests of SmallVector in brtoy/container.h, with ints, which are relocated with memcpy, and with
+// an element type that counts its live instances and poisons itself when destroyed, so that leaks,
+// double destruction and reads of destroyed elements show up.
+
+namespace brtoy {
+
+static constexpr size_t InlineCount = 8;
+
+static bool check(bool condition, const char *test, const char *what) {
+    if (!condition)
+        fprintf(stderr, "%s: %s\n", test, what);
+    return condition;
+}
+
+struct Tracked {
+    static constexpr int Destroyed = -1000;
+    static constexpr int MovedFrom = -1;
+    static inline int live = 0;
+
+    Tracked() : value(0) { ++live; }
+    Tracked(int value) : value(value) { ++live; }
+    Tracked(const Tracked &other) : value(other.value) { ++live; }
+    Tracked(Tracked &&other) noexcept : value(other.value) {
+        other.value = MovedFrom;
+        ++live;
+    }
+    Tracked &operator=(const Tracked &other) {
+        value = other.value;
+        return *this;
+    }
+    Tracked &operator=(Tracked &&other) noexcept {
+        value = other.value;
+        other.value = MovedFrom;
+        return *this;
+    }
+    ~Tracked() {
+        value = Destroyed;
+        --live;
+    }
+
+    int value;
+};
+
+using IntVector = SmallVector<int, InlineCount>;
+using TrackedVector = SmallVector<Tracked, InlineCount>;
+
+// Elements 0, 1, 2, ... count - 1
+template <typename V> static V makeSequence(size_t count) {
+    V v;
+    for (size_t i = 0; i < count; ++i)
+        v.push_back(int(i));
+    return v;
+}
+
+static int valueOf(int value) { return value; }
+static int valueOf(const Tracked &tracked) { return tracked.value; }
+
+template <typename V> static bool isSequence(const V &v, size_t count, int first = 0) {
+    if (v.size() != count)
+        return false;
+    for (size_t i = 0; i < count; ++i) {
+        if (valueOf(v[i]) != first + int(i))
+            return false;
+    }
+    return true;
+}
+
+template <typename V> static bool testSpill(const char *name) {
+    V v = makeSequence<V>(InlineCount);
+    bool inline_until_full = v.isInline() && v.capacity() == InlineCount;
+    v.push_back(int(InlineCount));
+    bool passed = check(inline_until_full, name, "spilled before the inline storage was full") &&
+                  check(!v.isInline() && v.capacity() > InlineCount, name, "didn't spill") &&
+                  check(isSequence(v, InlineCount + 1), name, "elements lost when spilling");
+    for (size_t i = InlineCount + 1; i < 100; ++i)
+        v.push_back(int(i));
+    passed = check(isSequence(v, 100), name, "elements lost when growing on the heap") && passed;
+    v.clear();
+    return check(v.empty() && !v.isInline(), name, "clear() gave up the heap storage") && passed;
+}
+
+template <typename V> static bool testCopyAndMove(const char *name, size_t count) {
+    bool passed = true;
+    {
+        V source = makeSequence<V>(count);
+        V copy(source);
+        passed = check(isSequence(copy, count) && isSequence(source, count), name,
+                       "copy construction") &&
+                 passed;
+
+        V moved(std::move(source));
+        const bool was_inline = count <= InlineCount;
+        passed = check(isSequence(moved, count), name, "move construction") &&
+                 check(source.empty() && source.isInline(), name,
+                       "moved-from vector not empty and inline") &&
+                 check(moved.isInline() == was_inline, name, "move changed the storage") &&
+                 passed;
+        source.push_back(7);
+        passed = check(isSequence(source, 1, 7), name, "moved-from vector not reusable") && passed;
+    }
+
+    // Assignments between inline and heap vectors in both directions
+    for (size_t other_count : {size_t(1), InlineCount + 3}) {
+        V source = makeSequence<V>(count);
+        V copy = makeSequence<V>(other_count);
+        copy = source;
+        passed = check(isSequence(copy, count) && isSequence(source, count), name,
+                       "copy assignment") &&
+                 passed;
+
+        V moved = makeSequence<V>(other_count);
+        moved = std::move(source);
+        passed = check(isSequence(moved, count), name, "move assignment") &&
+                 check(source.empty() && source.isInline(), name,
+                       "move-assigned-from vector not empty and inline") &&
+                 passed;
+
+        const V &self = copy;
+        copy = self;
+        passed = check(isSequence(copy, count), name, "self assignment") && passed;
+    }
+    return passed;
+}
+
+template <typename V> static bool testErase(const char *name, size_t count) {
+    V v = makeSequence<V>(count);
+    typename V::iterator next = v.erase(v.begin() + 1);
+    bool passed = check(next == v.begin() + 1 && v.size() == count - 1 && valueOf(v[0]) == 0 &&
+                            valueOf(v[1]) == 2 && valueOf(v.back()) == int(count) - 1,
+                        name, "erasing one element");
+
+    next = v.erase(v.begin() + 1, v.begin() + 3);
+    passed = check(next == v.begin() + 1 && v.size() == count - 3 && valueOf(v[1]) == 4 &&
+                       valueOf(v.back()) == int(count) - 1,
+                   name, "erasing a range") &&
+             passed;
+
+    next = v.erase(v.begin() + 1, v.begin() + 1);
+    passed = check(next == v.begin() + 1 && v.size() == count - 3, name, "erasing nothing") &&
+             passed;
+
+    next = v.erase(v.end() - 1);
+    passed = check(next == v.end() && v.size() == count - 4 && valueOf(v[1]) == 4, name,
+                   "erasing the last element") &&
+             passed;
+
+    v.erase(v.begin(), v.end());
+    return check(v.empty(), name, "erasing everything") && passed;
+}
+
+template <typename V> static bool testResize(const char *name) {
+    V v;
+    v.resize(3);
+    bool passed = check(v.size() == 3 && valueOf(v[0]) == 0 && valueOf(v[2]) == 0, name,
+                        "resize() didn't value-initialize");
+    v.resize(20);
+    passed = check(v.size() == 20 && !v.isInline() && valueOf(v[19]) == 0, name,
+                   "resize() past the inline storage") &&
+             passed;
+    v.resize(2);
+    passed = check(v.size() == 2, name, "resize() didn't shrink") && passed;
+
+    V filled;
+    filled.resize(3, 5);
+    filled.resize(2, 9);
+    passed = check(filled.size() == 2 && valueOf(filled[1]) == 5, name,
+                   "resize(count, value) changed the kept elements") &&
+             passed;
+    filled.resize(InlineCount, 6);
+    passed = check(filled.isInline() && valueOf(filled.back()) == 6, name,
+                   "resize(count, value) within the inline storage") &&
+             passed;
+    // The value is an element of the vector, which moves to the heap
+    filled.front() = 8;
+    filled.resize(30, filled.front());
+    bool all_filled = true;
+    for (size_t i = InlineCount; i < filled.size(); ++i)
+        all_filled = all_filled && valueOf(filled[i]) == 8;
+    return check(filled.size() == 30 && !filled.isInline() && all_filled, name,
+                 "resize(count, value) with a value from the vector") &&
+           passed;
+}
+
+// push_back and emplace_back given an element of the vector itself, just as the vector grows, out
+// of the inline storage and then on the heap
+template <typename V> static bool testSelfReference(const char *name) {
+    V v = makeSequence<V>(InlineCount);
+    v.push_back(v[1]);
+    bool passed = check(v.size() == InlineCount + 1 && valueOf(v.back()) == 1, name,
+                        "push_back of an element when spilling");
+
+    while (v.size() < v.capacity())
+        v.push_back(int(v.size()));
+    v.emplace_back(v.front());
+    passed = check(valueOf(v.back()) == 0, name, "emplace_back of an element when growing") &&
+             passed;
+
+    while (v.size() < v.capacity())
+        v.push_back(int(v.size()));
+    const auto &last = v.back();
+    int last_value = valueOf(last);
+    v.push_back(last);
+    return check(valueOf(v.back()) == last_value, name,
+                 "push_back of the last element when growing") &&
+           passed;
+}
+
+template <typename V> static bool runAll(const char *type_name) {
+    char name[64];
+    bool passed = true;
+    snprintf(name, sizeof(name), "%s spill", type_name);
+    passed = testSpill<V>(name) && passed;
+    for (size_t count : {size_t(3), InlineCount + 5}) {
+        snprintf(name, sizeof(name), "%s copy and move %zu", type_name, count);
+        passed = testCopyAndMove<V>(name, count) && passed;
+    }
+    for (size_t count : {InlineCount, InlineCount + 5}) {
+        snprintf(name, sizeof(name), "%s erase %zu", type_name, count);
+        passed = testErase<V>(name, count) && passed;
+    }
+    snprintf(name, sizeof(name), "%s resize", type_name);
+    passed = testResize<V>(name) && passed;
+    snprintf(name, sizeof(name), "%s self reference", type_name);
+    passed = testSelfReference<V>(name) && passed;
+    return passed;
+}
+
+static int runSmallVectorTest() {
+    bool passed = true;
+    passed = runAll<IntVector>("int") && passed;
+    passed = runAll<TrackedVector>("tracked") && passed;
+    passed = check(Tracked::live == 0, "tracked", "elements leaked or destroyed twice") && passed;
+    printf("%s\n", passed ? "passed" : "FAILED");
+    return passed ? 0 : 1;
+}
+
+} // namespace brtoy
+
+int main() { return brtoy::runSmallVectorTest(); }
@@ -0,0 +1,126 @@
+#include <algorithm>
+#include <brtoy/vertex_codec.h>
+#include <cmath>
+#include <cstring>
+#include <random>
+#include <stdio.h>
+#include <vector>
+
+// Round trips through the vertex encoders in brtoy/vertex_codec.h. The encoders take blocks of
+// four with SSE2 and the rest with scalar code, so encoding a whole array and encoding every
+// element on its own must give the same bits; the counts aren't multiples of four so that both
+// paths run in one call. Decoded positions must be within half a quantization step of the
+// input, and decoded normals within a few steps of its direction.
+
+namespace brtoy {
+
+static bool check(bool condition, const char *test, const char *what) {
+    if (!condition)
+        fprintf(stderr, "%s: %s\n", test, what);
+    return condition;
+}
+
+// Random vectors plus the cases the encoders treat specially: zero, the axes, both signs of zero
+// and the folds of the octahedron
+static std::vector<V3f> makeVectors(size_t count, float scale, u32 seed) {
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> distribution(-scale, scale);
+    std::vector<V3f> vectors = {
+        {0.0f, 0.0f, 0.0f},  {-0.0f, -0.0f, -0.0f}, {1.0f, 0.0f, 0.0f}, {-1.0f, 0.0f, 0.0f},
+        {0.0f, 1.0f, 0.0f},  {0.0f, -1.0f, 0.0f},   {0.0f, 0.0f, 1.0f}, {0.0f, 0.0f, -1.0f},
+        {0.5f, 0.5f, -0.0f}, {-0.5f, 0.5f, -1.0f},  {0.3f, -0.7f, 0.0f},
+    };
+    for (V3f &v : vectors)
+        v *= scale;
+    while (vectors.size() < count)
+        vectors.push_back({distribution(rng), distribution(rng), distribution(rng)});
+    vectors.resize(count);
+    return vectors;
+}
+
+template <typename T> static bool sameBits(const std::vector<T> &a, const std::vector<T> &b) {
+    return a.size() == b.size() && memcmp(a.data(), b.data(), a.size() * sizeof(T)) == 0;
+}
+
+static bool testPositions(size_t count) {
+    char name[32];
+    snprintf(name, sizeof(name), "positions %zu", count);
+    std::vector<V3f> positions = makeVectors(count, 10.0f, u32(count));
+    // Some positions end up outside the bounds and are clamped, and the flat z axis encodes 0
+    Aabb bounds = {{-8.0f, -9.0f, 1.0f}, {9.5f, 7.0f, 1.0f}};
+    std::vector<PackedPosition> batch(count);
+    std::vector<PackedPosition> single(count);
+    encodePositions(positions.data(), count, bounds, batch.data());
+    for (size_t i = 0; i < count; ++i)
+        encodePositions(&positions[i], 1, bounds, &single[i]);
+
+    V3f extent = bounds.max - bounds.min;
+    bool within_bounds = true;
+    bool zero_pad = true;
+    for (size_t i = 0; i < count; ++i) {
+        V3f decoded = decodePosition(batch[i], bounds);
+        for (int axis = 0; axis < 3; ++axis) {
+            float clamped =
+                std::clamp(positions[i].e[axis], bounds.min.e[axis], bounds.max.e[axis]);
+            float tolerance = 0.5f / 65535.0f * extent.e[axis] * 1.001f + 1e-6f;
+            within_bounds = within_bounds && std::fabs(decoded.e[axis] - clamped) <= tolerance;
+        }
+        zero_pad = zero_pad && batch[i].pad == 0;
+    }
+    return check(sameBits(batch, single), name, "SSE2 and scalar encodings differ") &&
+           check(within_bounds, name, "decoded position off by more than half a step") &&
+           check(zero_pad, name, "padding not zero");
+}
+
+// The error is the distance between the decoded normal and the normalized input, which is the
+// angle between them for small angles without acos's loss of precision near 1. Zero vectors have
+// no direction to compare with.
+template <typename T>
+static bool checkNormals(const char *name, const std::vector<V3f> &normals, size_t count,
+                         float max_error) {
+    std::vector<T> batch(count);
+    std::vector<T> single(count);
+    encodeNormals(normals.data(), count, batch.data());
+    for (size_t i = 0; i < count; ++i)
+        encodeNormals(&normals[i], 1, &single[i]);
+
+    bool within_error = true;
+    bool zero_is_z = true;
+    for (size_t i = 0; i < count; ++i) {
+        V3f decoded = decodeNormal(batch[i]);
+        float l = length(normals[i]);
+        if (l == 0.0f) {
+            zero_is_z = zero_is_z && decoded.z > 0.999f;
+            continue;
+        }
+        within_error = within_error && length(decoded - normals[i] / l) <= max_error;
+    }
+    return check(sameBits(batch, single), name, "SSE2 and scalar encodings differ") &&
+           check(within_error, name, "decoded normal off by more than the bound") &&
+           check(zero_is_z, name, "zero vector doesn't decode to +Z");
+}
+
+static bool testNormals(size_t count) {
+    char name[32];
+    snprintf(name, sizeof(name), "normals %zu", count);
+    // Not normalized, the encoders must not care
+    std::vector<V3f> normals = makeVectors(count, 3.0f, u32(count) + 1);
+    // Rounding to the nearest step in octahedral coordinates stretches to an error of up to about
+    // 2.1 steps on the sphere
+    return checkNormals<OctNormal16>(name, normals, count, 2.5f / 32767.0f) &&
+           checkNormals<OctNormal8>(name, normals, count, 2.5f / 127.0f);
+}
+
+static int runVertexCodecTest() {
+    bool passed = true;
+    for (size_t count : {1, 3, 6, 11, 17, 1023}) {
+        passed = testPositions(count) && passed;
+        passed = testNormals(count) && passed;
+    }
+    printf("%s\n", passed ? "passed" : "FAILED");
+    return passed ? 0 : 1;
+}
+
+} // namespace brtoy
+
+int main() { return brtoy::runVertexCodecTest(); }
@@ -0,0 +1,81 @@
+#include <algorithm>
+#include <brtoy/mesh_optimizer.h>
+#include <brtoy/thread_pool.h>
+#include <chrono>
+#include <memory>
+#include <stdio.h>
+#include <thread>
+#include <vector>
+
+// Time of weldVertices on an unindexed grid of 10M vertices, as a mesh importer emits it, with
+// positions and normals. Every grid point is shared by six triangle corners, so about one vertex
+// in six survives. Runs serially and on thread pools of up to twice the hardware threads, and
+// fails if any run remaps differently from the serial one.
+
+namespace brtoy {
+
+using Clock = std::chrono::steady_clock;
+
+static constexpr u32 VertexCountMin = 10'000'000;
+
+struct WeldInput {
+    std::vector<V3f> positions;
+    std::vector<V3f> normals;
+};
+
+// Two triangles per cell, each corner a vertex of its own
+static WeldInput createGrid(u32 vertex_count_min) {
+    u32 cells = 1;
+    while (cells * cells * 6 < vertex_count_min)
+        ++cells;
+    WeldInput input;
+    input.positions.reserve((size_t)cells * cells * 6);
+    auto point = [](u32 x, u32 y) { return V3f{(float)x, (float)y, (float)((x ^ y) & 7)}; };
+    for (u32 y = 0; y < cells; ++y) {
+        for (u32 x = 0; x < cells; ++x) {
+            V3f quad[] = {point(x, y), point(x + 1, y), point(x + 1, y + 1), point(x, y + 1)};
+            for (u32 corner : {0, 1, 2, 0, 2, 3})
+                input.positions.push_back(quad[corner]);
+        }
+    }
+    input.normals.assign(input.positions.size(), V3f{0.0f, 0.0f, 1.0f});
+    return input;
+}
+
+static int runWeldBench() {
+    WeldInput input = createGrid(VertexCountMin);
+    u32 vertex_count = (u32)input.positions.size();
+    WeldStream streams[] = {
+        {input.positions.front().e, 3, 3},
+        {input.normals.front().e, 3, 3},
+    };
+
+    std::vector<u32> expected(vertex_count);
+    Clock::time_point start = Clock::now();
+    u32 unique_count = weldVertices(streams, vertex_count, expected, nullptr);
+    std::chrono::duration<double, std::milli> serial_time = Clock::now() - start;
+    printf("%u -> %u vertices\n", vertex_count, unique_count);
+    printf("threads         ms   Mvertices/s\n");
+    printf("serial  %10.1f %13.1f\n", serial_time.count(),
+           vertex_count / serial_time.count() / 1e3);
+
+    bool matches = true;
+    u32 thread_count_max = std::max(1u, std::thread::hardware_concurrency()) * 2;
+    std::vector<u32> remap(vertex_count);
+    for (u32 thread_count = 1; thread_count <= thread_count_max; thread_count *= 2) {
+        ThreadPool thread_pool(thread_count);
+        start = Clock::now();
+        u32 count = weldVertices(streams, vertex_count, remap, &thread_pool);
+        std::chrono::duration<double, std::milli> time = Clock::now() - start;
+        printf("%-7u %10.1f %13.1f\n", thread_count, time.count(),
+               vertex_count / time.count() / 1e3);
+        matches = matches && count == unique_count && remap == expected;
+    }
+    if (!matches)
+        fprintf(stderr, "threaded welds differ from the serial one\n");
+    return matches ? 0 : 1;
+}
+
+} // namespace brtoy
+
+int main() { return brtoy::runWeldBench(); }
@@ -0,0 +1,239 @@
+#include <brtoy/hash.h>
+#include <brtoy/mesh_file.h>
+#include <brtoy/mesh_import.h>
+#include <brtoy/platform.h>
+#include <brtoy/thread_pool.h>
+#include <charconv>
+#include <chrono>
+#include <filesystem>
+#include <future>
+#include <optional>
+#include <span>
+#include <stdio.h>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Converts meshes into cooked mesh files, see mesh_file.h. Inputs are cooked in parallel, one per
+// job, except for a single input, which is imported and optimized on all threads instead. An
+// output whose header carries the hash of the input's contents and the cook settings is up to date
+// and skipped.
+
+namespace brtoy {
+
+static void printUsage(const char *program) {
+    printf("usage: %s [options] INPUT...\n"
+           "  -o DIR              write the cooked files to DIR (default: next to the inputs)\n"
+           "  --vertex-format F   float, q16 or q8 (default q16): quantized positions with\n"
+           "                      16- or 8-bit octahedral normals\n"
+           "  --threads N         cooking threads (default one per hardware thread)\n"
+           "  --force             cook inputs even when their output is up to date\n"
+           "Inputs are Wavefront OBJ or glTF 2.0 (.gltf, .glb) files. Each is cooked to a .brmesh\n"
+           "file of the same name.\n",
+           program);
+}
+
+struct CookOptions {
+    std::vector<std::filesystem::path> inputs;
+    std::filesystem::path output_dir;
+    VertexFormat vertex_format = {PositionFormat::Unorm16, NormalFormat::Oct16};
+    u32 thread_count = 0;
+    bool force = false;
+};
+
+static std::optional<CookOptions> parseCookOptions(int argc, char **argv) {
+    CookOptions options;
+    bool valid = true;
+    for (int i = 1; i < argc && valid; ++i) {
+        std::string_view arg = argv[i];
+        std::string_view value = i + 1 < argc ? argv[i + 1] : "";
+        if (arg == "-o") {
+            options.output_dir = value;
+            valid = !value.empty();
+            ++i;
+        } else if (arg == "--vertex-format") {
+            if (value == "float")
+                options.vertex_format = {PositionFormat::Float3, NormalFormat::Float3};
+            else if (value == "q16")
+                options.vertex_format = {PositionFormat::Unorm16, NormalFormat::Oct16};
+            else if (value == "q8")
+                options.vertex_format = {PositionFormat::Unorm16, NormalFormat::Oct8};
+            else
+                valid = false;
+            ++i;
+        } else if (arg == "--threads") {
+            const char *end = value.data() + value.size();
+            auto [ptr, ec] = std::from_chars(value.data(), end, options.thread_count);
+            valid = ec == std::errc() && ptr == end;
+            ++i;
+        } else if (arg == "--force") {
+            options.force = true;
+        } else if (arg.starts_with("-")) {
+            valid = false;
+        } else {
+            options.inputs.push_back(arg);
+        }
+    }
+
+    if (!valid || options.inputs.empty()) {
+        printUsage(argc > 0 ? argv[0] : "brtoy_cook");
+        return std::nullopt;
+    }
+    return options;
+}
+
+struct CookResult {
+    enum class Status {
+        Cooked,
+        UpToDate,
+        Failed,
+    };
+
+    Status status;
+    std::string message;
+};
+
+static bool isGltf(const std::filesystem::path &path) {
+    std::filesystem::path extension = path.extension();
+    return extension == ".gltf" || extension == ".glb";
+}
+
+// Without a thread pool, the calling job cooks the whole file. Otherwise the import and
+// optimization run on the pool's threads.
+static CookResult cookFile(const std::filesystem::path &input_path,
+                           const std::filesystem::path &output_path, const CookOptions &options,
+                           ThreadPool *thread_pool) {
+    std::optional<MappedFile> input = mapFile(input_path.string().c_str());
+    if (!input)
+        return {CookResult::Status::Failed, "can't read the input"};
+    // A .gltf's buffers may live in files next to it, which are part of the source
+    bool gltf = isGltf(input_path);
+    std::vector<MappedFile> buffer_files;
+    std::vector<std::span<const std::byte>> buffers;
+    if (gltf) {
+        std::optional<std::vector<std::string>> uris = gltfExternalBufferUris(input->data());
+        if (!uris)
+            return {CookResult::Status::Failed, "malformed glTF"};
+        for (const std::string &uri : *uris) {
+            std::filesystem::path buffer_path = input_path.parent_path() / uri;
+            std::optional<MappedFile> buffer = mapFile(buffer_path.string().c_str());
+            if (!buffer)
+                return {CookResult::Status::Failed, "can't read " + buffer_path.string()};
+            buffer_files.push_back(std::move(*buffer));
+            buffers.push_back(buffer_files.back().data());
+        }
+    }
+    // Includes the settings, so that cooking with other ones replaces the output
+    u64 source_hash = hashBytes(input->data());
+    for (std::span<const std::byte> buffer : buffers)
+        source_hash = hashBytes(buffer, source_hash);
+    source_hash = hashBytes(std::as_bytes(std::span(&options.vertex_format, 1)), source_hash);
+
+    if (!options.force) {
+        std::optional<MappedFile> output = mapFile(output_path.string().c_str());
+        std::optional<MeshFileView> cooked;
+        if (output)
+            cooked = parseMeshFile(output->data());
+        if (cooked && cooked->header.source_hash == source_hash)
+            return {CookResult::Status::UpToDate, ""};
+    }
+
+    auto import_start = std::chrono::steady_clock::now();
+    u64 source_size = input->data().size();
+    for (std::span<const std::byte> buffer : buffers)
+        source_size += buffer.size();
+    std::optional<MeshSource> mesh = gltf ? importGltf(input->data(), buffers, thread_pool)
+                                          : importObj(input->data(), thread_pool);
+    std::chrono::duration<double> import_time = std::chrono::steady_clock::now() - import_start;
+    if (!mesh)
+        return {CookResult::Status::Failed, gltf ? "malformed glTF" : "malformed OBJ"};
+    if (mesh->indices.empty())
+        return {CookResult::Status::Failed, "no triangles"};
+    buffers.clear();
+    buffer_files.clear();
+    input.reset();
+
+    MeshOptimizeStats stats = optimizeMesh(*mesh, thread_pool);
+    MeshLayout layout = layoutMesh(*mesh, options.vertex_format);
+    std::vector<std::byte> streams(layout.size());
+    encodeMesh(*mesh, layout, streams.data());
+    if (!writeMeshFile(output_path.string().c_str(), source_hash, layout, streams))
+        return {CookResult::Status::Failed, "can't write the output"};
+
+    char message[256];
+    snprintf(message, sizeof(message),
+             "imported at %.0f MB/s, %zu triangles, %u -> %u vertices, %u LODs, "
+             "ACMR %.3f -> %.3f, %llu bytes",
+             source_size / import_time.count() / (1024.0 * 1024.0), mesh->indices.size() / 3,
+             stats.source_vertex_count, layout.vertex_count, layout.lod_count, stats.before.acmr,
+             stats.after.acmr,
+             (unsigned long long)(MeshFileStreamsOffset + layout.size()));
+    return {CookResult::Status::Cooked, message};
+}
+
+static int runCook(int argc, char **argv) {
+    std::optional<CookOptions> options = parseCookOptions(argc, argv);
+    if (!options)
+        return 1;
+    if (!options->output_dir.empty()) {
+        std::error_code ec;
+        std::filesystem::create_directories(options->output_dir, ec);
+        if (ec) {
+            fprintf(stderr, "can't create %s\n", options->output_dir.string().c_str());
+            return 1;
+        }
+    }
+
+    ThreadPool thread_pool(options->thread_count);
+    std::vector<std::filesystem::path> output_paths;
+    std::vector<std::future<CookResult>> results;
+    for (const std::filesystem::path &input_path : options->inputs) {
+        std::filesystem::path output_path = input_path;
+        output_path.replace_extension(".brmesh");
+        if (!options->output_dir.empty())
+            output_path = options->output_dir / output_path.filename();
+        output_paths.push_back(output_path);
+    }
+    if (options->inputs.size() == 1) {
+        // Nothing to cook alongside, so the one file gets all threads
+        std::promise<CookResult> result;
+        result.set_value(cookFile(options->inputs[0], output_paths[0], *options, &thread_pool));
+        results.push_back(result.get_future());
+    } else {
+        // The jobs must not wait on jobs of the same pool, so each cooks its file alone
+        for (size_t i = 0; i < options->inputs.size(); ++i) {
+            results.push_back(thread_pool.submit([&options, &output_paths, i]() {
+                return cookFile(options->inputs[i], output_paths[i], *options, nullptr);
+            }));
+        }
+    }
+
+    // Reported in input order as the jobs finish
+    u32 cooked_count = 0;
+    u32 up_to_date_count = 0;
+    u32 failed_count = 0;
+    for (size_t i = 0; i < results.size(); ++i) {
+        CookResult result = results[i].get();
+        std::string input = options->inputs[i].string();
+        switch (result.status) {
+        case CookResult::Status::Cooked:
+            printf("%s -> %s: %s\n", input.c_str(), output_paths[i].string().c_str(),
+                   result.message.c_str());
+            ++cooked_count;
+            break;
+        case CookResult::Status::UpToDate:
+            ++up_to_date_count;
+            break;
+        case CookResult::Status::Failed:
+            fprintf(stderr, "%s: %s\n", input.c_str(), result.message.c_str());
+            ++failed_count;
+            break;
+        }
+    }
+    printf("%u cooked, %u up to date, %u failed\n", cooked_count, up_to_date_count, failed_count);
+    return failed_count == 0 ? 0 : 1;
+}
+
+} // namespace brtoy
+
+int main(int argc, char **argv) { return brtoy::runCook(argc, argv); }
@@ -0,0 +1,186 @@
+#include <algorithm>
+#include <brtoy/async_io.h>
+#include <brtoy/platform.h>
+#include <charconv>
+#include <chrono>
+#include <filesystem>
+#include <optional>
+#include <random>
+#include <span>
+#include <stdio.h>
+#include <string_view>
+#include <vector>
+
+// Measures AsyncFileReader with random block reads of one file at queue depths 1 to 128, for the
+// io_uring and the thread pool backends. Each depth keeps that many reads in flight, issuing the
+// next read from the callback of the previous one. The page cache isn't bypassed, so a file
+// larger than memory, or a dropped cache, measures the device rather than memcpy.
+
+namespace brtoy {
+
+using Clock = std::chrono::steady_clock;
+
+static void printUsage(const char *program) {
+    printf("usage: %s [options] FILE\n"
+           "  --block-size N   bytes per read (default 65536)\n"
+           "  --reads N        reads per queue depth (default 4096)\n",
+           program);
+}
+
+struct BenchOptions {
+    const char *path = nullptr;
+    u32 block_size = 64 * 1024;
+    u32 read_count = 4096;
+};
+
+static std::optional<BenchOptions> parseBenchOptions(int argc, char **argv) {
+    BenchOptions options;
+    bool valid = true;
+    for (int i = 1; i < argc && valid; ++i) {
+        std::string_view arg = argv[i];
+        std::string_view value = i + 1 < argc ? argv[i + 1] : "";
+        const char *value_end = value.data() + value.size();
+        if (arg == "--block-size") {
+            auto [ptr, ec] = std::from_chars(value.data(), value_end, options.block_size);
+            valid = ec == std::errc() && ptr == value_end && options.block_size > 0 &&
+                    options.block_size <= AsyncFileReader::MaxReadSize;
+            ++i;
+        } else if (arg == "--reads") {
+            auto [ptr, ec] = std::from_chars(value.data(), value_end, options.read_count);
+            valid = ec == std::errc() && ptr == value_end && options.read_count > 0;
+            ++i;
+        } else if (arg.starts_with("-") || options.path) {
+            valid = false;
+        } else {
+            options.path = argv[i];
+        }
+    }
+
+    if (!valid || !options.path) {
+        printUsage(argc > 0 ? argv[0] : "brtoy_io_bench");
+        return std::nullopt;
+    }
+    return options;
+}
+
+struct BenchResult {
+    double mb_per_second;
+    double p50_us;
+    double p99_us;
+    u32 failed_count;
+};
+
+struct ReadBench {
+    AsyncFileReader &reader;
+    Handle file;
+    const BenchOptions &options;
+    u64 block_count;
+    std::mt19937_64 rng;
+    std::vector<std::byte> buffers;
+    std::vector<Clock::time_point> start_times;
+    std::vector<double> latencies_us;
+    u32 issued_count = 0;
+    u32 failed_count = 0;
+
+    // Reads a random block into the slot's buffer and reissues from its callback until all reads
+    // are issued
+    void issue(u32 slot);
+};
+
+void ReadBench::issue(u32 slot) {
+    if (issued_count == options.read_count)
+        return;
+    ++issued_count;
+    u64 offset = rng() % block_count * options.block_size;
+    std::span<std::byte> dst(buffers.data() + (size_t)slot * options.block_size,
+                             options.block_size);
+    start_times[slot] = Clock::now();
+    reader.read(file, offset, dst, [this, slot](i64 result) {
+        std::chrono::duration<double, std::micro> latency = Clock::now() - start_times[slot];
+        latencies_us.push_back(latency.count());
+        if (result != (i64)options.block_size)
+            ++failed_count;
+        issue(slot);
+    });
+}
+
+static double percentile(std::vector<double> &values, double p) {
+    size_t index = std::min(values.size() - 1, (size_t)(p * values.size()));
+    std::nth_element(values.begin(), values.begin() + index, values.end());
+    return values[index];
+}
+
+static BenchResult runBench(AsyncFileReader &reader, Handle file, u64 file_size,
+                            const BenchOptions &options, u32 queue_depth) {
+    ReadBench bench = {
+        .reader = reader,
+        .file = file,
+        .options = options,
+        .block_count = file_size / options.block_size,
+        .rng = std::mt19937_64(queue_depth),
+        .buffers = std::vector<std::byte>((size_t)queue_depth * options.block_size),
+        .start_times = std::vector<Clock::time_point>(queue_depth),
+        .latencies_us = {},
+    };
+    bench.latencies_us.reserve(options.read_count);
+
+    Clock::time_point start = Clock::now();
+    for (u32 slot = 0; slot < queue_depth; ++slot)
+        bench.issue(slot);
+    // The callbacks issue the remaining reads, so this returns once all are done
+    reader.waitAll();
+    std::chrono::duration<double> time = Clock::now() - start;
+
+    return {
+        .mb_per_second = (double)options.read_count * options.block_size / time.count() /
+                         (1024.0 * 1024.0),
+        .p50_us = percentile(bench.latencies_us, 0.5),
+        .p99_us = percentile(bench.latencies_us, 0.99),
+        .failed_count = bench.failed_count,
+    };
+}
+
+static int runIoBench(int argc, char **argv) {
+    std::optional<BenchOptions> options = parseBenchOptions(argc, argv);
+    if (!options)
+        return 1;
+    std::error_code ec;
+    u64 file_size = std::filesystem::file_size(options->path, ec);
+    if (ec || file_size < options->block_size) {
+        fprintf(stderr, "%s must be at least one block long\n", options->path);
+        return 1;
+    }
+
+    constexpr u32 QueueDepthMax = 128;
+    bool failed = false;
+    for (bool use_io_uring : {true, false}) {
+        std::optional<AsyncFileReader> reader =
+            AsyncFileReader::create(QueueDepthMax, use_io_uring);
+        if (!reader || reader->usesIoUring() != use_io_uring) {
+            printf("io_uring: unavailable\n");
+            continue;
+        }
+        Handle file = reader->openFile(options->path);
+        if (!file) {
+            fprintf(stderr, "can't open %s\n", options->path);
+            return 1;
+        }
+        printf("%s:\n", use_io_uring ? "io_uring" : "thread pool");
+        printf("  depth       MB/s    p50 us    p99 us\n");
+        for (u32 queue_depth = 1; queue_depth <= QueueDepthMax; queue_depth *= 2) {
+            BenchResult result = runBench(*reader, file, file_size, *options, queue_depth);
+            printf("  %5u %10.1f %9.1f %9.1f\n", queue_depth, result.mb_per_second,
+                   result.p50_us, result.p99_us);
+            if (result.failed_count > 0) {
+                fprintf(stderr, "  %u reads failed\n", result.failed_count);
+                failed = true;
+            }
+        }
+        reader->closeFile(file);
+    }
+    return failed ? 1 : 0;
+}
+
+} // namespace brtoy
+
+int main(int argc, char **argv) { return brtoy::runIoBench(argc, argv); }